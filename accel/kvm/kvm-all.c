@@ -96,8 +96,46 @@ struct KVMDirtyRingReaper {
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    /* Current reaping interval, adapted to the observed dirty rate */
+    unsigned int reaper_interval_ms;
+    /* Pages harvested by all vCPUs when the reaper last woke up */
+    uint64_t reaper_dirty_pages;
+    /* Number of full dirty rings since the reaper last woke up */
+    unsigned int ring_full;
 };
 
+#define KVM_DIRTY_RING_REAPER_INTERVAL_MIN_MS   10
+#define KVM_DIRTY_RING_REAPER_INTERVAL_MAX_MS   1000
+
+typedef struct KVMDirtySyncJob {
+    unsigned long *bitmap;
+    ram_addr_t start;
+    ram_addr_t pages;
+} KVMDirtySyncJob;
+
+/*
+ * Worker threads merging the dirty bitmaps of large slots into the
+ * ram_list dirty bitmaps.  Users are serialized by the slots lock.
+ */
+struct KVMDirtySyncPool {
+    bool initialized;
+    QemuThread *threads;
+    int nr_threads;
+    QemuMutex lock;
+    /* Signalled when jobs are queued */
+    QemuCond job_cond;
+    /* Signalled when the last queued job is done */
+    QemuCond done_cond;
+    KVMDirtySyncJob *jobs;
+    int nr_jobs;
+    int next_job;
+    int pending_jobs;
+};
+
+/* Bitmaps of slots larger than this are merged by the pool, in such chunks */
+#define KVM_DIRTY_SYNC_CHUNK_PAGES  (1ULL << 22)
+#define KVM_DIRTY_SYNC_MAX_THREADS  8
+
 struct KVMState
 {
     AccelState parent_obj;
@@ -149,6 +187,7 @@ struct KVMState
     uint64_t kvm_dirty_ring_bytes;  /* Size of the per-vcpu dirty ring */
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
     struct KVMDirtyRingReaper reaper;
+    struct KVMDirtySyncPool sync_pool;
 };
 
 KVMState *kvm_state;
@@ -248,16 +287,11 @@ int kvm_get_max_memslots(void)
 /* Called with KVMMemoryListener.slots_lock held */
 static KVMSlot *kvm_get_free_slot(KVMMemoryListener *kml)
 {
-    KVMState *s = kvm_state;
-    int i;
-
-    for (i = 0; i < s->nr_slots; i++) {
-        if (kml->slots[i].memory_size == 0) {
-            return &kml->slots[i];
-        }
+    if (!kml->nr_free_slots) {
+        return NULL;
     }
 
-    return NULL;
+    return &kml->slots[kml->free_slots[kml->nr_free_slots - 1]];
 }
 
 bool kvm_has_free_slot(MachineState *ms)
@@ -273,12 +307,21 @@ bool kvm_has_free_slot(MachineState *ms)
     return result;
 }
 
+static void kvm_memory_batch_flush_del(KVMMemoryListener *kml);
+
 /* Called with KVMMemoryListener.slots_lock held */
 static KVMSlot *kvm_alloc_slot(KVMMemoryListener *kml)
 {
     KVMSlot *slot = kvm_get_free_slot(kml);
 
+    if (!slot && g_hash_table_size(kml->batch_del)) {
+        /* Give back the slots removed earlier in this transaction */
+        kvm_memory_batch_flush_del(kml);
+        slot = kvm_get_free_slot(kml);
+    }
+
     if (slot) {
+        kml->nr_free_slots--;
         return slot;
     }
 
@@ -286,19 +329,74 @@ static KVMSlot *kvm_alloc_slot(KVMMemoryListener *kml)
     abort();
 }
 
+/* Called with KVMMemoryListener.slots_lock held */
+static void kvm_free_slot(KVMMemoryListener *kml, KVMSlot *mem)
+{
+    g_free(mem->dirty_bmap);
+    mem->dirty_bmap = NULL;
+    mem->memory_size = 0;
+    mem->flags = 0;
+    mem->batch = KVM_SLOT_BATCH_NONE;
+    kml->free_slots[kml->nr_free_slots++] = mem->slot;
+}
+
+/*
+ * Return the position in slots_by_gpa of the first slot that ends
+ * after @addr, or nr_used_slots if there is none.  Slots never overlap,
+ * so the array is an interval index of the address space.
+ */
+static int kvm_slot_index(KVMMemoryListener *kml, hwaddr addr)
+{
+    int lo = 0, hi = kml->nr_used_slots;
+
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        KVMSlot *mem = kml->slots_by_gpa[mid];
+
+        if (mem->start_addr + mem->memory_size <= addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return lo;
+}
+
+static void kvm_slot_index_insert(KVMMemoryListener *kml, KVMSlot *mem)
+{
+    int i = kvm_slot_index(kml, mem->start_addr);
+
+    memmove(&kml->slots_by_gpa[i + 1], &kml->slots_by_gpa[i],
+            (kml->nr_used_slots - i) * sizeof(KVMSlot *));
+    kml->slots_by_gpa[i] = mem;
+    kml->nr_used_slots++;
+}
+
+static void kvm_slot_index_remove(KVMMemoryListener *kml, KVMSlot *mem)
+{
+    int i = kvm_slot_index(kml, mem->start_addr);
+
+    assert(i < kml->nr_used_slots && kml->slots_by_gpa[i] == mem);
+    kml->nr_used_slots--;
+    memmove(&kml->slots_by_gpa[i], &kml->slots_by_gpa[i + 1],
+            (kml->nr_used_slots - i) * sizeof(KVMSlot *));
+}
+
 static KVMSlot *kvm_lookup_matching_slot(KVMMemoryListener *kml,
                                          hwaddr start_addr,
                                          hwaddr size)
 {
-    KVMState *s = kvm_state;
-    int i;
+    int i = kvm_slot_index(kml, start_addr);
+    KVMSlot *mem;
 
-    for (i = 0; i < s->nr_slots; i++) {
-        KVMSlot *mem = &kml->slots[i];
+    if (i == kml->nr_used_slots) {
+        return NULL;
+    }
 
-        if (start_addr == mem->start_addr && size == mem->memory_size) {
-            return mem;
-        }
+    mem = kml->slots_by_gpa[i];
+    if (start_addr == mem->start_addr && size == mem->memory_size) {
+        return mem;
     }
 
     return NULL;
@@ -335,8 +433,8 @@ int kvm_physical_memory_addr_from_host(KVMState *s, void *ram,
     int i, ret = 0;
 
     kvm_slots_lock();
-    for (i = 0; i < s->nr_slots; i++) {
-        KVMSlot *mem = &kml->slots[i];
+    for (i = 0; i < kml->nr_used_slots; i++) {
+        KVMSlot *mem = kml->slots_by_gpa[i];
 
         if (ram >= mem->ram && ram < mem->ram + mem->memory_size) {
             *phys_addr = mem->start_addr + (ram - mem->ram);
@@ -546,6 +644,10 @@ static int kvm_slot_update_flags(KVMMemoryListener *kml, KVMSlot *mem,
     }
 
     kvm_slot_init_dirty_bitmap(mem);
+    if (mem->batch == KVM_SLOT_BATCH_ADD) {
+        /* The slot will be registered with the new flags on commit */
+        return 0;
+    }
     return kvm_set_user_memory_region(kml, mem, false);
 }
 
@@ -615,13 +717,113 @@ static void kvm_log_stop(MemoryListener *listener,
     }
 }
 
+/* Must be called with the pool lock held, which is dropped while merging */
+static void kvm_dirty_sync_run_jobs(struct KVMDirtySyncPool *p)
+{
+    while (p->next_job < p->nr_jobs) {
+        KVMDirtySyncJob *job = &p->jobs[p->next_job++];
+
+        qemu_mutex_unlock(&p->lock);
+        cpu_physical_memory_set_dirty_lebitmap(job->bitmap, job->start,
+                                               job->pages);
+        qemu_mutex_lock(&p->lock);
+
+        if (!--p->pending_jobs) {
+            qemu_cond_signal(&p->done_cond);
+        }
+    }
+}
+
+static void *kvm_dirty_sync_thread(void *opaque)
+{
+    struct KVMDirtySyncPool *p = opaque;
+
+    rcu_register_thread();
+
+    qemu_mutex_lock(&p->lock);
+    while (true) {
+        qemu_cond_wait(&p->job_cond, &p->lock);
+        kvm_dirty_sync_run_jobs(p);
+    }
+    qemu_mutex_unlock(&p->lock);
+
+    rcu_unregister_thread();
+
+    return NULL;
+}
+
+/* Returns false if there is no point in using worker threads */
+static bool kvm_dirty_sync_pool_init(struct KVMDirtySyncPool *p)
+{
+    int i;
+
+    if (p->initialized) {
+        return p->nr_threads > 0;
+    }
+    p->initialized = true;
+
+    /* The thread merging the first job is one of the workers */
+    p->nr_threads = MIN(sysconf(_SC_NPROCESSORS_ONLN),
+                        KVM_DIRTY_SYNC_MAX_THREADS) - 1;
+    if (p->nr_threads <= 0) {
+        return false;
+    }
+
+    qemu_mutex_init(&p->lock);
+    qemu_cond_init(&p->job_cond);
+    qemu_cond_init(&p->done_cond);
+    p->threads = g_new0(QemuThread, p->nr_threads);
+    for (i = 0; i < p->nr_threads; i++) {
+        qemu_thread_create(&p->threads[i], "kvm-dirty-sync",
+                           kvm_dirty_sync_thread, p, QEMU_THREAD_DETACHED);
+    }
+
+    return true;
+}
+
 /* get kvm's dirty pages bitmap and update qemu's */
 static void kvm_slot_sync_dirty_pages(KVMSlot *slot)
 {
+    struct KVMDirtySyncPool *p = &kvm_state->sync_pool;
     ram_addr_t start = slot->ram_start_offset;
     ram_addr_t pages = slot->memory_size / qemu_real_host_page_size;
+    g_autofree KVMDirtySyncJob *jobs = NULL;
+    ram_addr_t offset;
+    int nr_jobs, i;
 
-    cpu_physical_memory_set_dirty_lebitmap(slot->dirty_bmap, start, pages);
+    if (pages <= KVM_DIRTY_SYNC_CHUNK_PAGES || !kvm_dirty_sync_pool_init(p)) {
+        cpu_physical_memory_set_dirty_lebitmap(slot->dirty_bmap, start, pages);
+        return;
+    }
+
+    /* Chunks start on a bitmap word, so every job keeps the fast path */
+    nr_jobs = DIV_ROUND_UP(pages, KVM_DIRTY_SYNC_CHUNK_PAGES);
+    jobs = g_new(KVMDirtySyncJob, nr_jobs);
+    for (i = 0, offset = 0; i < nr_jobs;
+         i++, offset += KVM_DIRTY_SYNC_CHUNK_PAGES) {
+        jobs[i].bitmap = slot->dirty_bmap + offset / BITS_PER_LONG;
+        jobs[i].start = start + offset * qemu_real_host_page_size;
+        jobs[i].pages = MIN(pages - offset, KVM_DIRTY_SYNC_CHUNK_PAGES);
+    }
+
+    trace_kvm_slot_sync_dirty_pages(slot->slot, nr_jobs);
+
+    qemu_mutex_lock(&p->lock);
+    p->jobs = jobs;
+    p->nr_jobs = nr_jobs;
+    p->next_job = 0;
+    p->pending_jobs = nr_jobs;
+    qemu_cond_broadcast(&p->job_cond);
+
+    kvm_dirty_sync_run_jobs(p);
+    while (p->pending_jobs) {
+        qemu_cond_wait(&p->done_cond, &p->lock);
+    }
+
+    p->jobs = NULL;
+    p->nr_jobs = 0;
+    p->next_job = 0;
+    qemu_mutex_unlock(&p->lock);
 }
 
 static void kvm_slot_reset_dirty_pages(KVMSlot *slot)
@@ -709,12 +911,20 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
 {
-    return gfn->flags == KVM_DIRTY_GFN_F_DIRTY;
+    /*
+     * Read the flags before the fields of the entry; pairs with the
+     * kernel publishing the entry with a store-release.
+     */
+    return qatomic_load_acquire(&gfn->flags) == KVM_DIRTY_GFN_F_DIRTY;
 }
 
 static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
 {
-    gfn->flags = KVM_DIRTY_GFN_F_RESET;
+    /*
+     * The kernel may reuse the entry as soon as it sees the flag, so we must
+     * be done reading it by then.
+     */
+    qatomic_store_release(&gfn->flags, KVM_DIRTY_GFN_F_RESET);
 }
 
 /*
@@ -727,7 +937,12 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     uint32_t ring_size = s->kvm_dirty_ring_size;
     uint32_t count = 0, fetch = cpu->kvm_fetch_index;
 
-    assert(dirty_gfns && ring_size);
+    /* The vCPU may not have set up its ring yet */
+    if (!dirty_gfns) {
+        return 0;
+    }
+
+    assert(ring_size);
     trace_kvm_dirty_ring_reap_vcpu(cpu->cpu_index);
 
     while (true) {
@@ -742,23 +957,42 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
         fetch++;
         count++;
     }
-    cpu->kvm_fetch_index = fetch;
+    qatomic_set(&cpu->kvm_fetch_index, fetch);
+    cpu->dirty_pages += count;
 
     return count;
 }
 
-/* Must be with slots_lock held */
-static uint64_t kvm_dirty_ring_reap_locked(KVMState *s)
+/*
+ * Lockless check whether the dirty ring of @cpu has entries to harvest.  May
+ * race with a concurrent reaper, which only makes the answer stale.
+ */
+static bool kvm_dirty_ring_pending(KVMState *s, CPUState *cpu)
+{
+    uint32_t fetch = qatomic_read(&cpu->kvm_fetch_index);
+
+    return dirty_gfn_is_dirtied(&cpu->kvm_dirty_gfns[fetch %
+                                                     s->kvm_dirty_ring_size]);
+}
+
+/*
+ * Must be with slots_lock held.  Reaps the ring of @cpu only, or the rings of
+ * all vCPUs if @cpu is NULL.
+ */
+static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState *cpu)
 {
     int ret;
-    CPUState *cpu;
     uint64_t total = 0;
     int64_t stamp;
 
     stamp = get_clock();
 
-    CPU_FOREACH(cpu) {
-        total += kvm_dirty_ring_reap_one(s, cpu);
+    if (cpu) {
+        total = kvm_dirty_ring_reap_one(s, cpu);
+    } else {
+        CPU_FOREACH(cpu) {
+            total += kvm_dirty_ring_reap_one(s, cpu);
+        }
     }
 
     if (total) {
@@ -776,10 +1010,12 @@ static uint64_t kvm_dirty_ring_reap_locked(KVMState *s)
 }
 
 /*
- * Currently for simplicity, we must hold BQL before calling this.  We can
- * consider to drop the BQL if we're clear with all the race conditions.
+ * Reaping all the rings (@cpu is NULL) requires the BQL, since it walks the
+ * rings of vCPUs that may be created or destroyed concurrently.  A vCPU
+ * thread can reap its own ring without the BQL: the dirty bitmaps of the
+ * slots and the ring reset are serialized by the slots lock.
  */
-static uint64_t kvm_dirty_ring_reap(KVMState *s)
+static uint64_t kvm_dirty_ring_reap(KVMState *s, CPUState *cpu)
 {
     uint64_t total;
 
@@ -799,7 +1035,7 @@ static uint64_t kvm_dirty_ring_reap(KVMState *s)
      *     reset below.
      */
     kvm_slots_lock();
-    total = kvm_dirty_ring_reap_locked(s);
+    total = kvm_dirty_ring_reap_locked(s, cpu);
     kvm_slots_unlock();
 
     return total;
@@ -846,7 +1082,7 @@ static void kvm_dirty_ring_flush(void)
      * vcpus out in a synchronous way.
      */
     kvm_cpu_synchronize_kick_all();
-    kvm_dirty_ring_reap(kvm_state);
+    kvm_dirty_ring_reap(kvm_state, NULL);
     trace_kvm_dirty_ring_flush(1);
 }
 
@@ -1031,13 +1267,11 @@ static int kvm_physical_log_clear(KVMMemoryListener *kml,
 
     kvm_slots_lock();
 
-    for (i = 0; i < s->nr_slots; i++) {
-        mem = &kml->slots[i];
-        /* Discard slots that are empty or do not overlap the section */
-        if (!mem->memory_size ||
-            mem->start_addr > start + size - 1 ||
-            start > mem->start_addr + mem->memory_size - 1) {
-            continue;
+    for (i = kvm_slot_index(kml, start); i < kml->nr_used_slots; i++) {
+        mem = kml->slots_by_gpa[i];
+        /* Stop at the first slot that does not overlap the section */
+        if (mem->start_addr > start + size - 1) {
+            break;
         }
 
         if (start >= mem->start_addr) {
@@ -1332,11 +1566,105 @@ void kvm_set_max_memslot_size(hwaddr max_slot_size)
     kvm_max_slot_size = max_slot_size;
 }
 
+/*
+ * Unregister the slots deleted in the current memory transaction.  Dirty
+ * pages still tracked by the kernel are collected first; with the dirty
+ * ring a single reap covers all the slots of the batch.
+ *
+ * Called with KVMMemoryListener.slots_lock held.
+ */
+static void kvm_memory_batch_flush_del(KVMMemoryListener *kml)
+{
+    bool reaped = false;
+    KVMSlot *mem;
+    int i, err;
+
+    for (i = 0; i < kml->batch->len; i++) {
+        mem = g_ptr_array_index(kml->batch, i);
+        if (mem->batch != KVM_SLOT_BATCH_DEL) {
+            continue;
+        }
+
+        if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+            /*
+             * NOTE: We should be aware of the fact that here we're only
+             * doing a best effort to sync dirty bits.  No matter whether
+             * we're using dirty log or dirty ring, we ignored two facts:
+             *
+             * (1) dirty bits can reside in hardware buffers (PML)
+             *
+             * (2) after we collected dirty bits here, pages can be dirtied
+             * again before we do the final KVM_SET_USER_MEMORY_REGION to
+             * remove the slot.
+             *
+             * Not easy.  Let's cross the fingers until it's fixed.
+             */
+            if (kvm_state->kvm_dirty_ring_size) {
+                if (!reaped) {
+                    kvm_dirty_ring_reap_locked(kvm_state, NULL);
+                    reaped = true;
+                }
+            } else {
+                kvm_slot_get_dirty_log(kvm_state, mem);
+            }
+            kvm_slot_sync_dirty_pages(mem);
+        }
+
+        /* unregister the slot */
+        g_hash_table_remove(kml->batch_del, &mem->start_addr);
+        kvm_free_slot(kml, mem);
+        err = kvm_set_user_memory_region(kml, mem, false);
+        if (err) {
+            fprintf(stderr, "%s: error unregistering slot: %s\n",
+                    __func__, strerror(-err));
+            abort();
+        }
+    }
+}
+
+/*
+ * Apply the slot changes of the current memory transaction: deletions
+ * first, so that the new slots never overlap stale ones in the kernel.
+ *
+ * Called with KVMMemoryListener.slots_lock held.
+ */
+static void kvm_memory_batch_flush(KVMMemoryListener *kml)
+{
+    unsigned int added = 0;
+    KVMSlot *mem;
+    int i, err;
+
+    if (!kml->batch->len) {
+        return;
+    }
+
+    kvm_memory_batch_flush_del(kml);
+
+    for (i = 0; i < kml->batch->len; i++) {
+        mem = g_ptr_array_index(kml->batch, i);
+        if (mem->batch != KVM_SLOT_BATCH_ADD) {
+            continue;
+        }
+
+        mem->batch = KVM_SLOT_BATCH_NONE;
+        err = kvm_set_user_memory_region(kml, mem, true);
+        if (err) {
+            fprintf(stderr, "%s: error registering slot: %s\n", __func__,
+                    strerror(-err));
+            abort();
+        }
+        added++;
+    }
+
+    trace_kvm_memory_batch_flush(kml->as_id, kml->batch->len, added);
+    g_ptr_array_set_size(kml->batch, 0);
+}
+
 static void kvm_set_phys_mem(KVMMemoryListener *kml,
                              MemoryRegionSection *section, bool add)
 {
     KVMSlot *mem;
-    int err;
+    int flags;
     MemoryRegion *mr = section->mr;
     bool writeable = !mr->readonly && !mr->rom_device;
     hwaddr start_addr, size, slot_size, mr_offset;
@@ -1375,38 +1703,14 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
             if (!mem) {
                 goto out;
             }
-            if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
-                /*
-                 * NOTE: We should be aware of the fact that here we're only
-                 * doing a best effort to sync dirty bits.  No matter whether
-                 * we're using dirty log or dirty ring, we ignored two facts:
-                 *
-                 * (1) dirty bits can reside in hardware buffers (PML)
-                 *
-                 * (2) after we collected dirty bits here, pages can be dirtied
-                 * again before we do the final KVM_SET_USER_MEMORY_REGION to
-                 * remove the slot.
-                 *
-                 * Not easy.  Let's cross the fingers until it's fixed.
-                 */
-                if (kvm_state->kvm_dirty_ring_size) {
-                    kvm_dirty_ring_reap_locked(kvm_state);
-                } else {
-                    kvm_slot_get_dirty_log(kvm_state, mem);
-                }
-                kvm_slot_sync_dirty_pages(mem);
-            }
-
-            /* unregister the slot */
-            g_free(mem->dirty_bmap);
-            mem->dirty_bmap = NULL;
-            mem->memory_size = 0;
-            mem->flags = 0;
-            err = kvm_set_user_memory_region(kml, mem, false);
-            if (err) {
-                fprintf(stderr, "%s: error unregistering slot: %s\n",
-                        __func__, strerror(-err));
-                abort();
+            kvm_slot_index_remove(kml, mem);
+            if (mem->batch == KVM_SLOT_BATCH_ADD) {
+                /* Added in this transaction, the kernel never saw it */
+                kvm_free_slot(kml, mem);
+            } else {
+                mem->batch = KVM_SLOT_BATCH_DEL;
+                g_ptr_array_add(kml->batch, mem);
+                g_hash_table_insert(kml->batch_del, &mem->start_addr, mem);
             }
             start_addr += slot_size;
             size -= slot_size;
@@ -1415,22 +1719,33 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     }
 
     /* register the new slot */
+    flags = kvm_mem_flags(mr);
     do {
         slot_size = MIN(kvm_max_slot_size, size);
-        mem = kvm_alloc_slot(kml);
-        mem->as_id = kml->as_id;
-        mem->memory_size = slot_size;
-        mem->start_addr = start_addr;
-        mem->ram_start_offset = ram_start_offset;
-        mem->ram = ram;
-        mem->flags = kvm_mem_flags(mr);
-        kvm_slot_init_dirty_bitmap(mem);
-        err = kvm_set_user_memory_region(kml, mem, true);
-        if (err) {
-            fprintf(stderr, "%s: error registering slot: %s\n", __func__,
-                    strerror(-err));
-            abort();
-        }
+        mem = g_hash_table_lookup(kml->batch_del, &start_addr);
+        if (mem && mem->memory_size == slot_size && mem->ram == ram &&
+            mem->ram_start_offset == ram_start_offset &&
+            mem->flags == flags) {
+            /*
+             * Removed and added back unchanged in the same transaction,
+             * e.g. because a neighbouring region was split: keep the
+             * kernel slot and its dirty log as they are.
+             */
+            g_hash_table_remove(kml->batch_del, &start_addr);
+            mem->batch = KVM_SLOT_BATCH_NONE;
+        } else {
+            mem = kvm_alloc_slot(kml);
+            mem->as_id = kml->as_id;
+            mem->memory_size = slot_size;
+            mem->start_addr = start_addr;
+            mem->ram_start_offset = ram_start_offset;
+            mem->ram = ram;
+            mem->flags = flags;
+            kvm_slot_init_dirty_bitmap(mem);
+            mem->batch = KVM_SLOT_BATCH_ADD;
+            g_ptr_array_add(kml->batch, mem);
+        }
+        kvm_slot_index_insert(kml, mem);
         start_addr += slot_size;
         ram_start_offset += slot_size;
         ram += slot_size;
@@ -1438,9 +1753,47 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     } while (size);
 
 out:
+    if (!kml->batching) {
+        kvm_memory_batch_flush(kml);
+    }
     kvm_slots_unlock();
 }
 
+/*
+ * Pick the next reaper interval from the number of pages the vCPUs dirtied
+ * since the last wakeup, aiming to harvest the rings while they are no more
+ * than half full.  Must be called with the BQL held.
+ */
+static void kvm_dirty_ring_reaper_adapt(KVMState *s)
+{
+    struct KVMDirtyRingReaper *r = &s->reaper;
+    uint64_t pages = 0, per_vcpu = 0;
+    unsigned int nr_vcpus = 0;
+    CPUState *cpu;
+
+    CPU_FOREACH(cpu) {
+        pages += cpu->dirty_pages;
+        nr_vcpus++;
+    }
+
+    /* The total can go down when vCPUs are unplugged */
+    if (nr_vcpus && pages > r->reaper_dirty_pages) {
+        per_vcpu = (pages - r->reaper_dirty_pages) / nr_vcpus;
+    }
+    r->reaper_dirty_pages = pages;
+
+    if (qatomic_xchg(&r->ring_full, 0) ||
+        per_vcpu > s->kvm_dirty_ring_size / 2) {
+        r->reaper_interval_ms = MAX(r->reaper_interval_ms / 2,
+                                    KVM_DIRTY_RING_REAPER_INTERVAL_MIN_MS);
+    } else if (per_vcpu < s->kvm_dirty_ring_size / 8) {
+        r->reaper_interval_ms = MIN(r->reaper_interval_ms * 2,
+                                    KVM_DIRTY_RING_REAPER_INTERVAL_MAX_MS);
+    }
+
+    trace_kvm_dirty_ring_reaper_adapt(per_vcpu, r->reaper_interval_ms);
+}
+
 static void *kvm_dirty_ring_reaper_thread(void *data)
 {
     KVMState *s = data;
@@ -1453,16 +1806,14 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     while (true) {
         r->reaper_state = KVM_DIRTY_RING_REAPER_WAIT;
         trace_kvm_dirty_ring_reaper("wait");
-        /*
-         * TODO: provide a smarter timeout rather than a constant?
-         */
-        sleep(1);
+        g_usleep(r->reaper_interval_ms * 1000);
 
         trace_kvm_dirty_ring_reaper("wakeup");
         r->reaper_state = KVM_DIRTY_RING_REAPER_REAPING;
 
         qemu_mutex_lock_iothread();
-        kvm_dirty_ring_reap(s);
+        kvm_dirty_ring_reap(s, NULL);
+        kvm_dirty_ring_reaper_adapt(s);
         qemu_mutex_unlock_iothread();
 
         r->reaper_iteration++;
@@ -1479,6 +1830,7 @@ static int kvm_dirty_ring_reaper_init(KVMState *s)
 {
     struct KVMDirtyRingReaper *r = &s->reaper;
 
+    r->reaper_interval_ms = KVM_DIRTY_RING_REAPER_INTERVAL_MAX_MS;
     qemu_thread_create(&r->reaper_thr, "kvm-reaper",
                        kvm_dirty_ring_reaper_thread,
                        s, QEMU_THREAD_JOINABLE);
@@ -1486,6 +1838,23 @@ static int kvm_dirty_ring_reaper_init(KVMState *s)
     return 0;
 }
 
+static void kvm_region_begin(MemoryListener *listener)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+
+    kml->batching = true;
+}
+
+static void kvm_region_commit(MemoryListener *listener)
+{
+    KVMMemoryListener *kml = container_of(listener, KVMMemoryListener, listener);
+
+    kvm_slots_lock();
+    kvm_memory_batch_flush(kml);
+    kml->batching = false;
+    kvm_slots_unlock();
+}
+
 static void kvm_region_add(MemoryListener *listener,
                            MemoryRegionSection *section)
 {
@@ -1517,21 +1886,16 @@ static void kvm_log_sync(MemoryListener *listener,
 static void kvm_log_sync_global(MemoryListener *l)
 {
     KVMMemoryListener *kml = container_of(l, KVMMemoryListener, listener);
-    KVMState *s = kvm_state;
     KVMSlot *mem;
     int i;
 
     /* Flush all kernel dirty addresses into KVMSlot dirty bitmap */
     kvm_dirty_ring_flush();
 
-    /*
-     * TODO: make this faster when nr_slots is big while there are
-     * only a few used slots (small VMs).
-     */
     kvm_slots_lock();
-    for (i = 0; i < s->nr_slots; i++) {
-        mem = &kml->slots[i];
-        if (mem->memory_size && mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
+    for (i = 0; i < kml->nr_used_slots; i++) {
+        mem = kml->slots_by_gpa[i];
+        if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES) {
             kvm_slot_sync_dirty_pages(mem);
             /*
              * This is not needed by KVM_GET_DIRTY_LOG because the
@@ -1639,12 +2003,21 @@ void kvm_memory_listener_register(KVMState *s, KVMMemoryListener *kml,
     int i;
 
     kml->slots = g_malloc0(s->nr_slots * sizeof(KVMSlot));
+    kml->slots_by_gpa = g_new0(KVMSlot *, s->nr_slots);
+    kml->free_slots = g_new(int, s->nr_slots);
+    kml->batch = g_ptr_array_new();
+    kml->batch_del = g_hash_table_new(g_int64_hash, g_int64_equal);
     kml->as_id = as_id;
 
     for (i = 0; i < s->nr_slots; i++) {
         kml->slots[i].slot = i;
+        /* Hand out the lowest slot numbers first */
+        kml->free_slots[i] = s->nr_slots - 1 - i;
     }
+    kml->nr_free_slots = s->nr_slots;
 
+    kml->listener.begin = kvm_region_begin;
+    kml->listener.commit = kvm_region_commit;
     kml->listener.region_add = kvm_region_add;
     kml->listener.region_del = kvm_region_del;
     kml->listener.log_start = kvm_log_start;
@@ -2923,9 +3296,12 @@ int kvm_cpu_exec(CPUState *cpu)
              * still full.  Got kicked by KVM_RESET_DIRTY_RINGS.
              */
             trace_kvm_dirty_ring_full(cpu->cpu_index);
-            qemu_mutex_lock_iothread();
-            kvm_dirty_ring_reap(kvm_state);
-            qemu_mutex_unlock_iothread();
+            /*
+             * Only our own ring needs to be drained, which can be done
+             * without the BQL and without stopping the other vcpus.
+             */
+            kvm_dirty_ring_reap(kvm_state, cpu);
+            qatomic_inc(&kvm_state->reaper.ring_full);
             ret = 0;
             break;
         case KVM_EXIT_SYSTEM_EVENT:
@@ -2959,6 +3335,17 @@ int kvm_cpu_exec(CPUState *cpu)
     } while (ret == 0);
 
     cpu_exec_end(cpu);
+
+    /*
+     * Harvest our own dirty ring while we are out of KVM_RUN and not holding
+     * the BQL yet, so that the reaper and dirty log syncs (which kick all
+     * vcpus out) find little left to do.
+     */
+    if (kvm_state->kvm_dirty_ring_size &&
+        kvm_dirty_ring_pending(kvm_state, cpu)) {
+        kvm_dirty_ring_reap(kvm_state, cpu);
+    }
+
     qemu_mutex_lock_iothread();
 
     if (ret < 0) {
@@ -3098,6 +3485,11 @@ bool kvm_has_sync_mmu(void)
     return kvm_state->sync_mmu;
 }
 
+bool kvm_dirty_ring_enabled(void)
+{
+    return kvm_state->kvm_dirty_ring_size != 0;
+}
+
 int kvm_has_vcpu_events(void)
 {
     return kvm_state->vcpu_events;
@@ -19,6 +19,14 @@
 #include "qemu/config-file.h"
 #include "qom/object_interfaces.h"
 #include "qemu/mmap-alloc.h"
+#include "qemu/thread-context.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "block/aio.h"
+#include "migration/postcopy-ram.h"
+#include "trace.h"
 
 #ifdef CONFIG_NUMA
 #include <numaif.h>
@@ -203,6 +211,210 @@ static void host_memory_backend_set_dump(Object *obj, bool value, Error **errp)
     }
 }
 
+#ifdef CONFIG_NUMA
+/*
+ * Thread contexts bound to the CPUs of a set of host nodes, shared by all
+ * the backends bound to the same nodes.  Keyed by the list of nodes.
+ */
+static GHashTable *host_memory_backend_node_contexts;
+
+static ThreadContext *
+host_memory_backend_get_node_context(HostMemoryBackend *backend)
+{
+    GString *key = g_string_new(NULL);
+    ThreadContext *tc;
+    Error *local_err = NULL;
+    unsigned long node;
+
+    for (node = find_first_bit(backend->host_nodes, MAX_NODES);
+         node < MAX_NODES;
+         node = find_next_bit(backend->host_nodes, MAX_NODES, node + 1)) {
+        g_string_append_printf(key, "%lu,", node);
+    }
+
+    if (!host_memory_backend_node_contexts) {
+        host_memory_backend_node_contexts =
+            g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+    }
+
+    tc = g_hash_table_lookup(host_memory_backend_node_contexts, key->str);
+    if (tc) {
+        g_string_free(key, true);
+        return tc;
+    }
+
+    tc = THREAD_CONTEXT(object_new(TYPE_THREAD_CONTEXT));
+    thread_context_set_node_affinity(tc, backend->host_nodes, MAX_NODES,
+                                     &local_err);
+    if (!local_err) {
+        user_creatable_complete(USER_CREATABLE(tc), &local_err);
+    }
+    if (local_err) {
+        /* Not fatal: the threads are simply not bound */
+        error_free(local_err);
+        object_unref(OBJECT(tc));
+        g_string_free(key, true);
+        return NULL;
+    }
+
+    g_hash_table_insert(host_memory_backend_node_contexts,
+                        g_string_free(key, false), tc);
+    return tc;
+}
+#endif
+
+/*
+ * With prealloc-async, the start of the memory, where firmware and kernel
+ * are loaded, is populated before the machine is allowed to start.
+ */
+#define HOST_MEMORY_BACKEND_PREALLOC_HEAD (1 * GiB)
+
+static void host_memory_backend_prealloc_bh(void *opaque)
+{
+    HostMemoryBackend *backend = opaque;
+    char *name = host_memory_backend_get_name(backend);
+
+    if (backend->prealloc_ret) {
+        /*
+         * Not fatal: background preallocation is only used for anonymous
+         * memory, where the pages that could not be populated are allocated
+         * when the guest touches them.  Unlike with hugetlbfs or other
+         * files, a shortage does not raise SIGBUS then.
+         */
+        warn_report("memory backend '%s': background preallocation "
+                    "failed: %s", name, strerror(-backend->prealloc_ret));
+    }
+    trace_host_memory_backend_prealloc_async_done(name, backend->prealloc_ret,
+        (get_clock() - backend->prealloc_start) / SCALE_MS);
+    g_free(name);
+
+    backend->prealloc_pending = false;
+    postcopy_remove_notifier(&backend->postcopy_notifier);
+    ram_block_discard_disable(false);
+    object_unref(OBJECT(backend));
+}
+
+/*
+ * An incoming postcopy migration discards all of guest memory before
+ * registering it with userfaultfd.  A page populated again afterwards by a
+ * preallocation thread never faults, and the guest would read zeroes.
+ */
+static int host_memory_backend_postcopy_notifier(NotifierWithReturn *notifier,
+                                                 void *opaque)
+{
+    HostMemoryBackend *backend = container_of(notifier, HostMemoryBackend,
+                                              postcopy_notifier);
+    struct PostcopyNotifyData *pnd = opaque;
+    char *name;
+
+    if (pnd->reason != POSTCOPY_NOTIFY_PROBE) {
+        return 0;
+    }
+
+    name = host_memory_backend_get_name(backend);
+    error_setg(pnd->errp, "memory backend '%s' is still being preallocated "
+               "in the background, postcopy is not possible yet", name);
+    g_free(name);
+    return -EBUSY;
+}
+
+/* Called from a preallocation thread */
+static void host_memory_backend_prealloc_done(void *opaque, int ret)
+{
+    HostMemoryBackend *backend = opaque;
+
+    backend->prealloc_ret = ret;
+    aio_bh_schedule_oneshot(qemu_get_aio_context(),
+                            host_memory_backend_prealloc_bh, backend);
+}
+
+/*
+ * Preallocate the memory of @backend.  Unless a prealloc-context is given,
+ * memory bound to host nodes is populated by threads running on the CPUs
+ * of those nodes, so that page clearing happens on the local node.
+ */
+static void host_memory_backend_do_prealloc(HostMemoryBackend *backend,
+                                            Error **errp)
+{
+    int fd = memory_region_get_fd(&backend->mr);
+    char *ptr = memory_region_get_ram_ptr(&backend->mr);
+    uint64_t sz = memory_region_size(&backend->mr);
+    ThreadContext *tc = backend->prealloc_context;
+    Error *local_err = NULL;
+    uint64_t head;
+    int64_t start;
+    char *name;
+
+#ifdef CONFIG_NUMA
+    if (!tc && backend->policy != MPOL_DEFAULT) {
+        tc = host_memory_backend_get_node_context(backend);
+    }
+#endif
+
+    start = get_clock();
+    name = host_memory_backend_get_name(backend);
+
+    /*
+     * Only anonymous memory may be left partly unpopulated while the guest
+     * runs.  With hugetlbfs and other files, touching a page that cannot be
+     * allocated raises SIGBUS, which is what preallocation must prevent.
+     */
+    if (backend->prealloc_async && fd < 0) {
+        head = MIN(sz, QEMU_ALIGN_UP(HOST_MEMORY_BACKEND_PREALLOC_HEAD,
+                                     qemu_fd_getpagesize(fd)));
+        os_mem_prealloc(fd, ptr, head, backend->prealloc_threads, tc,
+                        &local_err);
+        if (local_err || head == sz) {
+            goto out;
+        }
+
+        /*
+         * A discarded page could be populated again by the background
+         * threads, so discards (virtio-balloon, virtio-mem, postcopy) stay
+         * off until they are done.  If something already relies on
+         * discards, do the rest right now.
+         */
+        if (!ram_block_discard_disable(true)) {
+            /*
+             * The reference, the notifier and the discard inhibition are
+             * dropped by host_memory_backend_prealloc_bh().
+             */
+            object_ref(OBJECT(backend));
+            backend->prealloc_pending = true;
+            backend->prealloc_start = start;
+            backend->postcopy_notifier.notify =
+                host_memory_backend_postcopy_notifier;
+            postcopy_add_notifier(&backend->postcopy_notifier);
+            if (os_mem_prealloc_async(fd, ptr + head, sz - head,
+                                      backend->prealloc_threads, tc,
+                                      host_memory_backend_prealloc_done,
+                                      backend)) {
+                trace_host_memory_backend_prealloc_async(name, head,
+                                                         sz - head);
+                g_free(name);
+                return;
+            }
+            postcopy_remove_notifier(&backend->postcopy_notifier);
+            backend->prealloc_pending = false;
+            ram_block_discard_disable(false);
+            object_unref(OBJECT(backend));
+        }
+
+        /* Not possible in the background, do the rest right now */
+        ptr += head;
+        sz -= head;
+    }
+
+    os_mem_prealloc(fd, ptr, sz, backend->prealloc_threads, tc, &local_err);
+
+out:
+    trace_host_memory_backend_prealloc(name, sz, backend->prealloc_threads,
+                                       tc != NULL,
+                                       (get_clock() - start) / SCALE_MS);
+    g_free(name);
+    error_propagate(errp, local_err);
+}
+
 static bool host_memory_backend_get_prealloc(Object *obj, Error **errp)
 {
     HostMemoryBackend *backend = MEMORY_BACKEND(obj);
@@ -227,11 +439,7 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 
     if (value && !backend->prealloc) {
-        int fd = memory_region_get_fd(&backend->mr);
-        void *ptr = memory_region_get_ram_ptr(&backend->mr);
-        uint64_t sz = memory_region_size(&backend->mr);
-
-        os_mem_prealloc(fd, ptr, sz, backend->prealloc_threads, &local_err);
+        host_memory_backend_do_prealloc(backend, &local_err);
         if (local_err) {
             error_propagate(errp, local_err);
             return;
@@ -240,6 +448,21 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 }
 
+static bool host_memory_backend_get_prealloc_async(Object *obj, Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->prealloc_async;
+}
+
+static void host_memory_backend_set_prealloc_async(Object *obj, bool value,
+                                                   Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    backend->prealloc_async = value;
+}
+
 static void host_memory_backend_get_prealloc_threads(Object *obj, Visitor *v,
     const char *name, void *opaque, Error **errp)
 {
@@ -392,8 +615,7 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
          * specified NUMA policy in place.
          */
         if (backend->prealloc) {
-            os_mem_prealloc(memory_region_get_fd(&backend->mr), ptr, sz,
-                            backend->prealloc_threads, &local_err);
+            host_memory_backend_do_prealloc(backend, &local_err);
             if (local_err) {
                 goto out;
             }
@@ -406,7 +628,9 @@ out:
 static bool
 host_memory_backend_can_be_deleted(UserCreatable *uc)
 {
-    if (host_memory_backend_is_mapped(MEMORY_BACKEND(uc))) {
+    HostMemoryBackend *backend = MEMORY_BACKEND(uc);
+
+    if (host_memory_backend_is_mapped(backend) || backend->prealloc_pending) {
         return false;
     } else {
         return true;
@@ -501,6 +725,16 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         NULL, NULL);
     object_class_property_set_description(oc, "prealloc-threads",
         "Number of CPU threads to use for prealloc");
+    object_class_property_add_link(oc, "prealloc-context",
+        TYPE_THREAD_CONTEXT, offsetof(HostMemoryBackend, prealloc_context),
+        object_property_allow_set_link, OBJ_PROP_LINK_STRONG);
+    object_class_property_set_description(oc, "prealloc-context",
+        "Context to use for creating CPU threads for preallocation");
+    object_class_property_add_bool(oc, "prealloc-async",
+        host_memory_backend_get_prealloc_async,
+        host_memory_backend_set_prealloc_async);
+    object_class_property_set_description(oc, "prealloc-async",
+        "Preallocate memory in the background while the guest runs");
     object_class_property_add(oc, "size", "int",
         host_memory_backend_get_size,
         host_memory_backend_set_size,
@@ -51,6 +51,9 @@ struct BdrvDirtyBitmap {
     bool skip_store;            /* We are either migrating or deleting this
                                  * bitmap; it should not be stored on the next
                                  * inactivation. */
+    bool stored;                /* The owner disk image holds the current
+                                   contents of this bitmap, so they need not
+                                   be written out again on the next store. */
     QLIST_ENTRY(BdrvDirtyBitmap) list;
 };
 
@@ -316,6 +319,7 @@ BdrvDirtyBitmap *bdrv_reclaim_dirty_bitmap_locked(BdrvDirtyBitmap *parent,
 
     parent->disabled = successor->disabled;
     parent->busy = false;
+    parent->stored = false;
     bdrv_release_dirty_bitmap_locked(successor);
     parent->successor = NULL;
 
@@ -350,6 +354,7 @@ void bdrv_dirty_bitmap_truncate(BlockDriverState *bs, int64_t bytes)
         assert(!bitmap->active_iterators);
         hbitmap_truncate(bitmap->bitmap, bytes);
         bitmap->size = bytes;
+        bitmap->stored = false;
     }
     bdrv_dirty_bitmaps_unlock(bs);
 }
@@ -628,6 +633,7 @@ void bdrv_set_dirty_bitmap_locked(BdrvDirtyBitmap *bitmap,
 {
     assert(!bdrv_dirty_bitmap_readonly(bitmap));
     hbitmap_set(bitmap->bitmap, offset, bytes);
+    bitmap->stored = false;
 }
 
 void bdrv_set_dirty_bitmap(BdrvDirtyBitmap *bitmap,
@@ -644,6 +650,7 @@ void bdrv_reset_dirty_bitmap_locked(BdrvDirtyBitmap *bitmap,
 {
     assert(!bdrv_dirty_bitmap_readonly(bitmap));
     hbitmap_reset(bitmap->bitmap, offset, bytes);
+    bitmap->stored = false;
 }
 
 void bdrv_reset_dirty_bitmap(BdrvDirtyBitmap *bitmap,
@@ -666,6 +673,7 @@ void bdrv_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap **out)
                                        hbitmap_granularity(backup));
         *out = backup;
     }
+    bitmap->stored = false;
     bdrv_dirty_bitmaps_unlock(bitmap->bs);
 }
 
@@ -674,6 +682,7 @@ void bdrv_restore_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap *backup)
     HBitmap *tmp = bitmap->bitmap;
     assert(!bdrv_dirty_bitmap_readonly(bitmap));
     bitmap->bitmap = backup;
+    bitmap->stored = false;
     hbitmap_free(tmp);
 }
 
@@ -713,6 +722,7 @@ void bdrv_dirty_bitmap_deserialize_part(BdrvDirtyBitmap *bitmap,
                                         uint64_t bytes, bool finish)
 {
     hbitmap_deserialize_part(bitmap->bitmap, buf, offset, bytes, finish);
+    bitmap->stored = false;
 }
 
 void bdrv_dirty_bitmap_deserialize_zeroes(BdrvDirtyBitmap *bitmap,
@@ -720,6 +730,7 @@ void bdrv_dirty_bitmap_deserialize_zeroes(BdrvDirtyBitmap *bitmap,
                                           bool finish)
 {
     hbitmap_deserialize_zeroes(bitmap->bitmap, offset, bytes, finish);
+    bitmap->stored = false;
 }
 
 void bdrv_dirty_bitmap_deserialize_ones(BdrvDirtyBitmap *bitmap,
@@ -727,6 +738,7 @@ void bdrv_dirty_bitmap_deserialize_ones(BdrvDirtyBitmap *bitmap,
                                         bool finish)
 {
     hbitmap_deserialize_ones(bitmap->bitmap, offset, bytes, finish);
+    bitmap->stored = false;
 }
 
 void bdrv_dirty_bitmap_deserialize_finish(BdrvDirtyBitmap *bitmap)
@@ -749,6 +761,7 @@ void bdrv_set_dirty(BlockDriverState *bs, int64_t offset, int64_t bytes)
         }
         assert(!bdrv_dirty_bitmap_readonly(bitmap));
         hbitmap_set(bitmap->bitmap, offset, bytes);
+        bitmap->stored = false;
     }
     bdrv_dirty_bitmaps_unlock(bs);
 }
@@ -830,6 +843,23 @@ void bdrv_dirty_bitmap_skip_store(BdrvDirtyBitmap *bitmap, bool skip)
     bdrv_dirty_bitmaps_unlock(bitmap->bs);
 }
 
+/*
+ * Record whether the owner image holds the current contents of @bitmap.
+ * Any modification of the bitmap clears this again.
+ * Called with BQL taken.
+ */
+void bdrv_dirty_bitmap_set_stored(BdrvDirtyBitmap *bitmap, bool stored)
+{
+    bdrv_dirty_bitmaps_lock(bitmap->bs);
+    bitmap->stored = stored;
+    bdrv_dirty_bitmaps_unlock(bitmap->bs);
+}
+
+bool bdrv_dirty_bitmap_stored(const BdrvDirtyBitmap *bitmap)
+{
+    return bitmap->stored;
+}
+
 bool bdrv_dirty_bitmap_get_persistence(BdrvDirtyBitmap *bitmap)
 {
     return bitmap->persistent && !bitmap->skip_store;
@@ -947,6 +977,7 @@ bool bdrv_dirty_bitmap_merge_internal(BdrvDirtyBitmap *dest,
     } else {
         ret = hbitmap_merge(dest->bitmap, src->bitmap, dest->bitmap);
     }
+    dest->stored = false;
 
     if (lock) {
         bdrv_dirty_bitmaps_unlock(dest->bs);
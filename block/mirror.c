@@ -79,6 +79,8 @@ typedef struct MirrorBlockJob {
     bool unmap;
     int target_cluster_size;
     int max_iov;
+    /* Write all-zero data to the target as zeroes instead of copying it */
+    bool detect_zeroes;
     bool initial_zeroing_ongoing;
     int in_active_write_counter;
     bool prepared;
@@ -254,7 +256,14 @@ static void coroutine_fn mirror_read_complete(MirrorOp *op, int ret)
         return;
     }
 
-    ret = blk_co_pwritev(s->target, op->offset, op->qiov.size, &op->qiov, 0);
+    if (s->detect_zeroes && qemu_iovec_is_zero(&op->qiov, 0, op->qiov.size)) {
+        trace_mirror_zero_detected(s, op->offset, op->qiov.size);
+        ret = blk_co_pwrite_zeroes(s->target, op->offset, op->qiov.size,
+                                   s->unmap ? BDRV_REQ_MAY_UNMAP : 0);
+    } else {
+        ret = blk_co_pwritev(s->target, op->offset, op->qiov.size,
+                             &op->qiov, 0);
+    }
     mirror_write_complete(op, ret);
 }
 
@@ -970,6 +979,10 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
     }
     s->max_iov = MIN(bs->bl.max_iov, target_bs->bl.max_iov);
 
+    /* Turning zero data into write_zeroes only pays off if the target can
+     * do it without writing the zeroes out anyway */
+    s->detect_zeroes = bdrv_can_write_zeroes_with_unmap(target_bs);
+
     s->buf = qemu_try_blockalign(bs, s->buf_size);
     if (s->buf == NULL) {
         ret = -ENOMEM;
@@ -1307,6 +1320,17 @@ do_sync_target_write(MirrorBlockJob *job, MirrorMethod method,
 
     job_progress_increase_remaining(&job->common.job, bytes);
 
+    if (method == MIRROR_METHOD_COPY && job->detect_zeroes &&
+        qemu_iovec_is_zero(qiov, qiov_offset, bytes))
+    {
+        trace_mirror_zero_detected(job, offset, bytes);
+        method = MIRROR_METHOD_ZERO;
+        qiov = NULL;
+        if (job->unmap) {
+            flags |= BDRV_REQ_MAY_UNMAP;
+        }
+    }
+
     switch (method) {
     case MIRROR_METHOD_COPY:
         ret = blk_co_pwritev_part(job->target, offset, bytes,
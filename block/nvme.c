@@ -32,6 +32,8 @@
 #define NVME_CQ_ENTRY_BYTES 16
 #define NVME_QUEUE_SIZE 128
 #define NVME_DOORBELL_SIZE 4096
+/* Upper limit for the "queues" option, the doorbell stride may lower it */
+#define NVME_MAX_IO_QUEUES 64
 
 /*
  * We have to leave one slot empty as that is the full queue case where
@@ -62,6 +64,7 @@ typedef struct {
 typedef struct {
     BlockCompletionFunc *cb;
     void *opaque;
+    uint32_t *result; /* if not NULL, receives DW0 of the completion entry */
     int cid;
     void *prp_list_page;
     uint64_t prp_list_iova;
@@ -78,6 +81,9 @@ typedef struct {
     /* Fields protected by BQL */
     uint8_t     *prp_list_pages;
 
+    /* Fields protected by BDRVNVMeState.dma_map_lock */
+    QEMUVFIOMappingCache dma_map_cache;
+
     /* Fields protected by @lock */
     CoQueue     free_req_queue;
     NVMeQueue   sq, cq;
@@ -106,6 +112,8 @@ struct BDRVNVMeState {
      */
     NVMeQueuePair **queues;
     unsigned queue_count;
+    /* Next I/O queue to submit to, requests are spread round-robin */
+    unsigned next_io_queue;
     size_t page_size;
     /* How many uint32_t elements does each doorbell entry take. */
     size_t doorbell_scale;
@@ -140,6 +148,7 @@ struct BDRVNVMeState {
 
 #define NVME_BLOCK_OPT_DEVICE "device"
 #define NVME_BLOCK_OPT_NAMESPACE "namespace"
+#define NVME_BLOCK_OPT_QUEUES "queues"
 
 static void nvme_process_completion_bh(void *opaque);
 
@@ -157,6 +166,11 @@ static QemuOptsList runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "NVMe namespace",
         },
+        {
+            .name = NVME_BLOCK_OPT_QUEUES,
+            .type = QEMU_OPT_NUMBER,
+            .help = "Number of I/O queue pairs (default: 1)",
+        },
         { /* end of list */ }
     },
 };
@@ -339,6 +353,15 @@ static void nvme_put_free_req_and_wake(NVMeQueuePair *q, NVMeRequest *req)
     qemu_mutex_unlock(&q->lock);
 }
 
+/* Pick the I/O queue pair for a new request */
+static NVMeQueuePair *nvme_get_io_queue(BDRVNVMeState *s)
+{
+    unsigned nr_io_queues = s->queue_count - INDEX_IO(0);
+
+    assert(nr_io_queues > 0);
+    return s->queues[INDEX_IO(s->next_io_queue++ % nr_io_queues)];
+}
+
 static inline int nvme_translate_error(const NvmeCqe *c)
 {
     uint16_t status = (le16_to_cpu(c->status) >> 1) & 0xFF;
@@ -414,8 +437,12 @@ static bool nvme_process_completion(NVMeQueuePair *q)
         req = *preq;
         assert(req.cid == cid);
         assert(req.cb);
+        if (req.result) {
+            *req.result = le32_to_cpu(c->result);
+        }
         nvme_put_free_req_locked(q, preq);
         preq->cb = preq->opaque = NULL;
+        preq->result = NULL;
         q->inflight--;
         qemu_mutex_unlock(&q->lock);
         req.cb(req.opaque, ret);
@@ -492,7 +519,9 @@ static void nvme_admin_cmd_sync_cb(void *opaque, int ret)
     aio_wait_kick();
 }
 
-static int nvme_admin_cmd_sync(BlockDriverState *bs, NvmeCmd *cmd)
+/* Like nvme_admin_cmd_sync(), and store DW0 of the completion in @result */
+static int nvme_admin_cmd_sync_result(BlockDriverState *bs, NvmeCmd *cmd,
+                                      uint32_t *result)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q = s->queues[INDEX_ADMIN];
@@ -503,12 +532,18 @@ static int nvme_admin_cmd_sync(BlockDriverState *bs, NvmeCmd *cmd)
     if (!req) {
         return -EBUSY;
     }
+    req->result = result;
     nvme_submit_command(q, req, cmd, nvme_admin_cmd_sync_cb, &ret);
 
     AIO_WAIT_WHILE(aio_context, ret == -EINPROGRESS);
     return ret;
 }
 
+static int nvme_admin_cmd_sync(BlockDriverState *bs, NvmeCmd *cmd)
+{
+    return nvme_admin_cmd_sync_result(bs, cmd, NULL);
+}
+
 /* Returns true on success, false on failure. */
 static bool nvme_identify(BlockDriverState *bs, int namespace, Error **errp)
 {
@@ -702,8 +737,37 @@ static bool nvme_poll_cb(void *opaque)
     return nvme_poll_queues(s);
 }
 
+/*
+ * Ask the controller for *@nr_io_queues I/O queue pairs.  Controllers are free
+ * to allocate fewer than requested, so *@nr_io_queues is lowered to the number
+ * of submission and completion queues that were actually allocated.
+ */
+static bool nvme_set_number_of_queues(BlockDriverState *bs,
+                                      unsigned *nr_io_queues, Error **errp)
+{
+    NvmeCmd cmd = {
+        .opcode = NVME_ADM_CMD_SET_FEATURES,
+        .cdw10 = cpu_to_le32(NVME_NUMBER_OF_QUEUES),
+        .cdw11 = cpu_to_le32(((*nr_io_queues - 1) << 16) |
+                             (*nr_io_queues - 1)),
+    };
+    uint32_t result;
+    unsigned nsqa, ncqa;
+
+    if (nvme_admin_cmd_sync_result(bs, &cmd, &result)) {
+        error_setg(errp, "Failed to set number of queues");
+        return false;
+    }
+
+    /* Both counts are zero-based */
+    nsqa = (result & 0xffff) + 1;
+    ncqa = (result >> 16) + 1;
+    *nr_io_queues = MIN(*nr_io_queues, MIN(nsqa, ncqa));
+    return true;
+}
+
 static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
-                     Error **errp)
+                     unsigned nr_io_queues, Error **errp)
 {
     BDRVNVMeState *s = bs->opaque;
     NVMeQueuePair *q;
@@ -841,9 +905,35 @@ static int nvme_init(BlockDriverState *bs, const char *device, int namespace,
         goto out;
     }
 
+    /* Every queue pair needs its doorbells inside the mapped doorbell area */
+    nr_io_queues = MIN(nr_io_queues,
+                       NVME_DOORBELL_SIZE /
+                       (s->doorbell_scale * sizeof(*s->doorbells)) -
+                       INDEX_IO(0));
+    if (nr_io_queues > 1) {
+        Error *local_err = NULL;
+
+        if (!nvme_set_number_of_queues(bs, &nr_io_queues, &local_err)) {
+            warn_report_err(local_err);
+            nr_io_queues = 1;
+        }
+    }
+
     /* Set up command queues. */
     if (!nvme_add_io_queue(bs, errp)) {
         ret = -EIO;
+        goto out;
+    }
+    while (s->queue_count < INDEX_IO(nr_io_queues)) {
+        Error *local_err = NULL;
+
+        if (!nvme_add_io_queue(bs, &local_err)) {
+            /* Should not happen once the count is clamped, but keep going */
+            error_prepend(&local_err, "Using %u of %u I/O queues: ",
+                          s->queue_count - INDEX_IO(0), nr_io_queues);
+            warn_report_err(local_err);
+            break;
+        }
     }
 out:
     if (regs) {
@@ -934,6 +1024,7 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     const char *device;
     QemuOpts *opts;
     int namespace;
+    uint64_t nr_io_queues;
     int ret;
     BDRVNVMeState *s = bs->opaque;
 
@@ -949,7 +1040,14 @@ static int nvme_file_open(BlockDriverState *bs, QDict *options, int flags,
     }
 
     namespace = qemu_opt_get_number(opts, NVME_BLOCK_OPT_NAMESPACE, 1);
-    ret = nvme_init(bs, device, namespace, errp);
+    nr_io_queues = qemu_opt_get_number(opts, NVME_BLOCK_OPT_QUEUES, 1);
+    if (nr_io_queues < 1 || nr_io_queues > NVME_MAX_IO_QUEUES) {
+        error_setg(errp, "'" NVME_BLOCK_OPT_QUEUES "' must be between 1 and %d",
+                   NVME_MAX_IO_QUEUES);
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+    ret = nvme_init(bs, device, namespace, nr_io_queues, errp);
     qemu_opts_del(opts);
     if (ret) {
         goto fail;
@@ -1012,7 +1110,8 @@ static coroutine_fn int nvme_cmd_unmap_qiov(BlockDriverState *bs,
 }
 
 /* Called with s->dma_map_lock */
-static coroutine_fn int nvme_cmd_map_qiov(BlockDriverState *bs, NvmeCmd *cmd,
+static coroutine_fn int nvme_cmd_map_qiov(BlockDriverState *bs,
+                                          NVMeQueuePair *q, NvmeCmd *cmd,
                                           NVMeRequest *req, QEMUIOVector *qiov)
 {
     BDRVNVMeState *s = bs->opaque;
@@ -1030,9 +1129,9 @@ static coroutine_fn int nvme_cmd_map_qiov(BlockDriverState *bs, NvmeCmd *cmd,
         size_t len = QEMU_ALIGN_UP(qiov->iov[i].iov_len,
                                    qemu_real_host_page_size);
 try_map:
-        r = qemu_vfio_dma_map(s->vfio,
-                              qiov->iov[i].iov_base,
-                              len, true, &iova, errp);
+        r = qemu_vfio_dma_map_cached(s->vfio, &q->dma_map_cache,
+                                     qiov->iov[i].iov_base,
+                                     len, true, &iova, errp);
         if (r == -ENOSPC) {
             /*
              * In addition to the -ENOMEM error, the VFIO_IOMMU_MAP_DMA
@@ -1149,7 +1248,7 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 {
     int r;
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
 
     uint32_t cdw12 = (((bytes >> s->blkshift) - 1) & 0xFFFF) |
@@ -1168,11 +1267,12 @@ static coroutine_fn int nvme_co_prw_aligned(BlockDriverState *bs,
 
     trace_nvme_prw_aligned(s, is_write, offset, bytes, flags, qiov->niov);
     assert(s->queue_count > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
 
     qemu_co_mutex_lock(&s->dma_map_lock);
-    r = nvme_cmd_map_qiov(bs, &cmd, req, qiov);
+    r = nvme_cmd_map_qiov(bs, ioq, &cmd, req, qiov);
     qemu_co_mutex_unlock(&s->dma_map_lock);
     if (r) {
         nvme_put_free_req_and_wake(ioq, req);
@@ -1269,7 +1369,7 @@ static coroutine_fn int nvme_co_pwritev(BlockDriverState *bs,
 static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     NvmeCmd cmd = {
         .opcode = NVME_CMD_FLUSH,
@@ -1281,6 +1381,7 @@ static coroutine_fn int nvme_co_flush(BlockDriverState *bs)
     };
 
     assert(s->queue_count > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
     nvme_submit_command(ioq, req, &cmd, nvme_rw_cb, &data);
@@ -1300,7 +1401,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
                                               BdrvRequestFlags flags)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     uint32_t cdw12;
 
@@ -1343,6 +1444,7 @@ static coroutine_fn int nvme_co_pwrite_zeroes(BlockDriverState *bs,
 
     trace_nvme_write_zeroes(s, offset, bytes, flags);
     assert(s->queue_count > 1);
+    ioq = nvme_get_io_queue(s);
     req = nvme_get_free_req(ioq);
     assert(req);
 
@@ -1363,7 +1465,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
                                          int64_t bytes)
 {
     BDRVNVMeState *s = bs->opaque;
-    NVMeQueuePair *ioq = s->queues[INDEX_IO(0)];
+    NVMeQueuePair *ioq;
     NVMeRequest *req;
     NvmeDsmRange *buf;
     QEMUIOVector local_qiov;
@@ -1386,6 +1488,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     }
 
     assert(s->queue_count > 1);
+    ioq = nvme_get_io_queue(s);
 
     /*
      * Filling the @buf requires @offset and @bytes to satisfy restrictions
@@ -1411,7 +1514,7 @@ static int coroutine_fn nvme_co_pdiscard(BlockDriverState *bs,
     assert(req);
 
     qemu_co_mutex_lock(&s->dma_map_lock);
-    ret = nvme_cmd_map_qiov(bs, &cmd, req, &local_qiov);
+    ret = nvme_cmd_map_qiov(bs, ioq, &cmd, req, &local_qiov);
     qemu_co_mutex_unlock(&s->dma_map_lock);
 
     if (ret) {
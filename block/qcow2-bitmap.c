@@ -45,6 +45,9 @@
 /* Size of bitmap table entries */
 #define BME_TABLE_ENTRY_SIZE (sizeof(uint64_t))
 
+/* Upper limit for a single read of contiguous bitmap data clusters */
+#define BITMAP_LOAD_BUF_SIZE (1 * MiB)
+
 QEMU_BUILD_BUG_ON(BME_MAX_NAME_SIZE != BDRV_BITMAP_MAX_NAME_SIZE);
 
 #if BME_MAX_TABLE_SIZE * 8ULL > INT_MAX
@@ -291,7 +294,7 @@ static int load_bitmap_data(BlockDriverState *bs,
     uint64_t offset, limit;
     uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
     uint8_t *buf = NULL;
-    uint64_t i, tab_size =
+    uint64_t i, j, n, max_clusters, tab_size =
             size_to_clusters(s,
                 bdrv_dirty_bitmap_serialization_size(bitmap, 0, bm_size));
 
@@ -299,29 +302,51 @@ static int load_bitmap_data(BlockDriverState *bs,
         return -EINVAL;
     }
 
-    buf = g_malloc(s->cluster_size);
+    max_clusters = MIN(tab_size,
+                       MAX(BITMAP_LOAD_BUF_SIZE >> s->cluster_bits, 1));
+    buf = g_malloc(max_clusters * s->cluster_size);
     limit = bdrv_dirty_bitmap_serialization_coverage(s->cluster_size, bitmap);
-    for (i = 0, offset = 0; i < tab_size; ++i, offset += limit) {
-        uint64_t count = MIN(bm_size - offset, limit);
+    for (i = 0; i < tab_size; i += n) {
         uint64_t entry = bitmap_table[i];
         uint64_t data_offset = entry & BME_TABLE_ENTRY_OFFSET_MASK;
 
         assert(check_table_entry(entry, s->cluster_size) == 0);
 
+        n = 1;
+        offset = i * limit;
         if (data_offset == 0) {
             if (entry & BME_TABLE_ENTRY_FLAG_ALL_ONES) {
-                bdrv_dirty_bitmap_deserialize_ones(bitmap, offset, count,
+                bdrv_dirty_bitmap_deserialize_ones(bitmap, offset,
+                                                   MIN(bm_size - offset, limit),
                                                    false);
             } else {
                 /* No need to deserialize zeros because the dirty bitmap is
                  * already cleared */
             }
-        } else {
-            ret = bdrv_pread(bs->file, data_offset, buf, s->cluster_size);
-            if (ret < 0) {
-                goto finish;
-            }
-            bdrv_dirty_bitmap_deserialize_part(bitmap, buf, offset, count,
+            continue;
+        }
+
+        /* Read physically contiguous data clusters with a single request */
+        while (n < max_clusters && i + n < tab_size &&
+               (bitmap_table[i + n] & BME_TABLE_ENTRY_OFFSET_MASK) ==
+               data_offset + n * s->cluster_size)
+        {
+            assert(check_table_entry(bitmap_table[i + n],
+                                     s->cluster_size) == 0);
+            n++;
+        }
+
+        ret = bdrv_pread(bs->file, data_offset, buf, n * s->cluster_size);
+        if (ret < 0) {
+            goto finish;
+        }
+
+        for (j = 0; j < n; j++) {
+            offset = (i + j) * limit;
+            bdrv_dirty_bitmap_deserialize_part(bitmap,
+                                               buf + j * s->cluster_size,
+                                               offset,
+                                               MIN(bm_size - offset, limit),
                                                false);
         }
     }
@@ -369,6 +394,9 @@ static BdrvDirtyBitmap *load_bitmap(BlockDriverState *bs,
         goto fail;
     }
 
+    /* The image holds exactly what we have just loaded */
+    bdrv_dirty_bitmap_set_stored(bitmap, true);
+
     g_free(bitmap_table);
     return bitmap;
 
@@ -1593,16 +1621,24 @@ bool qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
             bm = g_new0(Qcow2Bitmap, 1);
             bm->name = g_strdup(name);
             QSIMPLEQ_INSERT_TAIL(bm_list, bm, entry);
+            bdrv_dirty_bitmap_set_stored(bitmap, false);
         } else {
             if (!(bm->flags & BME_FLAG_IN_USE)) {
                 error_setg(errp, "Bitmap '%s' already exists in the image",
                            name);
                 goto fail;
             }
-            tb = g_memdup(&bm->table, sizeof(bm->table));
-            bm->table.offset = 0;
-            bm->table.size = 0;
-            QSIMPLEQ_INSERT_TAIL(&drop_tables, tb, entry);
+            /*
+             * If the bitmap has not changed since it was loaded or last
+             * stored, its data in the image is still valid and only the
+             * directory entry needs to be rewritten.
+             */
+            if (!bdrv_dirty_bitmap_stored(bitmap)) {
+                tb = g_memdup(&bm->table, sizeof(bm->table));
+                bm->table.offset = 0;
+                bm->table.size = 0;
+                QSIMPLEQ_INSERT_TAIL(&drop_tables, tb, entry);
+            }
         }
         bm->flags = bdrv_dirty_bitmap_enabled(bitmap) ? BME_FLAG_AUTO : 0;
         bm->granularity_bits = ctz32(bdrv_dirty_bitmap_granularity(bitmap));
@@ -1622,7 +1658,9 @@ bool qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
         BdrvDirtyBitmap *bitmap = bm->dirty_bitmap;
 
-        if (bitmap == NULL || bdrv_dirty_bitmap_readonly(bitmap)) {
+        if (bitmap == NULL || bdrv_dirty_bitmap_readonly(bitmap) ||
+            bdrv_dirty_bitmap_stored(bitmap))
+        {
             continue;
         }
 
@@ -1645,6 +1683,14 @@ bool qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
         g_free(tb);
     }
 
+    QSIMPLEQ_FOREACH(bm, bm_list, entry) {
+        if (bm->dirty_bitmap != NULL &&
+            !bdrv_dirty_bitmap_readonly(bm->dirty_bitmap))
+        {
+            bdrv_dirty_bitmap_set_stored(bm->dirty_bitmap, true);
+        }
+    }
+
 success:
     if (release_stored) {
         QSIMPLEQ_FOREACH(bm, bm_list, entry) {
@@ -1662,7 +1708,8 @@ success:
 fail:
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
         if (bm->dirty_bitmap == NULL || bm->table.offset == 0 ||
-            bdrv_dirty_bitmap_readonly(bm->dirty_bitmap))
+            bdrv_dirty_bitmap_readonly(bm->dirty_bitmap) ||
+            bdrv_dirty_bitmap_stored(bm->dirty_bitmap))
         {
             continue;
         }
@@ -37,25 +37,30 @@
 #include "block/thread-pool.h"
 #include "crypto.h"
 
+/*
+ * Run @func in the thread pool, with at most @limit->max_threads jobs of
+ * this kind running at the same time.
+ */
 static int coroutine_fn
-qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg)
+qcow2_co_process(BlockDriverState *bs, ThreadPoolFunc *func, void *arg,
+                 Qcow2ThreadLimit *limit)
 {
     int ret;
     BDRVQcow2State *s = bs->opaque;
     ThreadPool *pool = aio_get_thread_pool(bdrv_get_aio_context(bs));
 
     qemu_co_mutex_lock(&s->lock);
-    while (s->nb_threads >= QCOW2_MAX_THREADS) {
-        qemu_co_queue_wait(&s->thread_task_queue, &s->lock);
+    while (limit->nb_threads >= limit->max_threads) {
+        qemu_co_queue_wait(&limit->queue, &s->lock);
     }
-    s->nb_threads++;
+    limit->nb_threads++;
     qemu_co_mutex_unlock(&s->lock);
 
     ret = thread_pool_submit_co(pool, func, arg);
 
     qemu_co_mutex_lock(&s->lock);
-    s->nb_threads--;
-    qemu_co_queue_next(&s->thread_task_queue);
+    limit->nb_threads--;
+    qemu_co_queue_next(&limit->queue);
     qemu_co_mutex_unlock(&s->lock);
 
     return ret;
@@ -339,6 +344,7 @@ static ssize_t coroutine_fn
 qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
                      const void *src, size_t src_size, Qcow2CompressFunc func)
 {
+    BDRVQcow2State *s = bs->opaque;
     Qcow2CompressData arg = {
         .dest = dest,
         .dest_size = dest_size,
@@ -347,7 +353,12 @@ qcow2_co_do_compress(BlockDriverState *bs, void *dest, size_t dest_size,
         .func = func,
     };
 
-    qcow2_co_process(bs, qcow2_compress_pool_func, &arg);
+    /*
+     * Compression does not share any per-thread state, so unlike encryption
+     * it may use as many threads as the host has CPUs.
+     */
+    qcow2_co_process(bs, qcow2_compress_pool_func, &arg,
+                     &s->compress_threads);
 
     return arg.ret;
 }
@@ -475,7 +486,9 @@ qcow2_co_encdec(BlockDriverState *bs, uint64_t host_offset,
     assert(QEMU_IS_ALIGNED(host_offset, sector_size));
     assert(QEMU_IS_ALIGNED(len, sector_size));
 
-    return len == 0 ? 0 : qcow2_co_process(bs, qcow2_encdec_pool_func, &arg);
+    /* The crypto block has one cipher per thread, QCOW2_MAX_THREADS in all */
+    return len == 0 ? 0 : qcow2_co_process(bs, qcow2_encdec_pool_func, &arg,
+                                           &s->crypto_threads);
 }
 
 /*
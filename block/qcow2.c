@@ -1832,7 +1832,12 @@ static int coroutine_fn qcow2_do_open(BlockDriverState *bs, QDict *options,
     }
 #endif
 
-    qemu_co_queue_init(&s->thread_task_queue);
+    qemu_co_queue_init(&s->crypto_threads.queue);
+    s->crypto_threads.max_threads = QCOW2_MAX_THREADS;
+    qemu_co_queue_init(&s->compress_threads.queue);
+    s->compress_threads.max_threads = MIN(MAX((int)g_get_num_processors(),
+                                              QCOW2_MAX_THREADS),
+                                          QCOW2_MAX_COMPRESS_THREADS);
 
     return ret;
 
@@ -4551,78 +4556,243 @@ fail:
     return ret;
 }
 
-static coroutine_fn int
-qcow2_co_pwritev_compressed_task(BlockDriverState *bs,
-                                 uint64_t offset, uint64_t bytes,
-                                 QEMUIOVector *qiov, size_t qiov_offset)
+/* One cluster of a batched compressed write */
+typedef struct Qcow2CompressedCluster {
+    uint8_t *buf;           /* uncompressed data, padded to the cluster size */
+    uint8_t *out_buf;
+    ssize_t out_len;        /* -ENOMEM if the data could not be compressed */
+    uint64_t host_offset;
+} Qcow2CompressedCluster;
+
+/*
+ * Up to QCOW2_COMPRESS_BATCH_SIZE bytes of guest data that are compressed
+ * together and then written out as one AioTask.
+ */
+typedef struct Qcow2CompressedBatch {
+    AioTask task;
+
+    BlockDriverState *bs;
+    uint64_t offset;
+    uint64_t bytes;
+    QEMUIOVector *qiov;
+    size_t qiov_offset;
+
+    int nb_clusters;
+    Qcow2CompressedCluster *clusters;
+} Qcow2CompressedBatch;
+
+typedef struct Qcow2CompressTask {
+    AioTask task;
+
+    BlockDriverState *bs;
+    Qcow2CompressedCluster *cluster;
+} Qcow2CompressTask;
+
+/* Free the buffers of @batch, but not @batch itself */
+static void qcow2_compressed_batch_free_clusters(Qcow2CompressedBatch *batch)
 {
-    BDRVQcow2State *s = bs->opaque;
-    int ret;
-    ssize_t out_len;
-    uint8_t *buf, *out_buf;
-    uint64_t cluster_offset;
+    int i;
 
-    assert(bytes == s->cluster_size || (bytes < s->cluster_size &&
-           (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS)));
+    for (i = 0; i < batch->nb_clusters; i++) {
+        qemu_vfree(batch->clusters[i].buf);
+        g_free(batch->clusters[i].out_buf);
+    }
+    g_free(batch->clusters);
+    batch->clusters = NULL;
+}
 
-    buf = qemu_blockalign(bs, s->cluster_size);
-    if (bytes < s->cluster_size) {
-        /* Zero-pad last write if image size is not cluster aligned */
-        memset(buf + bytes, 0, s->cluster_size - bytes);
+static coroutine_fn int qcow2_co_compress_task_entry(AioTask *task)
+{
+    Qcow2CompressTask *t = container_of(task, Qcow2CompressTask, task);
+    BDRVQcow2State *s = t->bs->opaque;
+    Qcow2CompressedCluster *c = t->cluster;
+
+    c->out_len = qcow2_co_compress(t->bs, c->out_buf, s->cluster_size - 1,
+                                   c->buf, s->cluster_size);
+    if (c->out_len < 0 && c->out_len != -ENOMEM) {
+        return -EINVAL;
     }
-    qemu_iovec_to_buf(qiov, qiov_offset, buf, bytes);
 
-    out_buf = g_malloc(s->cluster_size);
+    return 0;
+}
 
-    out_len = qcow2_co_compress(bs, out_buf, s->cluster_size - 1,
-                                buf, s->cluster_size);
-    if (out_len == -ENOMEM) {
-        /* could not compress: write normal cluster */
-        ret = qcow2_co_pwritev_part(bs, offset, bytes, qiov, qiov_offset, 0);
-        if (ret < 0) {
-            goto fail;
+/*
+ * Compress all clusters of @batch in parallel, then allocate host space
+ * for them in one go, so that the compressed data of consecutive clusters
+ * is usually adjacent in the image file and can be written with a single
+ * request.
+ */
+static coroutine_fn int qcow2_co_compress_batch(Qcow2CompressedBatch *batch)
+{
+    BlockDriverState *bs = batch->bs;
+    BDRVQcow2State *s = bs->opaque;
+    int i, ret;
+
+    if (batch->nb_clusters == 1) {
+        Qcow2CompressTask task = {
+            .bs = bs,
+            .cluster = &batch->clusters[0],
+        };
+
+        ret = qcow2_co_compress_task_entry(&task.task);
+    } else {
+        AioTaskPool *aio = aio_task_pool_new(
+            MIN(batch->nb_clusters, s->compress_threads.max_threads));
+
+        for (i = 0; i < batch->nb_clusters; i++) {
+            Qcow2CompressTask *task = g_new(Qcow2CompressTask, 1);
+
+            *task = (Qcow2CompressTask) {
+                .task.func = qcow2_co_compress_task_entry,
+                .bs = bs,
+                .cluster = &batch->clusters[i],
+            };
+            aio_task_pool_start_task(aio, &task->task);
         }
-        goto success;
-    } else if (out_len < 0) {
-        ret = -EINVAL;
-        goto fail;
-    }
 
-    qemu_co_mutex_lock(&s->lock);
-    ret = qcow2_alloc_compressed_cluster_offset(bs, offset, out_len,
-                                                &cluster_offset);
+        aio_task_pool_wait_all(aio);
+        ret = aio_task_pool_status(aio);
+        g_free(aio);
+    }
     if (ret < 0) {
-        qemu_co_mutex_unlock(&s->lock);
-        goto fail;
+        return ret;
     }
 
-    ret = qcow2_pre_write_overlap_check(bs, 0, cluster_offset, out_len, true);
+    qemu_co_mutex_lock(&s->lock);
+    for (i = 0; i < batch->nb_clusters; i++) {
+        Qcow2CompressedCluster *c = &batch->clusters[i];
+
+        if (c->out_len < 0) {
+            continue;
+        }
+
+        ret = qcow2_alloc_compressed_cluster_offset(bs,
+                                                    batch->offset +
+                                                    i * s->cluster_size,
+                                                    c->out_len,
+                                                    &c->host_offset);
+        if (ret < 0) {
+            break;
+        }
+
+        ret = qcow2_pre_write_overlap_check(bs, 0, c->host_offset, c->out_len,
+                                            true);
+        if (ret < 0) {
+            break;
+        }
+    }
     qemu_co_mutex_unlock(&s->lock);
-    if (ret < 0) {
-        goto fail;
+
+    return ret;
+}
+
+/*
+ * Write a batch that qcow2_co_compress_batch() has prepared and free its
+ * buffers.
+ */
+static coroutine_fn int qcow2_co_write_compressed_batch_entry(AioTask *task)
+{
+    Qcow2CompressedBatch *batch = container_of(task, Qcow2CompressedBatch,
+                                               task);
+    BDRVQcow2State *s = batch->bs->opaque;
+    Qcow2CompressedCluster *clusters = batch->clusters;
+    int nb_clusters = batch->nb_clusters;
+    QEMUIOVector hd_qiov;
+    int i, j, ret = 0;
+
+    /* Clusters that could not be compressed are written as normal clusters */
+    for (i = 0; i < nb_clusters; i++) {
+        if (clusters[i].out_len == -ENOMEM) {
+            ret = qcow2_co_pwritev_part(batch->bs,
+                                        batch->offset + i * s->cluster_size,
+                                        MIN(batch->bytes - i * s->cluster_size,
+                                            s->cluster_size),
+                                        batch->qiov,
+                                        batch->qiov_offset +
+                                        i * s->cluster_size, 0);
+            if (ret < 0) {
+                goto out;
+            }
+        }
     }
 
-    BLKDBG_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
-    ret = bdrv_co_pwrite(s->data_file, cluster_offset, out_len, out_buf, 0);
-    if (ret < 0) {
-        goto fail;
+    qemu_iovec_init(&hd_qiov, nb_clusters);
+    for (i = 0; i < nb_clusters; i = j) {
+        Qcow2CompressedCluster *c = &clusters[i];
+
+        j = i + 1;
+        if (c->out_len < 0) {
+            continue;
+        }
+
+        qemu_iovec_reset(&hd_qiov);
+        qemu_iovec_add(&hd_qiov, c->out_buf, c->out_len);
+        while (j < nb_clusters && clusters[j].out_len >= 0 &&
+               clusters[j].host_offset ==
+               clusters[j - 1].host_offset + clusters[j - 1].out_len)
+        {
+            qemu_iovec_add(&hd_qiov, clusters[j].out_buf, clusters[j].out_len);
+            j++;
+        }
+
+        trace_qcow2_writev_compressed(qemu_coroutine_self(), c->host_offset,
+                                      j - i, hd_qiov.size);
+        BLKDBG_EVENT(s->data_file, BLKDBG_WRITE_COMPRESSED);
+        ret = bdrv_co_pwritev(s->data_file, c->host_offset, hd_qiov.size,
+                              &hd_qiov, 0);
+        if (ret < 0) {
+            break;
+        }
     }
-success:
-    ret = 0;
-fail:
-    qemu_vfree(buf);
-    g_free(out_buf);
+    qemu_iovec_destroy(&hd_qiov);
+
+out:
+    qcow2_compressed_batch_free_clusters(batch);
     return ret;
 }
 
-static coroutine_fn int qcow2_co_pwritev_compressed_task_entry(AioTask *task)
+static Qcow2CompressedBatch *
+qcow2_compressed_batch_new(BlockDriverState *bs, uint64_t offset,
+                           uint64_t bytes, QEMUIOVector *qiov,
+                           size_t qiov_offset)
 {
-    Qcow2AioTask *t = container_of(task, Qcow2AioTask, task);
+    BDRVQcow2State *s = bs->opaque;
+    Qcow2CompressedBatch *batch = g_new(Qcow2CompressedBatch, 1);
+    int i;
+
+    assert(bytes > 0 && bytes <= MAX(QCOW2_COMPRESS_BATCH_SIZE,
+                                     s->cluster_size));
+
+    *batch = (Qcow2CompressedBatch) {
+        .task.func = qcow2_co_write_compressed_batch_entry,
+        .bs = bs,
+        .offset = offset,
+        .bytes = bytes,
+        .qiov = qiov,
+        .qiov_offset = qiov_offset,
+        .nb_clusters = size_to_clusters(s, bytes),
+    };
+
+    assert(bytes == (uint64_t)batch->nb_clusters * s->cluster_size ||
+           (offset + bytes == bs->total_sectors << BDRV_SECTOR_BITS));
 
-    assert(!t->subcluster_type && !t->l2meta);
+    batch->clusters = g_new0(Qcow2CompressedCluster, batch->nb_clusters);
+    for (i = 0; i < batch->nb_clusters; i++) {
+        Qcow2CompressedCluster *c = &batch->clusters[i];
+        uint64_t chunk_size = MIN(bytes - i * s->cluster_size,
+                                  s->cluster_size);
+
+        c->buf = qemu_blockalign(bs, s->cluster_size);
+        if (chunk_size < s->cluster_size) {
+            /* Zero-pad last write if image size is not cluster aligned */
+            memset(c->buf + chunk_size, 0, s->cluster_size - chunk_size);
+        }
+        qemu_iovec_to_buf(qiov, qiov_offset + i * s->cluster_size,
+                          c->buf, chunk_size);
+        c->out_buf = g_malloc(s->cluster_size);
+    }
 
-    return qcow2_co_pwritev_compressed_task(t->bs, t->offset, t->bytes, t->qiov,
-                                            t->qiov_offset);
+    return batch;
 }
 
 /*
@@ -4636,6 +4806,7 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
 {
     BDRVQcow2State *s = bs->opaque;
     AioTaskPool *aio = NULL;
+    uint64_t batch_size;
     int ret = 0;
 
     if (has_data_file(bs)) {
@@ -4664,18 +4835,39 @@ qcow2_co_pwritev_compressed_part(BlockDriverState *bs,
         return -EINVAL;
     }
 
+    /*
+     * Batch N + 1 is compressed while batch N is being written. The pool
+     * has room for a single write, so starting the write of a batch waits
+     * for the one before.
+     */
+    batch_size = MAX(QCOW2_COMPRESS_BATCH_SIZE, s->cluster_size);
     while (bytes && aio_task_pool_status(aio) == 0) {
-        uint64_t chunk_size = MIN(bytes, s->cluster_size);
+        uint64_t chunk_size = MIN(bytes, batch_size);
+        Qcow2CompressedBatch *batch;
 
         if (!aio && chunk_size != bytes) {
-            aio = aio_task_pool_new(QCOW2_MAX_WORKERS);
+            aio = aio_task_pool_new(1);
         }
 
-        ret = qcow2_add_task(bs, aio, qcow2_co_pwritev_compressed_task_entry,
-                             0, 0, offset, chunk_size, qiov, qiov_offset, NULL);
+        batch = qcow2_compressed_batch_new(bs, offset, chunk_size,
+                                           qiov, qiov_offset);
+        ret = qcow2_co_compress_batch(batch);
         if (ret < 0) {
+            qcow2_compressed_batch_free_clusters(batch);
+            g_free(batch);
             break;
         }
+
+        if (aio) {
+            aio_task_pool_start_task(aio, &batch->task);
+        } else {
+            ret = qcow2_co_write_compressed_batch_entry(&batch->task);
+            g_free(batch);
+            if (ret < 0) {
+                break;
+            }
+        }
+
         qiov_offset += chunk_size;
         offset += chunk_size;
         bytes -= chunk_size;
@@ -71,6 +71,9 @@
 /* Maximum of parallel sub-request per guest request */
 #define QCOW2_MAX_WORKERS 8
 
+/* Maximum amount of guest data compressed and written out together */
+#define QCOW2_COMPRESS_BATCH_SIZE (4 * MiB)
+
 /* indicate that the refcount of the referenced cluster is exactly one. */
 #define QCOW_OFLAG_COPIED     (1ULL << 63)
 /* indicate that the cluster is compressed (they never have the copied flag) */
@@ -322,6 +325,18 @@ typedef struct Qcow2BitmapHeaderExt {
 } QEMU_PACKED Qcow2BitmapHeaderExt;
 
 #define QCOW2_MAX_THREADS 4
+/* Upper limit for concurrent (de)compression jobs of one image */
+#define QCOW2_MAX_COMPRESS_THREADS 64
+
+/*
+ * Concurrent thread pool jobs of one kind. Each kind has its own queue so
+ * that a finished job always wakes a waiter that may run under its limit.
+ */
+typedef struct Qcow2ThreadLimit {
+    CoQueue queue;
+    int nb_threads;
+    int max_threads;
+} Qcow2ThreadLimit;
 
 typedef struct BDRVQcow2State {
     int cluster_bits;
@@ -405,8 +420,8 @@ typedef struct BDRVQcow2State {
     char *image_backing_format;
     char *image_data_file;
 
-    CoQueue thread_task_queue;
-    int nb_threads;
+    Qcow2ThreadLimit crypto_threads;
+    Qcow2ThreadLimit compress_threads;
 
     BdrvChild *data_file;
 
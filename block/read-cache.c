@@ -0,0 +1,560 @@
+/*
+ * read-cache filter driver
+ *
+ * The driver keeps a persistent copy of the data read from its file child
+ * in a local, sparse cache image.  Regions allocated in the cache image are
+ * served from there, everything else is read from the file child and then
+ * stored in the cache image.
+ *
+ * Before a request modifies the file child, the affected range is discarded
+ * in the cache image and the cache image is flushed.  Neither a failed
+ * request nor a crash can therefore leave the old data in the cache image,
+ * at the price of one cache image flush per write.  Writes of whole granules
+ * are stored in the cache image again after the file child was updated.
+ *
+ * The cache image is keyed by guest offset: data at offset X of the file
+ * child is cached at offset X of the cache image.  It is only ever valid for
+ * the file child it was populated from.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/host-utils.h"
+#include "qemu/module.h"
+#include "qemu/option.h"
+#include "qemu/units.h"
+#include "block/block_int.h"
+#include "trace.h"
+
+/* Largest amount of data moved between the children with one bounce buffer */
+#define READ_CACHE_MAX_BOUNCE (1 * MiB)
+
+typedef struct BDRVReadCacheState {
+    BdrvChild *cache_file;
+
+    /*
+     * Cache fills are done in units of @granularity, so that a cluster
+     * allocated in @cache_file always holds valid data in its entirety.
+     */
+    int64_t granularity;
+
+    /*
+     * Readers (including cache fills) take the lock shared, anything that
+     * modifies the file child takes it exclusive, so that no fill can store
+     * stale data after a write has updated the cache.
+     */
+    CoRwlock lock;
+
+    /*
+     * Set once updating @cache_file failed.  From then on its contents cannot
+     * be trusted and all requests bypass it.  @cache_file is emptied, so that
+     * it is not trusted when it is opened again either.
+     */
+    bool failed;
+
+    /*
+     * Set if emptying @cache_file failed as well.  The file child must then
+     * not be modified any more, @cache_file would still hold the old data.
+     */
+    bool stale;
+} BDRVReadCacheState;
+
+#define READ_CACHE_OPT_CACHE_FILE "cache-file"
+#define READ_CACHE_OPT_GRANULARITY "granularity"
+static QemuOptsList runtime_opts = {
+    .name = "read-cache",
+    .head = QTAILQ_HEAD_INITIALIZER(runtime_opts.head),
+    .desc = {
+        {
+            .name = READ_CACHE_OPT_GRANULARITY,
+            .type = QEMU_OPT_SIZE,
+            .help = "unit of cache fills, default 64k or the cluster size "
+                    "of the cache file if larger",
+        },
+        { /* end of list */ }
+    },
+};
+
+static int read_cache_open(BlockDriverState *bs, QDict *options, int flags,
+                           Error **errp)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    BlockDriverInfo bdi;
+    QemuOpts *opts;
+    int64_t file_len, cache_len, min_granularity;
+
+    bs->file = bdrv_open_child(NULL, options, "file", bs, &child_of_bds,
+                               BDRV_CHILD_FILTERED | BDRV_CHILD_PRIMARY,
+                               false, errp);
+    if (!bs->file) {
+        return -EINVAL;
+    }
+
+    /*
+     * The filter is typically used read-only (e.g. as a backing file), but
+     * the cache image always needs to be writable.  This only applies to
+     * a cache image opened here, not to a reference to an existing node.
+     */
+    if (!qdict_haskey(options, READ_CACHE_OPT_CACHE_FILE)) {
+        qdict_set_default_str(options,
+                              READ_CACHE_OPT_CACHE_FILE "." BDRV_OPT_READ_ONLY,
+                              "off");
+    }
+    s->cache_file = bdrv_open_child(NULL, options, READ_CACHE_OPT_CACHE_FILE,
+                                    bs, &child_of_bds, BDRV_CHILD_DATA,
+                                    false, errp);
+    if (!s->cache_file) {
+        return -EINVAL;
+    }
+
+    opts = qemu_opts_create(&runtime_opts, NULL, 0, &error_abort);
+    if (!qemu_opts_absorb_qdict(opts, options, errp)) {
+        qemu_opts_del(opts);
+        return -EINVAL;
+    }
+
+    /*
+     * A fill must cover whole clusters of the cache image, or the part of a
+     * newly allocated cluster that was not filled would be reported as
+     * cached data and read back as zeroes.  Formats without clusters, like
+     * raw, allocate in blocks of the host filesystem.  Their size is not
+     * known here, but common filesystems do not use blocks larger than the
+     * host page size.
+     */
+    min_granularity = MAX(s->cache_file->bs->bl.request_alignment,
+                          qemu_real_host_page_size);
+    if (bdrv_get_info(s->cache_file->bs, &bdi) == 0) {
+        min_granularity = MAX(min_granularity, bdi.cluster_size);
+    }
+
+    s->granularity = qemu_opt_get_size(opts, READ_CACHE_OPT_GRANULARITY,
+                                       MAX(64 * KiB, min_granularity));
+    qemu_opts_del(opts);
+
+    if (s->granularity < BDRV_SECTOR_SIZE || s->granularity > 64 * MiB ||
+        !is_power_of_2(s->granularity)) {
+        error_setg(errp, "granularity of read-cache filter must be a power "
+                   "of 2 between %llu and %llu", BDRV_SECTOR_SIZE, 64 * MiB);
+        return -EINVAL;
+    }
+    if (s->granularity < min_granularity) {
+        error_setg(errp, "granularity of read-cache filter must not be "
+                   "smaller than the cluster size of the cache file (%"
+                   PRId64 " bytes)", min_granularity);
+        return -EINVAL;
+    }
+
+    file_len = bdrv_getlength(bs->file->bs);
+    if (file_len < 0) {
+        error_setg_errno(errp, -file_len, "Could not get file child length");
+        return file_len;
+    }
+    cache_len = bdrv_getlength(s->cache_file->bs);
+    if (cache_len < 0) {
+        error_setg_errno(errp, -cache_len, "Could not get cache file length");
+        return cache_len;
+    }
+    if (cache_len == 0 && file_len > 0 &&
+        !bdrv_is_read_only(s->cache_file->bs) &&
+        !(bs->open_flags & BDRV_O_INACTIVE)) {
+        /* Emptied after an error, or newly created: start from scratch */
+        int ret = bdrv_truncate(s->cache_file, file_len, false,
+                                PREALLOC_MODE_OFF, 0, errp);
+        if (ret < 0) {
+            error_prepend(errp, "Could not resize empty cache file: ");
+            return ret;
+        }
+        cache_len = file_len;
+    }
+    if (cache_len < file_len) {
+        error_setg(errp, "Cache file is smaller than the file child "
+                   "(%" PRId64 " < %" PRId64 " bytes)", cache_len, file_len);
+        return -EINVAL;
+    }
+
+    qemu_co_rwlock_init(&s->lock);
+
+    bs->supported_write_flags = BDRV_REQ_WRITE_UNCHANGED |
+        (BDRV_REQ_FUA & bs->file->bs->supported_write_flags);
+
+    bs->supported_zero_flags = BDRV_REQ_WRITE_UNCHANGED |
+        ((BDRV_REQ_FUA | BDRV_REQ_MAY_UNMAP | BDRV_REQ_NO_FALLBACK) &
+            bs->file->bs->supported_zero_flags);
+
+    return 0;
+}
+
+static void coroutine_fn read_cache_set_failed(BlockDriverState *bs, int ret)
+{
+    BDRVReadCacheState *s = bs->opaque;
+
+    trace_read_cache_failed(bs, ret);
+    if (s->failed) {
+        return;
+    }
+
+    error_report("read-cache: disabling cache of '%s' after error: %s",
+                 bdrv_get_device_or_node_name(bs), strerror(-ret));
+    s->failed = true;
+
+    /* The cache image may hold stale or partially written data now */
+    ret = bdrv_co_truncate(s->cache_file, 0, false, PREALLOC_MODE_OFF, 0,
+                           NULL);
+    if (ret == 0) {
+        ret = bdrv_co_flush(s->cache_file->bs);
+    }
+    if (ret < 0) {
+        error_report("read-cache: could not empty cache image of '%s', "
+                     "refusing writes: %s",
+                     bdrv_get_device_or_node_name(bs), strerror(-ret));
+        s->stale = true;
+    }
+}
+
+/*
+ * Read [offset, offset + bytes) from the file child into @qiov and store the
+ * surrounding granularity-aligned region in the cache image.  Failing to
+ * update the cache does not fail the read.
+ */
+static int coroutine_fn read_cache_fill(BlockDriverState *bs,
+                                        int64_t offset, int64_t bytes,
+                                        QEMUIOVector *qiov,
+                                        size_t qiov_offset)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int64_t align_offset = QEMU_ALIGN_DOWN(offset, s->granularity);
+    int64_t align_end = QEMU_ALIGN_UP(offset + bytes, s->granularity);
+    int64_t file_len;
+    QEMUIOVector local_qiov;
+    void *buf;
+    int ret;
+
+    file_len = bdrv_getlength(bs->file->bs);
+    if (file_len >= 0) {
+        align_end = MIN(align_end, MAX(file_len, offset + bytes));
+    }
+
+    buf = qemu_try_blockalign(bs, align_end - align_offset);
+    if (!buf) {
+        return bdrv_co_preadv_part(bs->file, offset, bytes, qiov, qiov_offset,
+                                   0);
+    }
+
+    trace_read_cache_fill(bs, align_offset, align_end - align_offset);
+    qemu_iovec_init_buf(&local_qiov, buf, align_end - align_offset);
+    ret = bdrv_co_preadv(bs->file, align_offset, align_end - align_offset,
+                         &local_qiov, 0);
+    if (ret < 0) {
+        goto out;
+    }
+
+    qemu_iovec_from_buf(qiov, qiov_offset,
+                        (uint8_t *)buf + (offset - align_offset), bytes);
+
+    if (!s->failed) {
+        int cache_ret = bdrv_co_pwritev(s->cache_file, align_offset,
+                                        align_end - align_offset,
+                                        &local_qiov, 0);
+        if (cache_ret < 0) {
+            read_cache_set_failed(bs, cache_ret);
+        }
+    }
+
+out:
+    qemu_vfree(buf);
+    return ret;
+}
+
+static coroutine_fn int read_cache_co_preadv_part(
+        BlockDriverState *bs, int64_t offset, int64_t bytes,
+        QEMUIOVector *qiov, size_t qiov_offset, BdrvRequestFlags flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int ret = 0;
+
+    qemu_co_rwlock_rdlock(&s->lock);
+    while (bytes) {
+        int64_t n = bytes;
+
+        if (s->failed) {
+            ret = bdrv_co_preadv_part(bs->file, offset, bytes, qiov,
+                                      qiov_offset, 0);
+            break;
+        }
+
+        ret = bdrv_block_status(s->cache_file->bs, offset, bytes, &n,
+                                NULL, NULL);
+        if (ret < 0 || n == 0) {
+            /* Beyond the end of the cache image, or it is unusable */
+            ret = bdrv_co_preadv_part(bs->file, offset, bytes, qiov,
+                                      qiov_offset, 0);
+            break;
+        }
+
+        if (ret & BDRV_BLOCK_DATA) {
+            trace_read_cache_hit(bs, offset, n);
+            ret = bdrv_co_preadv_part(s->cache_file, offset, n, qiov,
+                                      qiov_offset, 0);
+            if (ret < 0) {
+                read_cache_set_failed(bs, ret);
+                continue;
+            }
+        } else {
+            n = MIN(n, READ_CACHE_MAX_BOUNCE);
+            trace_read_cache_miss(bs, offset, n);
+            ret = read_cache_fill(bs, offset, n, qiov, qiov_offset);
+            if (ret < 0) {
+                break;
+            }
+        }
+
+        offset += n;
+        qiov_offset += n;
+        bytes -= n;
+    }
+    qemu_co_rwlock_unlock(&s->lock);
+
+    return ret;
+}
+
+/*
+ * Discard the granularity-aligned region around [offset, offset + bytes) in
+ * the cache image and flush it, before the file child is modified.
+ * Called with s->lock held exclusively.
+ */
+static int coroutine_fn read_cache_invalidate(BlockDriverState *bs,
+                                              int64_t offset, int64_t bytes)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int64_t end = QEMU_ALIGN_UP(offset + bytes, s->granularity);
+    int64_t cache_len, pos, n;
+    int ret;
+
+    if (s->stale) {
+        return -EIO;
+    }
+    if (s->failed) {
+        return 0;
+    }
+
+    cache_len = bdrv_getlength(s->cache_file->bs);
+    if (cache_len < 0) {
+        ret = cache_len;
+        goto fail;
+    }
+    offset = QEMU_ALIGN_DOWN(offset, s->granularity);
+    end = MIN(end, cache_len);
+    if (offset >= end) {
+        return 0;
+    }
+
+    trace_read_cache_invalidate(bs, offset, end - offset);
+    ret = bdrv_co_pdiscard(s->cache_file, offset, end - offset);
+    if (ret < 0) {
+        goto fail;
+    }
+
+    /* A discard may be ignored, check that nothing is left */
+    for (pos = offset; pos < end; pos += n) {
+        ret = bdrv_block_status(s->cache_file->bs, pos, end - pos, &n,
+                                NULL, NULL);
+        if (ret < 0) {
+            goto fail;
+        }
+        if (n == 0) {
+            break;
+        }
+        if (ret & BDRV_BLOCK_DATA) {
+            ret = -ENOTSUP;
+            goto fail;
+        }
+    }
+
+    ret = bdrv_co_flush(s->cache_file->bs);
+    if (ret < 0) {
+        goto fail;
+    }
+    return 0;
+
+fail:
+    read_cache_set_failed(bs, ret);
+    return s->stale ? ret : 0;
+}
+
+static coroutine_fn int read_cache_co_pwritev_part(BlockDriverState *bs,
+                                                   int64_t offset,
+                                                   int64_t bytes,
+                                                   QEMUIOVector *qiov,
+                                                   size_t qiov_offset,
+                                                   BdrvRequestFlags flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int ret;
+
+    qemu_co_rwlock_wrlock(&s->lock);
+    if (!(flags & BDRV_REQ_WRITE_UNCHANGED)) {
+        ret = read_cache_invalidate(bs, offset, bytes);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
+    ret = bdrv_co_pwritev_part(bs->file, offset, bytes, qiov, qiov_offset,
+                               flags);
+    if (ret < 0 || s->failed || (flags & BDRV_REQ_WRITE_UNCHANGED)) {
+        goto out;
+    }
+
+    if (QEMU_IS_ALIGNED(offset | bytes, s->granularity)) {
+        /* Whole granules are written, so they can be cached right away */
+        int cache_ret = bdrv_co_pwritev_part(s->cache_file, offset, bytes,
+                                             qiov, qiov_offset, 0);
+        if (cache_ret < 0) {
+            read_cache_set_failed(bs, cache_ret);
+        }
+    }
+
+out:
+    qemu_co_rwlock_unlock(&s->lock);
+    return ret;
+}
+
+static int coroutine_fn read_cache_co_pwrite_zeroes(BlockDriverState *bs,
+        int64_t offset, int64_t bytes, BdrvRequestFlags flags)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int ret;
+
+    qemu_co_rwlock_wrlock(&s->lock);
+    if (!(flags & BDRV_REQ_WRITE_UNCHANGED)) {
+        ret = read_cache_invalidate(bs, offset, bytes);
+        if (ret < 0) {
+            goto out;
+        }
+    }
+
+    ret = bdrv_co_pwrite_zeroes(bs->file, offset, bytes, flags);
+
+out:
+    qemu_co_rwlock_unlock(&s->lock);
+    return ret;
+}
+
+static int coroutine_fn read_cache_co_pdiscard(BlockDriverState *bs,
+                                               int64_t offset, int64_t bytes)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int ret;
+
+    qemu_co_rwlock_wrlock(&s->lock);
+    ret = read_cache_invalidate(bs, offset, bytes);
+    if (ret == 0) {
+        ret = bdrv_co_pdiscard(bs->file, offset, bytes);
+    }
+    qemu_co_rwlock_unlock(&s->lock);
+
+    return ret;
+}
+
+static int coroutine_fn read_cache_co_flush(BlockDriverState *bs)
+{
+    BDRVReadCacheState *s = bs->opaque;
+    int ret;
+
+    ret = bdrv_co_flush(bs->file->bs);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (!s->failed) {
+        int cache_ret = bdrv_co_flush(s->cache_file->bs);
+        if (cache_ret < 0) {
+            read_cache_set_failed(bs, cache_ret);
+        }
+    }
+    return 0;
+}
+
+static int64_t read_cache_getlength(BlockDriverState *bs)
+{
+    return bdrv_getlength(bs->file->bs);
+}
+
+static void read_cache_refresh_filename(BlockDriverState *bs)
+{
+    pstrcpy(bs->exact_filename, sizeof(bs->exact_filename),
+            bs->file->bs->filename);
+}
+
+static void read_cache_child_perm(BlockDriverState *bs, BdrvChild *c,
+                                  BdrvChildRole role,
+                                  BlockReopenQueue *reopen_queue,
+                                  uint64_t perm, uint64_t shared,
+                                  uint64_t *nperm, uint64_t *nshared)
+{
+    if (!(role & BDRV_CHILD_FILTERED)) {
+        /*
+         * Cache image
+         *
+         * Nobody else may change it behind our back.  We must not request
+         * write permissions for an inactive node, the child cannot provide
+         * it.
+         */
+        *nperm = BLK_PERM_CONSISTENT_READ;
+        if (!(bs->open_flags & BDRV_O_INACTIVE)) {
+            *nperm |= BLK_PERM_WRITE | BLK_PERM_RESIZE;
+        }
+        *nshared = BLK_PERM_ALL & ~(BLK_PERM_WRITE | BLK_PERM_RESIZE);
+    } else {
+        /* Filtered child */
+        bdrv_default_perms(bs, c, role, reopen_queue,
+                           perm, shared, nperm, nshared);
+
+        /* Writes that bypass this node would make the cache stale */
+        *nshared &= ~(BLK_PERM_WRITE | BLK_PERM_RESIZE);
+    }
+}
+
+static BlockDriver bdrv_read_cache_filter = {
+    .format_name = "read-cache",
+    .instance_size = sizeof(BDRVReadCacheState),
+
+    .bdrv_open = read_cache_open,
+    .bdrv_getlength = read_cache_getlength,
+
+    .bdrv_co_preadv_part = read_cache_co_preadv_part,
+    .bdrv_co_pwritev_part = read_cache_co_pwritev_part,
+    .bdrv_co_pwrite_zeroes = read_cache_co_pwrite_zeroes,
+    .bdrv_co_pdiscard = read_cache_co_pdiscard,
+    .bdrv_co_flush = read_cache_co_flush,
+
+    .bdrv_refresh_filename = read_cache_refresh_filename,
+
+    .bdrv_child_perm = read_cache_child_perm,
+
+    .is_filter = true,
+};
+
+static void bdrv_read_cache_init(void)
+{
+    bdrv_register(&bdrv_read_cache_filter);
+}
+
+block_init(bdrv_read_cache_init);
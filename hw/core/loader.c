@@ -861,6 +861,8 @@ struct Rom {
     char *fw_dir;
     char *fw_file;
     GMappedFile *mapped_file;
+    /* data points to a read-only mapping, see rom_unshare_data() */
+    bool data_readonly;
 
     bool committed;
 
@@ -885,6 +887,25 @@ static void rom_free_data(Rom *rom)
     }
 
     rom->data = NULL;
+    rom->data_readonly = false;
+}
+
+/*
+ * Replace a read-only mapping of the ROM file with a private copy, before
+ * handing out a pointer that callers may use to patch the data.
+ */
+static void rom_unshare_data(Rom *rom)
+{
+    uint8_t *data;
+
+    if (!rom->data_readonly) {
+        return;
+    }
+
+    data = g_malloc(rom->datasize);
+    memcpy(data, rom->data, rom->datasize);
+    rom_free_data(rom);
+    rom->data = data;
 }
 
 static void rom_free(Rom *rom)
@@ -961,7 +982,7 @@ int rom_add_file(const char *file, const char *fw_dir,
 {
     MachineClass *mc = MACHINE_GET_CLASS(qdev_get_machine());
     Rom *rom;
-    int rc, fd = -1;
+    GError *gerr = NULL;
     char devpath[100];
 
     if (as && mr) {
@@ -979,10 +1000,16 @@ int rom_add_file(const char *file, const char *fw_dir,
         rom->path = g_strdup(file);
     }
 
-    fd = open(rom->path, O_RDONLY | O_BINARY);
-    if (fd == -1) {
-        fprintf(stderr, "Could not open option rom '%s': %s\n",
-                rom->path, strerror(errno));
+    /*
+     * Map the image instead of reading it, so that pages are only faulted in
+     * when the ROM is copied into guest memory or fw_cfg.  The mapping is
+     * read-only: a writable one would need the file to be opened O_RDWR.
+     * Boards patching the data through rom_ptr() get a copy.
+     */
+    rom->mapped_file = g_mapped_file_new(rom->path, false, &gerr);
+    if (!rom->mapped_file) {
+        fprintf(stderr, "Could not open option rom: %s\n", gerr->message);
+        g_error_free(gerr);
         goto err;
     }
 
@@ -991,23 +1018,10 @@ int rom_add_file(const char *file, const char *fw_dir,
         rom->fw_file = g_strdup(file);
     }
     rom->addr     = addr;
-    rom->romsize  = lseek(fd, 0, SEEK_END);
-    if (rom->romsize == -1) {
-        fprintf(stderr, "rom: file %-20s: get size error: %s\n",
-                rom->name, strerror(errno));
-        goto err;
-    }
-
+    rom->romsize  = g_mapped_file_get_length(rom->mapped_file);
     rom->datasize = rom->romsize;
-    rom->data     = g_malloc0(rom->datasize);
-    lseek(fd, 0, SEEK_SET);
-    rc = read(fd, rom->data, rom->datasize);
-    if (rc != rom->datasize) {
-        fprintf(stderr, "rom: file %-20s: read error: rc=%d (expected %zd)\n",
-                rom->name, rc, rom->datasize);
-        goto err;
-    }
-    close(fd);
+    rom->data     = (uint8_t *)g_mapped_file_get_contents(rom->mapped_file);
+    rom->data_readonly = true;
     rom_insert(rom);
     if (rom->fw_file && fw_cfg) {
         const char *basename;
@@ -1027,6 +1041,8 @@ int rom_add_file(const char *file, const char *fw_dir,
         if ((!option_rom || mc->option_rom_has_mr) && mc->rom_file_has_mr) {
             data = rom_set_mr(rom, OBJECT(fw_cfg), devpath, true);
         } else {
+            /* fw_cfg keeps the pointer, which must see later patches */
+            rom_unshare_data(rom);
             data = rom->data;
         }
 
@@ -1044,9 +1060,6 @@ int rom_add_file(const char *file, const char *fw_dir,
     return 0;
 
 err:
-    if (fd != -1)
-        close(fd);
-
     rom_free(rom);
     return -1;
 }
@@ -1396,6 +1409,7 @@ void *rom_ptr(hwaddr addr, size_t size)
     rom = find_rom(addr, size);
     if (!rom || !rom->data)
         return NULL;
+    rom_unshare_data(rom);
     return rom->data + (addr - rom->addr);
 }
 
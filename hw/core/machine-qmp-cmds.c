@@ -67,6 +67,11 @@ CpuInfoFastList *qmp_query_cpus_fast(Error **errp)
             cpustate_to_cpuinfo_s390(&value->u.s390x, cpu);
         }
 
+        if (kvm_enabled() && kvm_dirty_ring_enabled()) {
+            value->has_dirty_pages = true;
+            value->dirty_pages = cpu->dirty_pages;
+        }
+
         QAPI_LIST_APPEND(tail, value);
     }
 
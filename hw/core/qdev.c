@@ -33,6 +33,7 @@
 #include "qapi/visitor.h"
 #include "qemu/error-report.h"
 #include "qemu/option.h"
+#include "qemu/timer.h"
 #include "hw/hotplug.h"
 #include "hw/irq.h"
 #include "hw/qdev-properties.h"
@@ -1144,15 +1145,42 @@ Object *qdev_get_machine(void)
 
 static MachineInitPhase machine_phase;
 
+/* Monotonic clock when initialization and the current phase started */
+static int64_t machine_init_start_ns;
+static int64_t machine_phase_start_ns;
+
+static const char *const machine_phase_names[] = {
+    [PHASE_NO_MACHINE] = "no-machine",
+    [PHASE_MACHINE_CREATED] = "machine-created",
+    [PHASE_ACCEL_CREATED] = "accel-created",
+    [PHASE_MACHINE_INITIALIZED] = "machine-initialized",
+    [PHASE_MACHINE_READY] = "machine-ready",
+};
+
 bool phase_check(MachineInitPhase phase)
 {
     return machine_phase >= phase;
 }
 
+void phase_start(void)
+{
+    assert(machine_phase == PHASE_NO_MACHINE);
+    machine_init_start_ns = machine_phase_start_ns = get_clock();
+}
+
 void phase_advance(MachineInitPhase phase)
 {
+    int64_t now = get_clock();
+
     assert(machine_phase == phase - 1);
+    trace_phase_advance(machine_phase_names[machine_phase],
+                        (now - machine_phase_start_ns) / SCALE_US);
     machine_phase = phase;
+    machine_phase_start_ns = now;
+
+    if (phase == PHASE_MACHINE_READY) {
+        trace_phase_machine_ready((now - machine_init_start_ns) / SCALE_US);
+    }
 }
 
 static const TypeInfo device_type_info = {
@@ -140,6 +140,24 @@ typedef enum {
     NetPktRssIpV6UdpEx,
 } NetRxPktRssType;
 
+/* Longest RSS hash input, the IPv6 addresses and L4 ports */
+#define NET_RX_PKT_RSS_INPUT_MAX 36
+
+/**
+* gathers the fields of the packet that are hashed for RSS
+*
+* @pkt:            packet
+* @type:           RSS hash type
+* @rss_input:      buffer of NET_RX_PKT_RSS_INPUT_MAX bytes
+*
+* Return:  number of bytes written to @rss_input.
+*
+*/
+size_t
+net_rx_pkt_get_rss_input(struct NetRxPkt *pkt,
+                         NetRxPktRssType type,
+                         uint8_t *rss_input);
+
 /**
 * calculates RSS hash for packet
 *
@@ -16,6 +16,7 @@
 #include "qemu/iov.h"
 #include "qemu/main-loop.h"
 #include "qemu/module.h"
+#include "qemu/xxhash.h"
 #include "hw/virtio/virtio.h"
 #include "net/net.h"
 #include "net/checksum.h"
@@ -44,6 +45,7 @@
 #include "hw/pci/pci.h"
 #include "net_rx_pkt.h"
 #include "hw/virtio/vhost.h"
+#include "block/aio-wait.h"
 
 #define VIRTIO_NET_VM_VERSION    11
 
@@ -117,9 +119,28 @@ static int vq2q(int queue_index)
     return queue_index / 2;
 }
 
-/* TODO
- * - we could suppress RX interrupt if we were so inclined.
- */
+static void virtio_net_notify(VirtIONet *n, VirtQueue *vq)
+{
+    if (n->dataplane_started) {
+        virtio_notify_irqfd(VIRTIO_DEVICE(n), vq);
+    } else {
+        virtio_notify(VIRTIO_DEVICE(n), vq);
+    }
+}
+
+/* Number of queue pairs whose virtqueues currently exist */
+static int virtio_net_num_queue_pairs(VirtIONet *n)
+{
+    return (virtio_get_num_queues(VIRTIO_DEVICE(n)) - 1) / 2;
+}
+
+static void virtio_net_apply_coalescing(VirtIONetQueue *q)
+{
+    virtio_queue_set_notify_coalescing(q->rx_vq, q->rx_coal.max_packets,
+                                       q->rx_coal.usecs);
+    virtio_queue_set_notify_coalescing(q->tx_vq, q->tx_coal.max_packets,
+                                       q->tx_coal.usecs);
+}
 
 static void virtio_net_get_config(VirtIODevice *vdev, uint8_t *config)
 {
@@ -355,7 +376,7 @@ static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify(VIRTIO_NET(vdev), vq);
     }
 }
 
@@ -369,6 +390,8 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
 
+    /* The queues may be processed by the dataplane IOThread */
+    aio_context_acquire(n->ctx);
     for (i = 0; i < n->max_queue_pairs; i++) {
         NetClientState *ncs = qemu_get_subqueue(n->nic, i);
         bool queue_started;
@@ -414,6 +437,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             }
         }
     }
+    aio_context_release(n->ctx);
 }
 
 static void virtio_net_set_link_status(NetClientState *nc)
@@ -565,6 +589,15 @@ static void virtio_net_reset(VirtIODevice *vdev)
             assert(!virtio_net_get_subqueue(nc)->async_tx.elem);
         }
     }
+
+    /* Drop coalescing parameters set by the guest */
+    for (i = 0; i < virtio_net_num_queue_pairs(n); i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        q->rx_coal = q->rx_coal_conf;
+        q->tx_coal = q->tx_coal_conf;
+        virtio_net_apply_coalescing(q);
+    }
 }
 
 static void peer_test_vnet_hdr(VirtIONet *n)
@@ -715,6 +748,10 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
 
     virtio_add_feature(&features, VIRTIO_NET_F_MAC);
 
+    if (!virtio_has_feature(features, VIRTIO_NET_F_CTRL_VQ)) {
+        virtio_clear_feature(&features, VIRTIO_NET_F_NOTF_COAL);
+    }
+
     if (!peer_has_vnet_hdr(n)) {
         virtio_clear_feature(&features, VIRTIO_NET_F_CSUM);
         virtio_clear_feature(&features, VIRTIO_NET_F_HOST_TSO4);
@@ -741,6 +778,8 @@ static uint64_t virtio_net_get_features(VirtIODevice *vdev, uint64_t features,
     if (!ebpf_rss_is_loaded(&n->ebpf_rss)) {
         virtio_clear_feature(&features, VIRTIO_NET_F_RSS);
     }
+    /* Notifications are sent by the vhost backend, not by us */
+    virtio_clear_feature(&features, VIRTIO_NET_F_NOTF_COAL);
     features = vhost_net_get_features(get_vhost_net(nc->peer), features);
     vdev->backend_features = features;
 
@@ -1009,6 +1048,57 @@ static int virtio_net_handle_offloads(VirtIONet *n, uint8_t cmd,
     }
 }
 
+static int virtio_net_handle_notf_coal(VirtIONet *n, uint8_t cmd,
+                                       struct iovec *iov,
+                                       unsigned int iov_cnt)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    struct virtio_net_ctrl_coal_rx rx;
+    struct virtio_net_ctrl_coal_tx tx;
+    VirtIONetCoalescing coal;
+    size_t s;
+    int i;
+
+    if (!virtio_vdev_has_feature(vdev, VIRTIO_NET_F_NOTF_COAL)) {
+        return VIRTIO_NET_ERR;
+    }
+
+    switch (cmd) {
+    case VIRTIO_NET_CTRL_NOTF_COAL_RX_SET:
+        s = iov_to_buf(iov, iov_cnt, 0, &rx, sizeof(rx));
+        if (s != sizeof(rx)) {
+            return VIRTIO_NET_ERR;
+        }
+        coal.usecs = le32_to_cpu(rx.rx_usecs);
+        coal.max_packets = le32_to_cpu(rx.rx_max_packets);
+        for (i = 0; i < n->max_queue_pairs; i++) {
+            n->vqs[i].rx_coal = coal;
+        }
+        break;
+    case VIRTIO_NET_CTRL_NOTF_COAL_TX_SET:
+        s = iov_to_buf(iov, iov_cnt, 0, &tx, sizeof(tx));
+        if (s != sizeof(tx)) {
+            return VIRTIO_NET_ERR;
+        }
+        coal.usecs = le32_to_cpu(tx.tx_usecs);
+        coal.max_packets = le32_to_cpu(tx.tx_max_packets);
+        for (i = 0; i < n->max_queue_pairs; i++) {
+            n->vqs[i].tx_coal = coal;
+        }
+        break;
+    default:
+        return VIRTIO_NET_ERR;
+    }
+
+    trace_virtio_net_notf_coal(n, cmd, coal.usecs, coal.max_packets);
+
+    for (i = 0; i < virtio_net_num_queue_pairs(n); i++) {
+        virtio_net_apply_coalescing(&n->vqs[i]);
+    }
+
+    return VIRTIO_NET_OK;
+}
+
 static int virtio_net_handle_mac(VirtIONet *n, uint8_t cmd,
                                  struct iovec *iov, unsigned int iov_cnt)
 {
@@ -1152,16 +1242,50 @@ static int virtio_net_handle_announce(VirtIONet *n, uint8_t cmd,
 
 static void virtio_net_detach_epbf_rss(VirtIONet *n);
 
+/*
+ * Stop steering in software and forget the flows hashed with the current
+ * key, so that they are not used after the key changes under eBPF steering.
+ */
+static void virtio_net_disable_software_rss(VirtIONet *n)
+{
+    n->rss_data.enabled_software_rss = false;
+    if (n->rss_data.flow_cache) {
+        memset(n->rss_data.flow_cache, 0,
+               sizeof(VirtioNetRssFlow) * VIRTIO_NET_RSS_FLOW_CACHE_SIZE);
+    }
+}
+
 static void virtio_net_disable_rss(VirtIONet *n)
 {
     if (n->rss_data.enabled) {
         trace_virtio_net_rss_disable();
     }
     n->rss_data.enabled = false;
+    virtio_net_disable_software_rss(n);
 
     virtio_net_detach_epbf_rss(n);
 }
 
+/*
+ * Precompute the Toeplitz table for the current key and forget the flows
+ * seen with the previous configuration.
+ */
+static void virtio_net_enable_software_rss(VirtIONet *n)
+{
+    QEMU_BUILD_BUG_ON(VIRTIO_NET_RSS_MAX_KEY_SIZE <
+                      NET_TOEPLITZ_TABLE_MAX_INPUT + 4);
+
+    n->rss_data.enabled_software_rss = true;
+    if (!n->rss_data.toeplitz) {
+        n->rss_data.toeplitz = g_new(NetToeplitzTable, 1);
+        n->rss_data.flow_cache = g_new(VirtioNetRssFlow,
+                                       VIRTIO_NET_RSS_FLOW_CACHE_SIZE);
+    }
+    net_toeplitz_table_init(n->rss_data.toeplitz, n->rss_data.key);
+    memset(n->rss_data.flow_cache, 0,
+           sizeof(VirtioNetRssFlow) * VIRTIO_NET_RSS_FLOW_CACHE_SIZE);
+}
+
 static bool virtio_net_attach_ebpf_to_backend(NICState *nic, int prog_fd)
 {
     NetClientState *nc = qemu_get_peer(qemu_get_queue(nic), 0);
@@ -1339,7 +1463,9 @@ static uint16_t virtio_net_handle_rss(VirtIONet *n,
     n->rss_data.enabled = true;
 
     if (!n->rss_data.populate_hash) {
-        if (!virtio_net_attach_epbf_rss(n)) {
+        if (virtio_net_attach_epbf_rss(n)) {
+            virtio_net_disable_software_rss(n);
+        } else {
             /* EBPF must be loaded for vhost */
             if (get_vhost_net(qemu_get_queue(n->nic)->peer)) {
                 warn_report("Can't load eBPF RSS for vhost");
@@ -1347,13 +1473,13 @@ static uint16_t virtio_net_handle_rss(VirtIONet *n,
             }
             /* fallback to software RSS */
             warn_report("Can't load eBPF RSS - fallback to software RSS");
-            n->rss_data.enabled_software_rss = true;
+            virtio_net_enable_software_rss(n);
         }
     } else {
         /* use software RSS for hash populating */
         /* and detach eBPF if was loaded before */
         virtio_net_detach_epbf_rss(n);
-        n->rss_data.enabled_software_rss = true;
+        virtio_net_enable_software_rss(n);
     }
 
     trace_virtio_net_rss_enable(n->rss_data.hash_types,
@@ -1452,6 +1578,8 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
             status = virtio_net_handle_mq(n, ctrl.cmd, iov, iov_cnt);
         } else if (ctrl.class == VIRTIO_NET_CTRL_GUEST_OFFLOADS) {
             status = virtio_net_handle_offloads(n, ctrl.cmd, iov, iov_cnt);
+        } else if (ctrl.class == VIRTIO_NET_CTRL_NOTF_COAL) {
+            status = virtio_net_handle_notf_coal(n, ctrl.cmd, iov, iov_cnt);
         }
 
         s = iov_from_buf(elem->in_sg, elem->in_num, 0, &status, sizeof(status));
@@ -1673,13 +1801,33 @@ static void virtio_set_packet_hash(const uint8_t *buf, uint8_t report,
     hdr->hash_report = report;
 }
 
+static VirtioNetRssFlow *virtio_net_rss_flow(VirtIONet *n,
+                                             const uint8_t *input, size_t len)
+{
+    uint64_t fold = 0;
+    size_t i;
+
+    for (i = 0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t)) {
+        fold ^= ldq_he_p(input + i);
+    }
+    for (; i < len; i++) {
+        fold ^= (uint64_t)input[i] << (8 * (i % sizeof(uint64_t)));
+    }
+
+    return &n->rss_data.flow_cache[qemu_xxhash2(fold) &
+                                   (VIRTIO_NET_RSS_FLOW_CACHE_SIZE - 1)];
+}
+
 static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
                                   size_t size)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     unsigned int index = nc->queue_index, new_index = index;
     struct NetRxPkt *pkt = n->rx_pkt;
+    uint8_t input[NET_RX_PKT_RSS_INPUT_MAX];
+    VirtioNetRssFlow *flow;
     uint8_t net_hash_type;
+    size_t len;
     uint32_t hash;
     bool isip4, isip6, isudp, istcp;
     static const uint8_t reports[NetPktRssIpV6UdpEx + 1] = {
@@ -1712,17 +1860,30 @@ static int virtio_net_process_rss(NetClientState *nc, const uint8_t *buf,
         return n->rss_data.redirect ? n->rss_data.default_queue : -1;
     }
 
-    hash = net_rx_pkt_calc_rss_hash(pkt, net_hash_type, n->rss_data.key);
+    len = net_rx_pkt_get_rss_input(pkt, net_hash_type, input);
+    flow = virtio_net_rss_flow(n, input, len);
+    if (flow->len == len && flow->hash_type == net_hash_type &&
+        !memcmp(flow->input, input, len)) {
+        hash = flow->hash;
+        new_index = n->rss_data.redirect ? flow->queue : index;
+    } else {
+        hash = net_toeplitz_table_hash(n->rss_data.toeplitz, input, len);
+        if (n->rss_data.redirect) {
+            new_index = hash & (n->rss_data.indirections_len - 1);
+            new_index = n->rss_data.indirections_table[new_index];
+        }
+
+        memcpy(flow->input, input, len);
+        flow->len = len;
+        flow->hash_type = net_hash_type;
+        flow->queue = new_index;
+        flow->hash = hash;
+    }
 
     if (n->rss_data.populate_hash) {
         virtio_set_packet_hash(buf, reports[net_hash_type], hash);
     }
 
-    if (n->rss_data.redirect) {
-        new_index = hash & (n->rss_data.indirections_len - 1);
-        new_index = n->rss_data.indirections_table[new_index];
-    }
-
     return (index == new_index) ? -1 : new_index;
 }
 
@@ -1851,12 +2012,17 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
 
     for (j = 0; j < i; j++) {
         /* signal other side */
-        virtqueue_fill(q->rx_vq, elems[j], lens[j], j);
+        virtqueue_fill(q->rx_vq, elems[j], lens[j], q->rx_batched + j);
         g_free(elems[j]);
     }
 
+    if (n->rx_batching) {
+        q->rx_batched += i;
+        return size;
+    }
+
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    virtio_net_notify(n, q->rx_vq);
 
     return size;
 
@@ -2480,16 +2646,47 @@ static ssize_t virtio_net_receive(NetClientState *nc, const uint8_t *buf,
     }
 }
 
+/*
+ * Publish all packets of a batch with a single used index update and at
+ * most one notification per queue.  RSS may have steered some of them to
+ * other queues than the one the batch arrived on.
+ */
+static int virtio_net_receive_batch(NetClientState *nc,
+                                    const struct iovec *pkts, int npkts)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    int i, j;
+
+    n->rx_batching = true;
+    for (i = 0; i < npkts; i++) {
+        if (virtio_net_receive(nc, pkts[i].iov_base, pkts[i].iov_len) == 0) {
+            break;
+        }
+    }
+    n->rx_batching = false;
+
+    for (j = 0; j < n->max_queue_pairs; j++) {
+        VirtIONetQueue *q = &n->vqs[j];
+
+        if (q->rx_batched) {
+            virtqueue_flush(q->rx_vq, q->rx_batched);
+            virtio_net_notify(n, q->rx_vq);
+            q->rx_batched = 0;
+        }
+    }
+
+    return i;
+}
+
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q);
 
 static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify(n, q->tx_vq);
 
     g_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
@@ -2584,7 +2781,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 
 drop:
         virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
+        virtio_net_notify(n, q->tx_vq);
         g_free(elem);
 
         if (++num_packets >= n->tx_burst) {
@@ -2742,6 +2939,7 @@ static void virtio_net_add_queue(VirtIONet *n, int index)
 
     n->vqs[index].tx_waiting = 0;
     n->vqs[index].n = n;
+    virtio_net_apply_coalescing(&n->vqs[index]);
 }
 
 static void virtio_net_del_queue(VirtIONet *n, int index)
@@ -2809,6 +3007,365 @@ static void virtio_net_set_multiqueue(VirtIONet *n, int multiqueue)
     virtio_net_set_queue_pairs(n);
 }
 
+/* Dataplane */
+
+static int virtio_net_dataplane_queue_pairs(VirtIONet *n)
+{
+    return n->multiqueue ? n->max_queue_pairs : 1;
+}
+
+static void virtio_net_dataplane_tx_timer(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    AioContext *ctx = q->n->ctx;
+
+    aio_context_acquire(ctx);
+    virtio_net_tx_timer(q);
+    aio_context_release(ctx);
+}
+
+static void virtio_net_dataplane_tx_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    AioContext *ctx = q->n->ctx;
+
+    aio_context_acquire(ctx);
+    virtio_net_tx_bh(q);
+    aio_context_release(ctx);
+}
+
+/*
+ * Recreate the TX timer or bottom half of @q in @ctx, carrying over a
+ * pending flush.  Passing the main loop context restores the default
+ * callbacks.
+ */
+static void virtio_net_tx_set_aio_context(VirtIONetQueue *q, AioContext *ctx)
+{
+    bool dataplane = ctx != qemu_get_aio_context();
+
+    if (q->tx_timer) {
+        uint64_t expire = timer_expire_time_ns(q->tx_timer);
+
+        timer_free(q->tx_timer);
+        if (dataplane) {
+            q->tx_timer = aio_timer_new(ctx, QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                        virtio_net_dataplane_tx_timer, q);
+        } else {
+            q->tx_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                       virtio_net_tx_timer, q);
+        }
+        if (expire != -1) {
+            timer_mod(q->tx_timer, expire);
+        }
+    } else {
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = aio_bh_new(ctx, dataplane ? virtio_net_dataplane_tx_bh :
+                                               virtio_net_tx_bh, q);
+        if (q->tx_waiting) {
+            qemu_bh_schedule(q->tx_bh);
+        }
+    }
+}
+
+/*
+ * The dataplane handlers also run from the AioContext busy-poll loop,
+ * whenever their virtqueue is not empty.  They return true only if they
+ * made progress, so that the poll time adapts to actual traffic.
+ */
+static bool virtio_net_dataplane_handle_rx(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    NetClientState *nc = qemu_get_subqueue(n->nic,
+                                           vq2q(virtio_get_queue_index(vq)));
+    bool progress;
+
+    aio_context_acquire(n->ctx);
+    /*
+     * An RX ring full of buffers is the normal state; new buffers only
+     * matter while received packets wait for them.
+     */
+    progress = nc->receive_disabled ||
+               !qemu_net_queue_empty(nc->incoming_queue);
+    if (progress) {
+        virtio_net_handle_rx(vdev, vq);
+    }
+    aio_context_release(n->ctx);
+    return progress;
+}
+
+static bool virtio_net_dataplane_handle_tx(VirtIODevice *vdev, VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    VirtIONetQueue *q = &n->vqs[vq2q(virtio_get_queue_index(vq))];
+    bool progress = true;
+
+    aio_context_acquire(n->ctx);
+    if (q->tx_timer) {
+        virtio_net_handle_tx_timer(vdev, vq);
+    } else {
+        /* The bottom half is already scheduled */
+        progress = !q->tx_waiting;
+        virtio_net_handle_tx_bh(vdev, vq);
+    }
+    aio_context_release(n->ctx);
+    return progress;
+}
+
+/* Context: QEMU global mutex held */
+static bool virtio_net_dataplane_handle_ctrl(VirtIODevice *vdev,
+                                             VirtQueue *vq)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+
+    /* Control commands update state that the IOThread reads on RX */
+    aio_context_acquire(n->ctx);
+    virtio_net_handle_ctrl(vdev, vq);
+    aio_context_release(n->ctx);
+    return true;
+}
+
+static bool virtio_net_dataplane_has_filters(VirtIONet *n)
+{
+    int i;
+
+    for (i = 0; i < virtio_net_dataplane_queue_pairs(n); i++) {
+        NetClientState *nc = qemu_get_subqueue(n->nic, i);
+
+        if (!QTAILQ_EMPTY(&nc->filters) ||
+            (nc->peer && !QTAILQ_EMPTY(&nc->peer->filters))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Context: QEMU global mutex held */
+static bool virtio_net_dataplane_setup(VirtIONet *n, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int i;
+
+    if (!n->net_conf.iothread) {
+        n->ctx = qemu_get_aio_context();
+        return true;
+    }
+
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+        error_setg(errp,
+                   "device is incompatible with iothread "
+                   "(transport does not support notifiers)");
+        return false;
+    }
+    if (!virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "ioeventfd is required for iothread");
+        return false;
+    }
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSC_EXT)) {
+        error_setg(errp, "guest_rsc_ext is not supported with iothread");
+        return false;
+    }
+    for (i = 0; i < n->nic_conf.peers.queues; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (!peer->info->set_aio_context) {
+            error_setg(errp, "netdev '%s' does not support iothread",
+                       peer->name);
+            return false;
+        }
+        if (get_vhost_net(peer)) {
+            error_setg(errp, "iothread is not supported with vhost");
+            return false;
+        }
+    }
+
+    n->ctx = iothread_get_aio_context(n->net_conf.iothread);
+    return true;
+}
+
+/* Context: BH in IOThread */
+static void virtio_net_dataplane_stop_bh(void *opaque)
+{
+    VirtIONet *n = opaque;
+    int i;
+
+    for (i = 0; i < virtio_net_dataplane_queue_pairs(n); i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        virtio_queue_aio_set_host_notifier_handler(q->rx_vq, n->ctx, NULL);
+        virtio_queue_aio_set_host_notifier_handler(q->tx_vq, n->ctx, NULL);
+        virtio_net_tx_set_aio_context(q, qemu_get_aio_context());
+        virtio_queue_set_notify_coalescing_aio_context(q->rx_vq,
+                                                       qemu_get_aio_context());
+        virtio_queue_set_notify_coalescing_aio_context(q->tx_vq,
+                                                       qemu_get_aio_context());
+    }
+}
+
+/* Context: QEMU global mutex held */
+static int virtio_net_dataplane_start(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int nvqs = virtio_get_num_queues(vdev);
+    int vq_init_count;
+    int i, rc;
+
+    if (!n->net_conf.iothread) {
+        return virtio_device_start_ioeventfd_impl(vdev);
+    }
+
+    /*
+     * Filters may call into subsystems that are bound to the main loop,
+     * so keep the datapath there for as long as any are attached.
+     */
+    if (virtio_net_dataplane_has_filters(n)) {
+        warn_report_once("virtio-net: netdev filters are attached, "
+                         "not using iothread");
+        return virtio_device_start_ioeventfd_impl(vdev);
+    }
+
+    /* Set up guest notifier (irq) */
+    rc = k->set_guest_notifiers(qbus->parent, nvqs, true);
+    if (rc != 0) {
+        error_report("virtio-net: Failed to set guest notifiers (%d), "
+                     "ensure -accel kvm is set.", rc);
+        return rc;
+    }
+
+    /*
+     * Batch all the host notifiers in a single transaction to avoid
+     * quadratic time complexity in address_space_update_ioeventfds().
+     */
+    memory_region_transaction_begin();
+
+    for (i = 0; i < nvqs; i++) {
+        rc = virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, true);
+        if (rc != 0) {
+            error_report("virtio-net: Failed to set host notifier (%d)", rc);
+            goto fail_host_notifiers;
+        }
+    }
+
+    memory_region_transaction_commit();
+
+    /* From here on completions may be signalled from the IOThread */
+    n->dataplane_started = true;
+
+    for (i = 0; i < virtio_net_dataplane_queue_pairs(n); i++) {
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        virtio_net_tx_set_aio_context(&n->vqs[i], n->ctx);
+        virtio_queue_set_notify_coalescing_aio_context(n->vqs[i].rx_vq,
+                                                       n->ctx);
+        virtio_queue_set_notify_coalescing_aio_context(n->vqs[i].tx_vq,
+                                                       n->ctx);
+        if (peer) {
+            qemu_set_aio_context(peer, n->ctx);
+        }
+    }
+
+    virtio_queue_aio_set_host_notifier_handler(n->ctrl_vq,
+                                               qemu_get_aio_context(),
+                                               virtio_net_dataplane_handle_ctrl);
+
+    aio_context_acquire(n->ctx);
+    for (i = 0; i < virtio_net_dataplane_queue_pairs(n); i++) {
+        virtio_queue_aio_set_host_notifier_handler(n->vqs[i].rx_vq, n->ctx,
+                                               virtio_net_dataplane_handle_rx);
+        virtio_queue_aio_set_host_notifier_handler(n->vqs[i].tx_vq, n->ctx,
+                                               virtio_net_dataplane_handle_tx);
+    }
+    aio_context_release(n->ctx);
+
+    /* Kick right away to begin processing requests already in vring */
+    for (i = 0; i < nvqs; i++) {
+        event_notifier_set(virtio_queue_get_host_notifier(
+                               virtio_get_queue(vdev, i)));
+    }
+    return 0;
+
+fail_host_notifiers:
+    vq_init_count = i;
+    for (i = 0; i < vq_init_count; i++) {
+        virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+    }
+
+    /*
+     * The transaction expects the ioeventfds to be open when it
+     * commits. Do it now, before the cleanup loop.
+     */
+    memory_region_transaction_commit();
+
+    for (i = 0; i < vq_init_count; i++) {
+        virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+    }
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+    return rc;
+}
+
+/* Context: QEMU global mutex held */
+static void virtio_net_dataplane_stop(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = qdev_get_parent_bus(DEVICE(vdev));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    int nvqs = virtio_get_num_queues(vdev);
+    int i;
+
+    if (!n->dataplane_started) {
+        virtio_device_stop_ioeventfd_impl(vdev);
+        return;
+    }
+
+    aio_context_acquire(n->ctx);
+    aio_wait_bh_oneshot(n->ctx, virtio_net_dataplane_stop_bh, n);
+
+    /*
+     * Backends install main loop fd handlers, which must not be done from
+     * the IOThread.  Holding the AioContext keeps their IOThread handlers
+     * from running while they are moved.
+     */
+    for (i = 0; i < virtio_net_dataplane_queue_pairs(n); i++) {
+        NetClientState *peer = qemu_get_subqueue(n->nic, i)->peer;
+
+        if (peer) {
+            qemu_set_aio_context(peer, NULL);
+        }
+    }
+    aio_context_release(n->ctx);
+
+    virtio_queue_aio_set_host_notifier_handler(n->ctrl_vq,
+                                               qemu_get_aio_context(), NULL);
+
+    /*
+     * Batch all the host notifiers in a single transaction to avoid
+     * quadratic time complexity in address_space_update_ioeventfds().
+     */
+    memory_region_transaction_begin();
+
+    for (i = 0; i < nvqs; i++) {
+        virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+    }
+
+    /*
+     * The transaction expects the ioeventfds to be open when it
+     * commits. Do it now, before the cleanup loop.
+     */
+    memory_region_transaction_commit();
+
+    for (i = 0; i < nvqs; i++) {
+        virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+    }
+
+    n->dataplane_started = false;
+
+    /* Clean up guest notifier (irq) */
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+}
+
 static int virtio_net_post_load_device(void *opaque, int version_id)
 {
     VirtIONet *n = opaque;
@@ -2869,8 +3426,12 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
         }
     }
 
+    for (i = 0; i < virtio_net_num_queue_pairs(n); i++) {
+        virtio_net_apply_coalescing(&n->vqs[i]);
+    }
+
     if (n->rss_data.enabled) {
-        n->rss_data.enabled_software_rss = n->rss_data.populate_hash;
+        virtio_net_disable_software_rss(n);
         if (!n->rss_data.populate_hash) {
             if (!virtio_net_attach_epbf_rss(n)) {
                 if (get_vhost_net(qemu_get_queue(n->nic)->peer)) {
@@ -2878,9 +3439,11 @@ static int virtio_net_post_load_device(void *opaque, int version_id)
                 } else {
                     warn_report("Can't post-load eBPF RSS - "
                                 "fallback to software RSS");
-                    n->rss_data.enabled_software_rss = true;
+                    virtio_net_enable_software_rss(n);
                 }
             }
+        } else {
+            virtio_net_enable_software_rss(n);
         }
 
         trace_virtio_net_rss_enable(n->rss_data.hash_types,
@@ -3092,6 +3655,44 @@ static const VMStateDescription vmstate_virtio_net_rss = {
     },
 };
 
+/* Coalescing parameters of a VirtIONetQueue */
+static const VMStateDescription vmstate_virtio_net_queue_coal = {
+    .name = "virtio-net-queue-coal",
+    .fields = (VMStateField[]) {
+        VMSTATE_UINT32(rx_coal.usecs, VirtIONetQueue),
+        VMSTATE_UINT32(rx_coal.max_packets, VirtIONetQueue),
+        VMSTATE_UINT32(tx_coal.usecs, VirtIONetQueue),
+        VMSTATE_UINT32(tx_coal.max_packets, VirtIONetQueue),
+        VMSTATE_END_OF_LIST()
+    },
+};
+
+static bool virtio_net_coal_needed(void *opaque)
+{
+    VirtIONet *n = VIRTIO_NET(opaque);
+    int i;
+
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        if (n->vqs[i].rx_coal.usecs || n->vqs[i].tx_coal.usecs) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static const VMStateDescription vmstate_virtio_net_coal = {
+    .name      = "virtio-net-device/coal",
+    .version_id = 1,
+    .minimum_version_id = 1,
+    .needed = virtio_net_coal_needed,
+    .fields = (VMStateField[]) {
+        VMSTATE_STRUCT_VARRAY_POINTER_UINT16(vqs, VirtIONet, max_queue_pairs,
+                                             vmstate_virtio_net_queue_coal,
+                                             VirtIONetQueue),
+        VMSTATE_END_OF_LIST()
+    },
+};
+
 static const VMStateDescription vmstate_virtio_net_device = {
     .name = "virtio-net-device",
     .version_id = VIRTIO_NET_VM_VERSION,
@@ -3144,18 +3745,68 @@ static const VMStateDescription vmstate_virtio_net_device = {
    },
     .subsections = (const VMStateDescription * []) {
         &vmstate_virtio_net_rss,
+        &vmstate_virtio_net_coal,
         NULL
     }
 };
 
+static void virtio_net_set_coalescing(NetClientState *nc,
+                                      const NicCoalescingParameters *params,
+                                      Error **errp)
+{
+    VirtIONet *n = qemu_get_nic_opaque(nc);
+    int i, first = 0, last = n->max_queue_pairs - 1;
+
+    if (get_vhost_net(nc->peer)) {
+        error_setg(errp, "notification coalescing is not supported "
+                   "with vhost");
+        return;
+    }
+
+    if (params->has_queue) {
+        if (params->queue >= n->max_queue_pairs) {
+            error_setg(errp, "queue %u out of range, the device has %u "
+                       "queue pairs", params->queue, n->max_queue_pairs);
+            return;
+        }
+        first = last = params->queue;
+    }
+
+    aio_context_acquire(n->ctx);
+    for (i = first; i <= last; i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        if (params->has_rx_usecs) {
+            q->rx_coal.usecs = q->rx_coal_conf.usecs = params->rx_usecs;
+        }
+        if (params->has_rx_max_packets) {
+            q->rx_coal.max_packets = q->rx_coal_conf.max_packets =
+                params->rx_max_packets;
+        }
+        if (params->has_tx_usecs) {
+            q->tx_coal.usecs = q->tx_coal_conf.usecs = params->tx_usecs;
+        }
+        if (params->has_tx_max_packets) {
+            q->tx_coal.max_packets = q->tx_coal_conf.max_packets =
+                params->tx_max_packets;
+        }
+        if (i < virtio_net_num_queue_pairs(n)) {
+            virtio_net_apply_coalescing(q);
+        }
+    }
+    aio_context_release(n->ctx);
+}
+
 static NetClientInfo net_virtio_info = {
     .type = NET_CLIENT_DRIVER_NIC,
     .size = sizeof(NICState),
     .can_receive = virtio_net_can_receive,
     .receive = virtio_net_receive,
+    .receive_batch = virtio_net_receive_batch,
     .link_status_changed = virtio_net_set_link_status,
     .query_rx_filter = virtio_net_query_rxfilter,
     .announce = virtio_net_announce,
+    .set_coalescing = virtio_net_set_coalescing,
 };
 
 static bool virtio_net_guest_notifier_pending(VirtIODevice *vdev, int idx)
@@ -3373,6 +4024,10 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         n->host_features |= (1ULL << VIRTIO_NET_F_SPEED_DUPLEX);
     }
 
+    if (!virtio_net_dataplane_setup(n, errp)) {
+        return;
+    }
+
     if (n->failover) {
         n->primary_listener.hide_device = failover_hide_primary_device;
         qatomic_set(&n->failover_primary_hidden, true);
@@ -3557,6 +4212,8 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
     g_free(n->rss_data.indirections_table);
+    g_free(n->rss_data.toeplitz);
+    g_free(n->rss_data.flow_cache);
     net_rx_pkt_uninit(n->rx_pkt);
     virtio_cleanup(vdev);
 }
@@ -3667,6 +4324,8 @@ static Property virtio_net_properties[] = {
                     VIRTIO_NET_F_RSS, false),
     DEFINE_PROP_BIT64("hash", VirtIONet, host_features,
                     VIRTIO_NET_F_HASH_REPORT, false),
+    DEFINE_PROP_BIT64("notf_coal", VirtIONet, host_features,
+                    VIRTIO_NET_F_NOTF_COAL, false),
     DEFINE_PROP_BIT64("guest_rsc_ext", VirtIONet, host_features,
                     VIRTIO_NET_F_RSC_EXT, false),
     DEFINE_PROP_UINT32("rsc_interval", VirtIONet, rsc_timeout,
@@ -3686,6 +4345,8 @@ static Property virtio_net_properties[] = {
     DEFINE_PROP_INT32("speed", VirtIONet, net_conf.speed, SPEED_UNKNOWN),
     DEFINE_PROP_STRING("duplex", VirtIONet, net_conf.duplex_str),
     DEFINE_PROP_BOOL("failover", VirtIONet, failover, false),
+    DEFINE_PROP_LINK("iothread", VirtIONet, net_conf.iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -3708,6 +4369,8 @@ static void virtio_net_class_init(ObjectClass *klass, void *data)
     vdc->set_status = virtio_net_set_status;
     vdc->guest_notifier_mask = virtio_net_guest_notifier_mask;
     vdc->guest_notifier_pending = virtio_net_guest_notifier_pending;
+    vdc->start_ioeventfd = virtio_net_dataplane_start;
+    vdc->stop_ioeventfd = virtio_net_dataplane_stop;
     vdc->legacy_features |= (0x1 << VIRTIO_NET_F_GSO);
     vdc->post_load = virtio_net_post_load_virtio;
     vdc->vmsd = &vmstate_virtio_net_device;
@@ -35,6 +35,7 @@
  *              mdts=<N[optional]>,vsl=<N[optional]>, \
  *              zoned.zasl=<N[optional]>, \
  *              zoned.auto_transition=<on|off[optional]>, \
+ *              ioeventfd=<on|off[optional]>,iothread=<iothread_id[optional]>, \
  *              subsys=<subsys_id>
  *      -device nvme-ns,drive=<drive_id>,bus=<bus_name>,nsid=<nsid>,\
  *              zoned=<true|false[optional]>, \
@@ -106,6 +107,16 @@
  *   transitioned to zone state closed for resource management purposes.
  *   Defaults to 'on'.
  *
+ * - `ioeventfd`
+ *   Use eventfds for the I/O queue doorbells once the host has configured
+ *   shadow doorbells with the Doorbell Buffer Config command, so doorbell
+ *   writes no longer exit to the vCPU thread. Defaults to 'off'.
+ *
+ * - `iothread`
+ *   Service the doorbell eventfds from the given iothread, which also polls
+ *   the shadow submission and completion queue doorbells. Requires
+ *   `ioeventfd`.
+ *
  * nvme namespace device parameters
  * ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
  * - `shared`
@@ -159,6 +170,8 @@
 #include "sysemu/sysemu.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/hostmem.h"
+#include "sysemu/iothread.h"
+#include "block/aio-wait.h"
 #include "hw/pci/msix.h"
 #include "migration/vmstate.h"
 
@@ -220,6 +233,7 @@ static const uint32_t nvme_cse_acs[256] = {
     [NVME_ADM_CMD_GET_FEATURES]     = NVME_CMD_EFF_CSUPP,
     [NVME_ADM_CMD_ASYNC_EV_REQ]     = NVME_CMD_EFF_CSUPP,
     [NVME_ADM_CMD_NS_ATTACHMENT]    = NVME_CMD_EFF_CSUPP | NVME_CMD_EFF_NIC,
+    [NVME_ADM_CMD_DBBUF_CONFIG]     = NVME_CMD_EFF_CSUPP,
     [NVME_ADM_CMD_FORMAT_NVM]       = NVME_CMD_EFF_CSUPP | NVME_CMD_EFF_LBCC,
 };
 
@@ -1265,14 +1279,100 @@ static inline void nvme_blk_write(BlockBackend *blk, int64_t offset,
     }
 }
 
+/*
+ * Shadow doorbells (Doorbell Buffer Config). The host mirrors every doorbell
+ * value into the shadow doorbell buffer and only writes the real doorbell
+ * register when the value crosses the EventIdx published by the controller.
+ *
+ * The shadow doorbells are read after a full barrier. It orders the read
+ * after a preceding EventIdx update, pairing with the host's barrier between
+ * writing the shadow doorbell and reading the EventIdx, so that either the
+ * host sees the new EventIdx and rings the doorbell, or the new shadow value
+ * is seen here.
+ */
+static void nvme_update_sq_tail(NvmeSQueue *sq)
+{
+    uint32_t tail;
+
+    smp_mb();
+
+    if (pci_dma_read(&sq->ctrl->parent_obj, sq->db_addr, &tail,
+                     sizeof(tail))) {
+        return;
+    }
+
+    tail = le32_to_cpu(tail);
+    if (tail == sq->tail || unlikely(tail >= sq->size)) {
+        return;
+    }
+
+    trace_pci_nvme_shadow_doorbell_sq(sq->sqid, tail);
+
+    /* Also read by nvme_sq_notifier_poll() in the iothread */
+    qatomic_set(&sq->tail, tail);
+}
+
+static void nvme_update_sq_eventidx(const NvmeSQueue *sq)
+{
+    uint32_t eventidx = cpu_to_le32(sq->tail);
+
+    pci_dma_write(&sq->ctrl->parent_obj, sq->ei_addr, &eventidx,
+                  sizeof(eventidx));
+}
+
+static void nvme_update_cq_head(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+    bool pending = cq->head != cq->tail;
+    uint32_t head;
+
+    smp_mb();
+
+    if (pci_dma_read(&n->parent_obj, cq->db_addr, &head, sizeof(head))) {
+        return;
+    }
+
+    head = le32_to_cpu(head);
+    if (head == cq->head || unlikely(head >= cq->size)) {
+        return;
+    }
+
+    trace_pci_nvme_shadow_doorbell_cq(cq->cqid, head);
+
+    /* Also read by nvme_cq_notifier_poll() in the iothread */
+    qatomic_set(&cq->head, head);
+    if (pending && cq->tail == cq->head) {
+        if (cq->irq_enabled) {
+            n->cq_pending--;
+        }
+
+        nvme_irq_deassert(n, cq);
+    }
+}
+
+static void nvme_update_cq_eventidx(const NvmeCQueue *cq)
+{
+    uint32_t eventidx = cpu_to_le32(cq->head);
+
+    pci_dma_write(&cq->ctrl->parent_obj, cq->ei_addr, &eventidx,
+                  sizeof(eventidx));
+}
+
 static void nvme_post_cqes(void *opaque)
 {
     NvmeCQueue *cq = opaque;
     NvmeCtrl *n = cq->ctrl;
     NvmeRequest *req, *next;
-    bool pending = cq->head != cq->tail;
+    bool pending;
     int ret;
 
+    if (n->dbbuf_enabled) {
+        nvme_update_cq_eventidx(cq);
+        nvme_update_cq_head(cq);
+    }
+
+    pending = cq->head != cq->tail;
+
     QTAILQ_FOREACH_SAFE(req, &cq->req_list, entry, next) {
         NvmeSQueue *sq;
         hwaddr addr;
@@ -3927,9 +4027,144 @@ static uint16_t nvme_io_cmd(NvmeCtrl *n, NvmeRequest *req)
     return NVME_INVALID_OPCODE | NVME_DNR;
 }
 
+static void nvme_iothread_nop_bh(void *opaque)
+{
+}
+
+/*
+ * Hook @notifier up to the doorbell register at @offset so that guest writes
+ * to it are signalled without exiting to the vCPU thread. With an iothread,
+ * the notifier is serviced there and @bh is scheduled to do the actual queue
+ * processing in the main loop.
+ */
+static int nvme_init_ioeventfd(NvmeCtrl *n, EventNotifier *notifier,
+                               hwaddr offset, EventNotifierHandler *handler,
+                               EventNotifierHandler *iothread_handler,
+                               AioPollFn *io_poll)
+{
+    int ret;
+
+    ret = event_notifier_init(notifier, 0);
+    if (ret < 0) {
+        return ret;
+    }
+
+    if (n->iothread) {
+        AioContext *ctx = iothread_get_aio_context(n->iothread);
+
+        aio_context_acquire(ctx);
+        aio_set_event_notifier(ctx, notifier, true, iothread_handler,
+                               io_poll);
+        aio_context_release(ctx);
+    } else {
+        event_notifier_set_handler(notifier, handler);
+    }
+
+    memory_region_add_eventfd(&n->iomem, 0x1000 + offset, 4, false, 0,
+                              notifier);
+
+    trace_pci_nvme_ioeventfd_init(offset);
+
+    return 0;
+}
+
+static void nvme_cleanup_ioeventfd(NvmeCtrl *n, EventNotifier *notifier,
+                                   hwaddr offset)
+{
+    memory_region_del_eventfd(&n->iomem, 0x1000 + offset, 4, false, 0,
+                              notifier);
+
+    if (n->iothread) {
+        AioContext *ctx = iothread_get_aio_context(n->iothread);
+
+        aio_context_acquire(ctx);
+        aio_set_event_notifier(ctx, notifier, true, NULL, NULL);
+
+        /* make sure the iothread is no longer running one of our handlers */
+        aio_wait_bh_oneshot(ctx, nvme_iothread_nop_bh, NULL);
+        aio_context_release(ctx);
+    } else {
+        event_notifier_set_handler(notifier, NULL);
+    }
+
+    event_notifier_cleanup(notifier);
+}
+
+static void nvme_sq_notifier(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (!event_notifier_test_and_clear(e)) {
+        return;
+    }
+
+    nvme_process_sq(sq);
+}
+
+static void nvme_sq_notifier_iothread(EventNotifier *e)
+{
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+
+    if (event_notifier_test_and_clear(e)) {
+        qemu_bh_schedule(sq->bh);
+    }
+}
+
+/*
+ * Polled from the iothread; a moved shadow tail is picked up without the host
+ * having to write the doorbell register at all.
+ */
+static bool nvme_sq_notifier_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    NvmeSQueue *sq = container_of(e, NvmeSQueue, notifier);
+    uint32_t tail;
+
+    if (pci_dma_read(&sq->ctrl->parent_obj, sq->db_addr, &tail,
+                     sizeof(tail))) {
+        return false;
+    }
+
+    if (le32_to_cpu(tail) == qatomic_read(&sq->tail)) {
+        return false;
+    }
+
+    qemu_bh_schedule(sq->bh);
+
+    return true;
+}
+
+static void nvme_init_sq_ioeventfd(NvmeSQueue *sq)
+{
+    NvmeCtrl *n = sq->ctrl;
+
+    if (n->iothread) {
+        sq->bh = qemu_bh_new(nvme_process_sq, sq);
+    }
+
+    if (nvme_init_ioeventfd(n, &sq->notifier, sq->sqid << 3,
+                            nvme_sq_notifier, nvme_sq_notifier_iothread,
+                            nvme_sq_notifier_poll)) {
+        if (sq->bh) {
+            qemu_bh_delete(sq->bh);
+            sq->bh = NULL;
+        }
+
+        return;
+    }
+
+    sq->ioeventfd_enabled = true;
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     n->sq[sq->sqid] = NULL;
+    if (sq->ioeventfd_enabled) {
+        nvme_cleanup_ioeventfd(n, &sq->notifier, sq->sqid << 3);
+    }
+    if (sq->bh) {
+        qemu_bh_delete(sq->bh);
+    }
     timer_free(sq->timer);
     g_free(sq->io_req);
     if (sq->sqid) {
@@ -3989,7 +4224,8 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
     sq->sqid = sqid;
     sq->size = size;
     sq->cqid = cqid;
-    sq->head = sq->tail = 0;
+    sq->head = 0;
+    qatomic_set(&sq->tail, 0);
     sq->io_req = g_new0(NvmeRequest, sq->size);
 
     QTAILQ_INIT(&sq->req_list);
@@ -4000,6 +4236,15 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
     }
     sq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_process_sq, sq);
 
+    if (n->dbbuf_enabled) {
+        sq->db_addr = n->dbbuf_dbs + (sqid << 3);
+        sq->ei_addr = n->dbbuf_eis + (sqid << 3);
+
+        if (n->params.ioeventfd && sqid) {
+            nvme_init_sq_ioeventfd(sq);
+        }
+    }
+
     assert(n->cq[cqid]);
     cq = n->cq[cqid];
     QTAILQ_INSERT_TAIL(&(cq->sq_list), sq, entry);
@@ -4295,9 +4540,81 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
     }
 }
 
+static void nvme_cq_notifier(EventNotifier *e)
+{
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, notifier);
+
+    if (!event_notifier_test_and_clear(e)) {
+        return;
+    }
+
+    nvme_post_cqes(cq);
+}
+
+static void nvme_cq_notifier_iothread(EventNotifier *e)
+{
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, notifier);
+
+    if (event_notifier_test_and_clear(e)) {
+        qemu_bh_schedule(cq->bh);
+    }
+}
+
+/*
+ * Polled from the iothread like nvme_sq_notifier_poll().  Without an io_poll
+ * callback, the CQ notifiers would disable polling for the whole AioContext.
+ */
+static bool nvme_cq_notifier_poll(void *opaque)
+{
+    EventNotifier *e = opaque;
+    NvmeCQueue *cq = container_of(e, NvmeCQueue, notifier);
+    uint32_t head;
+
+    if (pci_dma_read(&cq->ctrl->parent_obj, cq->db_addr, &head,
+                     sizeof(head))) {
+        return false;
+    }
+
+    if (le32_to_cpu(head) == qatomic_read(&cq->head)) {
+        return false;
+    }
+
+    qemu_bh_schedule(cq->bh);
+
+    return true;
+}
+
+static void nvme_init_cq_ioeventfd(NvmeCQueue *cq)
+{
+    NvmeCtrl *n = cq->ctrl;
+
+    if (n->iothread) {
+        cq->bh = qemu_bh_new(nvme_post_cqes, cq);
+    }
+
+    if (nvme_init_ioeventfd(n, &cq->notifier, (cq->cqid << 3) + (1 << 2),
+                            nvme_cq_notifier, nvme_cq_notifier_iothread,
+                            nvme_cq_notifier_poll)) {
+        if (cq->bh) {
+            qemu_bh_delete(cq->bh);
+            cq->bh = NULL;
+        }
+
+        return;
+    }
+
+    cq->ioeventfd_enabled = true;
+}
+
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     n->cq[cq->cqid] = NULL;
+    if (cq->ioeventfd_enabled) {
+        nvme_cleanup_ioeventfd(n, &cq->notifier, (cq->cqid << 3) + (1 << 2));
+    }
+    if (cq->bh) {
+        qemu_bh_delete(cq->bh);
+    }
     timer_free(cq->timer);
     if (msix_enabled(&n->parent_obj)) {
         msix_vector_unuse(&n->parent_obj, cq->vector);
@@ -4351,9 +4668,18 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
     cq->phase = 1;
     cq->irq_enabled = irq_enabled;
     cq->vector = vector;
-    cq->head = cq->tail = 0;
+    qatomic_set(&cq->head, 0);
+    cq->tail = 0;
     QTAILQ_INIT(&cq->req_list);
     QTAILQ_INIT(&cq->sq_list);
+    if (n->dbbuf_enabled) {
+        cq->db_addr = n->dbbuf_dbs + (cqid << 3) + (1 << 2);
+        cq->ei_addr = n->dbbuf_eis + (cqid << 3) + (1 << 2);
+
+        if (n->params.ioeventfd && cqid) {
+            nvme_init_cq_ioeventfd(cq);
+        }
+    }
     n->cq[cqid] = cq;
     cq->timer = timer_new_ns(QEMU_CLOCK_VIRTUAL, nvme_post_cqes, cq);
 }
@@ -5464,6 +5790,62 @@ out:
     return status;
 }
 
+static uint16_t nvme_dbbuf_config(NvmeCtrl *n, const NvmeRequest *req)
+{
+    uint64_t dbs_addr = le64_to_cpu(req->cmd.dptr.prp1);
+    uint64_t eis_addr = le64_to_cpu(req->cmd.dptr.prp2);
+    int i;
+
+    /* Address should be page aligned */
+    if (dbs_addr & (n->page_size - 1) || eis_addr & (n->page_size - 1)) {
+        return NVME_INVALID_FIELD | NVME_DNR;
+    }
+
+    trace_pci_nvme_dbbuf_config(dbs_addr, eis_addr);
+
+    /* Save shadow buffer base addr for use during queue creation */
+    n->dbbuf_dbs = dbs_addr;
+    n->dbbuf_eis = eis_addr;
+    n->dbbuf_enabled = true;
+
+    for (i = 0; i < n->params.max_ioqpairs + 1; i++) {
+        NvmeSQueue *sq = n->sq[i];
+        NvmeCQueue *cq = n->cq[i];
+
+        /*
+         * CAP.DSTRD is 0, so the doorbells are laid out the same way as the
+         * registers decoded by nvme_process_db().
+         */
+        if (sq) {
+            uint32_t tail = cpu_to_le32(sq->tail);
+
+            sq->db_addr = dbs_addr + (i << 3);
+            sq->ei_addr = eis_addr + (i << 3);
+            pci_dma_write(&n->parent_obj, sq->db_addr, &tail, sizeof(tail));
+            nvme_update_sq_eventidx(sq);
+
+            if (n->params.ioeventfd && sq->sqid && !sq->ioeventfd_enabled) {
+                nvme_init_sq_ioeventfd(sq);
+            }
+        }
+
+        if (cq) {
+            uint32_t head = cpu_to_le32(cq->head);
+
+            cq->db_addr = dbs_addr + (i << 3) + (1 << 2);
+            cq->ei_addr = eis_addr + (i << 3) + (1 << 2);
+            pci_dma_write(&n->parent_obj, cq->db_addr, &head, sizeof(head));
+            nvme_update_cq_eventidx(cq);
+
+            if (n->params.ioeventfd && cq->cqid && !cq->ioeventfd_enabled) {
+                nvme_init_cq_ioeventfd(cq);
+            }
+        }
+    }
+
+    return NVME_SUCCESS;
+}
+
 static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
 {
     trace_pci_nvme_admin_cmd(nvme_cid(req), nvme_sqid(req), req->cmd.opcode,
@@ -5506,6 +5888,8 @@ static uint16_t nvme_admin_cmd(NvmeCtrl *n, NvmeRequest *req)
         return nvme_aer(n, req);
     case NVME_ADM_CMD_NS_ATTACHMENT:
         return nvme_ns_attachment(n, req);
+    case NVME_ADM_CMD_DBBUF_CONFIG:
+        return nvme_dbbuf_config(n, req);
     case NVME_ADM_CMD_FORMAT_NVM:
         return nvme_format(n, req);
     default:
@@ -5526,6 +5910,10 @@ static void nvme_process_sq(void *opaque)
     NvmeCmd cmd;
     NvmeRequest *req;
 
+    if (n->dbbuf_enabled) {
+        nvme_update_sq_tail(sq);
+    }
+
     while (!(nvme_sq_empty(sq) || QTAILQ_EMPTY(&sq->req_list))) {
         addr = sq->dma_addr + sq->head * n->sqe_size;
         if (nvme_addr_read(n, addr, (void *)&cmd, sizeof(cmd))) {
@@ -5549,6 +5937,15 @@ static void nvme_process_sq(void *opaque)
             req->status = status;
             nvme_enqueue_req_completion(cq, req);
         }
+
+        if (n->dbbuf_enabled && nvme_sq_empty(sq)) {
+            /*
+             * Ask for a doorbell write on the next submission and pick up
+             * anything that was queued before the host could see the update.
+             */
+            nvme_update_sq_eventidx(sq);
+            nvme_update_sq_tail(sq);
+        }
     }
 }
 
@@ -5586,6 +5983,10 @@ static void nvme_ctrl_reset(NvmeCtrl *n)
     n->aer_queued = 0;
     n->outstanding_aers = 0;
     n->qs_created = false;
+
+    n->dbbuf_dbs = 0;
+    n->dbbuf_eis = 0;
+    n->dbbuf_enabled = false;
 }
 
 static void nvme_ctrl_shutdown(NvmeCtrl *n)
@@ -6043,6 +6444,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         uint16_t new_head = val & 0xffff;
         int start_sqs;
+        bool pending;
         NvmeCQueue *cq;
 
         qid = (addr - (0x1000 + (1 << 2))) >> 3;
@@ -6094,7 +6496,18 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         trace_pci_nvme_mmio_doorbell_cq(cq->cqid, new_head);
 
         start_sqs = nvme_cq_full(cq) ? 1 : 0;
-        cq->head = new_head;
+        pending = cq->head != cq->tail;
+        qatomic_set(&cq->head, new_head);
+        if (!qid && n->dbbuf_enabled) {
+            /*
+             * Drivers commonly keep ringing the admin queue doorbells through
+             * the register only; mirror the value so the shadow doorbell
+             * buffer does not hold a stale head.
+             */
+            uint32_t head = cpu_to_le32(cq->head);
+
+            pci_dma_write(&n->parent_obj, cq->db_addr, &head, sizeof(head));
+        }
         if (start_sqs) {
             NvmeSQueue *sq;
             QTAILQ_FOREACH(sq, &cq->sq_list, entry) {
@@ -6104,7 +6517,7 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
         }
 
         if (cq->tail == cq->head) {
-            if (cq->irq_enabled) {
+            if (cq->irq_enabled && pending) {
                 n->cq_pending--;
             }
 
@@ -6151,7 +6564,12 @@ static void nvme_process_db(NvmeCtrl *n, hwaddr addr, int val)
 
         trace_pci_nvme_mmio_doorbell_sq(sq->sqid, new_tail);
 
-        sq->tail = new_tail;
+        qatomic_set(&sq->tail, new_tail);
+        if (!qid && n->dbbuf_enabled) {
+            uint32_t tail = cpu_to_le32(sq->tail);
+
+            pci_dma_write(&n->parent_obj, sq->db_addr, &tail, sizeof(tail));
+        }
         timer_mod(sq->timer, qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) + 500);
     }
 }
@@ -6264,6 +6682,11 @@ static void nvme_check_constraints(NvmeCtrl *n, Error **errp)
         error_setg(errp, "vsl must be non-zero");
         return;
     }
+
+    if (n->iothread && !n->params.ioeventfd) {
+        error_setg(errp, "iothread requires ioeventfd to be enabled");
+        return;
+    }
 }
 
 static void nvme_init_state(NvmeCtrl *n)
@@ -6429,7 +6852,8 @@ static void nvme_init_ctrl(NvmeCtrl *n, PCIDevice *pci_dev)
 
     id->mdts = n->params.mdts;
     id->ver = cpu_to_le32(NVME_SPEC_VER);
-    id->oacs = cpu_to_le16(NVME_OACS_NS_MGMT | NVME_OACS_FORMAT);
+    id->oacs = cpu_to_le16(NVME_OACS_NS_MGMT | NVME_OACS_FORMAT |
+                           NVME_OACS_DBBUF);
     id->cntrltype = 0x1;
 
     /*
@@ -6617,6 +7041,9 @@ static Property nvme_props[] = {
     DEFINE_PROP_UINT8("vsl", NvmeCtrl, params.vsl, 7),
     DEFINE_PROP_BOOL("use-intel-id", NvmeCtrl, params.use_intel_id, false),
     DEFINE_PROP_BOOL("legacy-cmb", NvmeCtrl, params.legacy_cmb, false),
+    DEFINE_PROP_BOOL("ioeventfd", NvmeCtrl, params.ioeventfd, false),
+    DEFINE_PROP_LINK("iothread", NvmeCtrl, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_UINT8("zoned.zasl", NvmeCtrl, params.zasl, 0),
     DEFINE_PROP_BOOL("zoned.auto_transition", NvmeCtrl,
                      params.auto_transition_zones, true),
@@ -0,0 +1,655 @@
+/*
+ * vhost shadow virtqueue
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/virtio/vhost-shadow-virtqueue.h"
+
+#include <linux/vhost.h>
+#include "qemu/error-report.h"
+#include "qemu/log.h"
+#include "qemu/main-loop.h"
+#include "qapi/error.h"
+#include "standard-headers/linux/virtio_config.h"
+#include "standard-headers/linux/virtio_ring.h"
+
+/**
+ * vhost_svq_filter_features:
+ * @features: Device features
+ *
+ * Returns the subset of @features the shadow virtqueue can offer to the
+ * guest.  The device side is always driven as a split ring without indirect
+ * descriptors or event idx, and the ring addresses it sees are IOVA, so
+ * every transport feature but VERSION_1 and ACCESS_PLATFORM is cleared.
+ */
+uint64_t vhost_svq_filter_features(uint64_t features)
+{
+    uint64_t allowed = BIT_ULL(VIRTIO_F_VERSION_1) |
+                       BIT_ULL(VIRTIO_F_ACCESS_PLATFORM);
+    unsigned b;
+
+    for (b = VIRTIO_TRANSPORT_F_START; b <= VIRTIO_TRANSPORT_F_END; ++b) {
+        if (!(allowed & BIT_ULL(b))) {
+            features &= ~BIT_ULL(b);
+        }
+    }
+
+    return features & ~BIT_ULL(VIRTIO_F_NOTIFY_ON_EMPTY);
+}
+
+/**
+ * Translate guest buffers to device IOVA
+ *
+ * @svq: Shadow virtqueue
+ * @addrs: Translated IOVA addresses
+ * @iovec: Host virtual addresses of the guest buffers
+ * @num: Number of entries in @iovec
+ *
+ * Returns false if some buffer is not in a region mapped to the device.
+ */
+static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
+                                     hwaddr *addrs, const struct iovec *iovec,
+                                     size_t num)
+{
+    size_t i;
+
+    for (i = 0; i < num; ++i) {
+        DMAMap needle = {
+            .translated_addr = (hwaddr)(uintptr_t)iovec[i].iov_base,
+            .size = iovec[i].iov_len ? iovec[i].iov_len - 1 : 0,
+        };
+        const DMAMap *map = iova_tree_find_iova(svq->iova_tree, &needle);
+
+        if (unlikely(!map)) {
+            qemu_log_mask(LOG_GUEST_ERROR,
+                          "Invalid address 0x%"HWADDR_PRIx" given by guest",
+                          needle.translated_addr);
+            return false;
+        }
+
+        addrs[i] = map->iova + (needle.translated_addr - map->translated_addr);
+    }
+
+    return true;
+}
+
+static void vhost_svq_write_descs(VhostShadowVirtqueue *svq, hwaddr *addrs,
+                                  const struct iovec *iovec, size_t num,
+                                  bool more_descs, bool write)
+{
+    vring_desc_t *descs = svq->vring.desc;
+    uint16_t i = svq->free_head;
+    size_t n;
+
+    for (n = 0; n < num; n++) {
+        uint16_t flags = write ? VRING_DESC_F_WRITE : 0;
+
+        if (more_descs || (n + 1 < num)) {
+            flags |= VRING_DESC_F_NEXT;
+        }
+        descs[i].addr = cpu_to_le64(addrs[n]);
+        descs[i].len = cpu_to_le32(iovec[n].iov_len);
+        descs[i].flags = cpu_to_le16(flags);
+        descs[i].next = cpu_to_le16(svq->desc_next[i]);
+
+        i = svq->desc_next[i];
+    }
+
+    svq->free_head = i;
+    svq->num_free -= num;
+}
+
+static bool vhost_svq_add(VhostShadowVirtqueue *svq, VirtQueueElement *elem)
+{
+    unsigned ndescs = elem->in_num + elem->out_num;
+    g_autofree hwaddr *addrs = g_new(hwaddr, ndescs);
+    uint16_t head = svq->free_head;
+    uint16_t avail_idx;
+
+    if (!vhost_svq_translate_addr(svq, addrs, elem->out_sg, elem->out_num) ||
+        !vhost_svq_translate_addr(svq, addrs + elem->out_num, elem->in_sg,
+                                  elem->in_num)) {
+        return false;
+    }
+
+    vhost_svq_write_descs(svq, addrs, elem->out_sg, elem->out_num,
+                          elem->in_num > 0, false);
+    vhost_svq_write_descs(svq, addrs + elem->out_num, elem->in_sg,
+                          elem->in_num, false, true);
+
+    svq->ring_id_maps[head].elem = elem;
+    svq->ring_id_maps[head].ndescs = ndescs;
+
+    /*
+     * Put the entry in the available array (but don't update avail->idx until
+     * they do sync).
+     */
+    avail_idx = svq->shadow_avail_idx % svq->vring.num;
+    svq->vring.avail->ring[avail_idx] = cpu_to_le16(head);
+    svq->shadow_avail_idx++;
+
+    /* Update the avail index after write the descriptor */
+    smp_wmb();
+    svq->vring.avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+
+    return true;
+}
+
+static void vhost_svq_kick(VhostShadowVirtqueue *svq)
+{
+    /* We need to expose the available array entries before checking flags */
+    smp_mb();
+    if (le16_to_cpu(svq->vring.used->flags) & VRING_USED_F_NO_NOTIFY) {
+        return;
+    }
+
+    event_notifier_set(&svq->hdev_kick);
+}
+
+/*
+ * Complete a guest element without handing it to the device, so a single
+ * bad element does not stall the whole queue.
+ */
+static void vhost_svq_discard_element(VhostShadowVirtqueue *svq,
+                                      VirtQueueElement *elem)
+{
+    virtqueue_push(svq->vq, elem, 0);
+    g_free(elem);
+
+    /* The in-flight buffers are not the last ones popped any more */
+    svq->in_order = false;
+
+    if (virtio_queue_should_notify(svq->vdev, svq->vq)) {
+        event_notifier_set(&svq->svq_call);
+    }
+}
+
+/**
+ * Forward available buffers from the guest vring to the shadow vring.
+ *
+ * @svq: Shadow VirtQueue
+ *
+ * Stops when the shadow vring is full; vhost_svq_flush resumes it once the
+ * device has used some descriptors.
+ */
+static void vhost_svq_forward_avail(VhostShadowVirtqueue *svq)
+{
+    bool kick = false;
+
+    /* Clear event notifier */
+    event_notifier_test_and_clear(&svq->svq_kick);
+
+    /* Forward to the device as many available buffers as possible */
+    do {
+        virtio_queue_set_notification(svq->vq, false);
+
+        while (true) {
+            VirtQueueElement *elem;
+            unsigned ndescs;
+
+            if (svq->next_guest_avail_elem) {
+                elem = g_steal_pointer(&svq->next_guest_avail_elem);
+            } else {
+                elem = virtqueue_pop(svq->vq, sizeof(*elem));
+            }
+
+            if (!elem) {
+                break;
+            }
+
+            ndescs = elem->out_num + elem->in_num;
+            if (unlikely(ndescs > svq->vring.num)) {
+                qemu_log_mask(LOG_GUEST_ERROR,
+                              "%s: element with %u buffers does not fit in "
+                              "a shadow vring of %u", svq->vdev->name, ndescs,
+                              svq->vring.num);
+                vhost_svq_discard_element(svq, elem);
+                continue;
+            }
+
+            if (ndescs > svq->num_free) {
+                /*
+                 * This condition is possible since a contiguous buffer in GPA
+                 * does not imply a contiguous buffer in qemu's VA
+                 * scatter-gather segments. If that happens, the buffer exposed
+                 * to the device needs to be a chain of descriptors at this
+                 * moment.
+                 *
+                 * SVQ cannot hold more available buffers if we are here:
+                 * queue the current guest descriptor and ignore further kicks
+                 * until some elements are used.
+                 */
+                svq->next_guest_avail_elem = elem;
+                goto out;
+            }
+
+            if (unlikely(!vhost_svq_add(svq, elem))) {
+                vhost_svq_discard_element(svq, elem);
+                continue;
+            }
+
+            kick = true;
+        }
+
+        virtio_queue_set_notification(svq->vq, true);
+    } while (!virtio_queue_empty(svq->vq));
+
+out:
+    if (kick) {
+        vhost_svq_kick(svq);
+    }
+}
+
+/**
+ * Handle guest's kick.
+ *
+ * @n: guest kick event notifier, the one that guest set to notify svq.
+ */
+static void vhost_handle_guest_kick(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             svq_kick);
+
+    if (unlikely(!svq->vq)) {
+        event_notifier_test_and_clear(n);
+        return;
+    }
+
+    vhost_svq_forward_avail(svq);
+}
+
+static bool vhost_svq_more_used(VhostShadowVirtqueue *svq)
+{
+    if (svq->last_used_idx != svq->shadow_used_idx) {
+        return true;
+    }
+
+    svq->shadow_used_idx = le16_to_cpu(qatomic_read(&svq->vring.used->idx));
+
+    return svq->last_used_idx != svq->shadow_used_idx;
+}
+
+/**
+ * Enable vhost device calls after disable them.
+ *
+ * @svq: The svq
+ *
+ * It returns false if there are pending used buffers from the vhost device,
+ * avoiding the possible races between SVQ checking for more work and enabling
+ * callbacks. True if SVQ used vring has no more pending buffers.
+ */
+static bool vhost_svq_enable_notification(VhostShadowVirtqueue *svq)
+{
+    svq->vring.avail->flags &= ~cpu_to_le16(VRING_AVAIL_F_NO_INTERRUPT);
+    /* Make sure the flag is written before the read of used_idx */
+    smp_mb();
+    return !vhost_svq_more_used(svq);
+}
+
+static void vhost_svq_disable_notification(VhostShadowVirtqueue *svq)
+{
+    svq->vring.avail->flags |= cpu_to_le16(VRING_AVAIL_F_NO_INTERRUPT);
+}
+
+static void vhost_svq_free_descs(VhostShadowVirtqueue *svq, uint16_t head)
+{
+    unsigned ndescs = svq->ring_id_maps[head].ndescs;
+    uint16_t last = head;
+    unsigned i;
+
+    for (i = 1; i < ndescs; ++i) {
+        last = svq->desc_next[last];
+    }
+
+    svq->desc_next[last] = svq->free_head;
+    svq->free_head = head;
+    svq->num_free += ndescs;
+}
+
+static VirtQueueElement *vhost_svq_get_buf(VhostShadowVirtqueue *svq,
+                                           uint32_t *len)
+{
+    const vring_used_t *used = svq->vring.used;
+    uint16_t slot, expected;
+    uint32_t id;
+
+    if (!vhost_svq_more_used(svq)) {
+        return NULL;
+    }
+
+    /* Only get used array entries after they have been exposed by dev */
+    smp_rmb();
+    slot = svq->last_used_idx % svq->vring.num;
+    id = le32_to_cpu(used->ring[slot].id);
+    *len = le32_to_cpu(used->ring[slot].len);
+
+    /*
+     * No more than vring.num buffers are in flight, so the avail slot with
+     * the same index still holds the head made available in that position.
+     */
+    expected = le16_to_cpu(svq->vring.avail->ring[slot]);
+    svq->last_used_idx++;
+
+    if (unlikely(id >= svq->vring.num || !svq->ring_id_maps[id].elem)) {
+        qemu_log_mask(LOG_GUEST_ERROR,
+                      "Device %s says index %u is used, but it was not "
+                      "available", svq->vdev->name, id);
+        return NULL;
+    }
+
+    if (id != expected) {
+        svq->in_order = false;
+    }
+
+    vhost_svq_free_descs(svq, id);
+    return g_steal_pointer(&svq->ring_id_maps[id].elem);
+}
+
+/**
+ * Forward used buffers to the guest.
+ *
+ * @svq: Shadow virtqueue
+ * @check_for_avail_queue: Retry the guest element that did not fit
+ *
+ * virtqueue_fill unmaps the in_sg of every element, which marks the guest
+ * pages the device wrote as dirty for migration.
+ */
+static void vhost_svq_flush(VhostShadowVirtqueue *svq,
+                            bool check_for_avail_queue)
+{
+    VirtQueue *vq = svq->vq;
+
+    /* Forward as many used buffers as possible. */
+    do {
+        unsigned i = 0;
+
+        vhost_svq_disable_notification(svq);
+        while (true) {
+            uint32_t len;
+            g_autofree VirtQueueElement *elem = vhost_svq_get_buf(svq, &len);
+
+            if (!elem) {
+                break;
+            }
+
+            if (unlikely(i >= svq->vring.num)) {
+                virtqueue_flush(vq, i);
+                i = 0;
+            }
+            virtqueue_fill(vq, elem, len, i++);
+        }
+
+        if (i) {
+            virtqueue_flush(vq, i);
+            if (virtio_queue_should_notify(svq->vdev, vq)) {
+                event_notifier_set(&svq->svq_call);
+            }
+        }
+
+        if (check_for_avail_queue && svq->next_guest_avail_elem) {
+            /*
+             * Avail ring was full when vhost_svq_flush was called, so it's a
+             * good moment to make more descriptors available if possible.
+             */
+            vhost_svq_forward_avail(svq);
+        }
+    } while (!vhost_svq_enable_notification(svq));
+}
+
+/**
+ * Forward used buffers.
+ *
+ * @n: hdev call event notifier, the one that device set to notify svq.
+ */
+static void vhost_svq_handle_call(EventNotifier *n)
+{
+    VhostShadowVirtqueue *svq = container_of(n, VhostShadowVirtqueue,
+                                             hdev_call);
+
+    event_notifier_test_and_clear(n);
+    if (unlikely(!svq->vq)) {
+        return;
+    }
+
+    vhost_svq_flush(svq, true);
+}
+
+/**
+ * Set the call notifier for the SVQ to call the guest
+ *
+ * @svq: Shadow virtqueue
+ * @call_fd: call notifier
+ */
+void vhost_svq_set_svq_call_fd(VhostShadowVirtqueue *svq, int call_fd)
+{
+    event_notifier_init_fd(&svq->svq_call, call_fd);
+}
+
+/**
+ * Set a new file descriptor for the guest to kick the SVQ and notify for avail
+ *
+ * @svq: The svq
+ * @svq_kick_fd: The svq kick fd
+ *
+ * Note that the SVQ will never close the old file descriptor.
+ */
+void vhost_svq_set_svq_kick_fd(VhostShadowVirtqueue *svq, int svq_kick_fd)
+{
+    EventNotifier *svq_kick = &svq->svq_kick;
+    bool poll_stop = VHOST_FILE_UNBIND != event_notifier_get_fd(svq_kick);
+    bool poll_start = svq_kick_fd != VHOST_FILE_UNBIND;
+
+    if (poll_stop) {
+        event_notifier_set_handler(svq_kick, NULL);
+    }
+
+    /*
+     * event_notifier_set_handler already checks for guest's notifications if
+     * they arrive at the new file descriptor in the switch, so there is no
+     * need to explicitly check for them.
+     */
+    event_notifier_init_fd(svq_kick, svq_kick_fd);
+    if (poll_start) {
+        event_notifier_set(svq_kick);
+        event_notifier_set_handler(svq_kick, vhost_handle_guest_kick);
+    }
+}
+
+/**
+ * Get the shadow vq vring address.
+ *
+ * @svq: Shadow virtqueue
+ * @addr: Destination to store address
+ *
+ * The addresses are qemu's virtual addresses; the caller translates them to
+ * the IOVA it maps the rings at.
+ */
+void vhost_svq_get_vring_addr(const VhostShadowVirtqueue *svq,
+                              struct vhost_vring_addr *addr)
+{
+    addr->desc_user_addr = (uint64_t)(uintptr_t)svq->vring.desc;
+    addr->avail_user_addr = (uint64_t)(uintptr_t)svq->vring.avail;
+    addr->used_user_addr = (uint64_t)(uintptr_t)svq->vring.used;
+}
+
+size_t vhost_svq_driver_area_size(const VhostShadowVirtqueue *svq)
+{
+    size_t desc_size = sizeof(vring_desc_t) * svq->vring.num;
+    size_t avail_size = offsetof(vring_avail_t, ring) +
+                        sizeof(uint16_t) * svq->vring.num;
+
+    return ROUND_UP(desc_size + avail_size, qemu_real_host_page_size);
+}
+
+size_t vhost_svq_device_area_size(const VhostShadowVirtqueue *svq)
+{
+    size_t used_size = offsetof(vring_used_t, ring) +
+                       sizeof(vring_used_elem_t) * svq->vring.num;
+
+    return ROUND_UP(used_size, qemu_real_host_page_size);
+}
+
+/**
+ * Start the shadow virtqueue operation.
+ *
+ * @svq: Shadow Virtqueue
+ * @vdev: VirtIO device
+ * @vq: Virtqueue to shadow
+ */
+void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
+                     VirtQueue *vq)
+{
+    size_t desc_size, driver_size, device_size;
+    unsigned i;
+
+    svq->next_guest_avail_elem = NULL;
+    svq->shadow_avail_idx = 0;
+    svq->shadow_used_idx = 0;
+    svq->last_used_idx = 0;
+    svq->in_order = true;
+    svq->vdev = vdev;
+    svq->vq = vq;
+
+    svq->vring.num = virtio_queue_get_num(vdev, virtio_get_queue_index(vq));
+    driver_size = vhost_svq_driver_area_size(svq);
+    device_size = vhost_svq_device_area_size(svq);
+    svq->vring.desc = qemu_memalign(qemu_real_host_page_size, driver_size);
+    desc_size = sizeof(vring_desc_t) * svq->vring.num;
+    svq->vring.avail = (void *)((char *)svq->vring.desc + desc_size);
+    memset(svq->vring.desc, 0, driver_size);
+    svq->vring.used = qemu_memalign(qemu_real_host_page_size, device_size);
+    memset(svq->vring.used, 0, device_size);
+
+    svq->ring_id_maps = g_new0(SVQElement, svq->vring.num);
+    svq->desc_next = g_new(uint16_t, svq->vring.num);
+    for (i = 0; i < svq->vring.num - 1; i++) {
+        svq->desc_next[i] = i + 1;
+    }
+    svq->desc_next[svq->vring.num - 1] = 0;
+    svq->free_head = 0;
+    svq->num_free = svq->vring.num;
+}
+
+/*
+ * Give an element the device never used back to the guest.  While the device
+ * has used every buffer in order, the pending ones are exactly the last ones
+ * popped and can be returned to the guest ring, so the destination processes
+ * them again.  Otherwise they can only be detached and are lost.
+ */
+static unsigned vhost_svq_return_element(VhostShadowVirtqueue *svq,
+                                         VirtQueueElement *elem)
+{
+    unsigned lost = 0;
+
+    if (svq->in_order) {
+        virtqueue_unpop(svq->vq, elem, 0);
+    } else {
+        virtqueue_detach_element(svq->vq, elem, 0);
+        lost = 1;
+    }
+    g_free(elem);
+    return lost;
+}
+
+/**
+ * Stop the shadow virtqueue operation.
+ *
+ * @svq: Shadow Virtqueue
+ *
+ * The device must not access the shadow vring anymore.
+ */
+void vhost_svq_stop(VhostShadowVirtqueue *svq)
+{
+    unsigned i, lost = 0;
+
+    vhost_svq_set_svq_kick_fd(svq, VHOST_FILE_UNBIND);
+
+    if (!svq->vq) {
+        return;
+    }
+
+    /* Send all pending used descriptors to guest */
+    vhost_svq_flush(svq, false);
+
+    if (svq->next_guest_avail_elem) {
+        lost += vhost_svq_return_element(svq,
+                                g_steal_pointer(&svq->next_guest_avail_elem));
+    }
+
+    for (i = 0; i < svq->vring.num; ++i) {
+        VirtQueueElement *elem = g_steal_pointer(&svq->ring_id_maps[i].elem);
+
+        if (elem) {
+            lost += vhost_svq_return_element(svq, elem);
+        }
+    }
+
+    if (lost) {
+        warn_report("%s: %u in-flight buffers were used out of order and "
+                    "could not be returned to the guest", svq->vdev->name,
+                    lost);
+    }
+
+    svq->vq = NULL;
+    g_free(svq->desc_next);
+    svq->desc_next = NULL;
+    g_free(svq->ring_id_maps);
+    svq->ring_id_maps = NULL;
+    qemu_vfree(svq->vring.desc);
+    svq->vring.desc = NULL;
+    svq->vring.avail = NULL;
+    qemu_vfree(svq->vring.used);
+    svq->vring.used = NULL;
+}
+
+/**
+ * Creates vhost shadow virtqueue.  It does nothing until vhost_svq_start.
+ *
+ * @iova_tree: Tree to translate qemu's virtual addresses to device IOVA
+ * @errp: Error pointer
+ *
+ * Returns the new virtqueue or NULL.
+ */
+VhostShadowVirtqueue *vhost_svq_new(IOVATree *iova_tree, Error **errp)
+{
+    g_autofree VhostShadowVirtqueue *svq = g_new0(VhostShadowVirtqueue, 1);
+    int r;
+
+    r = event_notifier_init(&svq->hdev_kick, 0);
+    if (r != 0) {
+        error_setg_errno(errp, -r, "Couldn't create kick event notifier");
+        return NULL;
+    }
+
+    r = event_notifier_init(&svq->hdev_call, 0);
+    if (r != 0) {
+        error_setg_errno(errp, -r, "Couldn't create call event notifier");
+        event_notifier_cleanup(&svq->hdev_kick);
+        return NULL;
+    }
+
+    event_notifier_init_fd(&svq->svq_kick, VHOST_FILE_UNBIND);
+    event_notifier_init_fd(&svq->svq_call, VHOST_FILE_UNBIND);
+    event_notifier_set_handler(&svq->hdev_call, vhost_svq_handle_call);
+    svq->iova_tree = iova_tree;
+    return g_steal_pointer(&svq);
+}
+
+/**
+ * Free the resources of the shadow virtqueue.
+ *
+ * @pvq: gpointer to SVQ so it can be used by autofree functions.
+ */
+void vhost_svq_free(gpointer pvq)
+{
+    VhostShadowVirtqueue *vq = pvq;
+
+    vhost_svq_stop(vq);
+    event_notifier_cleanup(&vq->hdev_kick);
+    event_notifier_set_handler(&vq->hdev_call, NULL);
+    event_notifier_cleanup(&vq->hdev_call);
+    g_free(vq);
+}
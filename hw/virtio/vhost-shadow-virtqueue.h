@@ -0,0 +1,105 @@
+/*
+ * vhost shadow virtqueue
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef VHOST_SHADOW_VIRTQUEUE_H
+#define VHOST_SHADOW_VIRTQUEUE_H
+
+#include "qemu/event_notifier.h"
+#include "qemu/iova-tree.h"
+#include "hw/virtio/virtio.h"
+#include "standard-headers/linux/vhost_types.h"
+
+typedef struct SVQElement {
+    /* Guest element, or NULL if the descriptor chain is free */
+    VirtQueueElement *elem;
+
+    /* Number of shadow descriptors used by the element */
+    unsigned int ndescs;
+} SVQElement;
+
+/* Shadow virtqueue to relay notifications and buffers */
+typedef struct VhostShadowVirtqueue {
+    /* Shadow vring, exposed to the device */
+    struct vring vring;
+
+    /* Shadow kick notifier, sent to vhost */
+    EventNotifier hdev_kick;
+    /* Shadow call notifier, sent to vhost */
+    EventNotifier hdev_call;
+
+    /*
+     * Borrowed virtqueue's guest to host notifier. To borrow it in this event
+     * notifier allows to recover the VhostShadowVirtqueue from the event loop
+     * easily. If we use the VirtQueue's one, we don't have an easy way to
+     * retrieve VhostShadowVirtqueue.
+     *
+     * So shadow virtqueue must not clean it, or we would lose VirtQueue one.
+     */
+    EventNotifier svq_kick;
+
+    /* Guest's call notifier, where the SVQ calls guest. */
+    EventNotifier svq_call;
+
+    /* Virtio queue shadowing, NULL while the SVQ is stopped */
+    VirtQueue *vq;
+
+    /* Virtio device */
+    VirtIODevice *vdev;
+
+    /* Host virtual address to device IOVA translations */
+    IOVATree *iova_tree;
+
+    /* Map for use the guest's descriptors, indexed by head descriptor */
+    SVQElement *ring_id_maps;
+
+    /* Next guest element that did not fit in the shadow vring */
+    VirtQueueElement *next_guest_avail_elem;
+
+    /* Next descriptor of each descriptor chain, and free list links */
+    uint16_t *desc_next;
+
+    /* Head of the free descriptor list */
+    uint16_t free_head;
+
+    /* Number of free descriptors */
+    uint16_t num_free;
+
+    /* Next avail ring index to expose to the device */
+    uint16_t shadow_avail_idx;
+
+    /* Last used ring index seen from the device */
+    uint16_t shadow_used_idx;
+
+    /* Next used ring index to process */
+    uint16_t last_used_idx;
+
+    /*
+     * True while every buffer has been used in the same order it was made
+     * available, so the in-flight ones can be handed back to the guest ring.
+     */
+    bool in_order;
+} VhostShadowVirtqueue;
+
+uint64_t vhost_svq_filter_features(uint64_t features);
+
+void vhost_svq_set_svq_kick_fd(VhostShadowVirtqueue *svq, int svq_kick_fd);
+void vhost_svq_set_svq_call_fd(VhostShadowVirtqueue *svq, int call_fd);
+void vhost_svq_get_vring_addr(const VhostShadowVirtqueue *svq,
+                              struct vhost_vring_addr *addr);
+size_t vhost_svq_driver_area_size(const VhostShadowVirtqueue *svq);
+size_t vhost_svq_device_area_size(const VhostShadowVirtqueue *svq);
+
+void vhost_svq_start(VhostShadowVirtqueue *svq, VirtIODevice *vdev,
+                     VirtQueue *vq);
+void vhost_svq_stop(VhostShadowVirtqueue *svq);
+
+VhostShadowVirtqueue *vhost_svq_new(IOVATree *iova_tree, Error **errp);
+void vhost_svq_free(gpointer vq);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC(VhostShadowVirtqueue, vhost_svq_free);
+
+#endif
@@ -18,8 +18,12 @@
 #include "hw/virtio/vhost-backend.h"
 #include "hw/virtio/virtio-net.h"
 #include "hw/virtio/vhost-vdpa.h"
+#include "hw/virtio/vhost-shadow-virtqueue.h"
 #include "exec/address-spaces.h"
+#include "migration/blocker.h"
+#include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qapi/error.h"
 #include "cpu.h"
 #include "trace.h"
 #include "qemu-common.h"
@@ -207,12 +211,40 @@ static void vhost_vdpa_listener_region_add(MemoryListener *listener,
                                          vaddr, section->readonly);
 
     llsize = int128_sub(llend, int128_make64(iova));
+    if (v->shadow_vqs_enabled) {
+        /*
+         * The device only sees qemu's virtual addresses through the shadow
+         * vrings, so guest memory goes wherever there is free IOVA.
+         */
+        DMAMap mem_region = {
+            .translated_addr = (hwaddr)(uintptr_t)vaddr,
+            .size = int128_get64(llsize) - 1,
+            .perm = IOMMU_ACCESS_FLAG(true, !section->readonly),
+        };
+
+        ret = iova_tree_alloc_map(v->iova_tree, &mem_region,
+                                  v->iova_range.first, v->iova_range.last);
+        if (unlikely(ret != IOVA_OK)) {
+            error_report("Can't allocate a mapping (%d)", ret);
+            goto fail;
+        }
+
+        iova = mem_region.iova;
+    }
 
     vhost_vdpa_iotlb_batch_begin_once(v);
     ret = vhost_vdpa_dma_map(v, iova, int128_get64(llsize),
                              vaddr, section->readonly);
     if (ret) {
         error_report("vhost vdpa map fail!");
+        if (v->shadow_vqs_enabled) {
+            DMAMap mem_region = {
+                .iova = iova,
+                .size = int128_get64(llsize) - 1,
+            };
+
+            iova_tree_remove(v->iova_tree, &mem_region);
+        }
         goto fail;
     }
 
@@ -259,12 +291,35 @@ static void vhost_vdpa_listener_region_del(MemoryListener *listener,
 
     llsize = int128_sub(llend, int128_make64(iova));
 
+    if (v->shadow_vqs_enabled) {
+        const DMAMap *result;
+        const void *vaddr = memory_region_get_ram_ptr(section->mr) +
+            section->offset_within_region +
+            (iova - section->offset_within_address_space);
+        DMAMap mem_region = {
+            .translated_addr = (hwaddr)(uintptr_t)vaddr,
+            .size = int128_get64(llsize) - 1,
+        };
+
+        result = iova_tree_find_iova(v->iova_tree, &mem_region);
+        if (!result) {
+            /* region_add failed to map it */
+            goto out;
+        }
+
+        /* The tree entry is freed on removal, keep a copy */
+        mem_region = *result;
+        iova = mem_region.iova;
+        iova_tree_remove(v->iova_tree, &mem_region);
+    }
+
     vhost_vdpa_iotlb_batch_begin_once(v);
     ret = vhost_vdpa_dma_unmap(v, iova, int128_get64(llsize));
     if (ret) {
         error_report("vhost_vdpa dma unmap error!");
     }
 
+out:
     memory_region_unref(section->mr);
 }
 /*
@@ -326,9 +381,49 @@ static bool vhost_vdpa_one_time_request(struct vhost_dev *dev)
     return v->index != 0;
 }
 
+static int vhost_vdpa_init_svq(struct vhost_dev *hdev, struct vhost_vdpa *v,
+                               Error **errp)
+{
+    g_autoptr(GPtrArray) shadow_vqs = NULL;
+    uint64_t dev_features;
+    unsigned n;
+    int r;
+
+    if (!v->shadow_vqs_enabled) {
+        return 0;
+    }
+
+    r = vhost_vdpa_call(hdev, VHOST_GET_FEATURES, &dev_features);
+    if (r != 0) {
+        error_setg_errno(errp, -r, "Can't get vdpa device features");
+        return r;
+    }
+
+    if (!(dev_features & BIT_ULL(VIRTIO_F_VERSION_1)) ||
+        !(dev_features & BIT_ULL(VIRTIO_F_ACCESS_PLATFORM))) {
+        error_setg(errp, "Shadow virtqueues need a device offering "
+                   "VIRTIO_F_VERSION_1 and VIRTIO_F_ACCESS_PLATFORM");
+        return -ENOTSUP;
+    }
+
+    shadow_vqs = g_ptr_array_new_full(hdev->nvqs, vhost_svq_free);
+    for (n = 0; n < hdev->nvqs; ++n) {
+        VhostShadowVirtqueue *svq = vhost_svq_new(v->iova_tree, errp);
+
+        if (unlikely(!svq)) {
+            return -ENOMEM;
+        }
+        g_ptr_array_add(shadow_vqs, svq);
+    }
+
+    v->shadow_vqs = g_steal_pointer(&shadow_vqs);
+    return 0;
+}
+
 static int vhost_vdpa_init(struct vhost_dev *dev, void *opaque, Error **errp)
 {
     struct vhost_vdpa *v;
+    int r;
     assert(dev->vhost_ops->backend_type == VHOST_BACKEND_TYPE_VDPA);
     trace_vhost_vdpa_init(dev, opaque);
 
@@ -340,6 +435,12 @@ static int vhost_vdpa_init(struct vhost_dev *dev, void *opaque, Error **errp)
 
     vhost_vdpa_get_iova_range(v);
 
+    r = vhost_vdpa_init_svq(dev, v, errp);
+    if (r) {
+        dev->opaque = NULL;
+        return r;
+    }
+
     if (vhost_vdpa_one_time_request(dev)) {
         return 0;
     }
@@ -417,8 +518,14 @@ err:
 
 static void vhost_vdpa_host_notifiers_init(struct vhost_dev *dev)
 {
+    struct vhost_vdpa *v = dev->opaque;
     int i;
 
+    if (v->shadow_vqs_enabled) {
+        /* Guest kicks must reach the shadow virtqueues, not the device */
+        return;
+    }
+
     for (i = dev->vq_index; i < dev->vq_index + dev->nvqs; i++) {
         if (vhost_vdpa_host_notifier_init(dev, i)) {
             goto err;
@@ -440,6 +547,15 @@ static int vhost_vdpa_cleanup(struct vhost_dev *dev)
     trace_vhost_vdpa_cleanup(dev, v);
     vhost_vdpa_host_notifiers_uninit(dev, dev->nvqs);
     memory_listener_unregister(&v->listener);
+    if (v->shadow_vqs) {
+        g_ptr_array_free(v->shadow_vqs, true);
+        v->shadow_vqs = NULL;
+    }
+    if (v->migration_blocker) {
+        migrate_del_blocker(v->migration_blocker);
+        error_free(v->migration_blocker);
+        v->migration_blocker = NULL;
+    }
 
     dev->opaque = NULL;
     return 0;
@@ -477,15 +593,71 @@ static int vhost_vdpa_set_mem_table(struct vhost_dev *dev,
     return 0;
 }
 
+/*
+ * The shadow virtqueues relay the control virtqueue like any other, but the
+ * state it configures in the device (MAC, RX mode, number of queue pairs)
+ * is not restored on the destination.  Block migration while it is in use.
+ */
+static int vhost_vdpa_svq_update_blocker(struct vhost_vdpa *v,
+                                         uint64_t features)
+{
+    Error *local_err = NULL;
+
+    if (!virtio_has_feature(features, VIRTIO_NET_F_CTRL_VQ)) {
+        if (v->migration_blocker) {
+            migrate_del_blocker(v->migration_blocker);
+            error_free(v->migration_blocker);
+            v->migration_blocker = NULL;
+        }
+        return 0;
+    }
+
+    if (v->migration_blocker) {
+        return 0;
+    }
+
+    error_setg(&v->migration_blocker,
+               "Migration disabled: vhost-vdpa shadow virtqueues cannot "
+               "migrate the control virtqueue state");
+    if (migrate_add_blocker(v->migration_blocker, &local_err) < 0) {
+        error_report_err(local_err);
+        error_free(v->migration_blocker);
+        v->migration_blocker = NULL;
+        return -EBUSY;
+    }
+    return 0;
+}
+
 static int vhost_vdpa_set_features(struct vhost_dev *dev,
                                    uint64_t features)
 {
+    struct vhost_vdpa *v = dev->opaque;
     int ret;
 
     if (vhost_vdpa_one_time_request(dev)) {
         return 0;
     }
 
+    if (v->shadow_vqs_enabled) {
+        uint64_t changed = v->acked_features ^ features;
+
+        ret = vhost_vdpa_svq_update_blocker(v, features);
+        if (ret) {
+            return ret;
+        }
+
+        v->acked_features = features;
+        if (changed == BIT_ULL(VHOST_F_LOG_ALL)) {
+            /*
+             * Dirty tracking is done by the shadow virtqueues, the device
+             * does not need to know about it.
+             */
+            return 0;
+        }
+
+        features &= ~BIT_ULL(VHOST_F_LOG_ALL);
+    }
+
     trace_vhost_vdpa_set_features(dev, features);
     ret = vhost_vdpa_call(dev, VHOST_SET_FEATURES, &features);
     uint8_t status = 0;
@@ -620,43 +792,12 @@ static int vhost_vdpa_get_config(struct vhost_dev *dev, uint8_t *config,
     return ret;
  }
 
-static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
-{
-    struct vhost_vdpa *v = dev->opaque;
-    trace_vhost_vdpa_dev_start(dev, started);
-
-    if (started) {
-        vhost_vdpa_host_notifiers_init(dev);
-        vhost_vdpa_set_vring_ready(dev);
-    } else {
-        vhost_vdpa_host_notifiers_uninit(dev, dev->nvqs);
-    }
-
-    if (dev->vq_index + dev->nvqs != dev->last_index) {
-        return 0;
-    }
-
-    if (started) {
-        uint8_t status = 0;
-        memory_listener_register(&v->listener, &address_space_memory);
-        vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_DRIVER_OK);
-        vhost_vdpa_call(dev, VHOST_VDPA_GET_STATUS, &status);
-
-        return !(status & VIRTIO_CONFIG_S_DRIVER_OK);
-    } else {
-        vhost_vdpa_reset_device(dev);
-        vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
-                                   VIRTIO_CONFIG_S_DRIVER);
-        memory_listener_unregister(&v->listener);
-
-        return 0;
-    }
-}
-
 static int vhost_vdpa_set_log_base(struct vhost_dev *dev, uint64_t base,
                                      struct vhost_log *log)
 {
-    if (vhost_vdpa_one_time_request(dev)) {
+    struct vhost_vdpa *v = dev->opaque;
+
+    if (v->shadow_vqs_enabled || vhost_vdpa_one_time_request(dev)) {
         return 0;
     }
 
@@ -665,8 +806,8 @@ static int vhost_vdpa_set_log_base(struct vhost_dev *dev, uint64_t base,
     return vhost_vdpa_call(dev, VHOST_SET_LOG_BASE, &base);
 }
 
-static int vhost_vdpa_set_vring_addr(struct vhost_dev *dev,
-                                       struct vhost_vring_addr *addr)
+static int vhost_vdpa_set_vring_dev_addr(struct vhost_dev *dev,
+                                         struct vhost_vring_addr *addr)
 {
     trace_vhost_vdpa_set_vring_addr(dev, addr->index, addr->flags,
                                     addr->desc_user_addr, addr->used_user_addr,
@@ -675,6 +816,22 @@ static int vhost_vdpa_set_vring_addr(struct vhost_dev *dev,
     return vhost_vdpa_call(dev, VHOST_SET_VRING_ADDR, addr);
 }
 
+static int vhost_vdpa_set_vring_addr(struct vhost_dev *dev,
+                                     struct vhost_vring_addr *addr)
+{
+    struct vhost_vdpa *v = dev->opaque;
+
+    if (v->shadow_vqs_enabled) {
+        /*
+         * Device vring addr was set at device start. SVQ base is handled by
+         * VirtQueue code.
+         */
+        return 0;
+    }
+
+    return vhost_vdpa_set_vring_dev_addr(dev, addr);
+}
+
 static int vhost_vdpa_set_vring_num(struct vhost_dev *dev,
                                       struct vhost_vring_state *ring)
 {
@@ -682,47 +839,355 @@ static int vhost_vdpa_set_vring_num(struct vhost_dev *dev,
     return vhost_vdpa_call(dev, VHOST_SET_VRING_NUM, ring);
 }
 
-static int vhost_vdpa_set_vring_base(struct vhost_dev *dev,
-                                       struct vhost_vring_state *ring)
+static int vhost_vdpa_set_dev_vring_base(struct vhost_dev *dev,
+                                         struct vhost_vring_state *ring)
 {
     trace_vhost_vdpa_set_vring_base(dev, ring->index, ring->num);
     return vhost_vdpa_call(dev, VHOST_SET_VRING_BASE, ring);
 }
 
+static int vhost_vdpa_set_vring_base(struct vhost_dev *dev,
+                                       struct vhost_vring_state *ring)
+{
+    struct vhost_vdpa *v = dev->opaque;
+
+    if (v->shadow_vqs_enabled) {
+        /*
+         * Device vring base was set at device start. SVQ base is handled by
+         * VirtQueue code.
+         */
+        return 0;
+    }
+
+    return vhost_vdpa_set_dev_vring_base(dev, ring);
+}
+
 static int vhost_vdpa_get_vring_base(struct vhost_dev *dev,
                                        struct vhost_vring_state *ring)
 {
+    struct vhost_vdpa *v = dev->opaque;
     int ret;
 
+    if (v->shadow_vqs_enabled) {
+        /* The shadow virtqueues gave back what the device did not use */
+        ring->num = virtio_queue_get_last_avail_idx(dev->vdev, ring->index);
+        trace_vhost_vdpa_get_vring_base(dev, ring->index, ring->num);
+        return 0;
+    }
+
     ret = vhost_vdpa_call(dev, VHOST_GET_VRING_BASE, ring);
     trace_vhost_vdpa_get_vring_base(dev, ring->index, ring->num);
     return ret;
 }
 
-static int vhost_vdpa_set_vring_kick(struct vhost_dev *dev,
-                                       struct vhost_vring_file *file)
+static int vhost_vdpa_set_vring_dev_kick(struct vhost_dev *dev,
+                                         struct vhost_vring_file *file)
 {
     trace_vhost_vdpa_set_vring_kick(dev, file->index, file->fd);
     return vhost_vdpa_call(dev, VHOST_SET_VRING_KICK, file);
 }
 
-static int vhost_vdpa_set_vring_call(struct vhost_dev *dev,
-                                       struct vhost_vring_file *file)
+static int vhost_vdpa_set_vring_dev_call(struct vhost_dev *dev,
+                                         struct vhost_vring_file *file)
 {
     trace_vhost_vdpa_set_vring_call(dev, file->index, file->fd);
     return vhost_vdpa_call(dev, VHOST_SET_VRING_CALL, file);
 }
 
+static int vhost_vdpa_set_vring_kick(struct vhost_dev *dev,
+                                       struct vhost_vring_file *file)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    int vdpa_idx = file->index - dev->vq_index;
+
+    if (v->shadow_vqs_enabled) {
+        VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs, vdpa_idx);
+
+        vhost_svq_set_svq_kick_fd(svq, file->fd);
+        return 0;
+    }
+
+    return vhost_vdpa_set_vring_dev_kick(dev, file);
+}
+
+static int vhost_vdpa_set_vring_call(struct vhost_dev *dev,
+                                       struct vhost_vring_file *file)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    int vdpa_idx = file->index - dev->vq_index;
+
+    if (v->shadow_vqs_enabled) {
+        VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs, vdpa_idx);
+
+        vhost_svq_set_svq_call_fd(svq, file->fd);
+        return 0;
+    }
+
+    return vhost_vdpa_set_vring_dev_call(dev, file);
+}
+
 static int vhost_vdpa_get_features(struct vhost_dev *dev,
                                      uint64_t *features)
 {
+    struct vhost_vdpa *v = dev->opaque;
     int ret;
 
     ret = vhost_vdpa_call(dev, VHOST_GET_FEATURES, features);
+    if (ret == 0 && v->shadow_vqs_enabled) {
+        /* Dirty memory is tracked by the shadow virtqueues */
+        *features = vhost_svq_filter_features(*features) |
+                    BIT_ULL(VHOST_F_LOG_ALL);
+    }
     trace_vhost_vdpa_get_features(dev, *features);
     return ret;
 }
 
+/*
+ * Map one of the shadow vring areas to the device at a free IOVA.
+ *
+ * @needle: translated_addr, size and perm of the area; iova is filled in
+ */
+static bool vhost_vdpa_svq_map_ring(struct vhost_vdpa *v, DMAMap *needle,
+                                    Error **errp)
+{
+    int r;
+
+    r = iova_tree_alloc_map(v->iova_tree, needle, v->iova_range.first,
+                            v->iova_range.last);
+    if (unlikely(r != IOVA_OK)) {
+        error_setg(errp, "Cannot allocate iova (%d)", r);
+        return false;
+    }
+
+    r = vhost_vdpa_dma_map(v, needle->iova, needle->size + 1,
+                           (void *)(uintptr_t)needle->translated_addr,
+                           needle->perm == IOMMU_RO);
+    if (unlikely(r != 0)) {
+        error_setg_errno(errp, -r, "Cannot map region to device");
+        iova_tree_remove(v->iova_tree, needle);
+        return false;
+    }
+
+    return true;
+}
+
+static void vhost_vdpa_svq_unmap_ring(struct vhost_vdpa *v, hwaddr addr)
+{
+    DMAMap needle = {
+        .translated_addr = addr,
+    };
+    const DMAMap *result = iova_tree_find_iova(v->iova_tree, &needle);
+    DMAMap map;
+
+    if (unlikely(!result)) {
+        error_report("Unable to find SVQ address to unmap");
+        return;
+    }
+
+    map = *result;
+    if (vhost_vdpa_dma_unmap(v, map.iova, map.size + 1)) {
+        error_report("Unable to unmap SVQ vring");
+    }
+    iova_tree_remove(v->iova_tree, &map);
+}
+
+/*
+ * Map the shadow vrings and point the device at them.  The addresses the
+ * device gets are IOVA, not the qemu virtual addresses of the rings.
+ */
+static bool vhost_vdpa_svq_map_rings(struct vhost_dev *dev,
+                                     const VhostShadowVirtqueue *svq,
+                                     struct vhost_vring_addr *addr,
+                                     Error **errp)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    DMAMap device_region, driver_region;
+    struct vhost_vring_addr svq_addr;
+    size_t device_size = vhost_svq_device_area_size(svq);
+    size_t driver_size = vhost_svq_driver_area_size(svq);
+
+    vhost_svq_get_vring_addr(svq, &svq_addr);
+
+    driver_region = (DMAMap) {
+        .translated_addr = svq_addr.desc_user_addr,
+        .size = driver_size - 1,
+        .perm = IOMMU_RO,
+    };
+    if (!vhost_vdpa_svq_map_ring(v, &driver_region, errp)) {
+        return false;
+    }
+    addr->desc_user_addr = driver_region.iova;
+    addr->avail_user_addr = driver_region.iova +
+                            (svq_addr.avail_user_addr - svq_addr.desc_user_addr);
+
+    device_region = (DMAMap) {
+        .translated_addr = svq_addr.used_user_addr,
+        .size = device_size - 1,
+        .perm = IOMMU_RW,
+    };
+    if (!vhost_vdpa_svq_map_ring(v, &device_region, errp)) {
+        vhost_vdpa_svq_unmap_ring(v, svq_addr.desc_user_addr);
+        return false;
+    }
+    addr->used_user_addr = device_region.iova;
+
+    return true;
+}
+
+static void vhost_vdpa_svq_unmap_rings(struct vhost_dev *dev,
+                                       const VhostShadowVirtqueue *svq)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    struct vhost_vring_addr svq_addr;
+
+    vhost_svq_get_vring_addr(svq, &svq_addr);
+    vhost_vdpa_svq_unmap_ring(v, svq_addr.desc_user_addr);
+    vhost_vdpa_svq_unmap_ring(v, svq_addr.used_user_addr);
+}
+
+static bool vhost_vdpa_svq_setup(struct vhost_dev *dev,
+                                 VhostShadowVirtqueue *svq, unsigned idx,
+                                 Error **errp)
+{
+    uint16_t vq_index = dev->vq_index + idx;
+    struct vhost_vring_state s = {
+        .index = vq_index,
+        .num = 0,
+    };
+    struct vhost_vring_file file = {
+        .index = vq_index,
+    };
+    struct vhost_vring_addr addr = {
+        .index = vq_index,
+    };
+    int r;
+
+    /* The shadow vring always starts from scratch */
+    r = vhost_vdpa_set_dev_vring_base(dev, &s);
+    if (unlikely(r)) {
+        error_setg_errno(errp, -r, "Cannot set vring base");
+        return false;
+    }
+
+    file.fd = event_notifier_get_fd(&svq->hdev_kick);
+    r = vhost_vdpa_set_vring_dev_kick(dev, &file);
+    if (unlikely(r != 0)) {
+        error_setg_errno(errp, -r, "Can't set device kick fd");
+        return false;
+    }
+
+    file.fd = event_notifier_get_fd(&svq->hdev_call);
+    r = vhost_vdpa_set_vring_dev_call(dev, &file);
+    if (unlikely(r != 0)) {
+        error_setg_errno(errp, -r, "Can't set device call fd");
+        return false;
+    }
+
+    vhost_svq_start(svq, dev->vdev, virtio_get_queue(dev->vdev, vq_index));
+
+    if (!vhost_vdpa_svq_map_rings(dev, svq, &addr, errp)) {
+        vhost_svq_stop(svq);
+        return false;
+    }
+
+    r = vhost_vdpa_set_vring_dev_addr(dev, &addr);
+    if (unlikely(r != 0)) {
+        error_setg_errno(errp, -r, "Cannot set device address");
+        vhost_vdpa_svq_unmap_rings(dev, svq);
+        vhost_svq_stop(svq);
+        return false;
+    }
+
+    return true;
+}
+
+static void vhost_vdpa_svqs_stop(struct vhost_dev *dev)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    unsigned i;
+
+    if (!v->shadow_vqs) {
+        return;
+    }
+
+    for (i = 0; i < v->shadow_vqs->len; ++i) {
+        VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs, i);
+
+        if (!svq->vq) {
+            continue;
+        }
+
+        /* The device must not touch the vrings once they are freed */
+        vhost_vdpa_svq_unmap_rings(dev, svq);
+        vhost_svq_stop(svq);
+    }
+}
+
+static bool vhost_vdpa_svqs_start(struct vhost_dev *dev)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    Error *err = NULL;
+    unsigned i;
+
+    if (!v->shadow_vqs) {
+        return true;
+    }
+
+    for (i = 0; i < v->shadow_vqs->len; ++i) {
+        VhostShadowVirtqueue *svq = g_ptr_array_index(v->shadow_vqs, i);
+
+        if (virtio_queue_get_desc_addr(dev->vdev, dev->vq_index + i) == 0) {
+            /* Not started by vhost either */
+            continue;
+        }
+
+        if (!vhost_vdpa_svq_setup(dev, svq, i, &err)) {
+            error_reportf_err(err, "Cannot setup SVQ %u: ", i);
+            vhost_vdpa_svqs_stop(dev);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static int vhost_vdpa_dev_start(struct vhost_dev *dev, bool started)
+{
+    struct vhost_vdpa *v = dev->opaque;
+    trace_vhost_vdpa_dev_start(dev, started);
+
+    if (started) {
+        if (!vhost_vdpa_svqs_start(dev)) {
+            return -1;
+        }
+        vhost_vdpa_host_notifiers_init(dev);
+        vhost_vdpa_set_vring_ready(dev);
+    } else {
+        vhost_vdpa_svqs_stop(dev);
+        vhost_vdpa_host_notifiers_uninit(dev, dev->nvqs);
+    }
+
+    if (dev->vq_index + dev->nvqs != dev->last_index) {
+        return 0;
+    }
+
+    if (started) {
+        uint8_t status = 0;
+        memory_listener_register(&v->listener, &address_space_memory);
+        vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_DRIVER_OK);
+        vhost_vdpa_call(dev, VHOST_VDPA_GET_STATUS, &status);
+
+        return !(status & VIRTIO_CONFIG_S_DRIVER_OK);
+    } else {
+        vhost_vdpa_reset_device(dev);
+        vhost_vdpa_add_status(dev, VIRTIO_CONFIG_S_ACKNOWLEDGE |
+                                   VIRTIO_CONFIG_S_DRIVER);
+        memory_listener_unregister(&v->listener);
+
+        return 0;
+    }
+}
+
 static int vhost_vdpa_set_owner(struct vhost_dev *dev)
 {
     if (vhost_vdpa_one_time_request(dev)) {
@@ -27,6 +27,7 @@
 #include "hw/virtio/virtio-access.h"
 #include "sysemu/dma.h"
 #include "sysemu/runstate.h"
+#include "sysemu/xen.h"
 #include "standard-headers/linux/virtio_ids.h"
 
 /*
@@ -131,8 +132,37 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    /*
+     * Elements released with virtqueue_free_element(), for reuse.  Allocated
+     * on first use, with room for VIRTQUEUE_ELEM_POOL_SIZE elements.
+     */
+    void **elem_pool;
+    unsigned int elem_pool_len;
+    size_t elem_pool_sz;
+
+    /* Notification coalescing, see virtio_queue_set_notify_coalescing() */
+    uint32_t coal_max_packets;
+    uint32_t coal_usecs;
+    uint32_t coal_pending;
+    bool coal_irqfd;
+    QEMUTimer *coal_timer;
+    AioContext *coal_ctx;
 };
 
+/*
+ * Guest memory translation that is reused for the following descriptors as
+ * long as they are in the same RAM section.  Only valid within a single RCU
+ * critical section.
+ */
+typedef struct VirtQueueMapCache {
+    MemoryRegion *mr;
+    hwaddr addr;
+    hwaddr len;
+    hwaddr xlat;
+    bool is_write;
+} VirtQueueMapCache;
+
 /* Called within call_rcu().  */
 static void virtio_free_region_cache(VRingMemoryRegionCaches *caches)
 {
@@ -903,6 +933,10 @@ void virtqueue_flush(VirtQueue *vq, unsigned int count)
         return;
     }
 
+    if (vq->coal_usecs) {
+        vq->coal_pending += count;
+    }
+
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
         virtqueue_packed_flush(vq, count);
     } else {
@@ -1288,10 +1322,55 @@ int virtqueue_avail_bytes(VirtQueue *vq, unsigned int in_bytes,
     return in_bytes <= in_total && out_bytes <= out_total;
 }
 
+/* Called within rcu_read_lock().  */
+static void *virtqueue_map_cached(VirtIODevice *vdev,
+                                  VirtQueueMapCache *map_cache,
+                                  hwaddr pa, hwaddr *plen, bool is_write)
+{
+    hwaddr offset;
+
+    if (!map_cache->mr || map_cache->is_write != is_write ||
+        pa < map_cache->addr || pa - map_cache->addr >= map_cache->len) {
+        MemoryRegion *mr;
+        hwaddr xlat, len = UINT64_MAX - pa;
+
+        map_cache->mr = NULL;
+        if (xen_enabled()) {
+            goto map;
+        }
+
+        mr = address_space_translate(vdev->dma_as, pa, &xlat, &len, is_write,
+                                     MEMTXATTRS_UNSPECIFIED);
+        if (!memory_access_is_direct(mr, is_write)) {
+            goto map;
+        }
+
+        map_cache->mr = mr;
+        map_cache->addr = pa;
+        map_cache->len = len;
+        map_cache->xlat = xlat;
+        map_cache->is_write = is_write;
+    }
+
+    /* Same as address_space_map() does for directly accessible RAM */
+    offset = pa - map_cache->addr;
+    *plen = MIN(*plen, map_cache->len - offset);
+    memory_region_ref(map_cache->mr);
+    fuzz_dma_read_cb(pa, *plen, map_cache->mr);
+    return qemu_map_ram_ptr(map_cache->mr->ram_block,
+                            map_cache->xlat + offset);
+
+map:
+    return dma_memory_map(vdev->dma_as, pa, plen,
+                          is_write ? DMA_DIRECTION_FROM_DEVICE :
+                                     DMA_DIRECTION_TO_DEVICE);
+}
+
 static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
                                hwaddr *addr, struct iovec *iov,
                                unsigned int max_num_sg, bool is_write,
-                               hwaddr pa, size_t sz)
+                               hwaddr pa, size_t sz,
+                               VirtQueueMapCache *map_cache)
 {
     bool ok = false;
     unsigned num_sg = *p_num_sg;
@@ -1311,10 +1390,8 @@ static bool virtqueue_map_desc(VirtIODevice *vdev, unsigned int *p_num_sg,
             goto out;
         }
 
-        iov[num_sg].iov_base = dma_memory_map(vdev->dma_as, pa, &len,
-                                              is_write ?
-                                              DMA_DIRECTION_FROM_DEVICE :
-                                              DMA_DIRECTION_TO_DEVICE);
+        iov[num_sg].iov_base = virtqueue_map_cached(vdev, map_cache, pa, &len,
+                                                    is_write);
         if (!iov[num_sg].iov_base) {
             virtio_error(vdev, "virtio: bogus descriptor or out of resources");
             goto out;
@@ -1382,7 +1459,43 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+static void virtqueue_element_pool_free(VirtQueue *vq)
+{
+    while (vq->elem_pool_len) {
+        g_free(vq->elem_pool[--vq->elem_pool_len]);
+    }
+    g_free(vq->elem_pool);
+    vq->elem_pool = NULL;
+}
+
+/*
+ * Get memory for an element from the pool of @vq.  All pooled elements have
+ * room for VIRTQUEUE_ELEM_POOL_SG descriptors after a @sz bytes header, see
+ * virtqueue_alloc_element() for the layout.
+ */
+static void *virtqueue_element_pool_get(VirtQueue *vq, size_t sz)
+{
+    VirtQueueElement *elem;
+    size_t addr_end = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0])) +
+                      VIRTQUEUE_ELEM_POOL_SG * sizeof(elem->in_addr[0]);
+    size_t sg_end = QEMU_ALIGN_UP(addr_end, __alignof__(elem->in_sg[0])) +
+                    VIRTQUEUE_ELEM_POOL_SG * sizeof(elem->in_sg[0]);
+
+    if (vq->elem_pool_sz != sz) {
+        /* The device changed its request size, pooled elements are useless */
+        virtqueue_element_pool_free(vq);
+        vq->elem_pool_sz = sz;
+    }
+
+    if (vq->elem_pool_len) {
+        return vq->elem_pool[--vq->elem_pool_len];
+    }
+    return g_malloc(sg_end);
+}
+
+/* @vq is the queue whose element pool is used, or NULL */
+static void *virtqueue_alloc_element(VirtQueue *vq, size_t sz,
+                                     unsigned out_num, unsigned in_num)
 {
     VirtQueueElement *elem;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
@@ -1391,10 +1504,16 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
     size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
     size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
+    bool pooled = vq && out_num + in_num <= VIRTQUEUE_ELEM_POOL_SG;
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+    if (pooled) {
+        elem = virtqueue_element_pool_get(vq, sz);
+    } else {
+        elem = g_malloc(out_sg_end);
+    }
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
+    elem->pool_sz = pooled ? sz : 0;
     elem->out_num = out_num;
     elem->in_num = in_num;
     elem->in_addr = (void *)elem + in_addr_ofs;
@@ -1404,7 +1523,9 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/* Called within rcu_read_lock().  */
+static void *virtqueue_split_pop(VirtQueue *vq, size_t sz,
+                                 VirtQueueMapCache *map_cache)
 {
     unsigned int i, head, max;
     VRingMemoryRegionCaches *caches;
@@ -1419,7 +1540,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     VRingDesc desc;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
     if (virtio_queue_empty_rcu(vq)) {
         goto done;
     }
@@ -1488,7 +1608,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
             map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
-                                        desc.addr, desc.len);
+                                        desc.addr, desc.len, map_cache);
         } else {
             if (in_num) {
                 virtio_error(vdev, "Incorrect order for descriptors");
@@ -1496,7 +1616,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
             }
             map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
-                                        desc.addr, desc.len);
+                                        desc.addr, desc.len, map_cache);
         }
         if (!map_ok) {
             goto err_undo_map;
@@ -1516,7 +1636,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1541,7 +1661,9 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+/* Called within rcu_read_lock().  */
+static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz,
+                                  VirtQueueMapCache *map_cache)
 {
     unsigned int i, max;
     VRingMemoryRegionCaches *caches;
@@ -1557,7 +1679,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     uint16_t id;
     int rc;
 
-    RCU_READ_LOCK_GUARD();
     if (virtio_queue_packed_empty_rcu(vq)) {
         goto done;
     }
@@ -1616,7 +1737,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
             map_ok = virtqueue_map_desc(vdev, &in_num, addr + out_num,
                                         iov + out_num,
                                         VIRTQUEUE_MAX_SIZE - out_num, true,
-                                        desc.addr, desc.len);
+                                        desc.addr, desc.len, map_cache);
         } else {
             if (in_num) {
                 virtio_error(vdev, "Incorrect order for descriptors");
@@ -1624,7 +1745,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
             }
             map_ok = virtqueue_map_desc(vdev, &out_num, addr, iov,
                                         VIRTQUEUE_MAX_SIZE, false,
-                                        desc.addr, desc.len);
+                                        desc.addr, desc.len, map_cache);
         }
         if (!map_ok) {
             goto err_undo_map;
@@ -1642,7 +1763,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     } while (rc == VIRTQUEUE_READ_DESC_MORE);
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq, sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1678,17 +1799,85 @@ err_undo_map:
 
 void *virtqueue_pop(VirtQueue *vq, size_t sz)
 {
+    VirtQueueMapCache map_cache = {};
+
     if (virtio_device_disabled(vq->vdev)) {
         return NULL;
     }
 
+    RCU_READ_LOCK_GUARD();
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        return virtqueue_packed_pop(vq, sz, &map_cache);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        return virtqueue_split_pop(vq, sz, &map_cache);
     }
 }
 
+/*
+ * virtqueue_pop_batch:
+ * @vq: a VirtQueue
+ * @sz: the size of the structure to allocate for each element
+ * @elems: array that receives the popped elements
+ * @max: the number of entries in @elems
+ *
+ * Pop up to @max elements like virtqueue_pop() does, but with a single
+ * RCU critical section, and with guest memory translations shared among
+ * all the elements.
+ *
+ * Returns: the number of elements stored in @elems.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    VirtQueueMapCache map_cache = {};
+    bool packed;
+    unsigned int n = 0;
+
+    if (virtio_device_disabled(vq->vdev)) {
+        return 0;
+    }
+
+    packed = virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED);
+
+    RCU_READ_LOCK_GUARD();
+    while (n < max) {
+        void *elem = packed ? virtqueue_packed_pop(vq, sz, &map_cache) :
+                              virtqueue_split_pop(vq, sz, &map_cache);
+        if (!elem) {
+            break;
+        }
+        elems[n++] = elem;
+    }
+
+    trace_virtqueue_pop_batch(vq, n, max);
+    return n;
+}
+
+/*
+ * virtqueue_free_element:
+ * @vq: the VirtQueue the element was popped from
+ * @elem: the element
+ *
+ * Free an element returned by virtqueue_pop() or virtqueue_pop_batch(),
+ * keeping its memory for reuse by later pops if possible.  Must be called
+ * from the context that pops elements from @vq.
+ */
+void virtqueue_free_element(VirtQueue *vq, void *elem)
+{
+    VirtQueueElement *e = elem;
+
+    if (e->pool_sz && e->pool_sz == vq->elem_pool_sz && vq->vring.num &&
+        vq->elem_pool_len < VIRTQUEUE_ELEM_POOL_SIZE) {
+        if (!vq->elem_pool) {
+            vq->elem_pool = g_new(void *, VIRTQUEUE_ELEM_POOL_SIZE);
+        }
+        vq->elem_pool[vq->elem_pool_len++] = elem;
+        return;
+    }
+
+    g_free(elem);
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -1824,7 +2013,7 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     assert(ARRAY_SIZE(data.in_addr) >= data.in_num);
     assert(ARRAY_SIZE(data.out_addr) >= data.out_num);
 
-    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
+    elem = virtqueue_alloc_element(NULL, sz, data.out_num, data.in_num);
     elem->index = data.index;
 
     for (i = 0; i < elem->in_num; i++) {
@@ -2021,6 +2210,10 @@ void virtio_reset(void *opaque)
         vdev->vq[i].notification = true;
         vdev->vq[i].vring.num = vdev->vq[i].vring.num_default;
         vdev->vq[i].inuse = 0;
+        vdev->vq[i].coal_pending = 0;
+        if (vdev->vq[i].coal_timer) {
+            timer_del(vdev->vq[i].coal_timer);
+        }
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
     }
 }
@@ -2419,6 +2612,12 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_aio_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    virtqueue_element_pool_free(vq);
+    timer_free(vq->coal_timer);
+    vq->coal_timer = NULL;
+    vq->coal_usecs = 0;
+    vq->coal_max_packets = 0;
+    vq->coal_ctx = NULL;
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -2520,7 +2719,13 @@ static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
     }
 }
 
-void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_irq(VirtQueue *vq)
+{
+    virtio_set_isr(vq->vdev, 0x1);
+    virtio_notify_vector(vq->vdev, vq->vector);
+}
+
+static void virtio_notify_now(VirtIODevice *vdev, VirtQueue *vq, bool irqfd)
 {
     WITH_RCU_READ_LOCK_GUARD() {
         if (!virtio_should_notify(vdev, vq)) {
@@ -2528,6 +2733,12 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
         }
     }
 
+    if (!irqfd) {
+        trace_virtio_notify(vdev, vq);
+        virtio_irq(vq);
+        return;
+    }
+
     trace_virtio_notify_irqfd(vdev, vq);
 
     /*
@@ -2549,22 +2760,133 @@ void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
     event_notifier_set(&vq->guest_notifier);
 }
 
-static void virtio_irq(VirtQueue *vq)
+static void virtio_notify_coalesced_fire(VirtQueue *vq)
 {
-    virtio_set_isr(vq->vdev, 0x1);
-    virtio_notify_vector(vq->vdev, vq->vector);
+    vq->coal_pending = 0;
+    virtio_notify_now(vq->vdev, vq, vq->coal_irqfd);
 }
 
-void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
+static void virtio_notify_coalesced_timer(void *opaque)
 {
-    WITH_RCU_READ_LOCK_GUARD() {
-        if (!virtio_should_notify(vdev, vq)) {
-            return;
+    VirtQueue *vq = opaque;
+
+    aio_context_acquire(vq->coal_ctx);
+    virtio_notify_coalesced_fire(vq);
+    aio_context_release(vq->coal_ctx);
+}
+
+/* Returns true if the notification has been deferred */
+static bool virtio_notify_coalesce(VirtQueue *vq, bool irqfd)
+{
+    if (!vq->coal_usecs) {
+        return false;
+    }
+
+    if (vq->coal_max_packets && vq->coal_pending >= vq->coal_max_packets) {
+        timer_del(vq->coal_timer);
+        vq->coal_pending = 0;
+        return false;
+    }
+
+    if (!timer_pending(vq->coal_timer)) {
+        vq->coal_irqfd = irqfd;
+        timer_mod(vq->coal_timer,
+                  qemu_clock_get_us(QEMU_CLOCK_VIRTUAL) + vq->coal_usecs);
+    }
+    return true;
+}
+
+/*
+ * Hold back notifications for @vq until @max_packets used buffers have
+ * accumulated, or until @usecs have passed since the first notification
+ * that was held back.  A @max_packets of 0 only bounds the delay; a
+ * @usecs of 0 disables coalescing and sends out anything pending.
+ */
+void virtio_queue_set_notify_coalescing(VirtQueue *vq, uint32_t max_packets,
+                                        uint32_t usecs)
+{
+    vq->coal_max_packets = max_packets;
+    vq->coal_usecs = usecs;
+
+    if (!vq->coal_ctx) {
+        vq->coal_ctx = qemu_get_aio_context();
+    }
+    if (usecs && !vq->coal_timer) {
+        vq->coal_timer = aio_timer_new(vq->coal_ctx, QEMU_CLOCK_VIRTUAL,
+                                       SCALE_US,
+                                       virtio_notify_coalesced_timer, vq);
+    }
+    if (!usecs && vq->coal_timer && timer_pending(vq->coal_timer)) {
+        timer_del(vq->coal_timer);
+        virtio_notify_coalesced_fire(vq);
+    }
+}
+
+/*
+ * Move the coalescing timer of @vq to @ctx.  A notification that is still
+ * held back is sent right away, so the caller must run in the context
+ * that currently owns @vq.
+ */
+void virtio_queue_set_notify_coalescing_aio_context(VirtQueue *vq,
+                                                    AioContext *ctx)
+{
+    if (vq->coal_timer) {
+        if (timer_pending(vq->coal_timer)) {
+            virtio_notify_coalesced_fire(vq);
         }
+        timer_free(vq->coal_timer);
+        vq->coal_timer = aio_timer_new(ctx, QEMU_CLOCK_VIRTUAL, SCALE_US,
+                                       virtio_notify_coalesced_timer, vq);
     }
+    vq->coal_ctx = ctx;
+}
 
-    trace_virtio_notify(vdev, vq);
-    virtio_irq(vq);
+/*
+ * For code that signals the guest notifier of @vq on its own, such as the
+ * vhost shadow virtqueue, and must still honour notification suppression.
+ */
+bool virtio_queue_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    RCU_READ_LOCK_GUARD();
+    return virtio_should_notify(vdev, vq);
+}
+
+/*
+ * Send out the notifications that are held back.  A pending coalescing
+ * timer is neither migrated nor run while the VM is stopped.
+ */
+static void virtio_notify_coalesced_flush(VirtIODevice *vdev)
+{
+    int i;
+
+    for (i = 0; i < VIRTIO_QUEUE_MAX; i++) {
+        VirtQueue *vq = &vdev->vq[i];
+
+        if (!vq->coal_timer) {
+            continue;
+        }
+
+        aio_context_acquire(vq->coal_ctx);
+        if (timer_pending(vq->coal_timer)) {
+            timer_del(vq->coal_timer);
+            virtio_notify_coalesced_fire(vq);
+        }
+        aio_context_release(vq->coal_ctx);
+    }
+}
+
+void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (!virtio_notify_coalesce(vq, true)) {
+        virtio_notify_now(vdev, vq, true);
+    }
+}
+
+void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
+{
+    if (!virtio_notify_coalesce(vq, false)) {
+        virtio_notify_now(vdev, vq, false);
+    }
 }
 
 void virtio_notify_config(VirtIODevice *vdev)
@@ -3211,6 +3533,10 @@ static void virtio_vmstate_change(void *opaque, bool running, RunState state)
     bool backend_run = running && virtio_device_started(vdev, vdev->status);
     vdev->vm_running = running;
 
+    if (!running) {
+        virtio_notify_coalesced_flush(vdev);
+    }
+
     if (backend_run) {
         virtio_set_status(vdev, vdev->status);
     }
@@ -3698,6 +4024,7 @@ static void virtio_device_free_virtqueues(VirtIODevice *vdev)
         if (vdev->vq[i].vring.num == 0) {
             break;
         }
+        virtqueue_element_pool_free(&vdev->vq[i]);
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
     }
     g_free(vdev->vq);
@@ -3722,7 +4049,7 @@ static Property virtio_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
-static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int i, n, r, err;
@@ -3792,7 +4119,7 @@ int virtio_device_start_ioeventfd(VirtIODevice *vdev)
     return virtio_bus_start_ioeventfd(vbus);
 }
 
-static void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int n, r;
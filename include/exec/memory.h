@@ -193,6 +193,9 @@ typedef struct IOMMUTLBEvent {
 /* RAM that isn't accessible through normal means. */
 #define RAM_PROTECTED (1 << 8)
 
+/* RAM is mmap-ed from a file that has a name in the host filesystem */
+#define RAM_NAMED_FILE (1 << 9)
+
 static inline void iommu_notifier_init(IOMMUNotifier *n, IOMMUNotify fn,
                                        IOMMUNotifierFlag flags,
                                        hwaddr start, hwaddr end,
@@ -1016,6 +1019,7 @@ struct AddressSpace {
 
 typedef struct AddressSpaceDispatch AddressSpaceDispatch;
 typedef struct FlatRange FlatRange;
+typedef struct FlatAlias FlatAlias;
 
 /* Flattened global view of current active memory hierarchy.  Kept in sorted
  * order.
@@ -1028,6 +1032,10 @@ struct FlatView {
     unsigned nr_allocated;
     struct AddressSpaceDispatch *dispatch;
     MemoryRegion *root;
+    /* Where the root and the alias targets show up, root first */
+    FlatAlias *aliases;
+    unsigned nr_aliases;
+    unsigned nr_aliases_allocated;
 };
 
 static inline FlatView *address_space_to_flatview(AddressSpace *as)
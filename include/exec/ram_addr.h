@@ -21,6 +21,7 @@
 
 #ifndef CONFIG_USER_ONLY
 #include "cpu.h"
+#include "qemu/cutils.h"
 #include "sysemu/xen.h"
 #include "sysemu/tcg.h"
 #include "exec/ramlist.h"
@@ -331,6 +332,12 @@ static inline void cpu_physical_memory_set_dirty_range(ram_addr_t start,
     xen_hvm_modified_memory(start, length);
 }
 
+/*
+ * Number of words of a dirty bitmap checked at once with buffer_is_zero()
+ * when merging, so that clean areas are skipped using vector instructions.
+ */
+#define DIRTY_BITMAP_SCAN_LONGS 64
+
 #if !defined(_WIN32)
 static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
                                                           ram_addr_t start,
@@ -364,6 +371,20 @@ static inline void cpu_physical_memory_set_dirty_lebitmap(unsigned long *bitmap,
             }
 
             for (k = 0; k < nr; k++) {
+                if (!(k % DIRTY_BITMAP_SCAN_LONGS)) {
+                    long n = MIN(DIRTY_BITMAP_SCAN_LONGS, nr - k);
+
+                    if (buffer_is_zero(&bitmap[k], n * sizeof(*bitmap))) {
+                        k += n - 1;
+                        offset += n;
+                        if (offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
+                            offset -= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE);
+                            idx++;
+                        }
+                        continue;
+                    }
+                }
+
                 if (bitmap[k]) {
                     unsigned long temp = leul_to_cpu(bitmap[k]);
 
@@ -465,6 +486,22 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
                 &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
 
         for (k = page; k < page + nr; k++) {
+            if (!((k - page) % DIRTY_BITMAP_SCAN_LONGS)) {
+                int n = MIN(DIRTY_BITMAP_SCAN_LONGS, page + nr - k);
+
+                /* Only skip runs that do not cross into the next block */
+                if (offset + n <= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE) &&
+                    buffer_is_zero(&src[idx][offset], n * sizeof(**src))) {
+                    k += n - 1;
+                    offset += n;
+                    if (offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
+                        offset = 0;
+                        idx++;
+                    }
+                    continue;
+                }
+            }
+
             if (src[idx][offset]) {
                 unsigned long bits = qatomic_xchg(&src[idx][offset], 0);
                 unsigned long new_dirty;
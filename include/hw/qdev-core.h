@@ -876,4 +876,10 @@ typedef enum MachineInitPhase {
 extern bool phase_check(MachineInitPhase phase);
 extern void phase_advance(MachineInitPhase phase);
 
+/*
+ * Start timing the initialization phases; phase_advance() traces how long
+ * each phase took.
+ */
+extern void phase_start(void);
+
 #endif
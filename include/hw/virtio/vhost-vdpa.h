@@ -12,6 +12,7 @@
 #ifndef HW_VIRTIO_VHOST_VDPA_H
 #define HW_VIRTIO_VHOST_VDPA_H
 
+#include "qemu/iova-tree.h"
 #include "hw/virtio/virtio.h"
 #include "standard-headers/linux/vhost_types.h"
 
@@ -28,6 +29,15 @@ typedef struct vhost_vdpa {
     MemoryListener listener;
     struct vhost_vdpa_iova_range iova_range;
     struct vhost_dev *dev;
+    /* Relay the virtqueues through shadow virtqueues in qemu */
+    bool shadow_vqs_enabled;
+    /* IOVA allocations of the shadow virtqueues, shared by the device */
+    IOVATree *iova_tree;
+    GPtrArray *shadow_vqs;
+    /* Features acked by the guest, including VHOST_F_LOG_ALL */
+    uint64_t acked_features;
+    /* Set while the shadow virtqueues cannot migrate the device state */
+    Error *migration_blocker;
     VhostVDPAHostNotifier notifier[VIRTIO_QUEUE_MAX];
 } VhostVDPA;
 
@@ -18,14 +18,46 @@
 #include "standard-headers/linux/virtio_net.h"
 #include "hw/virtio/virtio.h"
 #include "net/announce.h"
+#include "net/checksum.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
+#include "sysemu/iothread.h"
 
 #include "ebpf/ebpf_rss.h"
 
 #define TYPE_VIRTIO_NET "virtio-net-device"
 OBJECT_DECLARE_SIMPLE_TYPE(VirtIONet, VIRTIO_NET)
 
+/*
+ * Notification coalescing, from the virtio specification.  Not in the
+ * imported Linux headers yet.
+ */
+#ifndef VIRTIO_NET_F_NOTF_COAL
+#define VIRTIO_NET_F_NOTF_COAL 53 /* Device supports notifications coalescing */
+
+#define VIRTIO_NET_CTRL_NOTF_COAL 6
+
+/* Set the tx-usecs/tx-max-packets parameters */
+struct virtio_net_ctrl_coal_tx {
+    /* Maximum number of packets to send before a TX notification */
+    uint32_t tx_max_packets;
+    /* Maximum number of usecs to delay a TX notification */
+    uint32_t tx_usecs;
+};
+
+#define VIRTIO_NET_CTRL_NOTF_COAL_TX_SET 0
+
+/* Set the rx-usecs/rx-max-packets parameters */
+struct virtio_net_ctrl_coal_rx {
+    /* Maximum number of usecs to delay a RX notification */
+    uint32_t rx_usecs;
+    /* Maximum number of packets to receive before a RX notification */
+    uint32_t rx_max_packets;
+};
+
+#define VIRTIO_NET_CTRL_NOTF_COAL_RX_SET 1
+#endif
+
 #define TX_TIMER_INTERVAL 150000 /* 150 us */
 
 /* Limit the number of packets that can be sent via a single flush
@@ -47,6 +79,7 @@ typedef struct virtio_net_conf
     char *duplex_str;
     uint8_t duplex;
     char *primary_id_str;
+    IOThread *iothread;
 } virtio_net_conf;
 
 /* Coalesced packets type & status */
@@ -130,6 +163,17 @@ typedef struct VirtioNetRscChain {
 #define VIRTIO_NET_RSS_MAX_KEY_SIZE     40
 #define VIRTIO_NET_RSS_MAX_TABLE_LEN    128
 
+#define VIRTIO_NET_RSS_FLOW_CACHE_SIZE  256
+
+/* Software RSS result for a recently seen flow */
+typedef struct VirtioNetRssFlow {
+    uint8_t input[NET_TOEPLITZ_TABLE_MAX_INPUT];
+    uint8_t len;        /* 0 while the entry is unused */
+    uint8_t hash_type;
+    uint16_t queue;
+    uint32_t hash;
+} VirtioNetRssFlow;
+
 typedef struct VirtioNetRssData {
     bool    enabled;
     bool    enabled_software_rss;
@@ -140,8 +184,16 @@ typedef struct VirtioNetRssData {
     uint16_t indirections_len;
     uint16_t *indirections_table;
     uint16_t default_queue;
+    /* software RSS: lookup table for @key, direct-mapped flow cache */
+    NetToeplitzTable *toeplitz;
+    VirtioNetRssFlow *flow_cache;
 } VirtioNetRssData;
 
+typedef struct VirtIONetCoalescing {
+    uint32_t usecs;
+    uint32_t max_packets;
+} VirtIONetCoalescing;
+
 typedef struct VirtIONetQueue {
     VirtQueue *rx_vq;
     VirtQueue *tx_vq;
@@ -151,6 +203,13 @@ typedef struct VirtIONetQueue {
     struct {
         VirtQueueElement *elem;
     } async_tx;
+    /* used elements filled but not yet flushed during a receive batch */
+    unsigned int rx_batched;
+    /* notification coalescing in effect, and as configured via QMP */
+    VirtIONetCoalescing rx_coal;
+    VirtIONetCoalescing tx_coal;
+    VirtIONetCoalescing rx_coal_conf;
+    VirtIONetCoalescing tx_coal_conf;
     struct VirtIONet *n;
 } VirtIONetQueue;
 
@@ -216,6 +275,10 @@ struct VirtIONet {
     VirtioNetRssData rss_data;
     struct NetRxPkt *rx_pkt;
     struct EBPFRSSContext ebpf_rss;
+    /* AioContext running the rx/tx queues and backends with iothread= */
+    AioContext *ctx;
+    bool dataplane_started;
+    bool rx_batching;
 };
 
 void virtio_net_set_netclient_name(VirtIONet *n, const char *name,
@@ -29,6 +29,7 @@
 #define  IOVA_OK           (0)
 #define  IOVA_ERR_INVALID  (-1) /* Invalid parameters */
 #define  IOVA_ERR_OVERLAP  (-2) /* IOVA range overlapped */
+#define  IOVA_ERR_NOMEM    (-3) /* Cannot allocate */
 
 typedef struct IOVATree IOVATree;
 typedef struct DMAMap {
@@ -94,6 +95,21 @@ int iova_tree_remove(IOVATree *tree, DMAMap *map);
  */
 DMAMap *iova_tree_find(IOVATree *tree, DMAMap *map);
 
+/**
+ * iova_tree_find_iova:
+ *
+ * @tree: the iova tree to search from
+ * @map: the mapping to search
+ *
+ * Search for a mapping in the iova tree whose translated address range
+ * contains the one specified by @map.  The iova field of @map is
+ * ignored.  This walks the whole tree, so it is slower than
+ * iova_tree_find().
+ *
+ * Return: same as iova_tree_find().
+ */
+const DMAMap *iova_tree_find_iova(IOVATree *tree, const DMAMap *map);
+
 /**
  * iova_tree_find_address:
  *
@@ -119,6 +135,24 @@ DMAMap *iova_tree_find_address(IOVATree *tree, hwaddr iova);
  */
 void iova_tree_foreach(IOVATree *tree, iova_tree_iterator iterator);
 
+/**
+ * iova_tree_alloc_map:
+ *
+ * @tree: the iova tree to allocate from
+ * @map: the new mapping; translated_addr, size and perm are used
+ * @iova_begin: the lowest iova that can be allocated
+ * @iova_last: the highest iova that can be allocated (inclusive)
+ *
+ * Find the lowest free iova range of @map's size within [@iova_begin,
+ * @iova_last] and insert @map there.  The allocated address is
+ * returned in map->iova.
+ *
+ * Return: same as iova_tree_insert(), or IOVA_ERR_NOMEM if there is no
+ * free range that is large enough.
+ */
+int iova_tree_alloc_map(IOVATree *tree, DMAMap *map, hwaddr iova_begin,
+                        hwaddr iova_last);
+
 /**
  * iova_tree_destroy:
  *
@@ -471,6 +471,11 @@ static inline void qemu_cleanup_generic_vfree(void *p)
 #else
 #define QEMU_MADV_REMOVE QEMU_MADV_DONTNEED
 #endif
+#ifdef MADV_POPULATE_WRITE
+#define QEMU_MADV_POPULATE_WRITE MADV_POPULATE_WRITE
+#else
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
+#endif
 
 #elif defined(CONFIG_POSIX_MADVISE)
 
@@ -484,6 +489,7 @@ static inline void qemu_cleanup_generic_vfree(void *p)
 #define QEMU_MADV_HUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_NOHUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_REMOVE QEMU_MADV_DONTNEED
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
 
 #else /* no-op */
 
@@ -497,6 +503,7 @@ static inline void qemu_cleanup_generic_vfree(void *p)
 #define QEMU_MADV_HUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_NOHUGEPAGE  QEMU_MADV_INVALID
 #define QEMU_MADV_REMOVE QEMU_MADV_INVALID
+#define QEMU_MADV_POPULATE_WRITE QEMU_MADV_INVALID
 
 #endif
 
@@ -687,8 +694,35 @@ unsigned long qemu_getauxval(unsigned long type);
 
 void qemu_set_tty_echo(int fd, bool echo);
 
-void os_mem_prealloc(int fd, char *area, size_t sz, int smp_cpus,
-                     Error **errp);
+/**
+ * os_mem_prealloc:
+ * @fd: file descriptor backing @area, or -1 for anonymous memory
+ * @area: start of the memory to preallocate
+ * @sz: size of the memory to preallocate
+ * @max_threads: maximum number of threads to populate the memory with
+ * @tc: thread context to create the threads in, or NULL
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * Populate @area so that the guest never faults on it.  The threads
+ * are created from @tc, if given, and so inherit its CPU affinity.
+ */
+void os_mem_prealloc(int fd, char *area, size_t sz, int max_threads,
+                     ThreadContext *tc, Error **errp);
+
+/**
+ * os_mem_prealloc_async:
+ *
+ * Like os_mem_prealloc(), but return as soon as the preallocation threads
+ * are running.  Once all of @area is populated, @cb is called from one of
+ * these threads with 0 or a negative errno value.
+ *
+ * Returns false, without doing anything, if @area cannot be preallocated
+ * in the background, e.g. because it is backed by a file; @cb is then never
+ * called.
+ */
+bool os_mem_prealloc_async(int fd, char *area, size_t sz, int max_threads,
+                           ThreadContext *tc,
+                           void (*cb)(void *opaque, int ret), void *opaque);
 
 /**
  * qemu_get_pid_name:
@@ -191,6 +191,13 @@ bool qemu_thread_is_self(QemuThread *thread);
 void qemu_thread_exit(void *retval) QEMU_NORETURN;
 void qemu_thread_naming(bool enable);
 
+/*
+ * Restrict @thread to the host CPUs set in the @nbits long @host_cpus
+ * bitmap.  Returns 0 on success or a positive errno value.
+ */
+int qemu_thread_set_affinity(QemuThread *thread, unsigned long *host_cpus,
+                             unsigned long nbits);
+
 struct Notifier;
 /**
  * qemu_thread_atexit_add:
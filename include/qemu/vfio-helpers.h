@@ -15,10 +15,26 @@
 
 typedef struct QEMUVFIOState QEMUVFIOState;
 
+#define QEMU_VFIO_MAPPING_CACHE_SIZE 4
+
+/* Lookaside cache of fixed mappings for qemu_vfio_dma_map_cached() */
+typedef struct QEMUVFIOMappingCache {
+    struct {
+        void *host;
+        size_t size;
+        uint64_t iova;
+    } entries[QEMU_VFIO_MAPPING_CACHE_SIZE];
+    unsigned next;
+    unsigned generation;
+} QEMUVFIOMappingCache;
+
 QEMUVFIOState *qemu_vfio_open_pci(const char *device, Error **errp);
 void qemu_vfio_close(QEMUVFIOState *s);
 int qemu_vfio_dma_map(QEMUVFIOState *s, void *host, size_t size,
                       bool temporary, uint64_t *iova_list, Error **errp);
+int qemu_vfio_dma_map_cached(QEMUVFIOState *s, QEMUVFIOMappingCache *cache,
+                             void *host, size_t size, bool temporary,
+                             uint64_t *iova, Error **errp);
 int qemu_vfio_dma_reset_temporary(QEMUVFIOState *s);
 void qemu_vfio_dma_unmap(QEMUVFIOState *s, void *host);
 void *qemu_vfio_pci_map_bar(QEMUVFIOState *s, int index,
@@ -65,7 +65,12 @@ struct HostMemoryBackend {
     uint64_t size;
     bool merge, dump, use_canonical_path;
     bool prealloc, is_mapped, share, reserve;
+    bool prealloc_async, prealloc_pending;
     uint32_t prealloc_threads;
+    ThreadContext *prealloc_context;
+    int prealloc_ret;
+    int64_t prealloc_start;
+    NotifierWithReturn postcopy_notifier;
     DECLARE_BITMAP(host_nodes, MAX_NODES + 1);
     HostMemPolicy policy;
 
@@ -28,11 +28,30 @@ typedef struct KVMSlot
     int as_id;
     /* Cache of the offset in ram address space */
     ram_addr_t ram_start_offset;
+    /* Change deferred to the end of the memory transaction */
+    int batch;
 } KVMSlot;
 
+enum {
+    KVM_SLOT_BATCH_NONE,
+    KVM_SLOT_BATCH_ADD,
+    KVM_SLOT_BATCH_DEL,
+};
+
 typedef struct KVMMemoryListener {
     MemoryListener listener;
     KVMSlot *slots;
+    /* Slots registered in the address space, sorted by guest address */
+    KVMSlot **slots_by_gpa;
+    int nr_used_slots;
+    /* Stack of unused slot numbers */
+    int *free_slots;
+    int nr_free_slots;
+    /* Slot changes of the current memory transaction */
+    bool batching;
+    GPtrArray *batch;
+    /* Slots deleted in the current transaction, keyed by start_addr */
+    GHashTable *batch_del;
     int as_id;
 } KVMMemoryListener;
 
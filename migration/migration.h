@@ -329,6 +329,7 @@ bool migrate_postcopy_ram(void);
 bool migrate_zero_blocks(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_ignore_shared(void);
+bool migrate_ignore_file_ram(void);
 bool migrate_validate_uuid(void);
 
 bool migrate_auto_converge(void);
@@ -166,7 +166,8 @@ out:
 bool ramblock_is_ignored(RAMBlock *block)
 {
     return !qemu_ram_is_migratable(block) ||
-           (migrate_ignore_shared() && qemu_ram_is_shared(block));
+           (migrate_ignore_shared() && qemu_ram_is_shared(block)) ||
+           (migrate_ignore_file_ram() && qemu_ram_is_named_file(block));
 }
 
 #undef RAMBLOCK_FOREACH
@@ -2803,6 +2804,20 @@ static int ram_save_setup(QEMUFile *f, void *opaque)
     RAMState **rsp = opaque;
     RAMBlock *block;
 
+    if (migrate_ignore_file_ram()) {
+        WITH_RCU_READ_LOCK_GUARD() {
+            RAMBLOCK_FOREACH_MIGRATABLE(block) {
+                /* Private mappings diverge from the file, it has to be sent */
+                if (qemu_ram_is_named_file(block) &&
+                    !qemu_ram_is_shared(block)) {
+                    error_report("RAM block %s is a private file mapping, "
+                                 "cannot ignore it", block->idstr);
+                    return -1;
+                }
+            }
+        }
+    }
+
     if (compress_threads_save_setup()) {
         return -1;
     }
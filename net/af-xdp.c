@@ -0,0 +1,846 @@
+/*
+ * AF_XDP network backend.
+ *
+ * One AF_XDP socket is bound to each queue of the host interface.  The
+ * sockets of a netdev share a single UMEM area, carved into per-queue
+ * frame pools, so the kernel only has to register and pin it once.
+ * Every queue has its own fill and completion rings.
+ *
+ * Guests see a virtio-net header capable peer: checksum and TCP
+ * segmentation offloads requested by the guest are completed in software
+ * before the frames are handed to the NIC.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include <bpf/libbpf.h>
+#include <linux/if_link.h>
+#include <linux/if_xdp.h>
+#include <net/if.h>
+#include <xdp/xsk.h>
+
+#include "clients.h"
+#include "net/checksum.h"
+#include "net/eth.h"
+#include "net/net.h"
+#include "qapi/error.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/iov.h"
+#include "qemu/main-loop.h"
+#include "standard-headers/linux/virtio_net.h"
+#include "trace.h"
+
+
+/* Number of frames handled per callback in each direction */
+#define AF_XDP_BATCH_SIZE 64
+
+#define AF_XDP_FRAME_SIZE XSK_UMEM__DEFAULT_FRAME_SIZE
+
+/* Frames owned by each queue, enough to keep all four rings full */
+#define AF_XDP_QUEUE_FRAMES ((XSK_RING_PROD__DEFAULT_NUM_DESCS + \
+                              XSK_RING_CONS__DEFAULT_NUM_DESCS) * 2)
+
+/*
+ * Smallest segment size accepted for TSO packets, the TCP_MIN_MSS of Linux.
+ * A TSO packet must also fit in the Tx ring at once, and the Rx side never
+ * holds more than the fill and Rx rings, so the pool can always provide
+ * that many frames eventually.
+ */
+#define AF_XDP_TSO_MIN_MSS 88
+#define AF_XDP_TSO_MAX_SEGS XSK_RING_PROD__DEFAULT_NUM_DESCS
+
+/* UMEM area shared by the sockets of all queues of a netdev */
+typedef struct AFXDPUmem {
+    struct xsk_umem *umem;
+    void *buffer;
+    size_t size;
+    unsigned int refcnt;
+    int ifindex;
+    uint32_t xdp_flags;     /* flags of the XDP program libxdp loaded */
+} AFXDPUmem;
+
+typedef struct AFXDPState {
+    NetClientState       nc;
+    AFXDPUmem            *umem;
+    struct xsk_socket    *xsk;
+    struct xsk_ring_cons rx;
+    struct xsk_ring_prod tx;
+    struct xsk_ring_cons cq;
+    struct xsk_ring_prod fq;
+    char                 ifname[IFNAMSIZ];
+    int                  ifindex;
+    bool                 read_poll;
+    bool                 write_poll;
+    uint32_t             outstanding_tx;
+    uint64_t             *pool;     /* free frames owned by this queue */
+    uint32_t             n_pool;
+    bool                 using_vnet_hdr;
+    int                  vnet_hdr_len;
+    uint8_t              *gso_buf;  /* linearized TSO packets */
+    uint64_t             tx_dropped; /* TSO packets that cannot be sent */
+    AioContext           *ctx;      /* NULL when run by the main loop */
+} AFXDPState;
+
+static const uint8_t af_xdp_zero_hdr[sizeof(struct virtio_net_hdr_v1_hash)];
+
+static void af_xdp_send(void *opaque);
+static void af_xdp_writable(void *opaque);
+static bool af_xdp_poll_rings(void *opaque);
+
+/* Set the event-loop handlers for the af-xdp backend. */
+static void af_xdp_update_fd_handler(AFXDPState *s)
+{
+    IOHandler *fd_read = s->read_poll ? af_xdp_send : NULL;
+    IOHandler *fd_write = s->write_poll ? af_xdp_writable : NULL;
+
+    if (s->ctx) {
+        /*
+         * Without a poll handler the socket would keep the whole AioContext
+         * out of adaptive polling, virtqueues included.
+         */
+        aio_set_fd_handler(s->ctx, xsk_socket__fd(s->xsk), false,
+                           fd_read, fd_write, af_xdp_poll_rings, s);
+    } else {
+        qemu_set_fd_handler(xsk_socket__fd(s->xsk), fd_read, fd_write, s);
+    }
+}
+
+/* Update the read handler. */
+static void af_xdp_read_poll(AFXDPState *s, bool enable)
+{
+    if (s->read_poll != enable) {
+        s->read_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+/* Update the write handler. */
+static void af_xdp_write_poll(AFXDPState *s, bool enable)
+{
+    if (s->write_poll != enable) {
+        s->write_poll = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+static void af_xdp_poll(NetClientState *nc, bool enable)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (s->read_poll != enable || s->write_poll != enable) {
+        s->write_poll = enable;
+        s->read_poll  = enable;
+        af_xdp_update_fd_handler(s);
+    }
+}
+
+/* Return frames the kernel finished transmitting to the pool. */
+static void af_xdp_complete_tx(AFXDPState *s)
+{
+    uint32_t idx = 0;
+    uint32_t done, i;
+
+    done = xsk_ring_cons__peek(&s->cq, XSK_RING_CONS__DEFAULT_NUM_DESCS, &idx);
+
+    for (i = 0; i < done; i++) {
+        s->pool[s->n_pool++] = *xsk_ring_cons__comp_addr(&s->cq, idx++);
+    }
+
+    if (done) {
+        xsk_ring_cons__release(&s->cq, done);
+        s->outstanding_tx -= done;
+    }
+}
+
+/*
+ * Take the AioContext lock of the fd handler that is running, if it is run
+ * by an IOThread.  Fails if the main loop moved the handlers elsewhere while
+ * we were waiting for the lock; their new owner takes over then.
+ */
+static bool af_xdp_aio_context_acquire(AFXDPState *s, AioContext *ctx)
+{
+    if (ctx) {
+        aio_context_acquire(ctx);
+        if (qatomic_read(&s->ctx) != ctx) {
+            aio_context_release(ctx);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * The fd_write() callback, invoked if the socket is marked as writable
+ * after a poll.  Polling also kicks the kernel to process the Tx ring.
+ */
+static void af_xdp_writable(void *opaque)
+{
+    AFXDPState *s = opaque;
+    AioContext *ctx = qatomic_read(&s->ctx);
+
+    if (!af_xdp_aio_context_acquire(s, ctx)) {
+        return;
+    }
+
+    af_xdp_complete_tx(s);
+
+    /*
+     * Unregister the handler, unless we still have packets to transmit
+     * and the kernel needs a wake up.
+     */
+    if (!s->outstanding_tx || !xsk_ring_prod__needs_wakeup(&s->tx)) {
+        af_xdp_write_poll(s, false);
+    }
+
+    qemu_flush_queued_packets(&s->nc);
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
+/*
+ * Reserve @n Tx descriptors along with the frames to back them.  On
+ * failure the packet is queued by the caller and sending resumes once the
+ * socket is writable again.
+ */
+static bool af_xdp_tx_reserve(AFXDPState *s, uint32_t n, uint32_t *idx)
+{
+    if (s->n_pool < n || xsk_ring_prod__reserve(&s->tx, n, idx) != n) {
+        af_xdp_write_poll(s, true);
+        return false;
+    }
+    return true;
+}
+
+static void af_xdp_tx_submit(AFXDPState *s, uint32_t n)
+{
+    xsk_ring_prod__submit(&s->tx, n);
+    s->outstanding_tx += n;
+
+    if (xsk_ring_prod__needs_wakeup(&s->tx)) {
+        af_xdp_write_poll(s, true);
+    }
+}
+
+/* Fill in Tx descriptor @idx and return the frame to copy the packet to */
+static uint8_t *af_xdp_tx_desc(AFXDPState *s, uint32_t idx, uint32_t len)
+{
+    struct xdp_desc *desc = xsk_ring_prod__tx_desc(&s->tx, idx);
+
+    desc->addr = s->pool[--s->n_pool];
+    desc->len = len;
+    return xsk_umem__get_data(s->umem->buffer, desc->addr);
+}
+
+/* Complete a partial checksum as requested by VIRTIO_NET_HDR_F_NEEDS_CSUM */
+static void af_xdp_fill_csum(uint8_t *pkt, size_t len,
+                             const struct virtio_net_hdr *hdr)
+{
+    size_t start = hdr->csum_start;
+    size_t off = start + hdr->csum_offset;
+
+    if (start >= len || off + sizeof(uint16_t) > len) {
+        return;
+    }
+    stw_be_p(pkt + off,
+             net_checksum_finish_nozero(net_checksum_add(len - start,
+                                                         pkt + start)));
+}
+
+/*
+ * Split a TCP segmentation offload packet into frames of at most
+ * gso_size bytes of payload, fixing up the IP and TCP headers and
+ * checksums of every frame.
+ *
+ * Returns 0 if the Tx ring is full and the packet must be retried later.
+ * Packets that could never be sent are dropped.
+ */
+static ssize_t af_xdp_send_tso(AFXDPState *s, const struct virtio_net_hdr *hdr,
+                               const uint8_t *pkt, size_t size)
+{
+    uint8_t gso_type = hdr->gso_type & ~VIRTIO_NET_HDR_GSO_ECN;
+    size_t l2_len = eth_get_l2_hdr_length(pkt);
+    size_t l4_off = hdr->csum_start;
+    size_t mss = hdr->gso_size;
+    const tcp_header *th;
+    size_t hdr_len, payload, off;
+    uint32_t seq, nsegs, i, idx;
+    uint16_t ip_id = 0;
+
+    if ((gso_type != VIRTIO_NET_HDR_GSO_TCPV4 &&
+         gso_type != VIRTIO_NET_HDR_GSO_TCPV6) ||
+        l4_off < l2_len || l4_off + sizeof(tcp_header) > size ||
+        mss < AF_XDP_TSO_MIN_MSS) {
+        goto drop;
+    }
+
+    th = (const tcp_header *)(pkt + l4_off);
+    hdr_len = l4_off + TCP_HEADER_DATA_OFFSET(th);
+    if (hdr_len >= size || hdr_len + mss > AF_XDP_FRAME_SIZE) {
+        goto drop;
+    }
+
+    payload = size - hdr_len;
+    nsegs = DIV_ROUND_UP(payload, mss);
+    if (nsegs > AF_XDP_TSO_MAX_SEGS) {
+        goto drop;
+    }
+    if (!af_xdp_tx_reserve(s, nsegs, &idx)) {
+        return 0;
+    }
+
+    seq = be32_to_cpu(th->th_seq);
+    if (gso_type == VIRTIO_NET_HDR_GSO_TCPV4) {
+        ip_id = be16_to_cpu(((struct ip_header *)(pkt + l2_len))->ip_id);
+    }
+
+    for (i = 0, off = 0; i < nsegs; i++, off += mss) {
+        size_t seg_len = MIN(mss, payload - off);
+        size_t l4_len = hdr_len - l4_off + seg_len;
+        uint32_t cso, sum;
+        uint16_t flags;
+        tcp_header *seg_th;
+        uint8_t *data;
+
+        data = af_xdp_tx_desc(s, idx + i, hdr_len + seg_len);
+        memcpy(data, pkt, hdr_len);
+        memcpy(data + hdr_len, pkt + hdr_len + off, seg_len);
+
+        seg_th = (tcp_header *)(data + l4_off);
+        seg_th->th_seq = cpu_to_be32(seq + off);
+        flags = be16_to_cpu(seg_th->th_offset_flags);
+        if (i) {
+            flags &= ~TH_CWR;
+        }
+        if (i != nsegs - 1) {
+            flags &= ~(TH_FIN | TH_PUSH);
+        }
+        seg_th->th_offset_flags = cpu_to_be16(flags);
+        seg_th->th_sum = 0;
+
+        if (gso_type == VIRTIO_NET_HDR_GSO_TCPV4) {
+            struct ip_header *ip = (struct ip_header *)(data + l2_len);
+
+            ip->ip_len = cpu_to_be16(hdr_len + seg_len - l2_len);
+            ip->ip_id = cpu_to_be16(ip_id + i);
+            eth_fix_ip4_checksum(ip, l4_off - l2_len);
+            sum = eth_calc_ip4_pseudo_hdr_csum(ip, l4_len, &cso);
+        } else {
+            struct ip6_header *ip6 = (struct ip6_header *)(data + l2_len);
+
+            ip6->ip6_plen = cpu_to_be16(hdr_len + seg_len - l2_len -
+                                        sizeof(*ip6));
+            sum = eth_calc_ip6_pseudo_hdr_csum(ip6, l4_len, IP_PROTO_TCP,
+                                               &cso);
+        }
+        sum = net_checksum_add_cont(l4_len, (uint8_t *)seg_th, cso) + sum;
+        seg_th->th_sum = cpu_to_be16(net_checksum_finish(sum));
+    }
+
+    af_xdp_tx_submit(s, nsegs);
+    return size;
+
+drop:
+    s->tx_dropped++;
+    trace_af_xdp_tso_drop(s->ifname, gso_type, mss, size, s->tx_dropped);
+    return size;
+}
+
+static ssize_t af_xdp_receive_iov(NetClientState *nc,
+                                  const struct iovec *iov, int iovcnt)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+    struct virtio_net_hdr hdr = { .gso_type = VIRTIO_NET_HDR_GSO_NONE };
+    size_t total = iov_size(iov, iovcnt);
+    size_t offset = 0;
+    size_t size = total;
+    uint8_t *data;
+    uint32_t idx;
+
+    /* Try to recover buffers that are already sent. */
+    af_xdp_complete_tx(s);
+
+    if (s->using_vnet_hdr) {
+        if (total < s->vnet_hdr_len) {
+            return total;
+        }
+        iov_to_buf(iov, iovcnt, 0, &hdr, sizeof(hdr));
+        offset = s->vnet_hdr_len;
+        size -= offset;
+    }
+
+    if (hdr.gso_type != VIRTIO_NET_HDR_GSO_NONE) {
+        if (size > NET_BUFSIZE) {
+            return total;
+        }
+        if (!s->gso_buf) {
+            s->gso_buf = g_malloc(NET_BUFSIZE);
+        }
+        iov_to_buf(iov, iovcnt, offset, s->gso_buf, size);
+        return af_xdp_send_tso(s, &hdr, s->gso_buf, size) ? total : 0;
+    }
+
+    if (size > AF_XDP_FRAME_SIZE) {
+        /* We can't transmit a packet this size, drop it. */
+        return total;
+    }
+
+    if (!af_xdp_tx_reserve(s, 1, &idx)) {
+        return 0;
+    }
+
+    data = af_xdp_tx_desc(s, idx, size);
+    iov_to_buf(iov, iovcnt, offset, data, size);
+    if (hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+        af_xdp_fill_csum(data, size, &hdr);
+    }
+
+    af_xdp_tx_submit(s, 1);
+    return total;
+}
+
+static ssize_t af_xdp_receive(NetClientState *nc,
+                              const uint8_t *buf, size_t size)
+{
+    struct iovec iov = {
+        .iov_base = (void *)buf,
+        .iov_len = size,
+    };
+
+    return af_xdp_receive_iov(nc, &iov, 1);
+}
+
+/* Give up to @n frames from the pool to the kernel for receiving. */
+static void af_xdp_fq_refill(AFXDPState *s, uint32_t n)
+{
+    uint32_t i, idx = 0;
+
+    /* Leave one frame for Tx, just in case. */
+    if (s->n_pool < n + 1) {
+        n = s->n_pool ? s->n_pool - 1 : 0;
+    }
+
+    if (!n || !xsk_ring_prod__reserve(&s->fq, n, &idx)) {
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        *xsk_ring_prod__fill_addr(&s->fq, idx++) = s->pool[--s->n_pool];
+    }
+    xsk_ring_prod__submit(&s->fq, n);
+
+    if (xsk_ring_prod__needs_wakeup(&s->fq)) {
+        /* Receive was blocked by not having enough buffers.  Wake it up. */
+        af_xdp_read_poll(s, true);
+    }
+}
+
+/* Complete a previous send (backend --> guest) and enable the
+   fd_read callback. */
+static void af_xdp_send_completed(NetClientState *nc, ssize_t len)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    af_xdp_read_poll(s, true);
+}
+
+static void af_xdp_send(void *opaque)
+{
+    AFXDPState *s = opaque;
+    AioContext *ctx = qatomic_read(&s->ctx);
+    uint32_t i, n_rx, idx = 0;
+    struct iovec iov[2];
+    int hdr_iov = 0;
+
+    if (!af_xdp_aio_context_acquire(s, ctx)) {
+        return;
+    }
+
+    n_rx = xsk_ring_cons__peek(&s->rx, AF_XDP_BATCH_SIZE, &idx);
+    if (!n_rx) {
+        goto out;
+    }
+
+    /* Frames from the wire are complete, an all-zero header describes them */
+    if (s->using_vnet_hdr) {
+        iov[0].iov_base = (void *)af_xdp_zero_hdr;
+        iov[0].iov_len = s->vnet_hdr_len;
+        hdr_iov = 1;
+    }
+
+    for (i = 0; i < n_rx; i++) {
+        const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&s->rx, idx++);
+
+        iov[hdr_iov].iov_base = xsk_umem__get_data(s->umem->buffer,
+                                                   desc->addr);
+        iov[hdr_iov].iov_len = desc->len;
+
+        /* The net queue copies packets it cannot deliver right away */
+        s->pool[s->n_pool++] = desc->addr;
+
+        if (!qemu_sendv_packet_async(&s->nc, iov, hdr_iov + 1,
+                                     af_xdp_send_completed)) {
+            /*
+             * The peer does not receive anymore.  Packet is queued, stop
+             * reading from the backend until af_xdp_send_completed().
+             */
+            af_xdp_read_poll(s, false);
+
+            /* Return unused descriptors to not break the ring cache. */
+            xsk_ring_cons__cancel(&s->rx, n_rx - i - 1);
+            n_rx = i + 1;
+            break;
+        }
+    }
+
+    /* Release actually sent descriptors and try to re-fill. */
+    xsk_ring_cons__release(&s->rx, n_rx);
+    af_xdp_fq_refill(s, AF_XDP_BATCH_SIZE);
+
+out:
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
+/*
+ * AioContext busy-poll handler.  The rings are shared memory, so checking
+ * them for received frames and Tx completions needs no syscall.
+ */
+static bool af_xdp_poll_rings(void *opaque)
+{
+    AFXDPState *s = opaque;
+    AioContext *ctx = qatomic_read(&s->ctx);
+    bool progress = false;
+    uint32_t idx, n;
+
+    if (!ctx || !af_xdp_aio_context_acquire(s, ctx)) {
+        return false;
+    }
+
+    if (s->read_poll) {
+        n = xsk_ring_cons__peek(&s->rx, 1, &idx);
+        if (n) {
+            xsk_ring_cons__cancel(&s->rx, n);
+            af_xdp_send(s);
+            progress = true;
+        }
+    }
+
+    if (s->outstanding_tx) {
+        n = xsk_ring_cons__peek(&s->cq, 1, &idx);
+        if (n) {
+            xsk_ring_cons__cancel(&s->cq, n);
+            af_xdp_writable(s);
+            progress = true;
+        }
+    }
+
+    aio_context_release(ctx);
+
+    return progress;
+}
+
+static void af_xdp_umem_unref(AFXDPUmem *umem)
+{
+    if (--umem->refcnt) {
+        return;
+    }
+
+    /* The last queue is gone, remove the program libxdp loaded for us. */
+    if (umem->xdp_flags &&
+        bpf_xdp_detach(umem->ifindex, umem->xdp_flags, NULL) != 0) {
+        error_report("af-xdp: unable to remove XDP program from "
+                     "ifindex: %d", umem->ifindex);
+    }
+    xsk_umem__delete(umem->umem);
+    qemu_vfree(umem->buffer);
+    g_free(umem);
+}
+
+/* Flush and close. */
+static void af_xdp_cleanup(NetClientState *nc)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    qemu_purge_queued_packets(nc);
+
+    if (s->xsk) {
+        af_xdp_poll(nc, false);
+        xsk_socket__delete(s->xsk);
+        s->xsk = NULL;
+    }
+    g_free(s->pool);
+    s->pool = NULL;
+    g_free(s->gso_buf);
+    s->gso_buf = NULL;
+    if (s->umem) {
+        af_xdp_umem_unref(s->umem);
+        s->umem = NULL;
+    }
+}
+
+static bool af_xdp_has_vnet_hdr(NetClientState *nc)
+{
+    return true;
+}
+
+static bool af_xdp_has_vnet_hdr_len(NetClientState *nc, int len)
+{
+    return len == sizeof(struct virtio_net_hdr) ||
+           len == sizeof(struct virtio_net_hdr_mrg_rxbuf) ||
+           len == sizeof(struct virtio_net_hdr_v1_hash);
+}
+
+static void af_xdp_using_vnet_hdr(NetClientState *nc, bool enable)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    s->using_vnet_hdr = enable;
+}
+
+static void af_xdp_set_vnet_hdr_len(NetClientState *nc, int len)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    assert(af_xdp_has_vnet_hdr_len(nc, len));
+    s->vnet_hdr_len = len;
+}
+
+static void af_xdp_set_offload(NetClientState *nc, int csum, int tso4,
+                               int tso6, int ecn, int ufo)
+{
+    /*
+     * Frames from the NIC always carry complete checksums and are never
+     * coalesced, so there is nothing to configure for the guest side.
+     */
+}
+
+static void af_xdp_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    if (s->ctx == ctx) {
+        return;
+    }
+
+    /* Drop the handlers from the old context before installing new ones */
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, xsk_socket__fd(s->xsk), false,
+                           NULL, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(xsk_socket__fd(s->xsk), NULL, NULL, NULL);
+    }
+    qatomic_set(&s->ctx, ctx);
+    af_xdp_update_fd_handler(s);
+}
+
+static NetClientInfo net_af_xdp_info = {
+    .type = NET_CLIENT_DRIVER_AF_XDP,
+    .size = sizeof(AFXDPState),
+    .receive = af_xdp_receive,
+    .receive_iov = af_xdp_receive_iov,
+    .poll = af_xdp_poll,
+    .cleanup = af_xdp_cleanup,
+    .has_vnet_hdr = af_xdp_has_vnet_hdr,
+    .has_vnet_hdr_len = af_xdp_has_vnet_hdr_len,
+    .using_vnet_hdr = af_xdp_using_vnet_hdr,
+    .set_offload = af_xdp_set_offload,
+    .set_vnet_hdr_len = af_xdp_set_vnet_hdr_len,
+    .set_aio_context = af_xdp_set_aio_context,
+};
+
+/*
+ * Allocate the UMEM area for @queues queues and register it with the
+ * rings of the first queue, which must be @s.
+ */
+static AFXDPUmem *af_xdp_umem_create(AFXDPState *s, int64_t queues,
+                                     Error **errp)
+{
+    struct xsk_umem_config config = {
+        .fill_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .frame_size = AF_XDP_FRAME_SIZE,
+        .frame_headroom = 0,
+    };
+    AFXDPUmem *umem = g_new0(AFXDPUmem, 1);
+    int ret;
+
+    umem->ifindex = s->ifindex;
+    umem->size = queues * AF_XDP_QUEUE_FRAMES * AF_XDP_FRAME_SIZE;
+    umem->buffer = qemu_memalign(qemu_real_host_page_size, umem->size);
+    memset(umem->buffer, 0, umem->size);
+
+    ret = xsk_umem__create(&umem->umem, umem->buffer, umem->size,
+                           &s->fq, &s->cq, &config);
+    if (ret) {
+        error_setg_errno(errp, -ret, "failed to create umem for %s",
+                         s->ifname);
+        qemu_vfree(umem->buffer);
+        g_free(umem);
+        return NULL;
+    }
+
+    return umem;
+}
+
+/* Hand the frames of queue @s out of the shared UMEM to its pool. */
+static void af_xdp_pool_init(AFXDPState *s)
+{
+    uint64_t base = (uint64_t)s->nc.queue_index * AF_XDP_QUEUE_FRAMES *
+                    AF_XDP_FRAME_SIZE;
+    int64_t i;
+
+    s->pool = g_new(uint64_t, AF_XDP_QUEUE_FRAMES);
+    /* Fill the pool in the opposite order, because it's a LIFO queue. */
+    for (i = AF_XDP_QUEUE_FRAMES - 1; i >= 0; i--) {
+        s->pool[AF_XDP_QUEUE_FRAMES - 1 - i] = base + i * AF_XDP_FRAME_SIZE;
+    }
+    s->n_pool = AF_XDP_QUEUE_FRAMES;
+}
+
+static int af_xdp_socket_create(AFXDPState *s,
+                                const NetdevAFXDPOptions *opts, Error **errp)
+{
+    struct xsk_socket_config cfg = {
+        .rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+        .tx_size = XSK_RING_PROD__DEFAULT_NUM_DESCS,
+        .libxdp_flags = 0,
+        .bind_flags = XDP_USE_NEED_WAKEUP,
+        .xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST,
+    };
+    int queue_id, ret;
+
+    if (opts->has_force_copy && opts->force_copy) {
+        cfg.bind_flags |= XDP_COPY;
+    }
+
+    queue_id = s->nc.queue_index;
+    if (opts->has_start_queue) {
+        queue_id += opts->start_queue;
+    }
+
+    if (opts->has_mode) {
+        /* Specific mode requested. */
+        cfg.xdp_flags |= (opts->mode == AFXDP_MODE_NATIVE)
+                         ? XDP_FLAGS_DRV_MODE : XDP_FLAGS_SKB_MODE;
+        ret = xsk_socket__create_shared(&s->xsk, s->ifname, queue_id,
+                                        s->umem->umem, &s->rx, &s->tx,
+                                        &s->fq, &s->cq, &cfg);
+    } else {
+        /* No mode requested, try native first. */
+        cfg.xdp_flags |= XDP_FLAGS_DRV_MODE;
+        ret = xsk_socket__create_shared(&s->xsk, s->ifname, queue_id,
+                                        s->umem->umem, &s->rx, &s->tx,
+                                        &s->fq, &s->cq, &cfg);
+        if (ret) {
+            /* Can't use native mode, try skb. */
+            cfg.xdp_flags &= ~XDP_FLAGS_DRV_MODE;
+            cfg.xdp_flags |= XDP_FLAGS_SKB_MODE;
+            ret = xsk_socket__create_shared(&s->xsk, s->ifname, queue_id,
+                                            s->umem->umem, &s->rx, &s->tx,
+                                            &s->fq, &s->cq, &cfg);
+        }
+    }
+
+    if (ret) {
+        s->xsk = NULL;
+        error_setg_errno(errp, -ret,
+                         "failed to create AF_XDP socket for %s queue_id: %d",
+                         s->ifname, queue_id);
+        return -1;
+    }
+
+    s->umem->xdp_flags = cfg.xdp_flags;
+    return 0;
+}
+
+/* The exported init function
+ *
+ * ... -netdev af-xdp,ifname="..."
+ */
+int net_init_af_xdp(const Netdev *netdev,
+                    const char *name, NetClientState *peer, Error **errp)
+{
+    const NetdevAFXDPOptions *opts = &netdev->u.af_xdp;
+    NetClientState *nc, *nc0 = NULL;
+    AFXDPUmem *umem = NULL;
+    unsigned int ifindex;
+    uint32_t prog_id = 0;
+    int64_t i, queues;
+    AFXDPState *s;
+
+    ifindex = if_nametoindex(opts->ifname);
+    if (!ifindex) {
+        error_setg_errno(errp, errno, "failed to get ifindex for '%s'",
+                         opts->ifname);
+        return -1;
+    }
+
+    queues = opts->has_queues ? opts->queues : 1;
+    if (queues < 1 || queues > MAX_QUEUE_NUM) {
+        error_setg(errp, "invalid number of queues (%" PRIi64 ") for '%s'",
+                   queues, opts->ifname);
+        return -1;
+    }
+
+    if (opts->has_start_queue && opts->start_queue < 0) {
+        error_setg(errp, "invalid start-queue (%" PRIi64 ") for '%s'",
+                   opts->start_queue, opts->ifname);
+        return -1;
+    }
+
+    for (i = 0; i < queues; i++) {
+        nc = qemu_new_net_client(&net_af_xdp_info, peer, "af-xdp", name);
+        snprintf(nc->info_str, sizeof(nc->info_str),
+                 "af-xdp%" PRIi64 " to %s", i, opts->ifname);
+        nc->queue_index = i;
+
+        if (!nc0) {
+            nc0 = nc;
+        }
+
+        s = DO_UPCAST(AFXDPState, nc, nc);
+
+        pstrcpy(s->ifname, sizeof(s->ifname), opts->ifname);
+        s->ifindex = ifindex;
+        s->vnet_hdr_len = sizeof(struct virtio_net_hdr);
+
+        if (!umem) {
+            umem = af_xdp_umem_create(s, queues, errp);
+            if (!umem) {
+                goto err;
+            }
+        }
+        umem->refcnt++;
+        s->umem = umem;
+
+        if (af_xdp_socket_create(s, opts, errp)) {
+            goto err;
+        }
+
+        af_xdp_pool_init(s);
+        af_xdp_fq_refill(s, XSK_RING_PROD__DEFAULT_NUM_DESCS);
+        af_xdp_read_poll(s, true); /* Initially only poll for reads. */
+    }
+
+    if (bpf_xdp_query_id(ifindex, umem->xdp_flags, &prog_id) || !prog_id) {
+        error_setg_errno(errp, errno,
+                         "no XDP program loaded on '%s', ifindex: %d",
+                         opts->ifname, ifindex);
+        goto err;
+    }
+
+    return 0;
+
+err:
+    if (nc0) {
+        qemu_del_net_client(nc0);
+    }
+
+    return -1;
+}
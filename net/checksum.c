@@ -206,3 +206,28 @@ net_checksum_add_iov(const struct iovec *iov, const unsigned int iov_cnt,
     }
     return res;
 }
+
+/*
+ * @key must be NET_TOEPLITZ_TABLE_MAX_INPUT + 4 bytes long.  Bit b of input
+ * byte i selects the 32-bit window of the key that starts at bit 8 * i + b.
+ */
+void net_toeplitz_table_init(NetToeplitzTable *table, const uint8_t *key)
+{
+    unsigned i, k, v;
+
+    for (i = 0; i < NET_TOEPLITZ_TABLE_MAX_INPUT; i++) {
+        uint64_t window = ((uint64_t)ldl_be_p(key + i) << 8) | key[i + 4];
+        uint32_t *lut = table->lut[i];
+
+        /* Build each value from the ones made of its lower bits */
+        lut[0] = 0;
+        for (k = 0; k < 8; k++) {
+            uint32_t contribution = window >> (k + 1);
+            unsigned bit = 1u << k;
+
+            for (v = 0; v < bit; v++) {
+                lut[bit | v] = lut[v] ^ contribution;
+            }
+        }
+    }
+}
@@ -55,6 +55,8 @@ static NotifierList colo_compare_notifiers =
 #define REGULAR_PACKET_CHECK_MS 1000
 #define DEFAULT_TIME_OUT_MS 3000
 
+#define MAX_COMPARE_THREADS 64
+
 /* #define DEBUG_COLO_PACKETS */
 
 static QemuMutex colo_compare_mutex;
@@ -103,6 +105,39 @@ typedef struct SendEntry {
     uint8_t *buf;
 } SendEntry;
 
+/*
+ * Connections are spread over shards by the hash of their key. With
+ * compare_threads set, each shard is compared by its own thread; the
+ * iothread keeps doing all chardev I/O and sends out the primary packets
+ * that the shard threads have matched.
+ */
+typedef struct CompareShard {
+    CompareState *s;
+    QemuThread thread;
+
+    /* Protects the fields below and the packet lists of the connections */
+    QemuMutex lock;
+    QemuCond cond;
+
+    /*
+     * Record the connection that through the NIC
+     * Element type: Connection
+     */
+    GQueue conn_list;
+    /* Record the connection without repetition */
+    GHashTable *connection_track_table;
+    /* This shard's part of HASHTABLE_MAX_SIZE */
+    guint max_connections;
+
+    /* Connections with packets not compared yet, element type: Connection */
+    GQueue pending_list;
+    /* Primary packets that matched and wait to be sent out */
+    GQueue release_list;
+    /* A packet pair was different, checkpoint requested */
+    bool inconsistent;
+    bool quit;
+} CompareShard;
+
 struct CompareState {
     Object parent;
 
@@ -122,20 +157,17 @@ struct CompareState {
     bool vnet_hdr;
     uint64_t compare_timeout;
     uint32_t expired_scan_cycle;
+    uint32_t compare_threads;
 
-    /*
-     * Record the connection that through the NIC
-     * Element type: Connection
-     */
-    GQueue conn_list;
-    /* Record the connection without repetition */
-    GHashTable *connection_track_table;
+    CompareShard *shards;
+    uint32_t nr_shards;
 
     IOThread *iothread;
     GMainContext *worker_context;
     QEMUTimer *packet_check_timer;
 
     QEMUBH *event_bh;
+    QEMUBH *release_bh;
     enum colo_event event;
 
     QTAILQ_ENTRY(CompareState) next;
@@ -242,10 +274,12 @@ static int colo_insert_packet(GQueue *queue, Packet *pkt, uint32_t *max_ack)
  * Return 0 on success, if return -1 means the pkt
  * is unsupported(arp and ipv6) and will be sent later
  */
-static int packet_enqueue(CompareState *s, int mode, Connection **con)
+static int packet_enqueue(CompareState *s, int mode, Connection **con,
+                          CompareShard **shard_out)
 {
     ConnectionKey key;
     Packet *pkt = NULL;
+    CompareShard *shard;
     Connection *conn;
     int ret;
 
@@ -266,12 +300,22 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
     }
     fill_connection_key(pkt, &key);
 
-    conn = connection_get(s->connection_track_table,
+    shard = &s->shards[connection_key_hash(&key) % s->nr_shards];
+    qemu_mutex_lock(&shard->lock);
+
+    if (g_hash_table_size(shard->connection_track_table) >
+        shard->max_connections &&
+        !connection_has_tracked(shard->connection_track_table, &key)) {
+        /* connection_get() is about to drop every connection */
+        g_queue_clear(&shard->pending_list);
+    }
+    conn = connection_get(shard->connection_track_table,
                           &key,
-                          &s->conn_list);
+                          &shard->conn_list,
+                          shard->max_connections);
 
     if (!conn->processing) {
-        g_queue_push_tail(&s->conn_list, conn);
+        g_queue_push_tail(&shard->conn_list, conn);
         conn->processing = true;
     }
 
@@ -288,7 +332,10 @@ static int packet_enqueue(CompareState *s, int mode, Connection **con)
         pkt = NULL;
     }
 
+    qemu_mutex_unlock(&shard->lock);
+
     *con = conn;
+    *shard_out = shard;
 
     return 0;
 }
@@ -298,7 +345,7 @@ static inline bool after(uint32_t seq1, uint32_t seq2)
         return (int32_t)(seq1 - seq2) > 0;
 }
 
-static void colo_release_primary_pkt(CompareState *s, Packet *pkt)
+static void colo_send_primary_pkt(CompareState *s, Packet *pkt)
 {
     int ret;
     ret = compare_chr_send(s,
@@ -314,6 +361,28 @@ static void colo_release_primary_pkt(CompareState *s, Packet *pkt)
     packet_destroy_partial(pkt, NULL);
 }
 
+/*
+ * Shard threads can't write to the chardevs, so they leave matched
+ * packets and checkpoint requests to the iothread.
+ */
+static void colo_release_primary_pkt(CompareShard *shard, Packet *pkt)
+{
+    if (shard->s->compare_threads) {
+        g_queue_push_tail(&shard->release_list, pkt);
+    } else {
+        colo_send_primary_pkt(shard->s, pkt);
+    }
+}
+
+static void colo_compare_shard_inconsistency(CompareShard *shard)
+{
+    if (shard->s->compare_threads) {
+        shard->inconsistent = true;
+    } else {
+        colo_compare_inconsistency_notify(shard->s);
+    }
+}
+
 /*
  * The IP packets sent by primary and secondary
  * will be compared in here
@@ -344,20 +413,70 @@ static int colo_compare_packet_payload(Packet *ppkt,
     return memcmp(ppkt->data + poffset, spkt->data + soffset, len);
 }
 
+/*
+ * Compare the whole packets from the given offsets on.
+ * return:    0  means packet same
+ *            > 0 || < 0 means packet different
+ */
+static int colo_compare_packet_whole(Packet *ppkt,
+                                     Packet *spkt,
+                                     uint16_t poffset,
+                                     uint16_t soffset)
+{
+    if (ppkt->size - poffset != spkt->size - soffset) {
+        return -1;
+    }
+
+    return colo_compare_packet_payload(ppkt, spkt, poffset, soffset,
+                                       ppkt->size - poffset);
+}
+
+static bool colo_tcp_payload_verified(Connection *conn, uint32_t seq_end)
+{
+    return conn->verified_seq && !after(seq_end, conn->verified_seq);
+}
+
+/*
+ * Compare @len bytes of TCP payload from the primary packet's offset on.
+ * Payload that an earlier pass already found identical, while waiting for
+ * the secondary to ack it, is not compared again.
+ * return true means that the payload is same
+ */
+static bool colo_compare_tcp_payload(Connection *conn,
+                                     Packet *ppkt,
+                                     Packet *spkt,
+                                     uint16_t len)
+{
+    uint32_t seq_end = ppkt->tcp_seq + ppkt->offset + len;
+
+    if (colo_tcp_payload_verified(conn, seq_end)) {
+        return true;
+    }
+    if (colo_compare_packet_payload(ppkt, spkt,
+                                    ppkt->header_size + ppkt->offset,
+                                    spkt->header_size + spkt->offset,
+                                    len)) {
+        return false;
+    }
+
+    conn->verified_seq = seq_end;
+    return true;
+}
+
 /*
  * return true means that the payload is consist and
  * need to make the next comparison, false means do
  * the checkpoint
 */
-static bool colo_mark_tcp_pkt(Packet *ppkt, Packet *spkt,
+static bool colo_mark_tcp_pkt(Connection *conn, Packet *ppkt, Packet *spkt,
                               int8_t *mark, uint32_t max_ack)
 {
     *mark = 0;
 
     if (ppkt->tcp_seq == spkt->tcp_seq && ppkt->seq_end == spkt->seq_end) {
-        if (!colo_compare_packet_payload(ppkt, spkt,
-                                        ppkt->header_size, spkt->header_size,
-                                        ppkt->payload_size)) {
+        if (colo_tcp_payload_verified(conn, ppkt->seq_end) ||
+            !colo_compare_packet_whole(ppkt, spkt,
+                                       ppkt->header_size, spkt->header_size)) {
             *mark = COLO_COMPARE_FREE_SECONDARY | COLO_COMPARE_FREE_PRIMARY;
             return true;
         }
@@ -365,10 +484,8 @@ static bool colo_mark_tcp_pkt(Packet *ppkt, Packet *spkt,
 
     /* one part of secondary packet payload still need to be compared */
     if (!after(ppkt->seq_end, spkt->seq_end)) {
-        if (!colo_compare_packet_payload(ppkt, spkt,
-                                        ppkt->header_size + ppkt->offset,
-                                        spkt->header_size + spkt->offset,
-                                        ppkt->payload_size - ppkt->offset)) {
+        if (colo_compare_tcp_payload(conn, ppkt, spkt,
+                                     ppkt->payload_size - ppkt->offset)) {
             if (!after(ppkt->tcp_ack, max_ack)) {
                 *mark = COLO_COMPARE_FREE_PRIMARY;
                 spkt->offset += ppkt->payload_size - ppkt->offset;
@@ -384,10 +501,8 @@ static bool colo_mark_tcp_pkt(Packet *ppkt, Packet *spkt,
         /* primary packet is longer than secondary packet, compare
          * the same part and mark the primary packet offset
          */
-        if (!colo_compare_packet_payload(ppkt, spkt,
-                                        ppkt->header_size + ppkt->offset,
-                                        spkt->header_size + spkt->offset,
-                                        spkt->payload_size - spkt->offset)) {
+        if (colo_compare_tcp_payload(conn, ppkt, spkt,
+                                     spkt->payload_size - spkt->offset)) {
             *mark = COLO_COMPARE_FREE_SECONDARY;
             ppkt->offset += spkt->payload_size - spkt->offset;
             return true;
@@ -397,7 +512,7 @@ static bool colo_mark_tcp_pkt(Packet *ppkt, Packet *spkt,
     return false;
 }
 
-static void colo_compare_tcp(CompareState *s, Connection *conn)
+static void colo_compare_tcp(CompareShard *shard, Connection *conn)
 {
     Packet *ppkt = NULL, *spkt = NULL;
     int8_t mark;
@@ -428,13 +543,13 @@ sec:
     spkt = g_queue_pop_head(&conn->secondary_list);
 
     if (ppkt->tcp_seq == ppkt->seq_end) {
-        colo_release_primary_pkt(s, ppkt);
+        colo_release_primary_pkt(shard, ppkt);
         ppkt = NULL;
     }
 
     if (ppkt && conn->compare_seq && !after(ppkt->seq_end, conn->compare_seq)) {
         trace_colo_compare_main("pri: this packet has compared");
-        colo_release_primary_pkt(s, ppkt);
+        colo_release_primary_pkt(shard, ppkt);
         ppkt = NULL;
     }
 
@@ -461,7 +576,7 @@ sec:
         }
     }
 
-    if (colo_mark_tcp_pkt(ppkt, spkt, &mark, min_ack)) {
+    if (colo_mark_tcp_pkt(conn, ppkt, spkt, &mark, min_ack)) {
         trace_colo_compare_tcp_info("pri",
                                     ppkt->tcp_seq, ppkt->tcp_ack,
                                     ppkt->header_size, ppkt->payload_size,
@@ -474,7 +589,7 @@ sec:
 
         if (mark == COLO_COMPARE_FREE_PRIMARY) {
             conn->compare_seq = ppkt->seq_end;
-            colo_release_primary_pkt(s, ppkt);
+            colo_release_primary_pkt(shard, ppkt);
             g_queue_push_head(&conn->secondary_list, spkt);
             goto pri;
         } else if (mark == COLO_COMPARE_FREE_SECONDARY) {
@@ -483,7 +598,7 @@ sec:
             goto sec;
         } else if (mark == (COLO_COMPARE_FREE_PRIMARY | COLO_COMPARE_FREE_SECONDARY)) {
             conn->compare_seq = ppkt->seq_end;
-            colo_release_primary_pkt(s, ppkt);
+            colo_release_primary_pkt(shard, ppkt);
             packet_destroy(spkt, NULL);
             goto pri;
         }
@@ -496,7 +611,7 @@ sec:
         qemu_hexdump(stderr, "colo-compare spkt", spkt->data, spkt->size);
 #endif
 
-        colo_compare_inconsistency_notify(s);
+        colo_compare_shard_inconsistency(shard);
     }
 }
 
@@ -526,8 +641,7 @@ static int colo_packet_compare_udp(Packet *spkt, Packet *ppkt)
         trace_colo_compare_main("UDP: payload size of packets are different");
         return -1;
     }
-    if (colo_compare_packet_payload(ppkt, spkt, offset, offset,
-                                    ppkt->size - offset)) {
+    if (colo_compare_packet_whole(ppkt, spkt, offset, offset)) {
         trace_colo_compare_udp_miscompare("primary pkt size", ppkt->size);
         trace_colo_compare_udp_miscompare("Secondary pkt size", spkt->size);
 #ifdef DEBUG_COLO_PACKETS
@@ -565,8 +679,7 @@ static int colo_packet_compare_icmp(Packet *spkt, Packet *ppkt)
         trace_colo_compare_main("ICMP: payload size of packets are different");
         return -1;
     }
-    if (colo_compare_packet_payload(ppkt, spkt, offset, offset,
-                                    ppkt->size - offset)) {
+    if (colo_compare_packet_whole(ppkt, spkt, offset, offset)) {
         trace_colo_compare_icmp_miscompare("primary pkt size",
                                            ppkt->size);
         trace_colo_compare_icmp_miscompare("Secondary pkt size",
@@ -594,8 +707,7 @@ static int colo_packet_compare_other(Packet *spkt, Packet *ppkt)
         trace_colo_compare_main("Other: payload size of packets are different");
         return -1;
     }
-    return colo_compare_packet_payload(ppkt, spkt, offset, offset,
-                                       ppkt->size - offset);
+    return colo_compare_packet_whole(ppkt, spkt, offset, offset);
 }
 
 static int colo_old_packet_check_one(Packet *pkt, int64_t *check_time)
@@ -640,8 +752,6 @@ static int colo_old_packet_check_one_conn(Connection *conn,
     return 1;
 
 out:
-    /* Do checkpoint will flush old packet */
-    colo_compare_inconsistency_notify(s);
     return 0;
 }
 
@@ -653,16 +763,30 @@ out:
 static void colo_old_packet_check(void *opaque)
 {
     CompareState *s = opaque;
+    GList *result;
+    uint32_t i;
 
     /*
      * If we find one old packet, stop finding job and notify
      * COLO frame do checkpoint.
      */
-    g_queue_find_custom(&s->conn_list, s,
-                        (GCompareFunc)colo_old_packet_check_one_conn);
+    for (i = 0; i < s->nr_shards; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        qemu_mutex_lock(&shard->lock);
+        result = g_queue_find_custom(&shard->conn_list, s,
+                            (GCompareFunc)colo_old_packet_check_one_conn);
+        qemu_mutex_unlock(&shard->lock);
+
+        if (result) {
+            /* Do checkpoint will flush old packet */
+            colo_compare_inconsistency_notify(s);
+            return;
+        }
+    }
 }
 
-static void colo_compare_packet(CompareState *s, Connection *conn,
+static void colo_compare_packet(CompareShard *shard, Connection *conn,
                                 int (*HandlePacket)(Packet *spkt,
                                 Packet *ppkt))
 {
@@ -676,7 +800,7 @@ static void colo_compare_packet(CompareState *s, Connection *conn,
                  pkt, (GCompareFunc)HandlePacket);
 
         if (result) {
-            colo_release_primary_pkt(s, pkt);
+            colo_release_primary_pkt(shard, pkt);
             packet_destroy(result->data, NULL);
             g_queue_delete_link(&conn->secondary_list, result);
         } else {
@@ -689,7 +813,7 @@ static void colo_compare_packet(CompareState *s, Connection *conn,
             trace_colo_compare_main("packet different");
             g_queue_push_head(&conn->primary_list, pkt);
 
-            colo_compare_inconsistency_notify(s);
+            colo_compare_shard_inconsistency(shard);
             break;
         }
     }
@@ -703,25 +827,99 @@ static void colo_compare_packet(CompareState *s, Connection *conn,
  */
 static void colo_compare_connection(void *opaque, void *user_data)
 {
-    CompareState *s = user_data;
+    CompareShard *shard = user_data;
     Connection *conn = opaque;
 
     switch (conn->ip_proto) {
     case IPPROTO_TCP:
-        colo_compare_tcp(s, conn);
+        colo_compare_tcp(shard, conn);
         break;
     case IPPROTO_UDP:
-        colo_compare_packet(s, conn, colo_packet_compare_udp);
+        colo_compare_packet(shard, conn, colo_packet_compare_udp);
         break;
     case IPPROTO_ICMP:
-        colo_compare_packet(s, conn, colo_packet_compare_icmp);
+        colo_compare_packet(shard, conn, colo_packet_compare_icmp);
         break;
     default:
-        colo_compare_packet(s, conn, colo_packet_compare_other);
+        colo_compare_packet(shard, conn, colo_packet_compare_other);
         break;
     }
 }
 
+/*
+ * Called from the compare thread on the primary once a packet was
+ * queued to @conn: compare right away, or wake up the shard thread.
+ */
+static void colo_compare_shard_kick(CompareShard *shard, Connection *conn)
+{
+    qemu_mutex_lock(&shard->lock);
+    if (!shard->s->compare_threads) {
+        colo_compare_connection(conn, shard);
+    } else if (!conn->compare_pending) {
+        conn->compare_pending = true;
+        g_queue_push_tail(&shard->pending_list, conn);
+        qemu_cond_signal(&shard->cond);
+    }
+    qemu_mutex_unlock(&shard->lock);
+}
+
+static void *colo_compare_shard_thread(void *opaque)
+{
+    CompareShard *shard = opaque;
+    Connection *conn;
+
+    qemu_mutex_lock(&shard->lock);
+    while (!shard->quit) {
+        conn = g_queue_pop_head(&shard->pending_list);
+        if (!conn) {
+            qemu_cond_wait(&shard->cond, &shard->lock);
+            continue;
+        }
+
+        conn->compare_pending = false;
+        colo_compare_connection(conn, shard);
+
+        if (!g_queue_is_empty(&shard->release_list) || shard->inconsistent) {
+            qemu_bh_schedule(shard->s->release_bh);
+        }
+    }
+    qemu_mutex_unlock(&shard->lock);
+
+    return NULL;
+}
+
+/*
+ * Called from the compare thread on the primary to send out
+ * what the shard threads have compared.
+ */
+static void colo_compare_release(void *opaque)
+{
+    CompareState *s = opaque;
+    bool inconsistent = false;
+    GQueue release_list;
+    Packet *pkt;
+    uint32_t i;
+
+    for (i = 0; i < s->nr_shards; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        qemu_mutex_lock(&shard->lock);
+        release_list = shard->release_list;
+        g_queue_init(&shard->release_list);
+        inconsistent |= shard->inconsistent;
+        shard->inconsistent = false;
+        qemu_mutex_unlock(&shard->lock);
+
+        while ((pkt = g_queue_pop_head(&release_list))) {
+            colo_send_primary_pkt(s, pkt);
+        }
+    }
+
+    if (inconsistent) {
+        colo_compare_inconsistency_notify(s);
+    }
+}
+
 static void coroutine_fn _compare_chr_send(void *opaque)
 {
     SendCo *sendco = opaque;
@@ -944,7 +1142,7 @@ static void colo_compare_timer_del(CompareState *s)
     }
  }
 
-static void colo_flush_packets(void *opaque, void *user_data);
+static void colo_compare_flush(CompareState *s);
 
 static void colo_compare_handle_event(void *opaque)
 {
@@ -952,7 +1150,7 @@ static void colo_compare_handle_event(void *opaque)
 
     switch (s->event) {
     case COLO_EVENT_CHECKPOINT:
-        g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        colo_compare_flush(s);
         break;
     case COLO_EVENT_FAILOVER:
         break;
@@ -987,6 +1185,7 @@ static void colo_compare_iothread(CompareState *s)
 
     colo_compare_timer_init(s);
     s->event_bh = aio_bh_new(ctx, colo_compare_handle_event, s);
+    s->release_bh = aio_bh_new(ctx, colo_compare_release, s);
 }
 
 static char *compare_get_pri_indev(Object *obj, Error **errp)
@@ -1121,6 +1320,35 @@ static void compare_set_expired_scan_cycle(Object *obj, Visitor *v,
     s->expired_scan_cycle = value;
 }
 
+static void compare_get_threads(Object *obj, Visitor *v,
+                                const char *name, void *opaque,
+                                Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    uint32_t value = s->compare_threads;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void compare_set_threads(Object *obj, Visitor *v,
+                                const char *name, void *opaque,
+                                Error **errp)
+{
+    CompareState *s = COLO_COMPARE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value > MAX_COMPARE_THREADS) {
+        error_setg(errp, "Property '%s.%s' doesn't take value '%u'"
+                   " (maximum: %u)", object_get_typename(obj), name,
+                   value, MAX_COMPARE_THREADS);
+        return;
+    }
+    s->compare_threads = value;
+}
+
 static void get_max_queue_size(Object *obj, Visitor *v,
                                const char *name, void *opaque,
                                Error **errp)
@@ -1155,9 +1383,10 @@ out:
 static void compare_pri_rs_finalize(SocketReadState *pri_rs)
 {
     CompareState *s = container_of(pri_rs, CompareState, pri_rs);
+    CompareShard *shard = NULL;
     Connection *conn = NULL;
 
-    if (packet_enqueue(s, PRIMARY_IN, &conn)) {
+    if (packet_enqueue(s, PRIMARY_IN, &conn, &shard)) {
         trace_colo_compare_main("primary: unsupported packet in");
         compare_chr_send(s,
                          pri_rs->buf,
@@ -1167,20 +1396,21 @@ static void compare_pri_rs_finalize(SocketReadState *pri_rs)
                          false);
     } else {
         /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
+        colo_compare_shard_kick(shard, conn);
     }
 }
 
 static void compare_sec_rs_finalize(SocketReadState *sec_rs)
 {
     CompareState *s = container_of(sec_rs, CompareState, sec_rs);
+    CompareShard *shard = NULL;
     Connection *conn = NULL;
 
-    if (packet_enqueue(s, SECONDARY_IN, &conn)) {
+    if (packet_enqueue(s, SECONDARY_IN, &conn, &shard)) {
         trace_colo_compare_main("secondary: unsupported packet in");
     } else {
         /* compare packet in the specified connection */
-        colo_compare_connection(conn, s);
+        colo_compare_shard_kick(shard, conn);
     }
 }
 
@@ -1202,7 +1432,7 @@ static void compare_notify_rs_finalize(SocketReadState *notify_rs)
                                   notify_rs->buf,
                                   notify_rs->packet_len)) {
         /* colo-compare do checkpoint, flush pri packet and remove sec packet */
-        g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+        colo_compare_flush(s);
     } else {
         error_report("COLO compare got unsupported instruction");
     }
@@ -1246,6 +1476,7 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
 {
     CompareState *s = COLO_COMPARE(uc);
     Chardev *chr;
+    uint32_t i;
 
     if (!s->pri_indev || !s->sec_indev || !s->outdev || !s->iothread) {
         error_setg(errp, "colo compare needs 'primary_in' ,"
@@ -1317,15 +1548,35 @@ static void colo_compare_complete(UserCreatable *uc, Error **errp)
         g_queue_init(&s->notify_sendco.send_list);
     }
 
-    g_queue_init(&s->conn_list);
+    s->nr_shards = MAX(s->compare_threads, 1);
+    s->shards = g_new0(CompareShard, s->nr_shards);
+    for (i = 0; i < s->nr_shards; i++) {
+        CompareShard *shard = &s->shards[i];
 
-    s->connection_track_table = g_hash_table_new_full(connection_key_hash,
-                                                      connection_key_equal,
-                                                      g_free,
-                                                      connection_destroy);
+        shard->s = s;
+        shard->max_connections = HASHTABLE_MAX_SIZE / s->nr_shards;
+        qemu_mutex_init(&shard->lock);
+        qemu_cond_init(&shard->cond);
+        g_queue_init(&shard->conn_list);
+        g_queue_init(&shard->pending_list);
+        g_queue_init(&shard->release_list);
+        shard->connection_track_table =
+            g_hash_table_new_full(connection_key_hash,
+                                  connection_key_equal,
+                                  g_free,
+                                  connection_destroy);
+    }
 
     colo_compare_iothread(s);
 
+    for (i = 0; i < s->compare_threads; i++) {
+        g_autofree char *name = g_strdup_printf("colo-compare-%u", i);
+
+        qemu_thread_create(&s->shards[i].thread, name,
+                           colo_compare_shard_thread, &s->shards[i],
+                           QEMU_THREAD_JOINABLE);
+    }
+
     qemu_mutex_lock(&colo_compare_mutex);
     if (!colo_compare_active) {
         qemu_mutex_init(&event_mtx);
@@ -1360,6 +1611,28 @@ static void colo_flush_packets(void *opaque, void *user_data)
     }
 }
 
+/*
+ * Send out the packets the shard threads have already matched, then
+ * everything else that is still queued.
+ */
+static void colo_compare_flush(CompareState *s)
+{
+    Packet *pkt;
+    uint32_t i;
+
+    for (i = 0; i < s->nr_shards; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        qemu_mutex_lock(&shard->lock);
+        while ((pkt = g_queue_pop_head(&shard->release_list))) {
+            colo_send_primary_pkt(s, pkt);
+        }
+        shard->inconsistent = false;
+        g_queue_foreach(&shard->conn_list, colo_flush_packets, s);
+        qemu_mutex_unlock(&shard->lock);
+    }
+}
+
 static void colo_compare_class_init(ObjectClass *oc, void *data)
 {
     UserCreatableClass *ucc = USER_CREATABLE_CLASS(oc);
@@ -1397,6 +1670,10 @@ static void colo_compare_init(Object *obj)
                         get_max_queue_size,
                         set_max_queue_size, NULL, NULL);
 
+    object_property_add(obj, "compare_threads", "uint32",
+                        compare_get_threads,
+                        compare_set_threads, NULL, NULL);
+
     s->vnet_hdr = false;
     object_property_add_bool(obj, "vnet_hdr_support", compare_get_vnet_hdr,
                              compare_set_vnet_hdr);
@@ -1416,6 +1693,7 @@ static void colo_compare_finalize(Object *obj)
 {
     CompareState *s = COLO_COMPARE(obj);
     CompareState *tmp = NULL;
+    uint32_t i;
 
     qemu_mutex_lock(&colo_compare_mutex);
     QTAILQ_FOREACH(tmp, &net_compares, next) {
@@ -1440,7 +1718,19 @@ static void colo_compare_finalize(Object *obj)
 
     colo_compare_timer_del(s);
 
+    /* The shard threads schedule release_bh, stop them first */
+    for (i = 0; i < s->compare_threads && s->shards; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        qemu_mutex_lock(&shard->lock);
+        shard->quit = true;
+        qemu_cond_signal(&shard->cond);
+        qemu_mutex_unlock(&shard->lock);
+        qemu_thread_join(&shard->thread);
+    }
+
     qemu_bh_delete(s->event_bh);
+    qemu_bh_delete(s->release_bh);
 
     AioContext *ctx = iothread_get_aio_context(s->iothread);
     aio_context_acquire(ctx);
@@ -1451,18 +1741,24 @@ static void colo_compare_finalize(Object *obj)
     aio_context_release(ctx);
 
     /* Release all unhandled packets after compare thead exited */
-    g_queue_foreach(&s->conn_list, colo_flush_packets, s);
+    colo_compare_flush(s);
     AIO_WAIT_WHILE(NULL, !s->out_sendco.done);
 
-    g_queue_clear(&s->conn_list);
     g_queue_clear(&s->out_sendco.send_list);
     if (s->notify_dev) {
         g_queue_clear(&s->notify_sendco.send_list);
     }
 
-    if (s->connection_track_table) {
-        g_hash_table_destroy(s->connection_track_table);
+    for (i = 0; i < s->nr_shards; i++) {
+        CompareShard *shard = &s->shards[i];
+
+        g_queue_clear(&shard->conn_list);
+        g_queue_clear(&shard->pending_list);
+        g_hash_table_destroy(shard->connection_track_table);
+        qemu_cond_destroy(&shard->cond);
+        qemu_mutex_destroy(&shard->lock);
     }
+    g_free(s->shards);
 
     object_unref(OBJECT(s->iothread));
 
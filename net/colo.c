@@ -206,10 +206,14 @@ void connection_hashtable_reset(GHashTable *connection_track_table)
     g_hash_table_remove_all(connection_track_table);
 }
 
-/* if not found, create a new connection and add to hash table */
+/*
+ * if not found, create a new connection and add to hash table;
+ * the table is cleared when it holds more than @max_size connections
+ */
 Connection *connection_get(GHashTable *connection_track_table,
                            ConnectionKey *key,
-                           GQueue *conn_list)
+                           GQueue *conn_list,
+                           guint max_size)
 {
     Connection *conn = g_hash_table_lookup(connection_track_table, key);
 
@@ -218,7 +222,7 @@ Connection *connection_get(GHashTable *connection_track_table,
 
         conn = connection_new(key);
 
-        if (g_hash_table_size(connection_track_table) > HASHTABLE_MAX_SIZE) {
+        if (g_hash_table_size(connection_track_table) > max_size) {
             trace_colo_proxy_main("colo proxy connection hashtable full,"
                                   " clear it");
             connection_hashtable_reset(connection_track_table);
@@ -72,9 +72,13 @@ typedef struct Connection {
     GQueue secondary_list;
     /* flag to enqueue unprocessed_connections */
     bool processing;
+    /* flag to enqueue the colo-compare shard's pending connections */
+    bool compare_pending;
     uint8_t ip_proto;
     /* record the sequence number that has been compared */
     uint32_t compare_seq;
+    /* record the sequence number whose payload matched, but not yet acked */
+    uint32_t verified_seq;
     /* the maximum of acknowledgement number in primary_list queue */
     uint32_t pack;
     /* the maximum of acknowledgement number in secondary_list queue */
@@ -96,7 +100,8 @@ Connection *connection_new(ConnectionKey *key);
 void connection_destroy(void *opaque);
 Connection *connection_get(GHashTable *connection_track_table,
                            ConnectionKey *key,
-                           GQueue *conn_list);
+                           GQueue *conn_list,
+                           guint max_size);
 bool connection_has_tracked(GHashTable *connection_track_table,
                             ConnectionKey *key);
 void connection_hashtable_reset(GHashTable *connection_track_table);
@@ -297,7 +297,8 @@ static ssize_t colo_rewriter_receive_iov(NetFilterState *nf,
 
         conn = connection_get(s->connection_track_table,
                               &key,
-                              NULL);
+                              NULL,
+                              HASHTABLE_MAX_SIZE);
 
         if (sender == nf->netdev) {
             /* NET_FILTER_DIRECTION_TX */
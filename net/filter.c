@@ -245,6 +245,14 @@ static void netfilter_complete(UserCreatable *uc, Error **errp)
         return;
     }
 
+    /* Filters only run in the main loop */
+    if (ncs[0]->aio_context) {
+        error_setg(errp, "netdev '%s' is handled by an iothread, filters "
+                   "cannot be added while the guest driver is running",
+                   nf->netdev_id);
+        return;
+    }
+
     if (strcmp(nf->position, "head") && strcmp(nf->position, "tail")) {
         Object *container;
         Object *obj;
@@ -233,6 +233,11 @@ static ssize_t qemu_deliver_packet_iov(NetClientState *sender,
                                        const struct iovec *iov,
                                        int iovcnt,
                                        void *opaque);
+static int qemu_deliver_packet_batch(NetClientState *sender,
+                                     unsigned flags,
+                                     const struct iovec *pkts,
+                                     int npkts,
+                                     void *opaque);
 
 static void qemu_net_client_setup(NetClientState *nc,
                                   NetClientInfo *info,
@@ -258,6 +263,10 @@ static void qemu_net_client_setup(NetClientState *nc,
     QTAILQ_INSERT_TAIL(&net_clients, nc, next);
 
     nc->incoming_queue = qemu_new_net_queue(qemu_deliver_packet_iov, nc);
+    if (info->receive_batch) {
+        qemu_net_queue_set_deliver_batch(nc->incoming_queue,
+                                         qemu_deliver_packet_batch);
+    }
     nc->destructor = destructor;
     nc->is_datapath = is_datapath;
     QTAILQ_INIT(&nc->filters);
@@ -502,6 +511,13 @@ void qemu_using_vnet_hdr(NetClientState *nc, bool enable)
     nc->info->using_vnet_hdr(nc, enable);
 }
 
+void qemu_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    assert(nc->info->set_aio_context);
+    nc->info->set_aio_context(nc, ctx);
+    nc->aio_context = ctx;
+}
+
 void qemu_set_offload(NetClientState *nc, int csum, int tso4, int tso6,
                           int ecn, int ufo)
 {
@@ -699,6 +715,40 @@ ssize_t qemu_send_packet_async(NetClientState *sender,
                                              buf, size, sent_cb);
 }
 
+/*
+ * Send @npkts packets, each one contiguous in its iovec, to the peer.
+ * Returns the number of leading packets that were consumed right away.
+ * If that is less than @npkts, the remaining packets have been queued;
+ * the caller must not send more until @sent_cb is invoked for them.
+ */
+int qemu_send_packets_async(NetClientState *sender,
+                            const struct iovec *pkts, int npkts,
+                            NetPacketSent *sent_cb)
+{
+    int i, done = npkts;
+
+    if (sender->link_down || !sender->peer) {
+        return npkts;
+    }
+
+    /* Filters only see single packets */
+    if (!QTAILQ_EMPTY(&sender->filters) ||
+        !QTAILQ_EMPTY(&sender->peer->filters)) {
+        for (i = 0; i < npkts; i++) {
+            if (qemu_send_packet_async(sender, pkts[i].iov_base,
+                                       pkts[i].iov_len, sent_cb) == 0 &&
+                done == npkts) {
+                done = i;
+            }
+        }
+        return done;
+    }
+
+    return qemu_net_queue_send_batch(sender->peer->incoming_queue, sender,
+                                     QEMU_NET_PACKET_FLAG_NONE,
+                                     pkts, npkts, sent_cb);
+}
+
 ssize_t qemu_send_packet(NetClientState *nc, const uint8_t *buf, int size)
 {
     return qemu_send_packet_async(nc, buf, size, NULL);
@@ -791,6 +841,31 @@ static ssize_t qemu_deliver_packet_iov(NetClientState *sender,
     return ret;
 }
 
+static int qemu_deliver_packet_batch(NetClientState *sender,
+                                     unsigned flags,
+                                     const struct iovec *pkts,
+                                     int npkts,
+                                     void *opaque)
+{
+    NetClientState *nc = opaque;
+    int ret;
+
+    if (nc->link_down) {
+        return npkts;
+    }
+
+    if (nc->receive_disabled) {
+        return 0;
+    }
+
+    ret = nc->info->receive_batch(nc, pkts, npkts);
+    if (ret < npkts) {
+        nc->receive_disabled = 1;
+    }
+
+    return ret;
+}
+
 ssize_t qemu_sendv_packet_async(NetClientState *sender,
                                 const struct iovec *iov, int iovcnt,
                                 NetPacketSent *sent_cb)
@@ -1008,6 +1083,9 @@ static int (* const net_client_init_fun[NET_CLIENT_DRIVER__MAX])(
 #ifdef CONFIG_NETMAP
         [NET_CLIENT_DRIVER_NETMAP]    = net_init_netmap,
 #endif
+#ifdef CONFIG_AF_XDP
+        [NET_CLIENT_DRIVER_AF_XDP]    = net_init_af_xdp,
+#endif
 #ifdef CONFIG_NET_BRIDGE
         [NET_CLIENT_DRIVER_BRIDGE]    = net_init_bridge,
 #endif
@@ -1101,6 +1179,9 @@ void show_netdevs(void)
 #ifdef CONFIG_NETMAP
         "netmap",
 #endif
+#ifdef CONFIG_AF_XDP
+        "af-xdp",
+#endif
 #ifdef CONFIG_POSIX
         "vhost-user",
 #endif
@@ -1308,6 +1389,32 @@ RxFilterInfoList *qmp_query_rx_filter(bool has_name, const char *name,
     return filter_list;
 }
 
+void qmp_set_nic_coalescing(NicCoalescingParameters *params, Error **errp)
+{
+    NetClientState *nc;
+
+    QTAILQ_FOREACH(nc, &net_clients, next) {
+        if (nc->info->type == NET_CLIENT_DRIVER_NIC &&
+            nc->queue_index == 0 && !strcmp(nc->name, params->name)) {
+            break;
+        }
+    }
+
+    if (!nc) {
+        error_set(errp, ERROR_CLASS_DEVICE_NOT_FOUND,
+                  "NIC '%s' not found", params->name);
+        return;
+    }
+
+    if (!nc->info->set_coalescing) {
+        error_setg(errp, "net client(%s) doesn't support"
+                   " notification coalescing", params->name);
+        return;
+    }
+
+    nc->info->set_coalescing(nc, params, errp);
+}
+
 void hmp_info_network(Monitor *mon, const QDict *qdict)
 {
     NetClientState *nc, *peer;
@@ -1405,6 +1512,16 @@ static void net_vm_change_state_handler(void *opaque, bool running,
     NetClientState *tmp;
 
     QTAILQ_FOREACH_SAFE(nc, &net_clients, next, tmp) {
+        /* The queues of a datapath handled by an IOThread belong to it */
+        AioContext *ctx = nc->aio_context;
+
+        if (!ctx && nc->peer) {
+            ctx = nc->peer->aio_context;
+        }
+        if (ctx) {
+            aio_context_acquire(ctx);
+        }
+
         if (running) {
             /* Flush queued packets and wake up backends. */
             if (nc->peer && qemu_can_send_packet(nc)) {
@@ -1416,6 +1533,10 @@ static void net_vm_change_state_handler(void *opaque, bool running,
              */
             qemu_flush_or_purge_queued_packets(nc, true);
         }
+
+        if (ctx) {
+            aio_context_release(ctx);
+        }
     }
 }
 
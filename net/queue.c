@@ -54,6 +54,7 @@ struct NetQueue {
     uint32_t nq_maxlen;
     uint32_t nq_count;
     NetQueueDeliverFunc *deliver;
+    NetQueueDeliverBatchFunc *deliver_batch;
 
     QTAILQ_HEAD(, NetPacket) packets;
 
@@ -78,6 +79,12 @@ NetQueue *qemu_new_net_queue(NetQueueDeliverFunc *deliver, void *opaque)
     return queue;
 }
 
+void qemu_net_queue_set_deliver_batch(NetQueue *queue,
+                                      NetQueueDeliverBatchFunc *deliver_batch)
+{
+    queue->deliver_batch = deliver_batch;
+}
+
 void qemu_del_net_queue(NetQueue *queue)
 {
     NetPacket *packet, *next;
@@ -182,6 +189,31 @@ static ssize_t qemu_net_queue_deliver_iov(NetQueue *queue,
     return ret;
 }
 
+static int qemu_net_queue_deliver_batch(NetQueue *queue,
+                                        NetClientState *sender,
+                                        unsigned flags,
+                                        const struct iovec *pkts,
+                                        int npkts)
+{
+    int i;
+
+    if (queue->deliver_batch) {
+        queue->delivering = 1;
+        i = queue->deliver_batch(sender, flags, pkts, npkts, queue->opaque);
+        queue->delivering = 0;
+        return i;
+    }
+
+    for (i = 0; i < npkts; i++) {
+        if (qemu_net_queue_deliver(queue, sender, flags,
+                                   pkts[i].iov_base, pkts[i].iov_len) == 0) {
+            break;
+        }
+    }
+
+    return i;
+}
+
 ssize_t qemu_net_queue_receive(NetQueue *queue,
                                const uint8_t *data,
                                size_t size)
@@ -254,6 +286,36 @@ ssize_t qemu_net_queue_send_iov(NetQueue *queue,
     return ret;
 }
 
+/* Each element of @pkts is one contiguous packet.  Returns the number of
+ * packets that were consumed right away; the remaining ones have been
+ * queued just like qemu_net_queue_send() does for a single packet, and
+ * @sent_cb will be invoked for each of them.
+ */
+int qemu_net_queue_send_batch(NetQueue *queue,
+                              NetClientState *sender,
+                              unsigned flags,
+                              const struct iovec *pkts,
+                              int npkts,
+                              NetPacketSent *sent_cb)
+{
+    int i, done = 0;
+
+    if (!queue->delivering && qemu_can_send_packet(sender)) {
+        done = qemu_net_queue_deliver_batch(queue, sender, flags, pkts, npkts);
+    }
+
+    for (i = done; i < npkts; i++) {
+        qemu_net_queue_append(queue, sender, flags,
+                              pkts[i].iov_base, pkts[i].iov_len, sent_cb);
+    }
+
+    if (done == npkts) {
+        qemu_net_queue_flush(queue);
+    }
+
+    return done;
+}
+
 void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
 {
     NetPacket *packet, *next;
@@ -270,6 +332,11 @@ void qemu_net_queue_purge(NetQueue *queue, NetClientState *from)
     }
 }
 
+bool qemu_net_queue_empty(NetQueue *queue)
+{
+    return QTAILQ_EMPTY(&queue->packets);
+}
+
 bool qemu_net_queue_flush(NetQueue *queue)
 {
     if (queue->delivering)
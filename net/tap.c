@@ -48,12 +48,20 @@
 
 #include "net/vhost_net.h"
 
+/*
+ * Received packets are read back to back into TAPState.buf and passed to
+ * the peer in batches.  Every read is given NET_BUFSIZE bytes of room so
+ * that a maximum-sized frame is never truncated.
+ */
+#define TAP_BATCH_BUFSIZE (2 * NET_BUFSIZE)
+#define TAP_BATCH_MAX 32
+
 typedef struct TAPState {
     NetClientState nc;
     int fd;
     char down_script[1024];
     char down_script_arg[128];
-    uint8_t buf[NET_BUFSIZE];
+    uint8_t buf[TAP_BATCH_BUFSIZE];
     bool read_poll;
     bool write_poll;
     bool using_vnet_hdr;
@@ -62,20 +70,31 @@ typedef struct TAPState {
     VHostNetState *vhost_net;
     unsigned host_vnet_hdr_len;
     Notifier exit;
+    AioContext *ctx; /* NULL when the fd is handled by the main loop */
 } TAPState;
 
 static void launch_script(const char *setup_script, const char *ifname,
                           int fd, Error **errp);
 
 static void tap_send(void *opaque);
+static bool tap_poll_send(void *opaque);
 static void tap_writable(void *opaque);
 
 static void tap_update_fd_handler(TAPState *s)
 {
-    qemu_set_fd_handler(s->fd,
-                        s->read_poll && s->enabled ? tap_send : NULL,
-                        s->write_poll && s->enabled ? tap_writable : NULL,
-                        s);
+    IOHandler *fd_read = s->read_poll && s->enabled ? tap_send : NULL;
+    IOHandler *fd_write = s->write_poll && s->enabled ? tap_writable : NULL;
+
+    if (s->ctx) {
+        /*
+         * Without a poll handler the fd would keep the whole AioContext
+         * out of adaptive polling, virtqueues included.
+         */
+        aio_set_fd_handler(s->ctx, s->fd, false, fd_read, fd_write,
+                           fd_read ? tap_poll_send : NULL, s);
+    } else {
+        qemu_set_fd_handler(s->fd, fd_read, fd_write, s);
+    }
 }
 
 static void tap_read_poll(TAPState *s, bool enable)
@@ -90,13 +109,39 @@ static void tap_write_poll(TAPState *s, bool enable)
     tap_update_fd_handler(s);
 }
 
+/*
+ * Take the AioContext lock of the fd handler that is running, if it is run
+ * by an IOThread.  Fails if the main loop moved the handlers elsewhere while
+ * we were waiting for the lock; their new owner takes over then.
+ */
+static bool tap_aio_context_acquire(TAPState *s, AioContext *ctx)
+{
+    if (ctx) {
+        aio_context_acquire(ctx);
+        if (qatomic_read(&s->ctx) != ctx) {
+            aio_context_release(ctx);
+            return false;
+        }
+    }
+    return true;
+}
+
 static void tap_writable(void *opaque)
 {
     TAPState *s = opaque;
+    AioContext *ctx = qatomic_read(&s->ctx);
+
+    if (!tap_aio_context_acquire(s, ctx)) {
+        return;
+    }
 
     tap_write_poll(s, false);
 
     qemu_flush_queued_packets(&s->nc);
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
 }
 
 static ssize_t tap_write_packet(TAPState *s, const struct iovec *iov, int iovcnt)
@@ -182,53 +227,123 @@ static void tap_send_completed(NetClientState *nc, ssize_t len)
     tap_read_poll(s, true);
 }
 
-static void tap_send(void *opaque)
+/*
+ * Read up to @max packets into s->buf.  Returns the number of packets
+ * read; *@drained is set when the fd had no more data.
+ */
+static int tap_read_batch(TAPState *s, struct iovec *pkts, int max,
+                          bool *drained)
 {
-    TAPState *s = opaque;
-    int size;
-    int packets = 0;
+    size_t offset = 0;
+    int npkts = 0;
 
-    while (true) {
-        uint8_t *buf = s->buf;
-        uint8_t min_pkt[ETH_ZLEN];
-        size_t min_pktsz = sizeof(min_pkt);
+    *drained = false;
 
-        size = tap_read_packet(s->fd, s->buf, sizeof(s->buf));
+    while (npkts < max && sizeof(s->buf) - offset >= NET_BUFSIZE) {
+        uint8_t *buf = s->buf + offset;
+        int size;
+
+        size = tap_read_packet(s->fd, buf, NET_BUFSIZE);
         if (size <= 0) {
+            *drained = true;
             break;
         }
+        offset += size;
 
         if (s->host_vnet_hdr_len && !s->using_vnet_hdr) {
+            if (size < s->host_vnet_hdr_len) {
+                continue;
+            }
             buf  += s->host_vnet_hdr_len;
             size -= s->host_vnet_hdr_len;
         }
 
-        if (net_peer_needs_padding(&s->nc)) {
-            if (eth_pad_short_frame(min_pkt, &min_pktsz, buf, size)) {
-                buf = min_pkt;
-                size = min_pktsz;
-            }
+        /* Pad in place, there is always room left behind the packet */
+        if (size < ETH_ZLEN && net_peer_needs_padding(&s->nc)) {
+            memset(buf + size, 0, ETH_ZLEN - size);
+            offset += ETH_ZLEN - size;
+            size = ETH_ZLEN;
         }
 
-        size = qemu_send_packet_async(&s->nc, buf, size, tap_send_completed);
-        if (size == 0) {
-            tap_read_poll(s, false);
+        pkts[npkts].iov_base = buf;
+        pkts[npkts].iov_len = size;
+        npkts++;
+    }
+
+    return npkts;
+}
+
+/* Returns the number of packets passed to the peer */
+static int tap_send_packets(TAPState *s)
+{
+    struct iovec pkts[TAP_BATCH_MAX];
+    int packets = 0;
+
+    /*
+     * When the host keeps receiving more packets while tap_send() is
+     * running we can hog the QEMU global mutex.  Limit the number of
+     * packets that are processed per tap_send() callback to prevent
+     * stalling the guest.
+     */
+    while (packets < 50) {
+        bool drained;
+        int npkts, done;
+
+        npkts = tap_read_batch(s, pkts, MIN(TAP_BATCH_MAX, 50 - packets),
+                               &drained);
+        if (npkts == 0) {
             break;
-        } else if (size < 0) {
+        }
+
+        done = qemu_send_packets_async(&s->nc, pkts, npkts,
+                                       tap_send_completed);
+        if (done < npkts) {
+            tap_read_poll(s, false);
             break;
         }
 
-        /*
-         * When the host keeps receiving more packets while tap_send() is
-         * running we can hog the QEMU global mutex.  Limit the number of
-         * packets that are processed per tap_send() callback to prevent
-         * stalling the guest.
-         */
-        packets++;
-        if (packets >= 50) {
+        packets += npkts;
+        if (drained) {
             break;
         }
     }
+
+    return packets;
+}
+
+static void tap_send(void *opaque)
+{
+    TAPState *s = opaque;
+    AioContext *ctx = qatomic_read(&s->ctx);
+
+    if (!tap_aio_context_acquire(s, ctx)) {
+        return;
+    }
+
+    tap_send_packets(s);
+
+    if (ctx) {
+        aio_context_release(ctx);
+    }
+}
+
+/*
+ * AioContext busy-poll handler.  Each call costs a read() that usually
+ * fails with EAGAIN, which is still far cheaper than a wakeup from ppoll().
+ */
+static bool tap_poll_send(void *opaque)
+{
+    TAPState *s = opaque;
+    AioContext *ctx = qatomic_read(&s->ctx);
+    int packets;
+
+    if (!ctx || !tap_aio_context_acquire(s, ctx)) {
+        return false;
+    }
+    packets = s->read_poll && s->enabled ? tap_send_packets(s) : 0;
+    aio_context_release(ctx);
+
+    return packets > 0;
 }
 
 static bool tap_has_ufo(NetClientState *nc)
@@ -355,6 +470,26 @@ static bool tap_set_steering_ebpf(NetClientState *nc, int prog_fd)
     return tap_fd_set_steering_ebpf(s->fd, prog_fd) == 0;
 }
 
+static void tap_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    TAPState *s = DO_UPCAST(TAPState, nc, nc);
+
+    assert(nc->info->type == NET_CLIENT_DRIVER_TAP);
+
+    if (s->ctx == ctx) {
+        return;
+    }
+
+    /* Drop the handlers from the old context before installing new ones */
+    if (s->ctx) {
+        aio_set_fd_handler(s->ctx, s->fd, false, NULL, NULL, NULL, NULL);
+    } else {
+        qemu_set_fd_handler(s->fd, NULL, NULL, NULL);
+    }
+    qatomic_set(&s->ctx, ctx);
+    tap_update_fd_handler(s);
+}
+
 int tap_get_fd(NetClientState *nc)
 {
     TAPState *s = DO_UPCAST(TAPState, nc, nc);
@@ -381,6 +516,7 @@ static NetClientInfo net_tap_info = {
     .set_vnet_le = tap_set_vnet_le,
     .set_vnet_be = tap_set_vnet_be,
     .set_steering_ebpf = tap_set_steering_ebpf,
+    .set_aio_context = tap_set_aio_context,
 };
 
 static TAPState *net_tap_fd_init(NetClientState *peer,
@@ -0,0 +1,113 @@
+/*
+ * vhost-user-net-server receive offload handling
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+/*
+ * A tap queue only hands out the offloads set with TUNSETOFFLOAD, but an
+ * AF_PACKET socket with PACKET_VNET_HDR passes on whatever the host stack
+ * produced: partial checksums of locally generated traffic and GRO/GSO
+ * super-frames.  A driver that did not negotiate the matching
+ * VIRTIO_NET_F_GUEST_* feature cannot parse those, so they are fixed up or
+ * dropped here before reaching the rx virtqueue.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "standard-headers/linux/virtio_net.h"
+#include "vhost-user-net-offload.h"
+
+static bool vu_net_has_offload(uint64_t features, unsigned int fbit)
+{
+    return features & (1ull << fbit);
+}
+
+/* Fold the one's complement sum of @len bytes at @data */
+static uint16_t vu_net_csum(const uint8_t *data, size_t len)
+{
+    uint32_t sum = 0;
+    size_t i;
+
+    for (i = 0; i + 1 < len; i += 2) {
+        sum += lduw_be_p(data + i);
+    }
+    if (len & 1) {
+        sum += data[len - 1] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+static bool vu_net_gso_allowed(uint8_t gso_type, uint64_t features)
+{
+    unsigned int fbit;
+
+    switch (gso_type & ~VIRTIO_NET_HDR_GSO_ECN) {
+    case VIRTIO_NET_HDR_GSO_TCPV4:
+        fbit = VIRTIO_NET_F_GUEST_TSO4;
+        break;
+    case VIRTIO_NET_HDR_GSO_TCPV6:
+        fbit = VIRTIO_NET_F_GUEST_TSO6;
+        break;
+    case VIRTIO_NET_HDR_GSO_UDP:
+        fbit = VIRTIO_NET_F_GUEST_UFO;
+        break;
+    default:
+        return false;
+    }
+
+    /* The guest offloads all depend on GUEST_CSUM */
+    if (!vu_net_has_offload(features, VIRTIO_NET_F_GUEST_CSUM)) {
+        return false;
+    }
+    if ((gso_type & VIRTIO_NET_HDR_GSO_ECN) &&
+        !vu_net_has_offload(features, VIRTIO_NET_F_GUEST_ECN)) {
+        return false;
+    }
+    return vu_net_has_offload(features, fbit);
+}
+
+bool vu_net_rx_fixup_offload(uint8_t *buf, size_t hdr_len, size_t size,
+                             uint64_t features)
+{
+    struct virtio_net_hdr hdr;
+    uint8_t *frame = buf + hdr_len;
+    size_t frame_len = size - hdr_len;
+
+    memcpy(&hdr, buf, sizeof(hdr));
+
+    if (hdr.gso_type != VIRTIO_NET_HDR_GSO_NONE &&
+        !vu_net_gso_allowed(hdr.gso_type, features)) {
+        return false;
+    }
+
+    if (vu_net_has_offload(features, VIRTIO_NET_F_GUEST_CSUM)) {
+        return true;
+    }
+
+    /* Without GUEST_CSUM, GSO frames were already refused above */
+    if (hdr.flags & VIRTIO_NET_HDR_F_NEEDS_CSUM) {
+        size_t start = hdr.csum_start;
+        size_t offset = hdr.csum_offset;
+
+        if (start > frame_len ||
+            offset + sizeof(uint16_t) > frame_len - start) {
+            return false;
+        }
+
+        /* The checksum field already holds the pseudo-header sum */
+        stw_be_p(frame + start + offset,
+                 ~vu_net_csum(frame + start, frame_len - start));
+    }
+
+    /* DATA_VALID is only defined for drivers with GUEST_CSUM */
+    hdr.flags = 0;
+    hdr.csum_start = 0;
+    hdr.csum_offset = 0;
+    memcpy(buf, &hdr, sizeof(hdr));
+    return true;
+}
@@ -0,0 +1,25 @@
+/*
+ * vhost-user-net-server receive offload handling
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+#ifndef NET_VHOST_USER_NET_OFFLOAD_H
+#define NET_VHOST_USER_NET_OFFLOAD_H
+
+/*
+ * Make the virtio-net header of a frame received from the host match the
+ * offloads in @features, the feature bits negotiated with the driver.
+ *
+ * @buf starts with a struct virtio_net_hdr and the frame follows after
+ * @hdr_len bytes.  @size includes the header.  A partial checksum is
+ * completed in software if the driver did not negotiate
+ * VIRTIO_NET_F_GUEST_CSUM.  GSO frames cannot be segmented here.
+ *
+ * Returns false if the frame cannot be delivered and must be dropped.
+ */
+bool vu_net_rx_fixup_offload(uint8_t *buf, size_t hdr_len, size_t size,
+                             uint64_t features);
+
+#endif /* NET_VHOST_USER_NET_OFFLOAD_H */
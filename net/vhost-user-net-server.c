@@ -0,0 +1,940 @@
+/*
+ * vhost-user-net server bridging to a host network interface
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ */
+
+/*
+ * Theory of operation:
+ *
+ * A vhost-user-net-server object listens on a vhost-user socket and serves
+ * the data virtqueues of a virtio-net device whose frontend is a QEMU
+ * vhost-user netdev.  The control virtqueue stays in the frontend.
+ *
+ * Each queue pair (rx virtqueue 2 * n, tx virtqueue 2 * n + 1) is bridged
+ * to one host file descriptor: a queue of a multiqueue tap interface or an
+ * AF_PACKET socket that is part of a fanout group.  Both carry a virtio-net
+ * header in front of every frame so checksum and segmentation offloads are
+ * passed through without touching the payload.
+ *
+ * All virtqueue and host fd processing runs in the AioContext of the
+ * optional iothread.  The host fd is registered with a poll handler so that
+ * an iothread with poll-max-ns set busy-polls both the host interface and
+ * the tx virtqueue instead of sleeping in ppoll().
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/iov.h"
+#include "qemu/cutils.h"
+#include "qemu/error-report.h"
+#include "qemu/main-loop.h"
+#include "qemu/module.h"
+#include "qemu/vhost-user-server.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qerror.h"
+#include "qapi/qapi-types-sockets.h"
+#include "qapi/qapi-visit-sockets.h"
+#include "qapi/qapi-types-qom.h"
+#include "qom/object_interfaces.h"
+#include "sysemu/iothread.h"
+#include "standard-headers/linux/virtio_net.h"
+#include "tap-linux.h"
+#include "vhost-user-net-offload.h"
+
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#define TYPE_VHOST_USER_NET_SERVER "vhost-user-net-server"
+OBJECT_DECLARE_SIMPLE_TYPE(VuNetServer, VHOST_USER_NET_SERVER)
+
+enum {
+    VU_NET_RXQ = 0,
+    VU_NET_TXQ = 1,
+    VU_NET_MAX_QUEUE_PAIRS = 256,
+    VU_NET_RX_BATCH = 64,
+    VU_NET_BUFSIZE = 4096 + 65536,
+};
+
+typedef struct VuNetQueuePair {
+    VuNetServer *server;
+    unsigned int index;
+    int fd;
+
+    bool rx_started;
+    bool tx_started;
+
+    /* Length of a frame in rx_buf that did not fit into the rx virtqueue */
+    size_t rx_pending;
+
+    /* The host fd returned EAGAIN for a tx frame */
+    bool tx_blocked;
+
+    /* Handlers currently registered for fd */
+    bool fd_read;
+    bool fd_write;
+    bool fd_poll;
+
+    uint8_t *rx_buf;
+} VuNetQueuePair;
+
+struct VuNetServer {
+    Object parent_obj;
+
+    SocketAddress *addr;
+    VhostUserNetServerBackend backend;
+    char *ifname;
+    uint16_t queues;
+    IOThread *iothread;
+
+    VuServer vu_server;
+    AioContext *ctx;
+    VuNetQueuePair *qps;
+
+    /* Size of the virtio-net header negotiated with the driver */
+    size_t hdr_len;
+};
+
+static VuNetServer *vu_net_server_from_dev(VuDev *vu_dev)
+{
+    VuServer *server = container_of(vu_dev, VuServer, vu_dev);
+
+    return container_of(server, VuNetServer, vu_server);
+}
+
+static bool vu_net_has_feature(VuDev *vu_dev, unsigned int fbit)
+{
+    return vu_dev->features & (1ull << fbit);
+}
+
+/* Size of the header that the host fd expects in front of each frame */
+static size_t vu_net_backend_hdr_len(VuNetServer *server)
+{
+    if (server->backend == VHOST_USER_NET_SERVER_BACKEND_TAP) {
+        /* Kept in sync with the driver through TUNSETVNETHDRSZ */
+        return server->hdr_len;
+    }
+    return sizeof(struct virtio_net_hdr);
+}
+
+static void vu_net_fd_read(void *opaque);
+static void vu_net_fd_write(void *opaque);
+static bool vu_net_fd_poll(void *opaque);
+
+/* Called with ctx acquired */
+static void vu_net_update_fd_handler(VuNetQueuePair *qp)
+{
+    bool fd_read = qp->rx_started && !qp->rx_pending;
+    bool fd_write = qp->tx_started && qp->tx_blocked;
+    bool fd_poll = qp->rx_started || qp->tx_started;
+
+    if (fd_read == qp->fd_read && fd_write == qp->fd_write &&
+        fd_poll == qp->fd_poll) {
+        return;
+    }
+
+    qp->fd_read = fd_read;
+    qp->fd_write = fd_write;
+    qp->fd_poll = fd_poll;
+    aio_set_fd_handler(qp->server->ctx, qp->fd, true,
+                       fd_read ? vu_net_fd_read : NULL,
+                       fd_write ? vu_net_fd_write : NULL,
+                       fd_poll ? vu_net_fd_poll : NULL,
+                       qp);
+}
+
+/*
+ * Read the next frame from the host fd into rx_buf, leaving room for the
+ * virtio-net header size the driver negotiated.  Returns the frame length
+ * including that header or -errno.  -EINVAL means the frame was dropped.
+ */
+static ssize_t vu_net_backend_recv(VuNetQueuePair *qp)
+{
+    VuNetServer *server = qp->server;
+    size_t offset = server->hdr_len - vu_net_backend_hdr_len(server);
+    ssize_t len;
+
+    for (;;) {
+        if (server->backend == VHOST_USER_NET_SERVER_BACKEND_TAP) {
+            len = read(qp->fd, qp->rx_buf + offset, VU_NET_BUFSIZE - offset);
+        } else {
+            struct sockaddr_ll sll;
+            socklen_t sll_len = sizeof(sll);
+
+            len = recvfrom(qp->fd, qp->rx_buf + offset,
+                           VU_NET_BUFSIZE - offset, 0,
+                           (struct sockaddr *)&sll, &sll_len);
+            /* Do not loop back what the host itself sends */
+            if (len >= 0 && sll.sll_pkttype == PACKET_OUTGOING) {
+                continue;
+            }
+        }
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        break;
+    }
+
+    if (len < 0) {
+        return -errno;
+    }
+    if (len < vu_net_backend_hdr_len(server)) {
+        return -EINVAL;
+    }
+
+    if (offset) {
+        memmove(qp->rx_buf, qp->rx_buf + offset, sizeof(struct virtio_net_hdr));
+    }
+    if (!vu_net_rx_fixup_offload(qp->rx_buf, server->hdr_len, len + offset,
+                                 server->vu_server.vu_dev.features)) {
+        return -EINVAL;
+    }
+    return len + offset;
+}
+
+/*
+ * Copy a frame into the rx virtqueue.  Returns false if the driver has not
+ * provided enough buffers yet, in which case the frame is kept for later.
+ */
+static bool vu_net_rx_deliver(VuNetQueuePair *qp, VuVirtq *vq,
+                              const uint8_t *buf, size_t size)
+{
+    VuNetServer *server = qp->server;
+    VuDev *vu_dev = &server->vu_server.vu_dev;
+    bool mergeable = vu_net_has_feature(vu_dev, VIRTIO_NET_F_MRG_RXBUF);
+    struct iovec mhdr_sg[2];
+    unsigned int mhdr_cnt = 0;
+    unsigned int i = 0;
+    size_t offset = 0;
+
+    if (!vu_queue_avail_bytes(vu_dev, vq, size, 0)) {
+        return false;
+    }
+
+    while (offset < size) {
+        VuVirtqElement *elem;
+        size_t len;
+
+        elem = vu_queue_pop(vu_dev, vq, sizeof(VuVirtqElement));
+        if (!elem) {
+            vu_queue_rewind(vu_dev, vq, i);
+            return false;
+        }
+
+        if (i == 0 &&
+            server->hdr_len == sizeof(struct virtio_net_hdr_mrg_rxbuf)) {
+            mhdr_cnt = iov_copy(mhdr_sg, ARRAY_SIZE(mhdr_sg),
+                                elem->in_sg, elem->in_num,
+                                offsetof(struct virtio_net_hdr_mrg_rxbuf,
+                                         num_buffers),
+                                sizeof(uint16_t));
+        }
+
+        len = iov_from_buf(elem->in_sg, elem->in_num, 0,
+                           buf + offset, size - offset);
+        offset += len;
+
+        if (!mergeable && offset < size) {
+            /* Truncating would corrupt the frame, drop it instead */
+            free(elem);
+            vu_queue_rewind(vu_dev, vq, i + 1);
+            return true;
+        }
+
+        vu_queue_fill(vu_dev, vq, elem, len, i++);
+        free(elem);
+    }
+
+    if (mhdr_cnt) {
+        uint16_t num_buffers = cpu_to_le16(i);
+
+        iov_from_buf(mhdr_sg, mhdr_cnt, 0, &num_buffers, sizeof(num_buffers));
+    }
+
+    vu_queue_flush(vu_dev, vq, i);
+    return true;
+}
+
+/* Called with ctx acquired */
+static bool vu_net_rx(VuNetQueuePair *qp)
+{
+    VuDev *vu_dev = &qp->server->vu_server.vu_dev;
+    VuVirtq *vq = vu_get_queue(vu_dev, qp->index * 2 + VU_NET_RXQ);
+    bool progress = false;
+    bool notify = false;
+    int budget;
+
+    if (!qp->rx_started) {
+        return false;
+    }
+
+    for (budget = VU_NET_RX_BATCH; budget > 0; budget--) {
+        if (!qp->rx_pending) {
+            ssize_t len = vu_net_backend_recv(qp);
+
+            if (len == -EINVAL) {
+                continue;
+            } else if (len < 0) {
+                break;
+            }
+            qp->rx_pending = len;
+            progress = true;
+        }
+
+        /* Frames arriving on a disabled queue are dropped */
+        if (vu_queue_enabled(vu_dev, vq)) {
+            if (!vu_net_rx_deliver(qp, vq, qp->rx_buf, qp->rx_pending)) {
+                /* Resumed by the next rx virtqueue kick */
+                break;
+            }
+            notify = true;
+        }
+        qp->rx_pending = 0;
+    }
+
+    if (notify) {
+        vu_queue_notify(vu_dev, vq);
+    }
+    vu_net_update_fd_handler(qp);
+    return progress;
+}
+
+static ssize_t vu_net_backend_send(VuNetQueuePair *qp,
+                                   const struct iovec *out_sg,
+                                   unsigned int out_num)
+{
+    VuNetServer *server = qp->server;
+    size_t backend_hdr_len = vu_net_backend_hdr_len(server);
+    g_autofree uint8_t *bounce_buf = NULL;
+    struct iovec bounce;
+    struct virtio_net_hdr hdr;
+    struct iovec iov[IOV_MAX];
+    ssize_t ret;
+
+    /*
+     * writev() takes at most IOV_MAX elements, one of which may be needed
+     * for the header below.  Longer chains are copied into one buffer.
+     */
+    if (out_num > IOV_MAX - 1) {
+        size_t size = iov_size(out_sg, out_num);
+
+        if (size > VU_NET_BUFSIZE) {
+            return -EINVAL;
+        }
+        bounce_buf = g_malloc(size);
+        iov_to_buf(out_sg, out_num, 0, bounce_buf, size);
+        bounce.iov_base = bounce_buf;
+        bounce.iov_len = size;
+        out_sg = &bounce;
+        out_num = 1;
+    }
+
+    if (backend_hdr_len == server->hdr_len) {
+        do {
+            ret = writev(qp->fd, out_sg, out_num);
+        } while (ret < 0 && errno == EINTR);
+        return ret < 0 ? -errno : ret;
+    }
+
+    /* Strip num_buffers, AF_PACKET only knows the legacy header */
+    if (iov_to_buf(out_sg, out_num, 0, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+        return -EINVAL;
+    }
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    out_num = iov_copy(&iov[1], ARRAY_SIZE(iov) - 1, out_sg, out_num,
+                       server->hdr_len, -1);
+
+    do {
+        ret = writev(qp->fd, iov, out_num + 1);
+    } while (ret < 0 && errno == EINTR);
+    return ret < 0 ? -errno : ret;
+}
+
+/* Called with ctx acquired */
+static bool vu_net_tx(VuNetQueuePair *qp)
+{
+    VuDev *vu_dev = &qp->server->vu_server.vu_dev;
+    VuVirtq *vq = vu_get_queue(vu_dev, qp->index * 2 + VU_NET_TXQ);
+    unsigned int i = 0;
+
+    if (!qp->tx_started || qp->tx_blocked || vu_queue_empty(vu_dev, vq)) {
+        return false;
+    }
+
+    do {
+        vu_queue_set_notification(vu_dev, vq, 0);
+
+        while (!qp->tx_blocked) {
+            VuVirtqElement *elem;
+
+            elem = vu_queue_pop(vu_dev, vq, sizeof(VuVirtqElement));
+            if (!elem) {
+                break;
+            }
+
+            if (vu_net_backend_send(qp, elem->out_sg, elem->out_num) ==
+                -EAGAIN) {
+                /* Retried once the host fd becomes writable */
+                vu_queue_unpop(vu_dev, vq, elem, 0);
+                free(elem);
+                qp->tx_blocked = true;
+                break;
+            }
+
+            /* Other errors drop the frame like a lossy link would */
+            vu_queue_fill(vu_dev, vq, elem, 0, i++);
+            free(elem);
+        }
+
+        vu_queue_set_notification(vu_dev, vq, 1);
+    } while (!qp->tx_blocked && !vu_queue_empty(vu_dev, vq));
+
+    if (i) {
+        vu_queue_flush(vu_dev, vq, i);
+        vu_queue_notify(vu_dev, vq);
+    }
+    vu_net_update_fd_handler(qp);
+    return i > 0;
+}
+
+static void vu_net_fd_read(void *opaque)
+{
+    vu_net_rx(opaque);
+}
+
+static void vu_net_fd_write(void *opaque)
+{
+    VuNetQueuePair *qp = opaque;
+
+    qp->tx_blocked = false;
+    vu_net_tx(qp);
+}
+
+static bool vu_net_fd_poll(void *opaque)
+{
+    VuNetQueuePair *qp = opaque;
+    bool progress;
+
+    progress = vu_net_tx(qp);
+    progress |= vu_net_rx(qp);
+    return progress;
+}
+
+static void vu_net_process_rxq(VuDev *vu_dev, int idx)
+{
+    VuNetServer *server = vu_net_server_from_dev(vu_dev);
+
+    /* New rx buffers may make room for a pending frame */
+    vu_net_rx(&server->qps[idx / 2]);
+}
+
+static void vu_net_process_txq(VuDev *vu_dev, int idx)
+{
+    VuNetServer *server = vu_net_server_from_dev(vu_dev);
+
+    vu_net_tx(&server->qps[idx / 2]);
+}
+
+static void vu_net_queue_set_started(VuDev *vu_dev, int idx, bool started)
+{
+    VuNetServer *server = vu_net_server_from_dev(vu_dev);
+    VuNetQueuePair *qp = &server->qps[idx / 2];
+    VuVirtq *vq = vu_get_queue(vu_dev, idx);
+
+    if (idx % 2 == VU_NET_RXQ) {
+        qp->rx_started = started;
+        qp->rx_pending = 0;
+        vu_set_queue_handler(vu_dev, vq, started ? vu_net_process_rxq : NULL);
+    } else {
+        qp->tx_started = started;
+        qp->tx_blocked = false;
+        vu_set_queue_handler(vu_dev, vq, started ? vu_net_process_txq : NULL);
+    }
+    vu_net_update_fd_handler(qp);
+}
+
+/*
+ * The kernel steers flows to every attached tap queue, so queues whose rx
+ * virtqueue the driver has not enabled are detached from the interface.
+ */
+static void vu_net_tap_set_queue_enabled(VuNetQueuePair *qp, bool enable)
+{
+    struct ifreq ifr;
+
+    if (qp->server->queues == 1 || qp->index == 0) {
+        return;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = enable ? IFF_ATTACH_QUEUE : IFF_DETACH_QUEUE;
+    if (ioctl(qp->fd, TUNSETQUEUE, &ifr) < 0 && errno != EINVAL) {
+        warn_report("vhost-user-net-server: could not %s tap queue %u: %s",
+                    enable ? "attach" : "detach", qp->index, strerror(errno));
+    }
+}
+
+static uint64_t vu_net_get_features(VuDev *vu_dev)
+{
+    VuNetServer *server = vu_net_server_from_dev(vu_dev);
+    uint64_t features;
+
+    /*
+     * AF_PACKET cannot be told which offloads to deliver; frames that the
+     * driver did not opt into are fixed up or dropped on receive.
+     */
+    features = 1ull << VIRTIO_NET_F_CSUM |
+               1ull << VIRTIO_NET_F_GUEST_CSUM |
+               1ull << VIRTIO_NET_F_HOST_TSO4 |
+               1ull << VIRTIO_NET_F_HOST_TSO6 |
+               1ull << VIRTIO_NET_F_HOST_ECN |
+               1ull << VIRTIO_NET_F_GUEST_TSO4 |
+               1ull << VIRTIO_NET_F_GUEST_TSO6 |
+               1ull << VIRTIO_NET_F_GUEST_ECN |
+               1ull << VIRTIO_NET_F_MRG_RXBUF |
+               1ull << VIRTIO_F_VERSION_1 |
+               1ull << VIRTIO_RING_F_INDIRECT_DESC |
+               1ull << VIRTIO_RING_F_EVENT_IDX |
+               1ull << VHOST_USER_F_PROTOCOL_FEATURES;
+
+    if (server->queues > 1) {
+        features |= 1ull << VIRTIO_NET_F_MQ;
+    }
+
+    return features;
+}
+
+static void vu_net_set_features(VuDev *vu_dev, uint64_t features)
+{
+    VuNetServer *server = vu_net_server_from_dev(vu_dev);
+    unsigned int offload = 0;
+    int hdr_len;
+    int i;
+
+    if (features & (1ull << VIRTIO_F_VERSION_1 |
+                    1ull << VIRTIO_NET_F_MRG_RXBUF)) {
+        server->hdr_len = sizeof(struct virtio_net_hdr_mrg_rxbuf);
+    } else {
+        server->hdr_len = sizeof(struct virtio_net_hdr);
+    }
+
+    if (server->backend != VHOST_USER_NET_SERVER_BACKEND_TAP) {
+        return;
+    }
+
+    if (features & (1ull << VIRTIO_NET_F_GUEST_CSUM)) {
+        offload |= TUN_F_CSUM;
+        if (features & (1ull << VIRTIO_NET_F_GUEST_TSO4)) {
+            offload |= TUN_F_TSO4;
+        }
+        if (features & (1ull << VIRTIO_NET_F_GUEST_TSO6)) {
+            offload |= TUN_F_TSO6;
+        }
+        if (features & (1ull << VIRTIO_NET_F_GUEST_ECN)) {
+            offload |= TUN_F_TSO_ECN;
+        }
+    }
+
+    hdr_len = server->hdr_len;
+    for (i = 0; i < server->queues; i++) {
+        int fd = server->qps[i].fd;
+
+        if (ioctl(fd, TUNSETVNETHDRSZ, &hdr_len) < 0) {
+            error_report("vhost-user-net-server: could not set tap vnet "
+                         "header size: %s", strerror(errno));
+            vu_dev->broken = true;
+            return;
+        }
+        if (ioctl(fd, TUNSETOFFLOAD, offload) < 0) {
+            warn_report("vhost-user-net-server: TUNSETOFFLOAD failed: %s",
+                        strerror(errno));
+        }
+    }
+}
+
+/*
+ * libvhost-user calls exit() for a message with request code
+ * VHOST_USER_NONE, which would terminate the whole process along with
+ * everything else it serves.  Report and consume such messages here.
+ */
+static int vu_net_process_msg(VuDev *vu_dev, VhostUserMsg *vmsg, int *do_reply)
+{
+    VuNetServer *server = vu_net_server_from_dev(vu_dev);
+
+    switch (vmsg->request) {
+    case VHOST_USER_NONE:
+        vu_dev->panic(vu_dev, "disconnect");
+        return true;
+    case VHOST_USER_SET_VRING_ENABLE: {
+        unsigned int index = vmsg->payload.state.index;
+
+        if (server->backend == VHOST_USER_NET_SERVER_BACKEND_TAP &&
+            index < vu_dev->max_queues && index % 2 == VU_NET_RXQ) {
+            vu_net_tap_set_queue_enabled(&server->qps[index / 2],
+                                         vmsg->payload.state.num);
+        }
+        /* libvhost-user still records the new state */
+        return false;
+    }
+    default:
+        return false;
+    }
+}
+
+static const VuDevIface vu_net_iface = {
+    .get_features          = vu_net_get_features,
+    .set_features          = vu_net_set_features,
+    .queue_set_started     = vu_net_queue_set_started,
+    .process_msg           = vu_net_process_msg,
+};
+
+static int vu_net_tap_open(VuNetServer *server, Error **errp)
+{
+    char ifname[IFNAMSIZ] = "";
+    int i;
+
+    if (server->ifname) {
+        pstrcpy(ifname, sizeof(ifname), server->ifname);
+    }
+
+    for (i = 0; i < server->queues; i++) {
+        struct ifreq ifr;
+        int fd;
+
+        fd = qemu_open("/dev/net/tun", O_RDWR, errp);
+        if (fd < 0) {
+            return -1;
+        }
+
+        memset(&ifr, 0, sizeof(ifr));
+        ifr.ifr_flags = IFF_TAP | IFF_NO_PI | IFF_VNET_HDR;
+        if (server->queues > 1) {
+            ifr.ifr_flags |= IFF_MULTI_QUEUE;
+        }
+        pstrcpy(ifr.ifr_name, IFNAMSIZ, ifname);
+
+        if (ioctl(fd, TUNSETIFF, &ifr) < 0) {
+            error_setg_errno(errp, errno, "could not configure tap interface");
+            close(fd);
+            return -1;
+        }
+
+        /* Further queues attach to the interface the kernel named */
+        pstrcpy(ifname, sizeof(ifname), ifr.ifr_name);
+        qemu_set_nonblock(fd);
+        server->qps[i].fd = fd;
+
+        vu_net_tap_set_queue_enabled(&server->qps[i], false);
+    }
+
+    return 0;
+}
+
+static int vu_net_packet_open(VuNetServer *server, Error **errp)
+{
+    struct sockaddr_ll sll = {
+        .sll_family = AF_PACKET,
+        .sll_protocol = htons(ETH_P_ALL),
+    };
+    int fanout = 0;
+    int i;
+
+    sll.sll_ifindex = if_nametoindex(server->ifname);
+    if (!sll.sll_ifindex) {
+        error_setg_errno(errp, errno, "could not find interface '%s'",
+                         server->ifname);
+        return -1;
+    }
+
+    for (i = 0; i < server->queues; i++) {
+        int one = 1;
+        int fd;
+
+        fd = qemu_socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+        if (fd < 0) {
+            error_setg_errno(errp, errno, "could not create packet socket");
+            return -1;
+        }
+        server->qps[i].fd = fd;
+
+        if (setsockopt(fd, SOL_PACKET, PACKET_VNET_HDR,
+                       &one, sizeof(one)) < 0) {
+            error_setg_errno(errp, errno, "could not enable PACKET_VNET_HDR");
+            return -1;
+        }
+
+        if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+            error_setg_errno(errp, errno, "could not bind to interface '%s'",
+                             server->ifname);
+            return -1;
+        }
+
+        /*
+         * Let the kernel pick an unused fanout group id for the first
+         * socket and join the others to the same group.
+         */
+        if (server->queues > 1) {
+            socklen_t len = sizeof(fanout);
+            int arg = i == 0 ?
+                (PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_UNIQUEID) << 16 :
+                PACKET_FANOUT_HASH << 16 | (fanout & 0xffff);
+
+            if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT,
+                           &arg, sizeof(arg)) < 0) {
+                error_setg_errno(errp, errno, "could not join fanout group");
+                return -1;
+            }
+            if (i == 0 &&
+                getsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, &len) < 0) {
+                error_setg_errno(errp, errno, "could not query fanout group");
+                return -1;
+            }
+        }
+
+        qemu_set_nonblock(fd);
+    }
+
+    return 0;
+}
+
+static void vu_net_server_close(VuNetServer *server)
+{
+    int i;
+
+    for (i = 0; i < server->queues; i++) {
+        if (server->qps[i].fd >= 0) {
+            close(server->qps[i].fd);
+        }
+        g_free(server->qps[i].rx_buf);
+    }
+    g_free(server->qps);
+    server->qps = NULL;
+}
+
+static void vu_net_server_complete(UserCreatable *uc, Error **errp)
+{
+    VuNetServer *server = VHOST_USER_NET_SERVER(uc);
+    int ret;
+    int i;
+
+    if (!server->addr) {
+        error_setg(errp, QERR_MISSING_PARAMETER, "addr");
+        return;
+    }
+    if (!server->ifname &&
+        server->backend == VHOST_USER_NET_SERVER_BACKEND_PACKET) {
+        error_setg(errp, QERR_MISSING_PARAMETER, "ifname");
+        return;
+    }
+    if (server->queues == 0 || server->queues > VU_NET_MAX_QUEUE_PAIRS) {
+        error_setg(errp, "queues must be between 1 and %d",
+                   VU_NET_MAX_QUEUE_PAIRS);
+        return;
+    }
+
+    if (server->iothread) {
+        server->ctx = iothread_get_aio_context(server->iothread);
+    } else {
+        server->ctx = qemu_get_aio_context();
+    }
+    server->hdr_len = sizeof(struct virtio_net_hdr);
+
+    server->qps = g_new0(VuNetQueuePair, server->queues);
+    for (i = 0; i < server->queues; i++) {
+        server->qps[i].server = server;
+        server->qps[i].index = i;
+        server->qps[i].fd = -1;
+        server->qps[i].rx_buf = g_malloc(VU_NET_BUFSIZE);
+    }
+
+    if (server->backend == VHOST_USER_NET_SERVER_BACKEND_TAP) {
+        ret = vu_net_tap_open(server, errp);
+    } else {
+        ret = vu_net_packet_open(server, errp);
+    }
+    if (ret < 0) {
+        goto fail;
+    }
+
+    if (!vhost_user_server_start(&server->vu_server, server->addr,
+                                 server->ctx, server->queues * 2,
+                                 &vu_net_iface, errp)) {
+        goto fail;
+    }
+    return;
+
+fail:
+    vu_net_server_close(server);
+}
+
+static bool vu_net_server_check_unset(VuNetServer *server, const char *name,
+                                      Error **errp)
+{
+    if (server->qps) {
+        error_setg(errp, "cannot change property '%s' of %s", name,
+                   object_get_typename(OBJECT(server)));
+        return false;
+    }
+    return true;
+}
+
+static void vu_net_server_get_addr(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    VuNetServer *server = VHOST_USER_NET_SERVER(obj);
+
+    visit_type_SocketAddress(v, name, &server->addr, errp);
+}
+
+static void vu_net_server_set_addr(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    VuNetServer *server = VHOST_USER_NET_SERVER(obj);
+    SocketAddress *addr;
+
+    if (!vu_net_server_check_unset(server, name, errp)) {
+        return;
+    }
+    if (!visit_type_SocketAddress(v, name, &addr, errp)) {
+        return;
+    }
+    qapi_free_SocketAddress(server->addr);
+    server->addr = addr;
+}
+
+static int vu_net_server_get_backend(Object *obj, Error **errp)
+{
+    return VHOST_USER_NET_SERVER(obj)->backend;
+}
+
+static void vu_net_server_set_backend(Object *obj, int value, Error **errp)
+{
+    VuNetServer *server = VHOST_USER_NET_SERVER(obj);
+
+    if (vu_net_server_check_unset(server, "backend", errp)) {
+        server->backend = value;
+    }
+}
+
+static char *vu_net_server_get_ifname(Object *obj, Error **errp)
+{
+    return g_strdup(VHOST_USER_NET_SERVER(obj)->ifname);
+}
+
+static void vu_net_server_set_ifname(Object *obj, const char *value,
+                                     Error **errp)
+{
+    VuNetServer *server = VHOST_USER_NET_SERVER(obj);
+
+    if (!vu_net_server_check_unset(server, "ifname", errp)) {
+        return;
+    }
+    if (strlen(value) >= IFNAMSIZ) {
+        error_setg(errp, "interface name '%s' is too long", value);
+        return;
+    }
+    g_free(server->ifname);
+    server->ifname = g_strdup(value);
+}
+
+static void vu_net_server_get_queues(Object *obj, Visitor *v, const char *name,
+                                     void *opaque, Error **errp)
+{
+    VuNetServer *server = VHOST_USER_NET_SERVER(obj);
+
+    visit_type_uint16(v, name, &server->queues, errp);
+}
+
+static void vu_net_server_set_queues(Object *obj, Visitor *v, const char *name,
+                                     void *opaque, Error **errp)
+{
+    VuNetServer *server = VHOST_USER_NET_SERVER(obj);
+    uint16_t value;
+
+    if (!vu_net_server_check_unset(server, name, errp)) {
+        return;
+    }
+    if (!visit_type_uint16(v, name, &value, errp)) {
+        return;
+    }
+    server->queues = value;
+}
+
+static void vu_net_server_instance_init(Object *obj)
+{
+    VuNetServer *server = VHOST_USER_NET_SERVER(obj);
+
+    server->backend = VHOST_USER_NET_SERVER_BACKEND_TAP;
+    server->queues = 1;
+}
+
+static void vu_net_server_instance_finalize(Object *obj)
+{
+    VuNetServer *server = VHOST_USER_NET_SERVER(obj);
+
+    if (server->qps) {
+        vhost_user_server_stop(&server->vu_server);
+        vu_net_server_close(server);
+    }
+    qapi_free_SocketAddress(server->addr);
+    g_free(server->ifname);
+}
+
+static void vu_net_server_class_init(ObjectClass *oc, void *data)
+{
+    UserCreatableClass *ucc = USER_CREATABLE_CLASS(oc);
+
+    ucc->complete = vu_net_server_complete;
+
+    object_class_property_add(oc, "addr", "SocketAddress",
+                              vu_net_server_get_addr,
+                              vu_net_server_set_addr,
+                              NULL, NULL);
+    object_class_property_set_description(oc, "addr",
+        "vhost-user socket to listen on");
+    object_class_property_add_enum(oc, "backend", "VhostUserNetServerBackend",
+                                   &VhostUserNetServerBackend_lookup,
+                                   vu_net_server_get_backend,
+                                   vu_net_server_set_backend);
+    object_class_property_set_description(oc, "backend",
+        "Host network backend (tap or packet)");
+    object_class_property_add_str(oc, "ifname",
+                                  vu_net_server_get_ifname,
+                                  vu_net_server_set_ifname);
+    object_class_property_set_description(oc, "ifname",
+        "Host network interface name");
+    object_class_property_add(oc, "queues", "uint16",
+                              vu_net_server_get_queues,
+                              vu_net_server_set_queues,
+                              NULL, NULL);
+    object_class_property_set_description(oc, "queues",
+        "Number of queue pairs");
+    object_class_property_add_link(oc, "iothread", TYPE_IOTHREAD,
+                                   offsetof(VuNetServer, iothread),
+                                   object_property_allow_set_link,
+                                   OBJ_PROP_LINK_STRONG);
+    object_class_property_set_description(oc, "iothread",
+        "IOThread that processes the queues");
+}
+
+static const TypeInfo vu_net_server_info = {
+    .name = TYPE_VHOST_USER_NET_SERVER,
+    .parent = TYPE_OBJECT,
+    .instance_size = sizeof(VuNetServer),
+    .instance_init = vu_net_server_instance_init,
+    .instance_finalize = vu_net_server_instance_finalize,
+    .class_init = vu_net_server_class_init,
+    .interfaces = (InterfaceInfo[]) {
+        { TYPE_USER_CREATABLE },
+        { }
+    },
+};
+
+static void vu_net_server_register_types(void)
+{
+    type_register_static(&vu_net_server_info);
+}
+
+type_init(vu_net_server_register_types)
@@ -31,6 +31,8 @@ typedef struct VhostVDPAState {
     struct vhost_vdpa vhost_vdpa;
     VHostNetState *vhost_net;
     bool started;
+    /* Last client of the device, it frees the shared IOVA tree */
+    bool owns_iova_tree;
 } VhostVDPAState;
 
 const int vdpa_feature_bits[] = {
@@ -137,6 +139,10 @@ static void vhost_vdpa_cleanup(NetClientState *nc)
         qemu_close(s->vhost_vdpa.device_fd);
         s->vhost_vdpa.device_fd = -1;
     }
+    if (s->owns_iova_tree) {
+        iova_tree_destroy(s->vhost_vdpa.iova_tree);
+        s->vhost_vdpa.iova_tree = NULL;
+    }
 }
 
 static bool vhost_vdpa_has_vnet_hdr(NetClientState *nc)
@@ -185,7 +191,9 @@ static NetClientState *net_vhost_vdpa_init(NetClientState *peer,
                                            int vdpa_device_fd,
                                            int queue_pair_index,
                                            int nvqs,
-                                           bool is_datapath)
+                                           bool is_datapath,
+                                           bool svq,
+                                           IOVATree *iova_tree)
 {
     NetClientState *nc = NULL;
     VhostVDPAState *s;
@@ -203,6 +211,8 @@ static NetClientState *net_vhost_vdpa_init(NetClientState *peer,
 
     s->vhost_vdpa.device_fd = vdpa_device_fd;
     s->vhost_vdpa.index = queue_pair_index;
+    s->vhost_vdpa.shadow_vqs_enabled = svq;
+    s->vhost_vdpa.iova_tree = iova_tree;
     ret = vhost_vdpa_add(nc, (void *)&s->vhost_vdpa, queue_pair_index, nvqs);
     if (ret) {
         qemu_del_net_client(nc);
@@ -255,7 +265,9 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
 {
     const NetdevVhostVDPAOptions *opts;
     int vdpa_device_fd;
-    NetClientState **ncs, *nc;
+    NetClientState **ncs, *nc = NULL;
+    IOVATree *iova_tree = NULL;
+    bool svq;
     int queue_pairs, i, has_cvq = 0;
 
     assert(netdev->type == NET_CLIENT_DRIVER_VHOST_VDPA);
@@ -273,22 +285,36 @@ int net_init_vhost_vdpa(const Netdev *netdev, const char *name,
         return queue_pairs;
     }
 
+    svq = opts->has_x_svq && opts->x_svq;
+    if (svq) {
+        /* All the virtqueues of the device share one IOVA space */
+        iova_tree = iova_tree_new();
+    }
+
     ncs = g_malloc0(sizeof(*ncs) * queue_pairs);
 
     for (i = 0; i < queue_pairs; i++) {
         ncs[i] = net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name,
-                                     vdpa_device_fd, i, 2, true);
+                                     vdpa_device_fd, i, 2, true,
+                                     svq, iova_tree);
         if (!ncs[i])
             goto err;
     }
 
     if (has_cvq) {
         nc = net_vhost_vdpa_init(peer, TYPE_VHOST_VDPA, name,
-                                 vdpa_device_fd, i, 1, false);
+                                 vdpa_device_fd, i, 1, false,
+                                 svq, iova_tree);
         if (!nc)
             goto err;
     }
 
+    if (iova_tree) {
+        /* Clients are cleaned up in creation order */
+        nc = nc ?: ncs[queue_pairs - 1];
+        DO_UPCAST(VhostVDPAState, nc, nc)->owns_iova_tree = true;
+    }
+
     g_free(ncs);
     return 0;
 
@@ -296,6 +322,9 @@ err:
     if (i) {
         qemu_del_net_client(ncs[0]);
     }
+    if (iova_tree) {
+        iova_tree_destroy(iova_tree);
+    }
     qemu_close(vdpa_device_fd);
     g_free(ncs);
 
@@ -2670,13 +2670,24 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                VALE port (created on the fly) called 'name' ('nmname' is name of the \n"
     "                netmap device, defaults to '/dev/netmap')\n"
 #endif
+#ifdef CONFIG_AF_XDP
+    "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
+    "         [,queues=n][,start-queue=m]\n"
+    "                attach to the existing network interface 'name' with AF_XDP socket\n"
+    "                use 'mode=MODE' to specify an XDP program attach mode\n"
+    "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
+    "                use 'queues=n' to specify how many queues of a multiqueue interface should be used\n"
+    "                use 'start-queue=m' to specify the first queue that should be used\n"
+#endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
     "                configure a vhost-user network, backed by a chardev 'dev'\n"
 #endif
 #ifdef __linux__
-    "-netdev vhost-vdpa,id=str,vhostdev=/path/to/dev\n"
+    "-netdev vhost-vdpa,id=str,vhostdev=/path/to/dev[,x-svq=on|off]\n"
     "                configure a vhost-vdpa network,Establish a vhost-vdpa netdev\n"
+    "                use 'x-svq=on' to relay the virtqueues through qemu so the\n"
+    "                guest can be live migrated (experimental)\n"
 #endif
     "-netdev hubport,id=str,hubid=n[,netdev=nd]\n"
     "                configure a hub port on the hub with ID 'n'\n", QEMU_ARCH_ALL)
@@ -2694,6 +2705,9 @@ DEF("nic", HAS_ARG, QEMU_OPTION_nic,
 #ifdef CONFIG_NETMAP
     "netmap|"
 #endif
+#ifdef CONFIG_AF_XDP
+    "af-xdp|"
+#endif
 #ifdef CONFIG_POSIX
     "vhost-user|"
 #endif
@@ -3137,6 +3151,35 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m]``
+    Configure AF_XDP backend to connect to a network interface 'name'
+    using AF_XDP sockets.  One socket is created per queue, starting
+    from queue 'start-queue' of the interface; all of them share a
+    single UMEM area.  The interface's ``combined`` channel count must
+    cover the queues in use, and the traffic that should reach the guest
+    has to be steered to those queues, for example with ethtool flow
+    rules.  Checksum and TCP segmentation offloads requested by the
+    guest are completed in software.  This option is only available if
+    QEMU has been compiled with libxdp support.
+
+    ``mode=native|skb``
+        Attach mode for the default XDP program.  If not specified,
+        ``native`` is tried first, falling back to ``skb``.  Zero-copy
+        requires ``native`` mode and driver support.
+
+    ``force-copy=on|off``
+        Force XDP copy mode even if the device supports zero-copy.
+
+    Example:
+
+    .. parsed-literal::
+
+        # set number of queues to 4
+        ethtool -L eth0 combined 4
+        # launch QEMU instance
+        |qemu_system| linux.img -device virtio-net-pci,netdev=n1,mq=on \\
+                -netdev af-xdp,id=n1,ifname=eth0,queues=4
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -3156,7 +3199,7 @@ SRST
              -netdev type=vhost-user,id=net0,chardev=chr0 \
              -device virtio-net-pci,netdev=net0
 
-``-netdev vhost-vdpa,vhostdev=/path/to/dev``
+``-netdev vhost-vdpa,vhostdev=/path/to/dev[,x-svq=on|off]``
     Establish a vhost-vdpa netdev.
 
     vDPA device is a device that uses a datapath which complies with
@@ -3164,6 +3207,12 @@ SRST
     vDPA devices can be both physically located on the hardware or
     emulated by software.
 
+    ``x-svq=on`` makes QEMU relay the buffers between the guest and the
+    device through shadow virtqueues instead of letting the device access
+    the guest rings directly. QEMU then knows which guest memory the device
+    writes, so the guest can be live migrated. The device must offer
+    VIRTIO_F_ACCESS_PLATFORM. This option is experimental.
+
 ``-netdev hubport,id=id,hubid=hubid[,netdev=nd]``
     Create a hub port on the emulated hub with ID hubid.
 
@@ -4640,7 +4689,7 @@ SRST
     they are specified. Note that the 'id' property must be set. These
     objects are placed in the '/objects' path.
 
-    ``-object memory-backend-file,id=id,size=size,mem-path=dir,share=on|off,discard-data=on|off,merge=on|off,dump=on|off,prealloc=on|off,host-nodes=host-nodes,policy=default|preferred|bind|interleave,align=align,readonly=on|off``
+    ``-object memory-backend-file,id=id,size=size,mem-path=dir,share=on|off,discard-data=on|off,merge=on|off,dump=on|off,prealloc=on|off,prealloc-threads=threads,prealloc-context=id,prealloc-async=on|off,host-nodes=host-nodes,policy=default|preferred|bind|interleave,align=align,readonly=on|off``
         Creates a memory file backend object, which can be used to back
         the guest RAM with huge pages.
 
@@ -4683,6 +4732,28 @@ SRST
 
         The ``prealloc`` boolean option enables memory preallocation.
 
+        The ``prealloc-threads`` option specifies the number of threads
+        used for preallocation (default: 1).
+
+        The ``prealloc-context`` option specifies the thread context
+        object used to create the preallocation threads, which inherit
+        its CPU affinity. Without it, memory bound to ``host-nodes`` is
+        preallocated by threads running on the CPUs of those nodes.
+        Preallocation uses MADV\_POPULATE\_WRITE if the host supports it.
+
+        Setting the ``prealloc-async`` boolean option to on preallocates
+        only the first gigabyte of memory before the machine starts, and
+        the rest in the background while firmware and guest run. This is
+        only done for anonymous memory (``memory-backend-ram``) and needs
+        MADV\_POPULATE\_WRITE; file backed memory such as hugetlbfs, or
+        hosts without MADV\_POPULATE\_WRITE, get all memory
+        preallocated up front. If the background preallocation fails, a
+        warning is printed and the remaining memory is allocated when the
+        guest touches it. Until the background preallocation is done, guest
+        memory cannot be discarded, so virtio-balloon does not free
+        memory, virtio-mem devices cannot be created and incoming
+        postcopy migration is refused.
+
         The ``host-nodes`` option binds the memory range to a list of
         NUMA host nodes.
 
@@ -4978,7 +5049,7 @@ SRST
         stored. The file format is libpcap, so it can be analyzed with
         tools such as tcpdump or Wireshark.
 
-    ``-object colo-compare,id=id,primary_in=chardevid,secondary_in=chardevid,outdev=chardevid,iothread=id[,vnet_hdr_support][,notify_dev=id][,compare_timeout=@var{ms}][,expired_scan_cycle=@var{ms}][,max_queue_size=@var{size}]``
+    ``-object colo-compare,id=id,primary_in=chardevid,secondary_in=chardevid,outdev=chardevid,iothread=id[,vnet_hdr_support][,notify_dev=id][,compare_timeout=@var{ms}][,expired_scan_cycle=@var{ms}][,max_queue_size=@var{size}][,compare_threads=@var{n}]``
         Colo-compare gets packet from primary\_in chardevid and
         secondary\_in, then compare whether the payload of primary packet
         and secondary packet are the same. If same, it will output
@@ -4992,6 +5063,9 @@ SRST
         is to set the period of scanning expired primary node network packets.
         The max\_queue\_size=@var{size} is to set the max compare queue
         size depend on user environment.
+        The compare\_threads=@var{n} spreads the connections over @var{n}
+        threads that compare packets in parallel, while the iothread keeps
+        receiving and sending them; by default the iothread compares too.
         If user want to use Xen COLO, need to add the notify\_dev to
         notify Xen colo-frame to do checkpoint.
 
@@ -5373,6 +5447,45 @@ SRST
         ::
 
             (qemu) qom-set /objects/iothread1 poll-max-ns 100000
+
+    ``-object thread-context,id=id,cpu-affinity=cpu[,cpu-affinity=cpu...],node-affinity=node[,node-affinity=node...]``
+        Creates a dedicated thread that creates other threads on behalf
+        of QEMU, such as the preallocation threads of memory backends
+        selected with ``prealloc-context``. New threads inherit the CPU
+        affinity of the thread context, so the same context can be used
+        by several memory backends.
+
+        The ``cpu-affinity`` option sets the list of host CPUs the
+        threads may run on. The ``node-affinity`` option is a shortcut
+        that selects all the host CPUs of a list of host NUMA nodes.
+        The two options cannot be combined.
+
+        The thread ID of the context is available in the ``thread-id``
+        property, so that management software can also set its CPU
+        affinity itself.
+
+        ::
+
+            -object thread-context,id=tc1,node-affinity=0 \
+            -object memory-backend-ram,id=mem0,size=512G,host-nodes=0,policy=bind,prealloc=on,prealloc-threads=16,prealloc-context=tc1
+
+    ``-object vhost-user-net-server,id=id,addr.type=unix,addr.path=path[,backend=tap|packet][,ifname=name][,queues=n][,iothread=id]``
+        Serves the data virtqueues of a vhost-user-net device on the
+        vhost-user socket ``addr`` and forwards frames to a host network
+        interface. Only available on Linux hosts; it is also available in
+        ``qemu-storage-daemon``.
+
+        ``backend=tap`` (the default) opens tap interface ``ifname``,
+        creating it if needed, with one tap queue per queue pair.
+        ``backend=packet`` binds one AF_PACKET socket per queue pair to the
+        existing interface ``ifname`` and spreads incoming flows across them.
+
+        ``queues`` sets the number of queue pairs and must match the
+        ``queues`` option of the vhost-user netdev connecting to the socket.
+
+        When ``iothread`` is given, queue processing runs in that IOThread,
+        which busy-polls the host interface and the transmit queues for up to
+        its ``poll-max-ns``.
 ERST
 
 
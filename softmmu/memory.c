@@ -22,12 +22,14 @@
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
 #include "qemu/qemu-print.h"
+#include "qemu/timer.h"
 #include "qom/object.h"
 #include "trace.h"
 
 #include "exec/memory-internal.h"
 #include "exec/ram_addr.h"
 #include "sysemu/kvm.h"
+#include "sysemu/qtest.h"
 #include "sysemu/runstate.h"
 #include "sysemu/tcg.h"
 #include "qemu/accel.h"
@@ -49,6 +51,26 @@ static QTAILQ_HEAD(, AddressSpace) address_spaces
 
 static GHashTable *flat_views;
 
+/*
+ * What changed since the last topology update: each MemoryRegion maps to
+ * a GArray of the AddrRanges, in the region's own address space, that may
+ * render differently now.  Unless everything is dirty, only the affected
+ * parts of the FlatViews are rendered again.
+ */
+static GHashTable *flat_views_dirty;
+static bool flat_views_dirty_all;
+
+/* Topology updates by memory_region_transaction_commit(), see info mtree */
+static struct {
+    uint64_t commits;
+    int64_t last_ns;
+    int64_t max_ns;
+    int64_t total_ns;
+    uint64_t views_generated;
+    uint64_t views_updated;
+    uint64_t views_reused;
+} topology_stats;
+
 typedef struct AddrRange AddrRange;
 
 /*
@@ -225,6 +247,17 @@ struct FlatRange {
     bool nonvolatile;
 };
 
+/*
+ * Where address 0 of a MemoryRegion lands in a FlatView, and the part of
+ * the view it can show up in.  Changes in the region or its subregions
+ * only need that part of the view rendered again.
+ */
+struct FlatAlias {
+    MemoryRegion *mr;
+    Int128 origin;
+    AddrRange clip;
+};
+
 #define FOR_EACH_FLAT_RANGE(var, view)          \
     for (var = (view)->ranges; var < (view)->ranges + (view)->nr; ++var)
 
@@ -282,6 +315,24 @@ static void flatview_insert(FlatView *view, unsigned pos, FlatRange *range)
     ++view->nr;
 }
 
+static void flatview_add_alias(FlatView *view, MemoryRegion *mr,
+                               Int128 origin, AddrRange clip)
+{
+    if (!int128_nz(clip.size)) {
+        return;
+    }
+    if (view->nr_aliases == view->nr_aliases_allocated) {
+        view->nr_aliases_allocated = MAX(2 * view->nr_aliases, 4);
+        view->aliases = g_renew(FlatAlias, view->aliases,
+                                view->nr_aliases_allocated);
+    }
+    view->aliases[view->nr_aliases++] = (FlatAlias) {
+        .mr = mr,
+        .origin = origin,
+        .clip = clip,
+    };
+}
+
 static void flatview_destroy(FlatView *view)
 {
     int i;
@@ -294,6 +345,7 @@ static void flatview_destroy(FlatView *view)
         memory_region_unref(view->ranges[i].mr);
     }
     g_free(view->ranges);
+    g_free(view->aliases);
     memory_region_unref(view->root);
     g_free(view);
 }
@@ -541,6 +593,12 @@ static MemTxResult access_with_adjusted_size(hwaddr addr,
         access_size_max = 4;
     }
 
+    /* Fast path: the device implements the access size, no splitting */
+    if (likely(size >= access_size_min && size <= access_size_max)) {
+        return access_fn(mr, addr, value, size, 0,
+                         MAKE_64BIT_MASK(0, size * 8), attrs);
+    }
+
     /* FIXME: support unaligned access? */
     access_size = MAX(MIN(size, access_size_max), access_size_min);
     access_mask = MAKE_64BIT_MASK(0, access_size * 8);
@@ -610,6 +668,9 @@ static void render_memory_region(FlatView *view,
     if (mr->alias) {
         int128_subfrom(&base, int128_make64(mr->alias->addr));
         int128_subfrom(&base, int128_make64(mr->alias_offset));
+        flatview_add_alias(view, mr->alias,
+                           int128_add(base, int128_make64(mr->alias->addr)),
+                           clip);
         render_memory_region(view, mr->alias, base, clip,
                              readonly, nonvolatile);
         return;
@@ -724,20 +785,77 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
-/* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+static int addrrange_compare(const void *a, const void *b)
 {
-    int i;
-    FlatView *view;
+    const AddrRange *r1 = a, *r2 = b;
 
-    view = flatview_new(mr);
+    if (int128_lt(r1->start, r2->start)) {
+        return -1;
+    }
+    return int128_lt(r2->start, r1->start);
+}
 
-    if (mr) {
-        render_memory_region(view, mr, int128_zero(),
-                             addrrange_make(int128_zero(), int128_2_64()),
-                             false, false);
+static int flat_alias_compare(const void *a, const void *b)
+{
+    const FlatAlias *fa1 = a, *fa2 = b;
+
+    if (fa1->mr != fa2->mr) {
+        return (uintptr_t)fa1->mr < (uintptr_t)fa2->mr ? -1 : 1;
+    }
+    if (!int128_eq(fa1->origin, fa2->origin)) {
+        return int128_lt(fa1->origin, fa2->origin) ? -1 : 1;
+    }
+    return addrrange_compare(&fa1->clip, &fa2->clip);
+}
+
+/*
+ * Sort the aliases except the root, and merge the pieces that updates of
+ * the view have split.
+ */
+static void flatview_merge_aliases(FlatView *view)
+{
+    FlatAlias *last, *fa;
+    unsigned i, n;
+
+    if (view->nr_aliases < 3) {
+        return;
+    }
+
+    qsort(view->aliases + 1, view->nr_aliases - 1, sizeof(FlatAlias),
+          flat_alias_compare);
+    for (i = 2, n = 2; i < view->nr_aliases; i++) {
+        last = &view->aliases[n - 1];
+        fa = &view->aliases[i];
+        if (last->mr == fa->mr && int128_eq(last->origin, fa->origin) &&
+            int128_ge(addrrange_end(last->clip), fa->clip.start)) {
+            Int128 end = int128_max(addrrange_end(last->clip),
+                                    addrrange_end(fa->clip));
+            last->clip.size = int128_sub(end, last->clip.start);
+        } else {
+            view->aliases[n++] = *fa;
+        }
+    }
+    view->nr_aliases = n;
+}
+
+static AddrRange flatview_root_clip(MemoryRegion *mr)
+{
+    AddrRange tmp = addrrange_make(int128_make64(mr->addr), mr->size);
+    AddrRange all = addrrange_make(int128_zero(), int128_2_64());
+
+    if (!addrrange_intersects(tmp, all)) {
+        return addrrange_make(int128_zero(), int128_zero());
     }
+    return addrrange_intersection(tmp, all);
+}
+
+/* Build the dispatch tree of a rendered view and make it the view of @mr. */
+static void flatview_finish(FlatView *view, MemoryRegion *mr)
+{
+    int i;
+
     flatview_simplify(view);
+    flatview_merge_aliases(view);
 
     view->dispatch = address_space_dispatch_new(view);
     for (i = 0; i < view->nr; i++) {
@@ -747,10 +865,241 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     address_space_dispatch_compact(view->dispatch);
     g_hash_table_replace(flat_views, mr, view);
+}
+
+/* Render a memory topology into a list of disjoint absolute ranges. */
+static FlatView *generate_memory_topology(MemoryRegion *mr)
+{
+    FlatView *view;
+
+    view = flatview_new(mr);
+
+    if (mr) {
+        flatview_add_alias(view, mr, int128_make64(mr->addr),
+                           flatview_root_clip(mr));
+        render_memory_region(view, mr, int128_zero(),
+                             addrrange_make(int128_zero(), int128_2_64()),
+                             false, false);
+    }
+    flatview_finish(view, mr);
+
+    return view;
+}
+
+/*
+ * Return the parts of @view that the changes recorded in flat_views_dirty
+ * can affect, sorted and disjoint.
+ */
+static GArray *flatview_dirty_ranges(FlatView *view)
+{
+    GArray *dirty = g_array_new(false, false, sizeof(AddrRange));
+    AddrRange *last, *r;
+    unsigned i, j, n;
+
+    for (i = 0; i < view->nr_aliases; i++) {
+        FlatAlias *fa = &view->aliases[i];
+        GArray *ranges = g_hash_table_lookup(flat_views_dirty, fa->mr);
+
+        for (j = 0; ranges && j < ranges->len; j++) {
+            AddrRange tmp = addrrange_shift(g_array_index(ranges, AddrRange, j),
+                                            fa->origin);
+
+            if (!int128_nz(tmp.size) || !addrrange_intersects(tmp, fa->clip)) {
+                continue;
+            }
+            tmp = addrrange_intersection(tmp, fa->clip);
+            if (int128_nz(tmp.size)) {
+                g_array_append_val(dirty, tmp);
+            }
+        }
+    }
+
+    g_array_sort(dirty, addrrange_compare);
+    for (i = 0, n = 0; i < dirty->len; i++) {
+        r = &g_array_index(dirty, AddrRange, i);
+        last = n ? &g_array_index(dirty, AddrRange, n - 1) : NULL;
+        if (last && int128_ge(addrrange_end(*last), r->start)) {
+            Int128 end = int128_max(addrrange_end(*last), addrrange_end(*r));
+            last->size = int128_sub(end, last->start);
+        } else {
+            g_array_index(dirty, AddrRange, n++) = *r;
+        }
+    }
+    g_array_set_size(dirty, n);
+
+    return dirty;
+}
+
+/*
+ * Append the parts of @old that are within @window to @view.  *first is
+ * the first range of @old that can still be within a later window.
+ */
+static void flatview_copy_window(FlatView *view, FlatView *old,
+                                 AddrRange window, unsigned *first)
+{
+    FlatRange fr;
+    unsigned i;
+
+    if (!int128_nz(window.size)) {
+        return;
+    }
+
+    for (i = *first; i < old->nr; i++) {
+        fr = old->ranges[i];
+        if (int128_le(addrrange_end(fr.addr), window.start)) {
+            *first = i + 1;
+            continue;
+        }
+        if (int128_ge(fr.addr.start, addrrange_end(window))) {
+            break;
+        }
+        fr.addr = addrrange_intersection(fr.addr, window);
+        fr.offset_in_region +=
+            int128_get64(int128_sub(fr.addr.start, old->ranges[i].addr.start));
+        flatview_insert(view, view->nr, &fr);
+    }
+
+    for (i = 1; i < old->nr_aliases; i++) {
+        FlatAlias *fa = &old->aliases[i];
+
+        if (addrrange_intersects(fa->clip, window)) {
+            flatview_add_alias(view, fa->mr, fa->origin,
+                               addrrange_intersection(fa->clip, window));
+        }
+    }
+}
+
+/*
+ * Update the view of @mr by rendering again only the parts of @old that
+ * changed, and copying everything else.  Returns NULL if @old can't be
+ * updated because the root itself moved or was resized.
+ */
+static FlatView *flatview_update(FlatView *old, MemoryRegion *mr)
+{
+    AddrRange root_clip = flatview_root_clip(mr);
+    Int128 pos = int128_zero();
+    AddrRange window;
+    FlatView *view, tmpview;
+    unsigned i, j, first = 0;
+    GArray *dirty;
+
+    if (!old->nr_aliases || old->aliases[0].mr != mr ||
+        !int128_eq(old->aliases[0].origin, int128_make64(mr->addr)) ||
+        !addrrange_equal(old->aliases[0].clip, root_clip)) {
+        return NULL;
+    }
+
+    dirty = flatview_dirty_ranges(old);
+    if (!dirty->len) {
+        g_array_free(dirty, true);
+        flatview_ref(old);
+        g_hash_table_replace(flat_views, mr, old);
+        topology_stats.views_reused++;
+        return old;
+    }
+
+    view = flatview_new(mr);
+    flatview_add_alias(view, mr, int128_make64(mr->addr), root_clip);
+
+    for (i = 0; i < dirty->len; i++) {
+        window = g_array_index(dirty, AddrRange, i);
+        flatview_copy_window(view, old,
+                             addrrange_make(pos, int128_sub(window.start, pos)),
+                             &first);
+
+        /* Render the window on its own, then move it to the end of @view */
+        tmpview = (FlatView) { .nr = 0 };
+        render_memory_region(&tmpview, mr, int128_zero(), window,
+                             false, false);
+        for (j = 0; j < tmpview.nr; j++) {
+            flatview_insert(view, view->nr, &tmpview.ranges[j]);
+            memory_region_unref(tmpview.ranges[j].mr);
+        }
+        for (j = 0; j < tmpview.nr_aliases; j++) {
+            flatview_add_alias(view, tmpview.aliases[j].mr,
+                               tmpview.aliases[j].origin,
+                               tmpview.aliases[j].clip);
+        }
+        g_free(tmpview.ranges);
+        g_free(tmpview.aliases);
+
+        pos = addrrange_end(window);
+    }
+    flatview_copy_window(view, old,
+                         addrrange_make(pos, int128_sub(int128_2_64(), pos)),
+                         &first);
+
+    trace_flatview_update(view, mr, dirty->len);
+    g_array_free(dirty, true);
+
+    flatview_finish(view, mr);
+    topology_stats.views_updated++;
 
     return view;
 }
 
+/*
+ * Render @mr from scratch and abort if @view, which flatview_update() has
+ * produced, differs from it.  Only done under qtest, where it turns every
+ * topology change that a test makes into a check of the update.
+ */
+static void flatview_check_update(FlatView *view, MemoryRegion *mr)
+{
+    FlatView *ref = flatview_new(mr);
+    unsigned i;
+
+    render_memory_region(ref, mr, int128_zero(),
+                         addrrange_make(int128_zero(), int128_2_64()),
+                         false, false);
+    flatview_simplify(ref);
+
+    for (i = 0; i < MAX(view->nr, ref->nr); i++) {
+        if (i >= view->nr || i >= ref->nr ||
+            !flatrange_equal(&view->ranges[i], &ref->ranges[i]) ||
+            view->ranges[i].dirty_log_mask != ref->ranges[i].dirty_log_mask) {
+            error_report("updated FlatView of %s differs from a full render "
+                         "at range %u", memory_region_name(mr), i);
+            abort();
+        }
+    }
+
+    flatview_destroy(ref);
+}
+
+/*
+ * Record that @size bytes at @offset in @mr, and so the matching parts of
+ * its containers, may render differently when the transaction commits.
+ */
+static void memory_region_update_range(MemoryRegion *mr, Int128 offset,
+                                       Int128 size)
+{
+    AddrRange range = addrrange_make(offset, size);
+    GArray *ranges;
+
+    if (!flat_views_dirty) {
+        flat_views_dirty = g_hash_table_new_full(g_direct_hash, g_direct_equal,
+                                                 NULL,
+                                                 (GDestroyNotify)g_array_unref);
+    }
+
+    for (; mr; mr = mr->container) {
+        ranges = g_hash_table_lookup(flat_views_dirty, mr);
+        if (!ranges) {
+            ranges = g_array_new(false, false, sizeof(AddrRange));
+            g_hash_table_insert(flat_views_dirty, mr, ranges);
+        }
+        g_array_append_val(ranges, range);
+        range = addrrange_shift(range, int128_make64(mr->addr));
+    }
+
+    memory_region_update_pending = true;
+}
+
+static void memory_region_update_extent(MemoryRegion *mr)
+{
+    memory_region_update_range(mr, int128_zero(), mr->size);
+}
+
 static void address_space_add_del_ioeventfds(AddressSpace *as,
                                              MemoryRegionIoeventfd *fds_new,
                                              unsigned fds_new_nb,
@@ -1003,24 +1352,47 @@ static void flatviews_init(void)
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
+    bool incremental;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    incremental = old_views && !flat_views_dirty_all &&
+                  flat_views_dirty && g_hash_table_size(flat_views_dirty);
+
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    /* Render unique FVs, updating the old ones where possible */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
+        FlatView *old_view = NULL;
+        FlatView *view = NULL;
 
         if (g_hash_table_lookup(flat_views, physmr)) {
             continue;
         }
 
-        generate_memory_topology(physmr);
+        if (incremental) {
+            old_view = g_hash_table_lookup(old_views, physmr);
+        }
+        if (old_view) {
+            view = flatview_update(old_view, physmr);
+        }
+        if (!view) {
+            generate_memory_topology(physmr);
+            topology_stats.views_generated++;
+        } else if (qtest_enabled()) {
+            flatview_check_update(view, physmr);
+        }
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
+    if (flat_views_dirty) {
+        g_hash_table_remove_all(flat_views_dirty);
+    }
+    flat_views_dirty_all = false;
 }
 
 static void address_space_set_flatview(AddressSpace *as)
@@ -1032,6 +1404,10 @@ static void address_space_set_flatview(AddressSpace *as)
     assert(new_view);
 
     if (old_view == new_view) {
+        /* Nothing changed, but listeners still expect to see every range */
+        if (!QTAILQ_EMPTY(&as->listeners)) {
+            address_space_update_topology_pass(as, new_view, new_view, true);
+        }
         return;
     }
 
@@ -1095,17 +1471,31 @@ void memory_region_transaction_commit(void)
     --memory_region_transaction_depth;
     if (!memory_region_transaction_depth) {
         if (memory_region_update_pending) {
+            int64_t start = get_clock();
+            int64_t ns;
+
             flatviews_reset();
 
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                FlatView *old_view = address_space_to_flatview(as);
+
                 address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                if (ioeventfd_update_pending ||
+                    address_space_to_flatview(as) != old_view) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
             MEMORY_LISTENER_CALL_GLOBAL(commit, Forward);
+
+            ns = get_clock() - start;
+            topology_stats.commits++;
+            topology_stats.last_ns = ns;
+            topology_stats.max_ns = MAX(topology_stats.max_ns, ns);
+            topology_stats.total_ns += ns;
         } else if (ioeventfd_update_pending) {
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
                 address_space_update_ioeventfds(as);
@@ -2114,7 +2504,9 @@ void memory_region_set_log(MemoryRegion *mr, bool log, unsigned client)
 
     memory_region_transaction_begin();
     mr->dirty_log_mask = (mr->dirty_log_mask & ~mask) | (log * mask);
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_extent(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2244,7 +2636,9 @@ void memory_region_set_readonly(MemoryRegion *mr, bool readonly)
     if (mr->readonly != readonly) {
         memory_region_transaction_begin();
         mr->readonly = readonly;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_extent(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2254,7 +2648,9 @@ void memory_region_set_nonvolatile(MemoryRegion *mr, bool nonvolatile)
     if (mr->nonvolatile != nonvolatile) {
         memory_region_transaction_begin();
         mr->nonvolatile = nonvolatile;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_extent(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2264,7 +2660,9 @@ void memory_region_rom_device_set_romd(MemoryRegion *mr, bool romd_mode)
     if (mr->romd_mode != romd_mode) {
         memory_region_transaction_begin();
         mr->romd_mode = romd_mode;
-        memory_region_update_pending |= mr->enabled;
+        if (mr->enabled) {
+            memory_region_update_extent(mr);
+        }
         memory_region_transaction_commit();
     }
 }
@@ -2516,7 +2914,10 @@ static void memory_region_update_container_subregions(MemoryRegion *subregion)
     }
     QTAILQ_INSERT_TAIL(&mr->subregions, subregion, subregions_link);
 done:
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_range(mr, int128_make64(subregion->addr),
+                                   subregion->size);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2554,8 +2955,11 @@ void memory_region_del_subregion(MemoryRegion *mr,
     assert(subregion->container == mr);
     subregion->container = NULL;
     QTAILQ_REMOVE(&mr->subregions, subregion, subregions_link);
+    if (mr->enabled && subregion->enabled) {
+        memory_region_update_range(mr, int128_make64(subregion->addr),
+                                   subregion->size);
+    }
     memory_region_unref(subregion);
-    memory_region_update_pending |= mr->enabled && subregion->enabled;
     memory_region_transaction_commit();
 }
 
@@ -2566,7 +2970,7 @@ void memory_region_set_enabled(MemoryRegion *mr, bool enabled)
     }
     memory_region_transaction_begin();
     mr->enabled = enabled;
-    memory_region_update_pending = true;
+    memory_region_update_extent(mr);
     memory_region_transaction_commit();
 }
 
@@ -2581,8 +2985,10 @@ void memory_region_set_size(MemoryRegion *mr, uint64_t size)
         return;
     }
     memory_region_transaction_begin();
+    /* Both the old and the new extent may render differently */
+    memory_region_update_extent(mr);
     mr->size = s;
-    memory_region_update_pending = true;
+    memory_region_update_extent(mr);
     memory_region_transaction_commit();
 }
 
@@ -2604,8 +3010,15 @@ static void memory_region_readd_subregion(MemoryRegion *mr)
 void memory_region_set_address(MemoryRegion *mr, hwaddr addr)
 {
     if (addr != mr->addr) {
+        memory_region_transaction_begin();
+        if (mr->container && mr->enabled && mr->container->enabled) {
+            /* Re-adding the region only covers its new place */
+            memory_region_update_range(mr->container, int128_make64(mr->addr),
+                                       mr->size);
+        }
         mr->addr = addr;
         memory_region_readd_subregion(mr);
+        memory_region_transaction_commit();
     }
 }
 
@@ -2619,7 +3032,9 @@ void memory_region_set_alias_offset(MemoryRegion *mr, hwaddr offset)
 
     memory_region_transaction_begin();
     mr->alias_offset = offset;
-    memory_region_update_pending |= mr->enabled;
+    if (mr->enabled) {
+        memory_region_update_extent(mr);
+    }
     memory_region_transaction_commit();
 }
 
@@ -2774,6 +3189,7 @@ void memory_global_dirty_log_start(void)
     /* Refresh DIRTY_MEMORY_MIGRATION bit.  */
     memory_region_transaction_begin();
     memory_region_update_pending = true;
+    flat_views_dirty_all = true;
     memory_region_transaction_commit();
 }
 
@@ -2784,6 +3200,7 @@ static void memory_global_dirty_log_do_stop(void)
     /* Refresh DIRTY_MEMORY_MIGRATION bit.  */
     memory_region_transaction_begin();
     memory_region_update_pending = true;
+    flat_views_dirty_all = true;
     memory_region_transaction_commit();
 
     MEMORY_LISTENER_CALL_GLOBAL(log_global_stop, Reverse);
@@ -3253,6 +3670,19 @@ static gboolean mtree_info_flatview_free(gpointer key, gpointer value,
     return true;
 }
 
+static void mtree_print_topology_stats(void)
+{
+    qemu_printf("topology updates: %" PRIu64 " commits, latency last %"
+                PRId64 " us, avg %" PRId64 " us, max %" PRId64 " us\n",
+                topology_stats.commits, topology_stats.last_ns / SCALE_US,
+                topology_stats.commits ?
+                topology_stats.total_ns / topology_stats.commits / SCALE_US : 0,
+                topology_stats.max_ns / SCALE_US);
+    qemu_printf("flatviews: %" PRIu64 " rendered, %" PRIu64 " updated, %"
+                PRIu64 " reused\n", topology_stats.views_generated,
+                topology_stats.views_updated, topology_stats.views_reused);
+}
+
 void mtree_info(bool flatview, bool dispatch_tree, bool owner, bool disabled)
 {
     MemoryRegionListHead ml_head;
@@ -3294,6 +3724,7 @@ void mtree_info(bool flatview, bool dispatch_tree, bool owner, bool disabled)
         g_hash_table_foreach_remove(views, mtree_info_flatview_free, 0);
         g_hash_table_unref(views);
 
+        mtree_print_topology_stats();
         return;
     }
 
@@ -3315,6 +3746,8 @@ void mtree_info(bool flatview, bool dispatch_tree, bool owner, bool disabled)
     QTAILQ_FOREACH_SAFE(ml, &ml_head, mrqueue, ml2) {
         g_free(ml);
     }
+
+    mtree_print_topology_stats();
 }
 
 void memory_region_init_ram(MemoryRegion *mr,
@@ -126,6 +126,8 @@ typedef struct PhysPageMap {
 
 struct AddressSpaceDispatch {
     MemoryRegionSection *mru_section;
+    /* Unique tag of the dispatch once complete, 0 while it is being built */
+    uint64_t generation;
     /* This is a multi-level map on the physical address space.
      * The bottom level has pointers to MemoryRegionSections.
      */
@@ -288,11 +290,29 @@ static void phys_page_compact(PhysPageEntry *lp, Node *nodes)
     }
 }
 
+/*
+ * Per-thread, and thus per-vCPU, cache of resolved sections, indexed by
+ * guest physical page.  A dispatch is never modified once complete, so an
+ * entry only needs the generation of the dispatch it was found in to tell
+ * whether it is still current; no locking or invalidation is needed.
+ */
+#define SECTION_CACHE_SIZE 16
+
+typedef struct SectionCacheEntry {
+    uint64_t generation;
+    MemoryRegionSection *section;
+} SectionCacheEntry;
+
+static __thread SectionCacheEntry section_cache[SECTION_CACHE_SIZE];
+static uint64_t dispatch_generation;
+
+/* Called with the BQL held, once the dispatch is complete */
 void address_space_dispatch_compact(AddressSpaceDispatch *d)
 {
     if (d->phys_map.skip) {
         phys_page_compact(&d->phys_map, d->map.nodes);
     }
+    d->generation = ++dispatch_generation;
 }
 
 static inline bool section_covers_addr(const MemoryRegionSection *section,
@@ -334,9 +354,20 @@ static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
                                                         hwaddr addr,
                                                         bool resolve_subpage)
 {
-    MemoryRegionSection *section = qatomic_read(&d->mru_section);
+    SectionCacheEntry *entry = NULL;
+    MemoryRegionSection *section;
     subpage_t *subpage;
 
+    if (resolve_subpage && d->generation) {
+        entry = &section_cache[(addr >> TARGET_PAGE_BITS) &
+                               (SECTION_CACHE_SIZE - 1)];
+        if (entry->generation == d->generation &&
+            section_covers_addr(entry->section, addr)) {
+            return entry->section;
+        }
+    }
+
+    section = qatomic_read(&d->mru_section);
     if (!section || section == &d->map.sections[PHYS_SECTION_UNASSIGNED] ||
         !section_covers_addr(section, addr)) {
         section = phys_page_find(d, addr);
@@ -346,6 +377,12 @@ static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
         subpage = container_of(section->mr, subpage_t, iomem);
         section = &d->map.sections[subpage->sub_section[SUBPAGE_IDX(addr)]];
     }
+
+    /* The unassigned section covers everything, never cache it */
+    if (entry && section != &d->map.sections[PHYS_SECTION_UNASSIGNED]) {
+        entry->generation = d->generation;
+        entry->section = section;
+    }
     return section;
 }
 
@@ -1726,6 +1763,11 @@ bool qemu_ram_is_noreserve(RAMBlock *rb)
     return rb->flags & RAM_NORESERVE;
 }
 
+bool qemu_ram_is_named_file(RAMBlock *rb)
+{
+    return rb->flags & RAM_NAMED_FILE;
+}
+
 /* Note: Only set at the start of postcopy */
 bool qemu_ram_is_uf_zeroable(RAMBlock *rb)
 {
@@ -2057,7 +2099,7 @@ RAMBlock *qemu_ram_alloc_from_fd(ram_addr_t size, MemoryRegion *mr,
 
     /* Just support these ram flags by now. */
     assert((ram_flags & ~(RAM_SHARED | RAM_PMEM | RAM_NORESERVE |
-                          RAM_PROTECTED)) == 0);
+                          RAM_PROTECTED | RAM_NAMED_FILE)) == 0);
 
     if (xen_enabled()) {
         error_setg(errp, "-mem-path not supported with Xen");
@@ -2117,6 +2159,7 @@ RAMBlock *qemu_ram_alloc_from_file(ram_addr_t size, MemoryRegion *mr,
     int fd;
     bool created;
     RAMBlock *block;
+    struct stat st;
 
     fd = file_ram_open(mem_path, memory_region_name(mr), readonly, &created,
                        errp);
@@ -2124,6 +2167,11 @@ RAMBlock *qemu_ram_alloc_from_file(ram_addr_t size, MemoryRegion *mr,
         return NULL;
     }
 
+    /* Temporary files created in a @mem_path directory are already unlinked */
+    if (fstat(fd, &st) == 0 && st.st_nlink) {
+        ram_flags |= RAM_NAMED_FILE;
+    }
+
     block = qemu_ram_alloc_from_fd(size, mr, ram_flags, fd, 0, readonly, errp);
     if (!block) {
         if (created) {
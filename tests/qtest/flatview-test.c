@@ -0,0 +1,117 @@
+/*
+ * QTest testcase for incremental FlatView updates
+ *
+ * Under qtest, every FlatView that a memory transaction updates instead of
+ * rendering from scratch is compared with a full render, and QEMU aborts
+ * if they differ.  This test moves PCI BARs over each other and over the
+ * BIOS to add, remove and overlap regions, and checks that guest accesses
+ * still reach the right region.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "libqos/libqtest.h"
+#include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+#include "hw/pci/pci_regs.h"
+
+/* Inside the last 128 KiB of the BIOS, which every PC BIOS image covers */
+#define BAR_A       0xfffe0000
+#define BAR_B       0xfffe2000
+#define BIOS_PEEK   0xfffe1000
+
+/* pci-testdev reports the selected test in the first byte of its BAR */
+#define TEST_A      1
+#define TEST_B      2
+
+static void set_bar(QPCIDevice *dev, uint32_t addr)
+{
+    qpci_config_writel(dev, PCI_BASE_ADDRESS_0, addr);
+}
+
+static void set_mem_enabled(QPCIDevice *dev, bool enabled)
+{
+    qpci_config_writew(dev, PCI_COMMAND, enabled ? PCI_COMMAND_MEMORY : 0);
+}
+
+static uint64_t flatviews_updated(QTestState *qts)
+{
+    g_autofree char *mtree = qtest_hmp(qts, "info mtree -f");
+    uint64_t rendered, updated;
+    char *stats = strstr(mtree, "flatviews: ");
+
+    g_assert_nonnull(stats);
+    g_assert_cmpint(sscanf(stats, "flatviews: %" SCNu64 " rendered, %"
+                           SCNu64 " updated", &rendered, &updated), ==, 2);
+    return updated;
+}
+
+static void test_flatview_update(void)
+{
+    QTestState *qts;
+    QPCIBus *bus;
+    QPCIDevice *dev_a, *dev_b;
+    uint8_t bios[2][16], buf[16];
+    uint64_t updated;
+
+    qts = qtest_init("-machine pc "
+                     "-device pci-testdev,addr=04.0 "
+                     "-device pci-testdev,addr=05.0");
+    bus = qpci_new_pc(qts, NULL);
+    dev_a = qpci_device_find(bus, QPCI_DEVFN(4, 0));
+    dev_b = qpci_device_find(bus, QPCI_DEVFN(5, 0));
+    g_assert_nonnull(dev_a);
+    g_assert_nonnull(dev_b);
+
+    qtest_memread(qts, BAR_A, bios[0], sizeof(bios[0]));
+    qtest_memread(qts, BIOS_PEEK, bios[1], sizeof(bios[1]));
+    updated = flatviews_updated(qts);
+
+    /* Add: both BARs split the BIOS, which stays visible in between */
+    set_bar(dev_a, BAR_A);
+    set_bar(dev_b, BAR_B);
+    set_mem_enabled(dev_a, true);
+    set_mem_enabled(dev_b, true);
+    qtest_writeb(qts, BAR_A, TEST_A);
+    qtest_writeb(qts, BAR_B, TEST_B);
+    g_assert_cmpint(qtest_readb(qts, BAR_A), ==, TEST_A);
+    g_assert_cmpint(qtest_readb(qts, BAR_B), ==, TEST_B);
+    qtest_memread(qts, BIOS_PEEK, buf, sizeof(buf));
+    g_assert_cmpmem(buf, sizeof(buf), bios[1], sizeof(bios[1]));
+
+    /* Overlap: the BAR that was mapped last is on top */
+    set_bar(dev_b, BAR_A);
+    g_assert_cmpint(qtest_readb(qts, BAR_A), ==, TEST_B);
+    qtest_memread(qts, BIOS_PEEK, buf, sizeof(buf));
+    g_assert_cmpmem(buf, sizeof(buf), bios[1], sizeof(bios[1]));
+
+    set_bar(dev_a, BAR_A + 0x1000);
+    set_bar(dev_a, BAR_A);
+    g_assert_cmpint(qtest_readb(qts, BAR_A), ==, TEST_A);
+
+    /* Delete: what was hidden below shows up again */
+    set_mem_enabled(dev_a, false);
+    g_assert_cmpint(qtest_readb(qts, BAR_A), ==, TEST_B);
+    set_mem_enabled(dev_b, false);
+    qtest_memread(qts, BAR_A, buf, sizeof(buf));
+    g_assert_cmpmem(buf, sizeof(buf), bios[0], sizeof(bios[0]));
+
+    /* The views were updated, not just rendered again */
+    g_assert_cmpint(flatviews_updated(qts), >, updated);
+
+    g_free(dev_a);
+    g_free(dev_b);
+    qpci_free_pc(bus);
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/flatview/update", test_flatview_update);
+
+    return g_test_run();
+}
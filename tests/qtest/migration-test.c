@@ -470,6 +470,9 @@ typedef struct {
      */
     bool hide_stderr;
     bool use_shmem;
+    /* Map the shmem file with share=off on the source or the target */
+    bool shmem_private_source;
+    bool shmem_private_target;
     /* only launch the target process */
     bool only_target;
     /* Use dirty ring if true; dirty logging otherwise */
@@ -503,7 +506,8 @@ static int test_migrate_start(QTestState **from, QTestState **to,
     g_autofree gchar *cmd_target = NULL;
     const gchar *ignore_stderr;
     g_autofree char *bootpath = NULL;
-    g_autofree char *shmem_opts = NULL;
+    g_autofree char *shmem_opts_source = NULL;
+    g_autofree char *shmem_opts_target = NULL;
     g_autofree char *shmem_path = NULL;
     const char *arch = qtest_get_arch();
     const char *machine_opts = NULL;
@@ -571,13 +575,20 @@ static int test_migrate_start(QTestState **from, QTestState **to,
 
     if (args->use_shmem) {
         shmem_path = g_strdup_printf("/dev/shm/qemu-%d", getpid());
-        shmem_opts = g_strdup_printf(
+        shmem_opts_source = g_strdup_printf(
             "-object memory-backend-file,id=mem0,size=%s"
-            ",mem-path=%s,share=on -numa node,memdev=mem0",
-            memory_size, shmem_path);
+            ",mem-path=%s,share=%s -numa node,memdev=mem0",
+            memory_size, shmem_path,
+            args->shmem_private_source ? "off" : "on");
+        shmem_opts_target = g_strdup_printf(
+            "-object memory-backend-file,id=mem0,size=%s"
+            ",mem-path=%s,share=%s -numa node,memdev=mem0",
+            memory_size, shmem_path,
+            args->shmem_private_target ? "off" : "on");
     } else {
         shmem_path = NULL;
-        shmem_opts = g_strdup("");
+        shmem_opts_source = g_strdup("");
+        shmem_opts_target = g_strdup("");
     }
 
     cmd_source = g_strdup_printf("-accel kvm%s -accel tcg%s%s "
@@ -590,7 +601,8 @@ static int test_migrate_start(QTestState **from, QTestState **to,
                                  machine_opts ? " -machine " : "",
                                  machine_opts ? machine_opts : "",
                                  memory_size, tmpfs,
-                                 arch_source, shmem_opts, args->opts_source,
+                                 arch_source, shmem_opts_source,
+                                 args->opts_source,
                                  ignore_stderr);
     if (!args->only_target) {
         *from = qtest_init(cmd_source);
@@ -607,7 +619,7 @@ static int test_migrate_start(QTestState **from, QTestState **to,
                                  machine_opts ? " -machine " : "",
                                  machine_opts ? machine_opts : "",
                                  memory_size, tmpfs, uri,
-                                 arch_target, shmem_opts,
+                                 arch_target, shmem_opts_target,
                                  args->opts_target, ignore_stderr);
     *to = qtest_init(cmd_target);
 
@@ -656,6 +668,7 @@ static void test_migrate_end(QTestState *from, QTestState *to, bool test_dest)
     cleanup("migsocket");
     cleanup("src_serial");
     cleanup("dest_serial");
+    cleanup("migfile");
 }
 
 static int migrate_postcopy_prepare(QTestState **from_ptr,
@@ -887,6 +900,79 @@ static void test_ignore_shared(void)
 }
 #endif
 
+/*
+ * Save the state of a template VM whose RAM is a shared file, and restore
+ * it in a clone that maps the same file private.  RAM is not in the stream,
+ * the clone faults it in from the file.
+ */
+static void test_ignore_file_ram(void)
+{
+    g_autofree char *save_uri = g_strdup_printf("exec:cat > %s/migfile",
+                                                tmpfs);
+    g_autofree char *load_uri = g_strdup_printf("exec:cat %s/migfile", tmpfs);
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+    QDict *rsp;
+
+    args->use_shmem = true;
+    args->shmem_private_target = true;
+
+    if (test_migrate_start(&from, &to, "defer", args)) {
+        return;
+    }
+
+    migrate_set_capability(from, "x-ignore-file-ram", true);
+    migrate_set_capability(to, "x-ignore-file-ram", true);
+
+    /* Wait for the first serial output from the source */
+    wait_for_serial("src_serial");
+
+    migrate_qmp(from, save_uri, "{}");
+
+    if (!got_stop) {
+        qtest_qmp_eventwait(from, "STOP");
+    }
+    wait_for_migration_complete(from);
+
+    /* Check whether file RAM has been really skipped */
+    g_assert_cmpint(read_ram_property_int(from, "transferred"), <, 1024 * 1024);
+
+    /* The template stays stopped, so the file now holds the saved RAM */
+    rsp = wait_command(to, "{ 'execute': 'migrate-incoming',"
+                           "  'arguments': { 'uri': %s }}", load_uri);
+    qobject_unref(rsp);
+
+    qtest_qmp_eventwait(to, "RESUME");
+
+    wait_for_serial("dest_serial");
+
+    test_migrate_end(from, to, true);
+}
+
+/* A private file mapping diverges from the file, so it cannot be ignored */
+static void test_ignore_file_ram_private(void)
+{
+    g_autofree char *uri = g_strdup_printf("exec:cat > %s/migfile", tmpfs);
+    MigrateStart *args = migrate_start_new();
+    QTestState *from, *to;
+
+    args->hide_stderr = true;
+    args->use_shmem = true;
+    args->shmem_private_source = true;
+
+    if (test_migrate_start(&from, &to, "defer", args)) {
+        return;
+    }
+
+    migrate_set_capability(from, "x-ignore-file-ram", true);
+
+    migrate_qmp(from, uri, "{}");
+
+    wait_for_migration_fail(from, false);
+
+    test_migrate_end(from, to, false);
+}
+
 static void test_xbzrle(const char *uri)
 {
     MigrateStart *args = migrate_start_new();
@@ -1463,6 +1549,9 @@ int main(int argc, char **argv)
     qtest_add_func("/migration/precopy/unix", test_precopy_unix);
     qtest_add_func("/migration/precopy/tcp", test_precopy_tcp);
     /* qtest_add_func("/migration/ignore_shared", test_ignore_shared); */
+    qtest_add_func("/migration/ignore_file_ram", test_ignore_file_ram);
+    qtest_add_func("/migration/ignore_file_ram/private",
+                   test_ignore_file_ram_private);
     qtest_add_func("/migration/xbzrle/unix", test_xbzrle_unix);
     qtest_add_func("/migration/fd_proto", test_migrate_fd_proto);
     qtest_add_func("/migration/validate_uuid", test_validate_uuid);
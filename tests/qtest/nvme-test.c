@@ -10,9 +10,12 @@
 #include "qemu/osdep.h"
 #include "qemu/module.h"
 #include "qemu/units.h"
+#include "qemu/bswap.h"
+#include "qemu/cutils.h"
 #include "libqos/libqtest.h"
 #include "libqos/qgraph.h"
 #include "libqos/pci.h"
+#include "libqos/malloc.h"
 #include "include/block/nvme.h"
 
 typedef struct QNvme QNvme;
@@ -142,6 +145,168 @@ static void nvmetest_pmr_reg_test(void *obj, void *data, QGuestAllocator *alloc)
     qpci_iounmap(pdev, pmr_bar);
 }
 
+#define NVMETEST_QSIZE      8
+#define NVMETEST_TIMEOUT_US (5 * G_USEC_PER_SEC)
+
+/* Queue pair 0 is the admin queue pair, queue pair 1 the I/O queue pair */
+typedef struct NvmeTestCtrl {
+    QPCIDevice *pdev;
+    QPCIBar bar;
+    QTestState *qts;
+    uint64_t sq_addr[2];
+    uint64_t cq_addr[2];
+    uint16_t sq_tail[2];
+    uint16_t cq_head[2];
+    uint16_t phase[2];
+    uint64_t dbs;
+    uint16_t cid;
+} NvmeTestCtrl;
+
+static void nvmetest_set_db(NvmeTestCtrl *t, unsigned int db, uint32_t val)
+{
+    uint32_t shadow = cpu_to_le32(val);
+
+    /*
+     * With shadow doorbells the controller reads the value from the doorbell
+     * buffer, so update it before writing the register.
+     */
+    if (t->dbs) {
+        qtest_memwrite(t->qts, t->dbs + (db << 2), &shadow, sizeof(shadow));
+    }
+
+    qpci_io_writel(t->pdev, t->bar, 0x1000 + (db << 2), val);
+}
+
+static void nvmetest_cmd(NvmeTestCtrl *t, int qid, NvmeCmd *cmd)
+{
+    gint64 end_time = g_get_monotonic_time() + NVMETEST_TIMEOUT_US;
+    NvmeCqe cqe;
+
+    cmd->cid = cpu_to_le16(t->cid++);
+    qtest_memwrite(t->qts, t->sq_addr[qid] + t->sq_tail[qid] * sizeof(*cmd),
+                   cmd, sizeof(*cmd));
+    t->sq_tail[qid] = (t->sq_tail[qid] + 1) % NVMETEST_QSIZE;
+    nvmetest_set_db(t, qid << 1, t->sq_tail[qid]);
+
+    for (;;) {
+        qtest_memread(t->qts, t->cq_addr[qid] + t->cq_head[qid] * sizeof(cqe),
+                      &cqe, sizeof(cqe));
+        if ((le16_to_cpu(cqe.status) & 0x1) == t->phase[qid]) {
+            break;
+        }
+
+        g_assert(g_get_monotonic_time() < end_time);
+        qtest_clock_step(t->qts, 1000);
+    }
+
+    g_assert_cmpint(le16_to_cpu(cqe.cid), ==, le16_to_cpu(cmd->cid));
+    g_assert_cmpint(le16_to_cpu(cqe.status) >> 1, ==, NVME_SUCCESS);
+
+    t->cq_head[qid] = (t->cq_head[qid] + 1) % NVMETEST_QSIZE;
+    if (!t->cq_head[qid]) {
+        t->phase[qid] ^= 0x1;
+    }
+    nvmetest_set_db(t, (qid << 1) + 1, t->cq_head[qid]);
+}
+
+static void nvmetest_alloc_queue(NvmeTestCtrl *t, QGuestAllocator *alloc,
+                                 int qid)
+{
+    t->sq_addr[qid] = guest_alloc(alloc, NVMETEST_QSIZE * sizeof(NvmeCmd));
+    t->cq_addr[qid] = guest_alloc(alloc, NVMETEST_QSIZE * sizeof(NvmeCqe));
+    qtest_memset(t->qts, t->cq_addr[qid], 0,
+                 NVMETEST_QSIZE * sizeof(NvmeCqe));
+    t->phase[qid] = 1;
+}
+
+/*
+ * Configure shadow doorbells with the Doorbell Buffer Config command, which
+ * moves the I/O queue doorbells to eventfds, and do I/O through them.
+ */
+static void nvmetest_dbbuf_test(void *obj, void *data, QGuestAllocator *alloc)
+{
+    QNvme *nvme = obj;
+    NvmeTestCtrl t = {
+        .pdev = &nvme->dev,
+        .qts = nvme->dev.bus->qts,
+    };
+    gint64 end_time;
+    uint64_t buf, eis;
+    uint16_t oacs;
+    uint32_t cc = 0;
+    uint8_t data_buf[512];
+    int i;
+
+    qpci_device_enable(t.pdev);
+    t.bar = qpci_iomap(t.pdev, 0, NULL);
+
+    nvmetest_alloc_queue(&t, alloc, 0);
+    qpci_io_writel(t.pdev, t.bar, NVME_REG_AQA,
+                   (NVMETEST_QSIZE - 1) << 16 | (NVMETEST_QSIZE - 1));
+    qpci_io_writeq(t.pdev, t.bar, NVME_REG_ASQ, t.sq_addr[0]);
+    qpci_io_writeq(t.pdev, t.bar, NVME_REG_ACQ, t.cq_addr[0]);
+
+    NVME_SET_CC_IOSQES(cc, 6);
+    NVME_SET_CC_IOCQES(cc, 4);
+    NVME_SET_CC_EN(cc, 1);
+    qpci_io_writel(t.pdev, t.bar, NVME_REG_CC, cc);
+
+    end_time = g_get_monotonic_time() + NVMETEST_TIMEOUT_US;
+    while (!(qpci_io_readl(t.pdev, t.bar, NVME_REG_CSTS) & NVME_CSTS_READY)) {
+        g_assert(g_get_monotonic_time() < end_time);
+        qtest_clock_step(t.qts, 1000);
+    }
+
+    buf = guest_alloc(alloc, 4096);
+    nvmetest_cmd(&t, 0, &(NvmeCmd) {
+        .opcode = NVME_ADM_CMD_IDENTIFY,
+        .dptr.prp1 = cpu_to_le64(buf),
+        .cdw10 = cpu_to_le32(NVME_ID_CNS_CTRL),
+    });
+    qtest_memread(t.qts, buf + offsetof(NvmeIdCtrl, oacs), &oacs,
+                  sizeof(oacs));
+    g_assert(le16_to_cpu(oacs) & NVME_OACS_DBBUF);
+
+    t.dbs = guest_alloc(alloc, 4096);
+    eis = guest_alloc(alloc, 4096);
+    qtest_memset(t.qts, t.dbs, 0, 4096);
+    nvmetest_cmd(&t, 0, &(NvmeCmd) {
+        .opcode = NVME_ADM_CMD_DBBUF_CONFIG,
+        .dptr.prp1 = cpu_to_le64(t.dbs),
+        .dptr.prp2 = cpu_to_le64(eis),
+    });
+
+    nvmetest_alloc_queue(&t, alloc, 1);
+    nvmetest_cmd(&t, 0, &(NvmeCmd) {
+        .opcode = NVME_ADM_CMD_CREATE_CQ,
+        .dptr.prp1 = cpu_to_le64(t.cq_addr[1]),
+        .cdw10 = cpu_to_le32((NVMETEST_QSIZE - 1) << 16 | 1),
+        .cdw11 = cpu_to_le32(NVME_CQ_PC),
+    });
+    nvmetest_cmd(&t, 0, &(NvmeCmd) {
+        .opcode = NVME_ADM_CMD_CREATE_SQ,
+        .dptr.prp1 = cpu_to_le64(t.sq_addr[1]),
+        .cdw10 = cpu_to_le32((NVMETEST_QSIZE - 1) << 16 | 1),
+        .cdw11 = cpu_to_le32(1 << 16 | NVME_SQ_PC),
+    });
+
+    /* Wrap around the I/O queues so that the phase tag flips */
+    for (i = 0; i < 2 * NVMETEST_QSIZE; i++) {
+        qtest_memset(t.qts, buf, 0xff, sizeof(data_buf));
+        nvmetest_cmd(&t, 1, &(NvmeCmd) {
+            .opcode = NVME_CMD_READ,
+            .nsid = cpu_to_le32(1),
+            .dptr.prp1 = cpu_to_le64(buf),
+            .cdw10 = cpu_to_le32(i),
+        });
+
+        qtest_memread(t.qts, buf, data_buf, sizeof(data_buf));
+        g_assert(buffer_is_zero(data_buf, sizeof(data_buf)));
+    }
+
+    qpci_iounmap(t.pdev, t.bar);
+}
+
 static void nvme_register_nodes(void)
 {
     QOSGraphEdgeOptions opts = {
@@ -168,6 +333,17 @@ static void nvme_register_nodes(void)
     });
 
     qos_add_test("reg-read", "nvme", nvmetest_reg_read_test, NULL);
+
+    qos_add_test("dbbuf-ioeventfd", "nvme", nvmetest_dbbuf_test,
+                 &(QOSGraphTestOptions) {
+        .edge.extra_device_opts = "ioeventfd=on"
+    });
+
+    qos_add_test("dbbuf-iothread", "nvme", nvmetest_dbbuf_test,
+                 &(QOSGraphTestOptions) {
+        .edge.before_cmd_line = "-object iothread,id=nvme-iothread",
+        .edge.extra_device_opts = "ioeventfd=on,iothread=nvme-iothread"
+    });
 }
 
 libqos_init(nvme_register_nodes);
@@ -0,0 +1,295 @@
+/*
+ * QTest testcase for colo-compare
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * later.  See the COPYING file in the top-level directory.
+ *
+ * The test side plays both the primary and the secondary guest and reads
+ * what colo-compare lets out:
+ *
+ * qemu side                 | test side
+ *                           |
+ * +--------------+          |  +----------+
+ * |              <-------------+ pri_sock |
+ * |              |          |  +----------+
+ * | colo-compare <-------------+ sec_sock |
+ * |              |          |  +----------+
+ * |              +-------------> out_sock |
+ * +--------------+          |  +----------+
+ */
+
+#include "qemu/osdep.h"
+#include "qemu-common.h"
+#include "libqos/libqtest.h"
+#include "qapi/qmp/qdict.h"
+#include "qemu/bswap.h"
+#include "qemu/iov.h"
+#include "qemu/sockets.h"
+
+/* TODO actually test the results and get rid of this */
+#define qmp_discard_response(qs, ...) qobject_unref(qtest_qmp(qs, __VA_ARGS__))
+
+/* Long enough that no packet is let out because it expired */
+#define COMPARE_TIMEOUT_MS  60000
+
+#define PKT_MAX_LEN         128
+#define ETH_HDR_LEN         14
+#define IP_HDR_LEN          20
+#define UDP_HDR_LEN         8
+#define TCP_HDR_LEN         20
+
+enum {
+    SOCK_PRI,
+    SOCK_SEC,
+    SOCK_OUT,
+    SOCK_MAX,
+};
+
+typedef struct ColoCompareTest {
+    QTestState *qts;
+    char *path[SOCK_MAX];
+    int sock[SOCK_MAX];
+} ColoCompareTest;
+
+static void colo_compare_test_start(ColoCompareTest *t, const char *opts)
+{
+    int i, fd;
+
+    for (i = 0; i < SOCK_MAX; i++) {
+        t->path[i] = g_strdup_printf("colo-compare%d.XXXXXX", i);
+        fd = mkstemp(t->path[i]);
+        g_assert_cmpint(fd, !=, -1);
+        close(fd);
+    }
+
+    t->qts = qtest_initf(
+        "-machine none "
+        "-object iothread,id=iothread0 "
+        "-chardev socket,id=pri,path=%s,server=on,wait=off "
+        "-chardev socket,id=sec,path=%s,server=on,wait=off "
+        "-chardev socket,id=out,path=%s,server=on,wait=off "
+        "-object colo-compare,id=comp0,primary_in=pri,secondary_in=sec,"
+        "outdev=out,iothread=iothread0,compare_timeout=%d%s",
+        t->path[SOCK_PRI], t->path[SOCK_SEC], t->path[SOCK_OUT],
+        COMPARE_TIMEOUT_MS, opts);
+
+    for (i = 0; i < SOCK_MAX; i++) {
+        t->sock[i] = unix_connect(t->path[i], NULL);
+        g_assert_cmpint(t->sock[i], !=, -1);
+    }
+
+    /* send a qmp command to guarantee that 'connected' is setting to true. */
+    qmp_discard_response(t->qts, "{ 'execute' : 'query-status'}");
+}
+
+static void colo_compare_test_stop(ColoCompareTest *t)
+{
+    int i;
+
+    for (i = 0; i < SOCK_MAX; i++) {
+        close(t->sock[i]);
+    }
+    qtest_quit(t->qts);
+    for (i = 0; i < SOCK_MAX; i++) {
+        unlink(t->path[i]);
+        g_free(t->path[i]);
+    }
+}
+
+/* Wrap an IPv4 @proto payload from 10.0.0.1 to 10.0.0.2 in an Ethernet frame */
+static size_t build_ip_packet(uint8_t *buf, uint8_t proto,
+                              const uint8_t *l4, size_t l4_len)
+{
+    static const uint8_t eth_hdr[ETH_HDR_LEN] = {
+        0x52, 0x54, 0x00, 0x12, 0x34, 0x57,
+        0x52, 0x54, 0x00, 0x12, 0x34, 0x56,
+        0x08, 0x00,
+    };
+    uint8_t *ip = buf + ETH_HDR_LEN;
+
+    g_assert_cmpint(ETH_HDR_LEN + IP_HDR_LEN + l4_len, <=, PKT_MAX_LEN);
+
+    memcpy(buf, eth_hdr, ETH_HDR_LEN);
+    memset(ip, 0, IP_HDR_LEN);
+    ip[0] = 0x45;
+    stw_be_p(ip + 2, IP_HDR_LEN + l4_len);
+    ip[8] = 64;
+    ip[9] = proto;
+    stl_be_p(ip + 12, 0x0a000001);
+    stl_be_p(ip + 16, 0x0a000002);
+    memcpy(ip + IP_HDR_LEN, l4, l4_len);
+
+    return ETH_HDR_LEN + IP_HDR_LEN + l4_len;
+}
+
+static size_t build_udp_packet(uint8_t *buf, uint16_t sport,
+                               const char *payload)
+{
+    uint8_t l4[PKT_MAX_LEN] = { 0 };
+    size_t len = strlen(payload);
+
+    stw_be_p(l4, sport);
+    stw_be_p(l4 + 2, 7);
+    stw_be_p(l4 + 4, UDP_HDR_LEN + len);
+    memcpy(l4 + UDP_HDR_LEN, payload, len);
+
+    return build_ip_packet(buf, IPPROTO_UDP, l4, UDP_HDR_LEN + len);
+}
+
+static size_t build_tcp_packet(uint8_t *buf, uint32_t seq, uint32_t ack,
+                               const char *payload)
+{
+    uint8_t l4[PKT_MAX_LEN] = { 0 };
+    size_t len = strlen(payload);
+
+    stw_be_p(l4, 1234);
+    stw_be_p(l4 + 2, 80);
+    stl_be_p(l4 + 4, seq);
+    stl_be_p(l4 + 8, ack);
+    l4[12] = (TCP_HDR_LEN / 4) << 4;
+    l4[13] = len ? 0x18 : 0x10; /* PSH | ACK, or a pure ACK */
+    stw_be_p(l4 + 14, 0xffff);
+    memcpy(l4 + TCP_HDR_LEN, payload, len);
+
+    return build_ip_packet(buf, IPPROTO_TCP, l4, TCP_HDR_LEN + len);
+}
+
+static void send_packet(int sock, const uint8_t *buf, size_t len)
+{
+    uint32_t size = htonl(len);
+    struct iovec iov[] = {
+        {
+            .iov_base = &size,
+            .iov_len = sizeof(size),
+        }, {
+            .iov_base = (void *)buf,
+            .iov_len = len,
+        },
+    };
+    ssize_t ret;
+
+    ret = iov_send(sock, iov, 2, 0, sizeof(size) + len);
+    g_assert_cmpint(ret, ==, sizeof(size) + len);
+}
+
+static size_t recv_packet(int sock, uint8_t *buf)
+{
+    uint32_t len;
+    ssize_t ret;
+
+    ret = qemu_recv(sock, &len, sizeof(len), MSG_WAITALL);
+    g_assert_cmpint(ret, ==, sizeof(len));
+    len = ntohl(len);
+    g_assert_cmpint(len, <=, PKT_MAX_LEN);
+
+    ret = qemu_recv(sock, buf, len, MSG_WAITALL);
+    g_assert_cmpint(ret, ==, len);
+
+    return len;
+}
+
+static void assert_no_packet(int sock)
+{
+    GPollFD pfd = { .fd = sock, .events = G_IO_IN };
+
+    g_assert_cmpint(g_poll(&pfd, 1, 100), ==, 0);
+}
+
+/*
+ * Spread UDP flows over the shards and check that every primary packet is
+ * let out once its secondary twin arrived, in order within each flow.
+ */
+static void test_colo_compare_sharded(void)
+{
+    enum { NR_FLOWS = 16, PKTS_PER_FLOW = 4 };
+    ColoCompareTest t;
+    uint8_t buf[PKT_MAX_LEN], expected[PKT_MAX_LEN];
+    int next[NR_FLOWS] = { 0 };
+    size_t len, expected_len;
+    char *payload;
+    int i, j, flow;
+
+    colo_compare_test_start(&t, ",compare_threads=4");
+
+    for (j = 0; j < PKTS_PER_FLOW; j++) {
+        for (i = 0; i < NR_FLOWS; i++) {
+            payload = g_strdup_printf("flow %d packet %d", i, j);
+            len = build_udp_packet(buf, 1000 + i, payload);
+            send_packet(t.sock[SOCK_PRI], buf, len);
+            send_packet(t.sock[SOCK_SEC], buf, len);
+            g_free(payload);
+        }
+    }
+
+    for (i = 0; i < NR_FLOWS * PKTS_PER_FLOW; i++) {
+        len = recv_packet(t.sock[SOCK_OUT], buf);
+        g_assert_cmpint(len, >, ETH_HDR_LEN + IP_HDR_LEN + UDP_HDR_LEN);
+
+        flow = lduw_be_p(buf + ETH_HDR_LEN + IP_HDR_LEN) - 1000;
+        g_assert_cmpint(flow, >=, 0);
+        g_assert_cmpint(flow, <, NR_FLOWS);
+        g_assert_cmpint(next[flow], <, PKTS_PER_FLOW);
+
+        payload = g_strdup_printf("flow %d packet %d", flow, next[flow]++);
+        expected_len = build_udp_packet(expected, 1000 + flow, payload);
+        g_free(payload);
+
+        g_assert_cmpint(len, ==, expected_len);
+        g_assert(!memcmp(buf, expected, len));
+    }
+
+    colo_compare_test_stop(&t);
+}
+
+/*
+ * The primary sends a segment that the secondary has sent too, but the
+ * secondary has not acked what the primary acks yet.  The segment is held
+ * back until the secondary's ack arrives.  The payload that already matched
+ * is not compared again then, and the rest of the secondary's segment still
+ * has to match the primary's next segment.
+ */
+static void test_colo_compare_tcp_verified(const void *opts)
+{
+    ColoCompareTest t;
+    uint8_t buf[PKT_MAX_LEN], pkt[PKT_MAX_LEN];
+    size_t len, pkt_len;
+
+    colo_compare_test_start(&t, opts);
+
+    len = build_tcp_packet(buf, 1, 100, "0123456789abcdefghij");
+    send_packet(t.sock[SOCK_SEC], buf, len);
+
+    pkt_len = build_tcp_packet(pkt, 1, 200, "0123456789");
+    send_packet(t.sock[SOCK_PRI], pkt, pkt_len);
+    assert_no_packet(t.sock[SOCK_OUT]);
+
+    len = build_tcp_packet(buf, 21, 200, "");
+    send_packet(t.sock[SOCK_SEC], buf, len);
+
+    len = recv_packet(t.sock[SOCK_OUT], buf);
+    g_assert_cmpint(len, ==, pkt_len);
+    g_assert(!memcmp(buf, pkt, len));
+
+    pkt_len = build_tcp_packet(pkt, 11, 200, "abcdefghij");
+    send_packet(t.sock[SOCK_PRI], pkt, pkt_len);
+
+    len = recv_packet(t.sock[SOCK_OUT], buf);
+    g_assert_cmpint(len, ==, pkt_len);
+    g_assert(!memcmp(buf, pkt, len));
+
+    colo_compare_test_stop(&t);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/colo-compare/sharded", test_colo_compare_sharded);
+    qtest_add_data_func("/colo-compare/tcp-verified/iothread", "",
+                        test_colo_compare_tcp_verified);
+    qtest_add_data_func("/colo-compare/tcp-verified/threads",
+                        ",compare_threads=2",
+                        test_colo_compare_tcp_verified);
+
+    return g_test_run();
+}
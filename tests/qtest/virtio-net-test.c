@@ -17,6 +17,12 @@
 #include "libqos/qgraph.h"
 #include "libqos/virtio-net.h"
 
+#ifdef CONFIG_LINUX
+#include <linux/if_tun.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#endif
+
 #ifndef ETH_P_RARP
 #define ETH_P_RARP 0x8035
 #endif
@@ -313,6 +319,86 @@ static void *virtio_net_test_setup_nosocket(GString *cmd_line, void *arg)
     return arg;
 }
 
+#ifdef CONFIG_LINUX
+/*
+ * Transmit through the IOThread dataplane, stopping and restarting it in
+ * between with 'stop' and 'cont'.
+ */
+static void dataplane_stop_cont(void *obj, void *data, QGuestAllocator *t_alloc)
+{
+    QVirtioNet *net_if = obj;
+    QVirtioDevice *dev = net_if->vdev;
+    QVirtQueue *tx = net_if->queues[1];
+    QTestState *qts = global_qtest;
+    int *tap_fd = data;
+    uint64_t req_addr;
+    uint32_t free_head;
+    QDict *rsp;
+    int i;
+
+    if (*tap_fd < 0) {
+        g_test_skip("tap is not available");
+        return;
+    }
+
+    req_addr = guest_alloc(t_alloc, 64);
+    qtest_memset(qts, req_addr, 0, 64);
+
+    for (i = 0; i < 3; i++) {
+        free_head = qvirtqueue_add(qts, tx, req_addr, 64, false, false);
+        qvirtqueue_kick(qts, dev, tx, free_head);
+        qvirtio_wait_used_elem(qts, dev, tx, free_head, NULL,
+                               QVIRTIO_NET_TIMEOUT_US);
+
+        rsp = qmp("{ 'execute' : 'stop'}");
+        qobject_unref(rsp);
+        rsp = qmp("{ 'execute' : 'cont'}");
+        qobject_unref(rsp);
+    }
+
+    guest_free(t_alloc, req_addr);
+}
+
+static void virtio_net_test_cleanup_dataplane(void *data)
+{
+    int *tap_fd = data;
+
+    qos_invalidate_command_line();
+    if (*tap_fd >= 0) {
+        close(*tap_fd);
+    }
+    g_free(tap_fd);
+}
+
+/*
+ * Only tap can run in an IOThread.  Without permission to create a tap
+ * device, start with a hub port and let the test skip itself.
+ */
+static void *virtio_net_test_setup_dataplane(GString *cmd_line, void *arg)
+{
+    struct ifreq ifr = { .ifr_flags = IFF_TAP | IFF_NO_PI };
+    int *tap_fd = g_new(int, 1);
+
+    *tap_fd = open("/dev/net/tun", O_RDWR);
+    if (*tap_fd >= 0 && ioctl(*tap_fd, TUNSETIFF, &ifr) < 0) {
+        close(*tap_fd);
+        *tap_fd = -1;
+    }
+
+    if (*tap_fd >= 0) {
+        g_string_append_printf(cmd_line,
+                               " -object iothread,id=net-iothread"
+                               " -global virtio-net-device.iothread=net-iothread"
+                               " -netdev tap,fd=%d,id=hs0 ", *tap_fd);
+    } else {
+        g_string_append(cmd_line, " -netdev hubport,hubid=0,id=hs0 ");
+    }
+
+    g_test_queue_destroy(virtio_net_test_cleanup_dataplane, tap_fd);
+    return tap_fd;
+}
+#endif
+
 static void register_virtio_net_test(void)
 {
     QOSGraphTestOptions opts = {
@@ -332,6 +418,13 @@ static void register_virtio_net_test(void)
     qos_add_test("large_tx/uint_max", "virtio-net", large_tx, &opts);
     opts.arg = (gpointer)NET_BUFSIZE;
     qos_add_test("large_tx/net_bufsize", "virtio-net", large_tx, &opts);
+
+#ifdef CONFIG_LINUX
+    opts.before = virtio_net_test_setup_dataplane;
+    opts.arg = NULL;
+    qos_add_test("dataplane/stop_cont", "virtio-net", dataplane_stop_cont,
+                 &opts);
+#endif
 }
 
 libqos_init(register_virtio_net_test);
@@ -0,0 +1,139 @@
+/*
+ * IOVA tree allocation and reverse lookup tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/iova-tree.h"
+
+#define PAGE 0x1000
+
+static int alloc_page(IOVATree *tree, hwaddr translated_addr, hwaddr size,
+                      hwaddr iova_begin, hwaddr iova_last, hwaddr *iova)
+{
+    DMAMap map = {
+        .translated_addr = translated_addr,
+        .size = size - 1,
+        .perm = IOMMU_RW,
+    };
+    int ret;
+
+    ret = iova_tree_alloc_map(tree, &map, iova_begin, iova_last);
+    *iova = map.iova;
+    return ret;
+}
+
+static void test_alloc_lowest(void)
+{
+    IOVATree *tree = iova_tree_new();
+    hwaddr iova;
+
+    g_assert_cmpint(alloc_page(tree, 0x100000, PAGE, PAGE, HWADDR_MAX, &iova),
+                    ==, IOVA_OK);
+    g_assert_cmphex(iova, ==, PAGE);
+    g_assert_cmpint(alloc_page(tree, 0x200000, PAGE, PAGE, HWADDR_MAX, &iova),
+                    ==, IOVA_OK);
+    g_assert_cmphex(iova, ==, 2 * PAGE);
+    g_assert_cmpint(alloc_page(tree, 0x300000, 2 * PAGE, PAGE, HWADDR_MAX,
+                               &iova), ==, IOVA_OK);
+    g_assert_cmphex(iova, ==, 3 * PAGE);
+
+    iova_tree_destroy(tree);
+}
+
+static void test_alloc_reuse_hole(void)
+{
+    IOVATree *tree = iova_tree_new();
+    DMAMap first = { .iova = PAGE, .size = PAGE - 1 };
+    hwaddr iova;
+
+    alloc_page(tree, 0x100000, PAGE, PAGE, HWADDR_MAX, &iova);
+    alloc_page(tree, 0x200000, PAGE, PAGE, HWADDR_MAX, &iova);
+    g_assert_cmpint(iova_tree_remove(tree, &first), ==, IOVA_OK);
+
+    /* Too large for the hole, goes after the last mapping */
+    g_assert_cmpint(alloc_page(tree, 0x300000, 2 * PAGE, PAGE, HWADDR_MAX,
+                               &iova), ==, IOVA_OK);
+    g_assert_cmphex(iova, ==, 3 * PAGE);
+
+    /* Fits exactly */
+    g_assert_cmpint(alloc_page(tree, 0x400000, PAGE, PAGE, HWADDR_MAX, &iova),
+                    ==, IOVA_OK);
+    g_assert_cmphex(iova, ==, PAGE);
+
+    iova_tree_destroy(tree);
+}
+
+static void test_alloc_exhausted(void)
+{
+    IOVATree *tree = iova_tree_new();
+    DMAMap map = { .translated_addr = 0x100000, .size = PAGE - 1 };
+    hwaddr iova;
+
+    g_assert_cmpint(alloc_page(tree, 0x100000, PAGE, 0, 2 * PAGE - 1, &iova),
+                    ==, IOVA_OK);
+    g_assert_cmphex(iova, ==, 0);
+    g_assert_cmpint(alloc_page(tree, 0x200000, PAGE, 0, 2 * PAGE - 1, &iova),
+                    ==, IOVA_OK);
+    g_assert_cmphex(iova, ==, PAGE);
+    g_assert_cmpint(alloc_page(tree, 0x300000, PAGE, 0, 2 * PAGE - 1, &iova),
+                    ==, IOVA_ERR_NOMEM);
+
+    /* The range must fit in its entirety */
+    g_assert_cmpint(alloc_page(tree, 0x300000, 2 * PAGE, 0, 3 * PAGE - 1,
+                               &iova), ==, IOVA_ERR_NOMEM);
+
+    /* Mappings need some access permission */
+    g_assert_cmpint(iova_tree_alloc_map(tree, &map, 0, HWADDR_MAX),
+                    ==, IOVA_ERR_INVALID);
+
+    iova_tree_destroy(tree);
+}
+
+static void test_find_iova(void)
+{
+    IOVATree *tree = iova_tree_new();
+    const DMAMap *result;
+    DMAMap needle;
+    hwaddr iova;
+
+    alloc_page(tree, 0x100000, 4 * PAGE, PAGE, HWADDR_MAX, &iova);
+    alloc_page(tree, 0x200000, PAGE, PAGE, HWADDR_MAX, &iova);
+
+    /* A range inside the first mapping */
+    needle = (DMAMap) { .translated_addr = 0x101000, .size = PAGE - 1 };
+    result = iova_tree_find_iova(tree, &needle);
+    g_assert_nonnull(result);
+    g_assert_cmphex(result->iova, ==, PAGE);
+    g_assert_cmphex(result->translated_addr, ==, 0x100000);
+    g_assert_cmphex(result->size, ==, 4 * PAGE - 1);
+
+    needle = (DMAMap) { .translated_addr = 0x200000, .size = PAGE - 1 };
+    result = iova_tree_find_iova(tree, &needle);
+    g_assert_nonnull(result);
+    g_assert_cmphex(result->iova, ==, 5 * PAGE);
+
+    /* Crossing the end of a mapping */
+    needle = (DMAMap) { .translated_addr = 0x103000, .size = 2 * PAGE - 1 };
+    g_assert_null(iova_tree_find_iova(tree, &needle));
+
+    /* Not mapped at all */
+    needle = (DMAMap) { .translated_addr = 0x300000, .size = PAGE - 1 };
+    g_assert_null(iova_tree_find_iova(tree, &needle));
+
+    iova_tree_destroy(tree);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/iova-tree/alloc/lowest", test_alloc_lowest);
+    g_test_add_func("/iova-tree/alloc/reuse-hole", test_alloc_reuse_hole);
+    g_test_add_func("/iova-tree/alloc/exhausted", test_alloc_exhausted);
+    g_test_add_func("/iova-tree/find-iova", test_find_iova);
+
+    return g_test_run();
+}
@@ -0,0 +1,192 @@
+/*
+ * Toeplitz hash tests
+ *
+ * The expected values are the RSS verification suite that Microsoft
+ * publishes for NDIS drivers, hashed with its default key.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "net/checksum.h"
+
+static uint8_t rss_key[NET_TOEPLITZ_TABLE_MAX_INPUT + 4] = {
+    0x6d, 0x5a, 0x56, 0xda, 0x25, 0x5b, 0x0e, 0xc2,
+    0x41, 0x67, 0x25, 0x3d, 0x43, 0xa3, 0x8f, 0xb0,
+    0xd0, 0xca, 0x2b, 0xcb, 0xae, 0x7b, 0x30, 0xb4,
+    0x77, 0xcb, 0x2d, 0xa3, 0x80, 0x30, 0xf2, 0x0c,
+    0x6a, 0x42, 0xb7, 0x3b, 0xbe, 0xac, 0x01, 0xfa,
+};
+
+/* Addresses and ports in network byte order, as they appear on the wire */
+typedef struct ToeplitzVector {
+    uint8_t src[16];
+    uint8_t dst[16];
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint32_t ip_hash;
+    uint32_t tcp_hash;
+} ToeplitzVector;
+
+static const ToeplitzVector ipv4_vectors[] = {
+    /* 66.9.149.187:2794 -> 161.142.100.80:1766 */
+    {
+        .src = { 66, 9, 149, 187 },
+        .dst = { 161, 142, 100, 80 },
+        .src_port = 2794, .dst_port = 1766,
+        .ip_hash = 0x323e8fc2, .tcp_hash = 0x51ccc178,
+    },
+    /* 199.92.111.2:14230 -> 65.69.140.83:4739 */
+    {
+        .src = { 199, 92, 111, 2 },
+        .dst = { 65, 69, 140, 83 },
+        .src_port = 14230, .dst_port = 4739,
+        .ip_hash = 0xd718262a, .tcp_hash = 0xc626b0ea,
+    },
+    /* 24.19.198.95:12898 -> 12.22.207.184:38024 */
+    {
+        .src = { 24, 19, 198, 95 },
+        .dst = { 12, 22, 207, 184 },
+        .src_port = 12898, .dst_port = 38024,
+        .ip_hash = 0xd2d0a5de, .tcp_hash = 0x5c2b394a,
+    },
+    /* 38.27.205.30:48228 -> 209.142.163.6:2217 */
+    {
+        .src = { 38, 27, 205, 30 },
+        .dst = { 209, 142, 163, 6 },
+        .src_port = 48228, .dst_port = 2217,
+        .ip_hash = 0x82989176, .tcp_hash = 0xafc7327f,
+    },
+    /* 153.39.163.191:44251 -> 202.188.127.2:1303 */
+    {
+        .src = { 153, 39, 163, 191 },
+        .dst = { 202, 188, 127, 2 },
+        .src_port = 44251, .dst_port = 1303,
+        .ip_hash = 0x5d1809c5, .tcp_hash = 0x10e828a2,
+    },
+};
+
+static const ToeplitzVector ipv6_vectors[] = {
+    /* [3ffe:2501:200:1fff::7]:2794 -> [3ffe:2501:200:3::1]:1766 */
+    {
+        .src = { 0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x1f, 0xff,
+                 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x07 },
+        .dst = { 0x3f, 0xfe, 0x25, 0x01, 0x02, 0x00, 0x00, 0x03,
+                 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 },
+        .src_port = 2794, .dst_port = 1766,
+        .ip_hash = 0x2cc18cd5, .tcp_hash = 0x40207d3d,
+    },
+    /* [3ffe:501:8::260:97ff:fe40:efab]:14230 -> [ff02::1]:4739 */
+    {
+        .src = { 0x3f, 0xfe, 0x05, 0x01, 0x00, 0x08, 0x00, 0x00,
+                 0x02, 0x60, 0x97, 0xff, 0xfe, 0x40, 0xef, 0xab },
+        .dst = { 0xff, 0x02, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01 },
+        .src_port = 14230, .dst_port = 4739,
+        .ip_hash = 0x0f0c461c, .tcp_hash = 0xdde51bbf,
+    },
+    /*
+     * [3ffe:1900:4545:3:200:f8ff:fe21:67cf]:44251 ->
+     * [fe80::200:f8ff:fe21:67cf]:38024
+     */
+    {
+        .src = { 0x3f, 0xfe, 0x19, 0x00, 0x45, 0x45, 0x00, 0x03,
+                 0x02, 0x00, 0xf8, 0xff, 0xfe, 0x21, 0x67, 0xcf },
+        .dst = { 0xfe, 0x80, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+                 0x02, 0x00, 0xf8, 0xff, 0xfe, 0x21, 0x67, 0xcf },
+        .src_port = 44251, .dst_port = 38024,
+        .ip_hash = 0x4b61e985, .tcp_hash = 0x02d1feef,
+    },
+};
+
+/* Hash input as virtio-net builds it: addresses, then ports */
+static size_t build_input(uint8_t *input, size_t addr_len,
+                          const ToeplitzVector *v, bool ports)
+{
+    memcpy(input, v->src, addr_len);
+    memcpy(input + addr_len, v->dst, addr_len);
+    if (!ports) {
+        return 2 * addr_len;
+    }
+
+    stw_be_p(input + 2 * addr_len, v->src_port);
+    stw_be_p(input + 2 * addr_len + 2, v->dst_port);
+    return 2 * addr_len + 4;
+}
+
+/* The bit by bit implementation that the table replaces */
+static uint32_t toeplitz_hash_slow(const uint8_t *input, size_t len)
+{
+    net_toeplitz_key key;
+    uint32_t hash = 0;
+
+    net_toeplitz_key_init(&key, rss_key);
+    net_toeplitz_add(&hash, (uint8_t *)input, len, &key);
+    return hash;
+}
+
+static void check_vectors(size_t addr_len, const ToeplitzVector *vectors,
+                          size_t nb_vectors)
+{
+    g_autofree NetToeplitzTable *table = g_new(NetToeplitzTable, 1);
+    uint8_t input[NET_TOEPLITZ_TABLE_MAX_INPUT];
+    size_t i, len;
+
+    net_toeplitz_table_init(table, rss_key);
+
+    for (i = 0; i < nb_vectors; i++) {
+        len = build_input(input, addr_len, &vectors[i], false);
+        g_assert_cmphex(net_toeplitz_table_hash(table, input, len),
+                        ==, vectors[i].ip_hash);
+        g_assert_cmphex(toeplitz_hash_slow(input, len),
+                        ==, vectors[i].ip_hash);
+
+        len = build_input(input, addr_len, &vectors[i], true);
+        g_assert_cmphex(net_toeplitz_table_hash(table, input, len),
+                        ==, vectors[i].tcp_hash);
+        g_assert_cmphex(toeplitz_hash_slow(input, len),
+                        ==, vectors[i].tcp_hash);
+    }
+}
+
+static void test_ipv4(void)
+{
+    check_vectors(4, ipv4_vectors, ARRAY_SIZE(ipv4_vectors));
+}
+
+static void test_ipv6(void)
+{
+    check_vectors(16, ipv6_vectors, ARRAY_SIZE(ipv6_vectors));
+}
+
+/* Every input position and byte value against the bit by bit hash */
+static void test_table(void)
+{
+    g_autofree NetToeplitzTable *table = g_new(NetToeplitzTable, 1);
+    uint8_t input[NET_TOEPLITZ_TABLE_MAX_INPUT];
+    unsigned pos, val;
+
+    net_toeplitz_table_init(table, rss_key);
+
+    for (pos = 0; pos < NET_TOEPLITZ_TABLE_MAX_INPUT; pos++) {
+        for (val = 0; val < 256; val++) {
+            memset(input, 0, sizeof(input));
+            input[pos] = val;
+            g_assert_cmphex(net_toeplitz_table_hash(table, input,
+                                                    sizeof(input)),
+                            ==, toeplitz_hash_slow(input, sizeof(input)));
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/net/toeplitz/ipv4", test_ipv4);
+    g_test_add_func("/net/toeplitz/ipv6", test_ipv6);
+    g_test_add_func("/net/toeplitz/table", test_table);
+
+    return g_test_run();
+}
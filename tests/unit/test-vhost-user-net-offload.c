@@ -0,0 +1,178 @@
+/*
+ * vhost-user-net-server receive offload tests
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "standard-headers/linux/virtio_net.h"
+#include "../net/vhost-user-net-offload.h"
+
+#define HDR_LEN     sizeof(struct virtio_net_hdr_mrg_rxbuf)
+#define FRAME_LEN   128
+#define CSUM_START  34      /* Ethernet and IPv4 headers */
+#define CSUM_OFFSET 16      /* TCP checksum field */
+
+#define GUEST_CSUM  (1ull << VIRTIO_NET_F_GUEST_CSUM)
+#define GUEST_TSO4  (1ull << VIRTIO_NET_F_GUEST_TSO4)
+#define GUEST_ECN   (1ull << VIRTIO_NET_F_GUEST_ECN)
+
+static uint8_t buf[HDR_LEN + FRAME_LEN];
+
+static void init_frame(uint8_t flags, uint8_t gso_type,
+                       uint16_t csum_start, uint16_t csum_offset)
+{
+    struct virtio_net_hdr hdr = {
+        .flags = flags,
+        .gso_type = gso_type,
+        .csum_start = csum_start,
+        .csum_offset = csum_offset,
+    };
+    int i;
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, &hdr, sizeof(hdr));
+    for (i = 0; i < FRAME_LEN; i++) {
+        buf[HDR_LEN + i] = i * 7 + 3;
+    }
+}
+
+static struct virtio_net_hdr get_hdr(void)
+{
+    struct virtio_net_hdr hdr;
+
+    memcpy(&hdr, buf, sizeof(hdr));
+    return hdr;
+}
+
+/*
+ * The checksum field initially holds the pseudo-header sum.  Like a real
+ * receiver, add it to the sum of the range that now has the checksum.
+ */
+static uint16_t verify_csum(uint16_t pseudo, const uint8_t *data, size_t len)
+{
+    uint32_t sum = pseudo;
+    size_t i;
+
+    for (i = 0; i + 1 < len; i += 2) {
+        sum += lduw_be_p(data + i);
+    }
+    if (len & 1) {
+        sum += data[len - 1] << 8;
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return sum;
+}
+
+static void test_plain(void)
+{
+    init_frame(VIRTIO_NET_HDR_F_DATA_VALID, VIRTIO_NET_HDR_GSO_NONE, 0, 0);
+    g_assert_true(vu_net_rx_fixup_offload(buf, HDR_LEN, sizeof(buf),
+                                          GUEST_CSUM));
+    g_assert_cmpint(get_hdr().flags, ==, VIRTIO_NET_HDR_F_DATA_VALID);
+
+    /* DATA_VALID means nothing to a driver without GUEST_CSUM */
+    g_assert_true(vu_net_rx_fixup_offload(buf, HDR_LEN, sizeof(buf), 0));
+    g_assert_cmpint(get_hdr().flags, ==, 0);
+}
+
+static void test_csum_passthrough(void)
+{
+    uint8_t frame[FRAME_LEN];
+
+    init_frame(VIRTIO_NET_HDR_F_NEEDS_CSUM, VIRTIO_NET_HDR_GSO_NONE,
+               CSUM_START, CSUM_OFFSET);
+    memcpy(frame, buf + HDR_LEN, FRAME_LEN);
+
+    g_assert_true(vu_net_rx_fixup_offload(buf, HDR_LEN, sizeof(buf),
+                                          GUEST_CSUM));
+    g_assert_cmpint(get_hdr().flags, ==, VIRTIO_NET_HDR_F_NEEDS_CSUM);
+    g_assert_cmpint(get_hdr().csum_start, ==, CSUM_START);
+    g_assert_cmpint(get_hdr().csum_offset, ==, CSUM_OFFSET);
+    g_assert_cmpmem(buf + HDR_LEN, FRAME_LEN, frame, FRAME_LEN);
+}
+
+static void test_csum_finalize(void)
+{
+    uint8_t *csum_data = buf + HDR_LEN + CSUM_START;
+    uint16_t pseudo;
+
+    init_frame(VIRTIO_NET_HDR_F_NEEDS_CSUM, VIRTIO_NET_HDR_GSO_NONE,
+               CSUM_START, CSUM_OFFSET);
+
+    pseudo = lduw_be_p(csum_data + CSUM_OFFSET);
+
+    g_assert_true(vu_net_rx_fixup_offload(buf, HDR_LEN, sizeof(buf), 0));
+    g_assert_cmpint(get_hdr().flags, ==, 0);
+    g_assert_cmpint(get_hdr().csum_start, ==, 0);
+    g_assert_cmpint(get_hdr().csum_offset, ==, 0);
+    g_assert_cmphex(verify_csum(pseudo, csum_data, FRAME_LEN - CSUM_START),
+                    ==, 0xffff);
+
+    /* Odd length frame */
+    init_frame(VIRTIO_NET_HDR_F_NEEDS_CSUM, VIRTIO_NET_HDR_GSO_NONE,
+               CSUM_START, CSUM_OFFSET);
+    g_assert_true(vu_net_rx_fixup_offload(buf, HDR_LEN, sizeof(buf) - 1, 0));
+    g_assert_cmphex(verify_csum(pseudo, csum_data,
+                                FRAME_LEN - 1 - CSUM_START), ==, 0xffff);
+}
+
+static void test_csum_out_of_bounds(void)
+{
+    init_frame(VIRTIO_NET_HDR_F_NEEDS_CSUM, VIRTIO_NET_HDR_GSO_NONE,
+               FRAME_LEN + 1, 0);
+    g_assert_false(vu_net_rx_fixup_offload(buf, HDR_LEN, sizeof(buf), 0));
+
+    init_frame(VIRTIO_NET_HDR_F_NEEDS_CSUM, VIRTIO_NET_HDR_GSO_NONE,
+               CSUM_START, FRAME_LEN - CSUM_START - 1);
+    g_assert_false(vu_net_rx_fixup_offload(buf, HDR_LEN, sizeof(buf), 0));
+}
+
+static void test_gso(void)
+{
+    init_frame(VIRTIO_NET_HDR_F_NEEDS_CSUM, VIRTIO_NET_HDR_GSO_TCPV4,
+               CSUM_START, CSUM_OFFSET);
+    g_assert_true(vu_net_rx_fixup_offload(buf, HDR_LEN, sizeof(buf),
+                                          GUEST_CSUM | GUEST_TSO4));
+    g_assert_cmpint(get_hdr().gso_type, ==, VIRTIO_NET_HDR_GSO_TCPV4);
+
+    /* Missing TSO4, TSO4 without GUEST_CSUM, TSO6 not negotiated */
+    g_assert_false(vu_net_rx_fixup_offload(buf, HDR_LEN, sizeof(buf),
+                                           GUEST_CSUM));
+    g_assert_false(vu_net_rx_fixup_offload(buf, HDR_LEN, sizeof(buf),
+                                           GUEST_TSO4));
+    init_frame(VIRTIO_NET_HDR_F_NEEDS_CSUM, VIRTIO_NET_HDR_GSO_TCPV6,
+               CSUM_START, CSUM_OFFSET);
+    g_assert_false(vu_net_rx_fixup_offload(buf, HDR_LEN, sizeof(buf),
+                                           GUEST_CSUM | GUEST_TSO4));
+
+    /* ECN needs its own feature */
+    init_frame(VIRTIO_NET_HDR_F_NEEDS_CSUM,
+               VIRTIO_NET_HDR_GSO_TCPV4 | VIRTIO_NET_HDR_GSO_ECN,
+               CSUM_START, CSUM_OFFSET);
+    g_assert_false(vu_net_rx_fixup_offload(buf, HDR_LEN, sizeof(buf),
+                                           GUEST_CSUM | GUEST_TSO4));
+    g_assert_true(vu_net_rx_fixup_offload(buf, HDR_LEN, sizeof(buf),
+                                          GUEST_CSUM | GUEST_TSO4 |
+                                          GUEST_ECN));
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/vhost-user-net/offload/plain", test_plain);
+    g_test_add_func("/vhost-user-net/offload/csum-passthrough",
+                    test_csum_passthrough);
+    g_test_add_func("/vhost-user-net/offload/csum-finalize",
+                    test_csum_finalize);
+    g_test_add_func("/vhost-user-net/offload/csum-out-of-bounds",
+                    test_csum_out_of_bounds);
+    g_test_add_func("/vhost-user-net/offload/gso", test_gso);
+
+    return g_test_run();
+}
@@ -47,6 +47,40 @@ DMAMap *iova_tree_find(IOVATree *tree, DMAMap *map)
     return g_tree_lookup(tree->tree, map);
 }
 
+typedef struct IOVATreeFindIOVAArgs {
+    const DMAMap *needle;
+    const DMAMap *result;
+} IOVATreeFindIOVAArgs;
+
+static gboolean iova_tree_find_iova_iterator(gpointer key, gpointer value,
+                                             gpointer data)
+{
+    const DMAMap *map = key;
+    IOVATreeFindIOVAArgs *args = data;
+    const DMAMap *needle = args->needle;
+
+    g_assert(key == value);
+
+    if (needle->translated_addr < map->translated_addr ||
+        needle->translated_addr + needle->size >
+        map->translated_addr + map->size) {
+        return false;
+    }
+
+    args->result = map;
+    return true;
+}
+
+const DMAMap *iova_tree_find_iova(IOVATree *tree, const DMAMap *map)
+{
+    IOVATreeFindIOVAArgs args = {
+        .needle = map,
+    };
+
+    g_tree_foreach(tree->tree, iova_tree_find_iova_iterator, &args);
+    return args.result;
+}
+
 DMAMap *iova_tree_find_address(IOVATree *tree, hwaddr iova)
 {
     DMAMap map = { .iova = iova, .size = 0 };
@@ -96,6 +130,60 @@ void iova_tree_foreach(IOVATree *tree, iova_tree_iterator iterator)
     g_tree_foreach(tree->tree, iova_tree_traverse, iterator);
 }
 
+typedef struct IOVATreeAllocArgs {
+    hwaddr size;            /* Inclusive, like DMAMap.size */
+    hwaddr next_free;       /* Lowest address not covered by a mapping */
+    bool exhausted;         /* A mapping ends at HWADDR_MAX */
+} IOVATreeAllocArgs;
+
+static gboolean iova_tree_alloc_iterator(gpointer key, gpointer value,
+                                         gpointer data)
+{
+    const DMAMap *map = key;
+    IOVATreeAllocArgs *args = data;
+
+    g_assert(key == value);
+
+    /* The tree is walked in iova order, so this is the next hole */
+    if (map->iova > args->next_free &&
+        map->iova - args->next_free > args->size) {
+        return true;
+    }
+
+    if (map->iova + map->size >= args->next_free) {
+        if (map->iova + map->size == HWADDR_MAX) {
+            args->exhausted = true;
+            return true;
+        }
+        args->next_free = map->iova + map->size + 1;
+    }
+    return false;
+}
+
+int iova_tree_alloc_map(IOVATree *tree, DMAMap *map, hwaddr iova_begin,
+                        hwaddr iova_last)
+{
+    IOVATreeAllocArgs args = {
+        .size = map->size,
+        .next_free = iova_begin,
+    };
+
+    if (map->translated_addr + map->size < map->translated_addr ||
+        map->perm == IOMMU_NONE) {
+        return IOVA_ERR_INVALID;
+    }
+
+    g_tree_foreach(tree->tree, iova_tree_alloc_iterator, &args);
+
+    if (args.exhausted || args.next_free > iova_last ||
+        iova_last - args.next_free < map->size) {
+        return IOVA_ERR_NOMEM;
+    }
+
+    map->iova = args.next_free;
+    return iova_tree_insert(tree, map);
+}
+
 int iova_tree_remove(IOVATree *tree, DMAMap *map)
 {
     DMAMap *overlap;
@@ -66,6 +66,7 @@
 #endif
 
 #include "qemu/mmap-alloc.h"
+#include "qemu/thread-context.h"
 
 #ifdef CONFIG_DEBUG_STACK_USAGE
 #include "qemu/error-report.h"
@@ -73,22 +74,36 @@
 
 #define MAX_MEM_PREALLOC_THREAD_COUNT 16
 
+typedef struct MemsetContext MemsetContext;
+
 struct MemsetThread {
     char *addr;
     size_t numpages;
     size_t hpagesize;
     QemuThread pgthread;
     sigjmp_buf env;
+    int ret;
+    MemsetContext *context;
 };
 typedef struct MemsetThread MemsetThread;
 
-static MemsetThread *memset_thread;
-static int memset_num_threads;
-static bool memset_thread_failed;
+struct MemsetContext {
+    bool all_threads_created;
+    MemsetThread *threads;
+    int num_threads;
+
+    /* Asynchronous preallocation only */
+    int pending;
+    int ret;
+    void (*cb)(void *opaque, int ret);
+    void *opaque;
+};
+
+/* used by sigbus_handler() */
+static MemsetContext *sigbus_memset_context;
 
 static QemuMutex page_mutex;
 static QemuCond page_cond;
-static bool threads_created_flag;
 
 int qemu_get_thread_id(void)
 {
@@ -439,30 +454,56 @@ const char *qemu_get_exec_dir(void)
 static void sigbus_handler(int signal)
 {
     int i;
-    if (memset_thread) {
-        for (i = 0; i < memset_num_threads; i++) {
-            if (qemu_thread_is_self(&memset_thread[i].pgthread)) {
-                siglongjmp(memset_thread[i].env, 1);
+    if (sigbus_memset_context) {
+        for (i = 0; i < sigbus_memset_context->num_threads; i++) {
+            MemsetThread *thread = &sigbus_memset_context->threads[i];
+
+            if (qemu_thread_is_self(&thread->pgthread)) {
+                siglongjmp(thread->env, 1);
             }
         }
     }
 }
 
-static void *do_touch_pages(void *arg)
+static void memset_thread_wait_start(MemsetThread *memset_args)
 {
-    MemsetThread *memset_args = (MemsetThread *)arg;
-    sigset_t set, oldset;
-
     /*
      * On Linux, the page faults from the loop below can cause mmap_sem
      * contention with allocation of the thread stacks.  Do not start
      * clearing until all threads have been created.
      */
     qemu_mutex_lock(&page_mutex);
-    while(!threads_created_flag){
+    while (!memset_args->context->all_threads_created) {
         qemu_cond_wait(&page_cond, &page_mutex);
     }
     qemu_mutex_unlock(&page_mutex);
+}
+
+static void memset_thread_done(MemsetThread *memset_args)
+{
+    MemsetContext *context = memset_args->context;
+
+    if (!context->cb) {
+        /* Synchronous preallocation, touch_all_pages() joins us. */
+        return;
+    }
+
+    if (memset_args->ret) {
+        qatomic_cmpxchg(&context->ret, 0, memset_args->ret);
+    }
+    if (qatomic_fetch_dec(&context->pending) == 1) {
+        context->cb(context->opaque, qatomic_read(&context->ret));
+        g_free(context->threads);
+        g_free(context);
+    }
+}
+
+static void *do_touch_pages(void *arg)
+{
+    MemsetThread *memset_args = (MemsetThread *)arg;
+    sigset_t set, oldset;
+
+    memset_thread_wait_start(memset_args);
 
     /* unblock SIGBUS */
     sigemptyset(&set);
@@ -470,7 +511,7 @@ static void *do_touch_pages(void *arg)
     pthread_sigmask(SIG_UNBLOCK, &set, &oldset);
 
     if (sigsetjmp(memset_args->env, 1)) {
-        memset_thread_failed = true;
+        memset_args->ret = -EFAULT;
     } else {
         char *addr = memset_args->addr;
         size_t numpages = memset_args->numpages;
@@ -494,28 +535,65 @@ static void *do_touch_pages(void *arg)
         }
     }
     pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+    memset_thread_done(memset_args);
     return NULL;
 }
 
-static inline int get_memset_num_threads(int smp_cpus)
+static void *do_madv_populate_write_pages(void *arg)
+{
+    MemsetThread *memset_args = (MemsetThread *)arg;
+    const size_t size = memset_args->numpages * memset_args->hpagesize;
+
+    memset_thread_wait_start(memset_args);
+
+    /*
+     * Let the kernel fault in the whole range at once: no access to each
+     * page from user space, and failures are reported as errors instead
+     * of SIGBUS.
+     */
+    if (size && qemu_madvise(memset_args->addr, size,
+                             QEMU_MADV_POPULATE_WRITE)) {
+        memset_args->ret = -errno;
+    }
+    memset_thread_done(memset_args);
+    return NULL;
+}
+
+static inline int get_memset_num_threads(size_t numpages, int max_threads)
 {
     long host_procs = sysconf(_SC_NPROCESSORS_ONLN);
     int ret = 1;
 
     if (host_procs > 0) {
-        ret = MIN(MIN(host_procs, MAX_MEM_PREALLOC_THREAD_COUNT), smp_cpus);
+        ret = MIN(MIN(host_procs, MAX_MEM_PREALLOC_THREAD_COUNT), max_threads);
     }
+
+    /* Especially with gigantic pages, don't create more threads than pages. */
+    ret = MIN(ret, MAX(1, numpages));
+
     /* In case sysconf() fails, we fall back to single threaded */
     return ret;
 }
 
-static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
-                            int smp_cpus)
+/*
+ * Start the threads populating @area.  With @cb, the threads are detached
+ * and the last one to finish calls @cb and frees the context; otherwise
+ * the caller joins them.
+ */
+static MemsetContext *memset_context_start(char *area, size_t hpagesize,
+                                           size_t numpages, int max_threads,
+                                           ThreadContext *tc,
+                                           bool use_madv_populate_write,
+                                           void (*cb)(void *opaque, int ret),
+                                           void *opaque)
 {
     static gsize initialized = 0;
+    MemsetContext *context = g_new0(MemsetContext, 1);
     size_t numpages_per_thread, leftover;
+    void *(*touch_fn)(void *);
+    int mode = cb ? QEMU_THREAD_DETACHED : QEMU_THREAD_JOINABLE;
     char *addr = area;
-    int i = 0;
+    int i;
 
     if (g_once_init_enter(&initialized)) {
         qemu_mutex_init(&page_mutex);
@@ -523,69 +601,147 @@ static bool touch_all_pages(char *area, size_t hpagesize, size_t numpages,
         g_once_init_leave(&initialized, 1);
     }
 
-    memset_thread_failed = false;
-    threads_created_flag = false;
-    memset_num_threads = get_memset_num_threads(smp_cpus);
-    memset_thread = g_new0(MemsetThread, memset_num_threads);
-    numpages_per_thread = numpages / memset_num_threads;
-    leftover = numpages % memset_num_threads;
-    for (i = 0; i < memset_num_threads; i++) {
-        memset_thread[i].addr = addr;
-        memset_thread[i].numpages = numpages_per_thread + (i < leftover);
-        memset_thread[i].hpagesize = hpagesize;
-        qemu_thread_create(&memset_thread[i].pgthread, "touch_pages",
-                           do_touch_pages, &memset_thread[i],
-                           QEMU_THREAD_JOINABLE);
-        addr += memset_thread[i].numpages * hpagesize;
+    if (use_madv_populate_write) {
+        touch_fn = do_madv_populate_write_pages;
+    } else {
+        touch_fn = do_touch_pages;
+        sigbus_memset_context = context;
+    }
+
+    context->num_threads = get_memset_num_threads(numpages, max_threads);
+    context->threads = g_new0(MemsetThread, context->num_threads);
+    context->pending = context->num_threads;
+    context->cb = cb;
+    context->opaque = opaque;
+    numpages_per_thread = numpages / context->num_threads;
+    leftover = numpages % context->num_threads;
+    for (i = 0; i < context->num_threads; i++) {
+        MemsetThread *thread = &context->threads[i];
+
+        thread->addr = addr;
+        thread->numpages = numpages_per_thread + (i < leftover);
+        thread->hpagesize = hpagesize;
+        thread->context = context;
+        if (tc) {
+            thread_context_create_thread(tc, &thread->pgthread,
+                                         "touch_pages", touch_fn, thread,
+                                         mode);
+        } else {
+            qemu_thread_create(&thread->pgthread, "touch_pages",
+                               touch_fn, thread, mode);
+        }
+        addr += thread->numpages * hpagesize;
     }
 
+    /* With @cb, @context may be gone as soon as the lock is dropped. */
     qemu_mutex_lock(&page_mutex);
-    threads_created_flag = true;
+    context->all_threads_created = true;
     qemu_cond_broadcast(&page_cond);
     qemu_mutex_unlock(&page_mutex);
 
-    for (i = 0; i < memset_num_threads; i++) {
-        qemu_thread_join(&memset_thread[i].pgthread);
+    return cb ? NULL : context;
+}
+
+static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
+                           int max_threads, ThreadContext *tc,
+                           bool use_madv_populate_write)
+{
+    MemsetContext *context;
+    int i, ret = 0;
+
+    context = memset_context_start(area, hpagesize, numpages, max_threads,
+                                   tc, use_madv_populate_write, NULL, NULL);
+
+    for (i = 0; i < context->num_threads; i++) {
+        qemu_thread_join(&context->threads[i].pgthread);
+        if (context->threads[i].ret) {
+            ret = context->threads[i].ret;
+        }
     }
-    g_free(memset_thread);
-    memset_thread = NULL;
+    sigbus_memset_context = NULL;
+    g_free(context->threads);
+    g_free(context);
 
-    return memset_thread_failed;
+    return ret;
 }
 
-void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
-                     Error **errp)
+static bool madv_populate_write_possible(char *area, size_t pagesize)
+{
+    return !qemu_madvise(area, pagesize, QEMU_MADV_POPULATE_WRITE) ||
+           errno != EINVAL;
+}
+
+void os_mem_prealloc(int fd, char *area, size_t memory, int max_threads,
+                     ThreadContext *tc, Error **errp)
 {
     int ret;
     struct sigaction act, oldact;
     size_t hpagesize = qemu_fd_getpagesize(fd);
     size_t numpages = DIV_ROUND_UP(memory, hpagesize);
+    bool use_madv_populate_write;
 
-    memset(&act, 0, sizeof(act));
-    act.sa_handler = &sigbus_handler;
-    act.sa_flags = 0;
-
-    ret = sigaction(SIGBUS, &act, &oldact);
-    if (ret) {
-        error_setg_errno(errp, errno,
-            "os_mem_prealloc: failed to install signal handler");
-        return;
+    /*
+     * Sense on the first page whether MADV_POPULATE_WRITE is available:
+     * the memory gets preallocated anyway.  Without it, fall back to
+     * touching every page and catching SIGBUS.
+     */
+    use_madv_populate_write = madv_populate_write_possible(area, hpagesize);
+
+    if (!use_madv_populate_write) {
+        memset(&act, 0, sizeof(act));
+        act.sa_handler = &sigbus_handler;
+        act.sa_flags = 0;
+
+        ret = sigaction(SIGBUS, &act, &oldact);
+        if (ret) {
+            error_setg_errno(errp, errno,
+                "os_mem_prealloc: failed to install signal handler");
+            return;
+        }
     }
 
     /* touch pages simultaneously */
-    if (touch_all_pages(area, hpagesize, numpages, smp_cpus)) {
-        error_setg(errp, "os_mem_prealloc: Insufficient free host memory "
+    ret = touch_all_pages(area, hpagesize, numpages, max_threads, tc,
+                          use_madv_populate_write);
+    if (ret) {
+        error_setg_errno(errp, -ret,
+            "os_mem_prealloc: Insufficient free host memory "
             "pages available to allocate guest RAM");
     }
 
-    ret = sigaction(SIGBUS, &oldact, NULL);
-    if (ret) {
-        /* Terminate QEMU since it can't recover from error */
-        perror("os_mem_prealloc: failed to reinstall signal handler");
-        exit(1);
+    if (!use_madv_populate_write) {
+        ret = sigaction(SIGBUS, &oldact, NULL);
+        if (ret) {
+            /* Terminate QEMU since it can't recover from error */
+            perror("os_mem_prealloc: failed to reinstall signal handler");
+            exit(1);
+        }
     }
 }
 
+bool os_mem_prealloc_async(int fd, char *area, size_t memory, int max_threads,
+                           ThreadContext *tc,
+                           void (*cb)(void *opaque, int ret), void *opaque)
+{
+    size_t hpagesize = qemu_fd_getpagesize(fd);
+    size_t numpages = DIV_ROUND_UP(memory, hpagesize);
+
+    /*
+     * A file backed page that cannot be allocated raises SIGBUS when the
+     * guest touches it, so only anonymous memory may be left partly
+     * unpopulated.  Touching the pages from user space needs our SIGBUS
+     * handler, which must not stay installed while the guest runs: without
+     * MADV_POPULATE_WRITE, preallocation can only be synchronous.
+     */
+    if (fd >= 0 || !madv_populate_write_possible(area, hpagesize)) {
+        return false;
+    }
+
+    memset_context_start(area, hpagesize, numpages, max_threads, tc, true,
+                         cb, opaque);
+    return true;
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     char *name = NULL;
@@ -370,8 +370,8 @@ int getpagesize(void)
     return system_info.dwPageSize;
 }
 
-void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
-                     Error **errp)
+void os_mem_prealloc(int fd, char *area, size_t memory, int max_threads,
+                     ThreadContext *tc, Error **errp)
 {
     int i;
     size_t pagesize = qemu_real_host_page_size;
@@ -382,6 +382,13 @@ void os_mem_prealloc(int fd, char *area, size_t memory, int smp_cpus,
     }
 }
 
+bool os_mem_prealloc_async(int fd, char *area, size_t memory, int max_threads,
+                           ThreadContext *tc,
+                           void (*cb)(void *opaque, int ret), void *opaque)
+{
+    return false;
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     /* XXX Implement me */
@@ -98,6 +98,9 @@ struct QEMUVFIOState {
     uint64_t high_water_mark;
     IOVAMapping *mappings;
     int nr_mappings;
+
+    /* Bumped whenever a fixed mapping goes away */
+    unsigned mapping_generation;
 };
 
 /**
@@ -653,6 +656,7 @@ static void qemu_vfio_undo_mapping(QEMUVFIOState *s, IOVAMapping *mapping,
             sizeof(s->mappings[0]) * (s->nr_mappings - index - 1));
     s->nr_mappings--;
     s->mappings = g_renew(IOVAMapping, s->mappings, s->nr_mappings);
+    s->mapping_generation++;
 }
 
 /* Check if the mapping list is (ascending) ordered. */
@@ -740,13 +744,16 @@ static bool qemu_vfio_water_mark_reached(QEMUVFIOState *s, size_t size,
     return false;
 }
 
-/* Map [host, host + size) area into a contiguous IOVA address space, and store
- * the result in @iova if not NULL. The caller need to make sure the area is
- * aligned to page size, and mustn't overlap with existing mapping areas (split
- * mapping status within this area is not allowed).
+/*
+ * Common part of qemu_vfio_dma_map() and qemu_vfio_dma_map_cached().  If the
+ * area ends up covered by a fixed mapping, a copy of that mapping is stored in
+ * @fixed; otherwise @fixed->size is set to 0.
+ *
+ * Called with s->lock held.
  */
-int qemu_vfio_dma_map(QEMUVFIOState *s, void *host, size_t size,
-                      bool temporary, uint64_t *iova, Error **errp)
+static int qemu_vfio_dma_map_common(QEMUVFIOState *s, void *host, size_t size,
+                                    bool temporary, uint64_t *iova,
+                                    IOVAMapping *fixed, Error **errp)
 {
     int index;
     IOVAMapping *mapping;
@@ -755,10 +762,11 @@ int qemu_vfio_dma_map(QEMUVFIOState *s, void *host, size_t size,
     assert(QEMU_PTR_IS_ALIGNED(host, qemu_real_host_page_size));
     assert(QEMU_IS_ALIGNED(size, qemu_real_host_page_size));
     trace_qemu_vfio_dma_map(s, host, size, temporary, iova);
-    QEMU_LOCK_GUARD(&s->lock);
+    fixed->size = 0;
     mapping = qemu_vfio_find_mapping(s, host, &index);
     if (mapping) {
         iova0 = mapping->iova + ((uint8_t *)host - (uint8_t *)mapping->host);
+        *fixed = *mapping;
     } else {
         int ret;
 
@@ -777,6 +785,7 @@ int qemu_vfio_dma_map(QEMUVFIOState *s, void *host, size_t size,
                 qemu_vfio_undo_mapping(s, mapping, NULL);
                 return ret;
             }
+            *fixed = *mapping;
             qemu_vfio_dump_mappings(s);
         } else {
             if (!qemu_vfio_find_temp_iova(s, size, &iova0, errp)) {
@@ -795,6 +804,68 @@ int qemu_vfio_dma_map(QEMUVFIOState *s, void *host, size_t size,
     return 0;
 }
 
+/* Map [host, host + size) area into a contiguous IOVA address space, and store
+ * the result in @iova if not NULL. The caller need to make sure the area is
+ * aligned to page size, and mustn't overlap with existing mapping areas (split
+ * mapping status within this area is not allowed).
+ */
+int qemu_vfio_dma_map(QEMUVFIOState *s, void *host, size_t size,
+                      bool temporary, uint64_t *iova, Error **errp)
+{
+    IOVAMapping fixed;
+
+    QEMU_LOCK_GUARD(&s->lock);
+    return qemu_vfio_dma_map_common(s, host, size, temporary, iova, &fixed,
+                                    errp);
+}
+
+/*
+ * Like qemu_vfio_dma_map(), but first look up [host, host + size) in @cache,
+ * which remembers the fixed mappings that recent calls resolved to, so that a
+ * hit does not search the mapping list.  The cache is validated under @s->lock,
+ * and entries are dropped as soon as any fixed mapping is removed from @s.
+ *
+ * @cache must be zero-initialized and must not be used concurrently from
+ * several threads.
+ */
+int qemu_vfio_dma_map_cached(QEMUVFIOState *s, QEMUVFIOMappingCache *cache,
+                             void *host, size_t size, bool temporary,
+                             uint64_t *iova, Error **errp)
+{
+    IOVAMapping fixed;
+    int i, ret;
+
+    QEMU_LOCK_GUARD(&s->lock);
+    if (cache->generation != s->mapping_generation) {
+        memset(cache->entries, 0, sizeof(cache->entries));
+        cache->generation = s->mapping_generation;
+    }
+
+    for (i = 0; i < QEMU_VFIO_MAPPING_CACHE_SIZE; i++) {
+        uint8_t *start = cache->entries[i].host;
+
+        if (cache->entries[i].size &&
+            (uint8_t *)host >= start &&
+            (uint8_t *)host + size <= start + cache->entries[i].size) {
+            if (iova) {
+                *iova = cache->entries[i].iova + ((uint8_t *)host - start);
+            }
+            trace_qemu_vfio_dma_map_cache_hit(s, host, size);
+            return 0;
+        }
+    }
+
+    ret = qemu_vfio_dma_map_common(s, host, size, temporary, iova, &fixed,
+                                   errp);
+    if (ret == 0 && fixed.size) {
+        i = cache->next++ % QEMU_VFIO_MAPPING_CACHE_SIZE;
+        cache->entries[i].host = fixed.host;
+        cache->entries[i].size = fixed.size;
+        cache->entries[i].iova = fixed.iova;
+    }
+    return ret;
+}
+
 /* Reset the high watermark and free all "temporary" mappings. */
 int qemu_vfio_dma_reset_temporary(QEMUVFIOState *s)
 {
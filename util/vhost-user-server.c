@@ -31,8 +31,9 @@
  * Both vu_client_trip() and kick fd monitoring can be stopped by shutting down
  * the socket connection. Shutting down the socket connection causes
  * vu_message_read() to fail since no more data can be received from the socket.
- * After vu_dispatch() fails, vu_client_trip() calls vu_deinit() to stop
- * libvhost-user before terminating the coroutine. vu_deinit() calls
+ * After vu_dispatch() fails, vu_client_trip() stops virtqueues that are still
+ * started and calls vu_deinit() to stop libvhost-user before terminating the
+ * coroutine. vu_deinit() calls
  * remove_watch() to stop monitoring kick fds and this stops virtqueue
  * processing.
  *
@@ -172,11 +173,25 @@ static coroutine_fn void vu_client_trip(void *opaque)
 {
     VuServer *server = opaque;
     VuDev *vu_dev = &server->vu_dev;
+    int i;
 
     while (!vu_dev->broken && vu_dispatch(vu_dev)) {
         /* Keep running */
     }
 
+    /*
+     * A client that goes away without GET_VRING_BASE leaves its virtqueues
+     * started. Stop them so that devices release fds they monitor for them.
+     */
+    for (i = 0; i < vu_dev->max_queues; i++) {
+        if (vu_dev->vq[i].started) {
+            vu_dev->vq[i].started = false;
+            if (vu_dev->iface->queue_set_started) {
+                vu_dev->iface->queue_set_started(vu_dev, i, false);
+            }
+        }
+    }
+
     vu_deinit(vu_dev);
 
     /* vu_deinit() should have called remove_watch() */